@@ -40,6 +40,9 @@
 #ifndef LKBOOT_AUTOBOOT_TIMEOUT
 #define LKBOOT_AUTOBOOT_TIMEOUT 5000
 #endif
+#ifndef LKBOOT_TCP_RX_BUFFER_SIZE
+#define LKBOOT_TCP_RX_BUFFER_SIZE (64 * 1024)
+#endif
 
 #define LOCAL_TRACE 0
 
@@ -217,9 +220,10 @@ static status_t lkboot_server(lk_time_t timeout) {
     lkboot_dcc_init();
 
 #if WITH_LIB_MINIP
-    /* open the server's socket */
+    /* open the server's socket, with a receive window big enough to keep
+     * image downloads streaming */
     tcp_socket_t *listen_socket = NULL;
-    if (tcp_open_listen(&listen_socket, 1023) < 0) {
+    if (tcp_open_listen_etc(&listen_socket, 1023, LKBOOT_TCP_RX_BUFFER_SIZE, 0) < 0) {
         printf("lkboot: error opening listen socket\n");
         return ERR_NO_MEMORY;
     }
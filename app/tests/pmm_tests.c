@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+/*
+ * Physical page allocator benchmark: single page alloc/free throughput with
+ * one thread pinned to each of a growing number of cpus. Run `pmm caches`
+ * afterwards to see how much of it was served by the per cpu page caches.
+ */
+#include "tests.h"
+
+#include <lib/unittest.h>
+#include <lk/err.h>
+#include <stdio.h>
+
+#if WITH_KERNEL_VM
+#include <kernel/vm.h>
+
+#define PMM_BENCH_ROUNDS 20000
+#define PMM_BENCH_BURST 8
+
+static int pmm_bench_thread(void *arg, uint index, const volatile bool *stop) {
+    vm_page_t *pages[PMM_BENCH_BURST];
+
+    for (int r = 0; r < PMM_BENCH_ROUNDS; r++) {
+        for (int i = 0; i < PMM_BENCH_BURST; i++) {
+            pages[i] = pmm_alloc_page();
+            if (!pages[i]) {
+                printf("pmm_alloc_page failed\n");
+                while (i-- > 0)
+                    pmm_free_page(pages[i]);
+                return ERR_NO_MEMORY;
+            }
+        }
+        for (int i = 0; i < PMM_BENCH_BURST; i++) {
+            pmm_free_page(pages[i]);
+        }
+    }
+
+    return NO_ERROR;
+}
+
+int pmm_bench(int argc, const console_cmd_args *argv) {
+    uint cpu_count = unittest_active_cpu_count();
+
+    printf("pmm single page alloc/free, %d rounds of %d pages per thread, 1 thread per cpu\n",
+           PMM_BENCH_ROUNDS, PMM_BENCH_BURST);
+
+    for (uint cpus = 1; cpus <= cpu_count; cpus++) {
+        lk_bigtime_t elapsed;
+
+        int err = unittest_run_threads("pmm bench", cpus, cpus, 0, &pmm_bench_thread, NULL, &elapsed);
+        if (err < 0)
+            return err;
+
+        uint64_t ops = (uint64_t)cpus * PMM_BENCH_ROUNDS * PMM_BENCH_BURST * 2;
+        printf("\t%u cpus: %llu ops in %llu usecs, %llu ops/sec\n",
+               cpus, ops, elapsed, elapsed ? ops * 1000000ULL / elapsed : 0);
+    }
+
+    return NO_ERROR;
+}
+
+#endif // WITH_KERNEL_VM
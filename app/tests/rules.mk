@@ -7,14 +7,17 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/clock_tests.c \
     $(LOCAL_DIR)/fibo.c \
     $(LOCAL_DIR)/mem_tests.c \
+    $(LOCAL_DIR)/pmm_tests.c \
     $(LOCAL_DIR)/tests.c \
     $(LOCAL_DIR)/thread_tests.c \
+    $(LOCAL_DIR)/timer_tests.c \
 
 MODULE_FLOAT_SRCS := \
     $(LOCAL_DIR)/benchmarks.c \
 
 MODULE_DEPS += \
-    lib/libm
+    lib/libm \
+    lib/unittest
 
 MODULE_COMPILEFLAGS += -fno-builtin
 
@@ -18,4 +18,8 @@ STATIC_COMMAND("clock_tests", "clock benchmarks", &clock_bench)
 STATIC_COMMAND("bench", "miscellaneous benchmarks", &benchmarks)
 STATIC_COMMAND("fibo", "threaded fibonacci", &fibo)
 STATIC_COMMAND("mem_test", "test memory", &mem_test)
+#if WITH_KERNEL_VM
+STATIC_COMMAND("pmm_bench", "physical page allocator benchmark", &pmm_bench)
+#endif
+STATIC_COMMAND("timer_bench", "timer set/cancel/expire benchmarks", &timer_bench)
 STATIC_COMMAND_END(tests);
@@ -13,3 +13,5 @@ int benchmarks(int argc, const console_cmd_args *argv);
 int clock_bench(int argc, const console_cmd_args *argv);
 int fibo(int argc, const console_cmd_args *argv);
 int mem_test(int argc, const console_cmd_args *argv);
+int pmm_bench(int argc, const console_cmd_args *argv);
+int timer_bench(int argc, const console_cmd_args *argv);
@@ -20,9 +20,14 @@
 #include <assert.h>
 #include <kernel/thread.h>
 #include <kernel/event.h>
+#include <kernel/mutex.h>
+#include <kernel/mp.h>
+#include <lib/unittest.h>
 #include <platform.h>
 #include <platform/time.h>
 #include <arch/atomic.h>
+#include <limits.h>
+#include <stdlib.h>
 
 /* Everything here is only reachable through the console command at the bottom,
  * so without lib/console in the build there is nothing to emit. */
@@ -84,6 +89,43 @@ static void context_switch_test(void) {
     thread_sleep(100);
 }
 
+#if WITH_SMP
+/* Context switch throughput as more cpus join in. Each participating cpu gets
+ * a pair of threads pinned to it that yield back and forth, so every yield is a
+ * real switch served out of that cpu's own run queue.
+ */
+#define SCALING_YIELDS 20000
+
+static int scaling_yielder(void *arg, uint index, const volatile bool *stop) {
+    for (int i = 0; i < SCALING_YIELDS; i++) {
+        thread_yield();
+    }
+
+    return 0;
+}
+
+static void context_switch_scaling_test(void) {
+    uint cpu_count = unittest_active_cpu_count();
+
+    printf("context switch scaling, %d yields per thread, 2 threads per cpu\n", SCALING_YIELDS);
+
+    for (uint cpus = 1; cpus <= cpu_count; cpus++) {
+        uint count = cpus * 2;
+        lk_bigtime_t elapsed;
+
+        int err = unittest_run_threads("cs scaling", count, cpus, 0, &scaling_yielder, NULL, &elapsed);
+        if (err < 0) {
+            printf("\t%u cpus: failed %d\n", cpus, err);
+            return;
+        }
+
+        uint64_t switches = (uint64_t)count * SCALING_YIELDS;
+        printf("\t%u cpus: %llu switches in %llu usecs, %llu switches/sec\n",
+               cpus, switches, elapsed, elapsed ? switches * 1000000ULL / elapsed : 0);
+    }
+}
+#endif
+
 static volatile int preempt_count;
 
 static int preempt_tester(void *arg) {
@@ -175,11 +217,140 @@ static void spinlock_test(void) {
 #undef COUNT
 }
 
+#if WITH_SMP
+/* Multicore spinlock stress. One thread pinned per cpu hammers a single lock
+ * with a short critical section for a fixed time. Total throughput shows how
+ * the lock scales as cpus join in, and the spread between the busiest and the
+ * least busy cpu shows how fair it is: a test and set lock tends to let the
+ * cpu that just released it win again, a ticket lock should be close to even.
+ */
+#define SPINLOCK_STRESS_MSECS 500
+
+static spin_lock_t spinlock_stress_lock = SPIN_LOCK_INITIAL_VALUE;
+static volatile uint spinlock_stress_shared;
+
+static int spinlock_stress_thread(void *arg, uint index, const volatile bool *stop) {
+    ulong *acquires = arg;
+    ulong count = 0;
+
+    while (!*stop) {
+        arch_interrupt_saved_state_t state = spin_lock_irqsave(&spinlock_stress_lock);
+        spinlock_stress_shared = spinlock_stress_shared + 1;
+        spin_unlock_irqrestore(&spinlock_stress_lock, state);
+        count++;
+    }
+
+    acquires[index] = count;
+    return 0;
+}
+
+static void spinlock_stress_test(void) {
+    uint cpu_count = unittest_active_cpu_count();
+
+    printf("spinlock stress, %d msecs per run, 1 thread per cpu\n", SPINLOCK_STRESS_MSECS);
+
+    for (uint cpus = 1; cpus <= cpu_count; cpus++) {
+        ulong acquires[SMP_MAX_CPUS] = { 0 };
+
+        spinlock_stress_shared = 0;
+
+        int err = unittest_run_threads("spinlock stress", cpus, cpus, SPINLOCK_STRESS_MSECS,
+                                       &spinlock_stress_thread, acquires, NULL);
+        if (err < 0) {
+            printf("\t%u cpus: failed %d\n", cpus, err);
+            return;
+        }
+
+        ulong total = 0, min = ULONG_MAX, max = 0;
+        for (uint i = 0; i < cpus; i++) {
+            total += acquires[i];
+            min = MIN(min, acquires[i]);
+            max = MAX(max, acquires[i]);
+        }
+        printf("\t%u cpus: %lu acquires, %lu acquires/sec, per cpu min %lu max %lu%s\n",
+               cpus, total, total * 1000 / SPINLOCK_STRESS_MSECS, min, max,
+               spinlock_stress_shared == total ? "" : " (COUNT MISMATCH)");
+    }
+}
+#endif
+
+/* Mutex acquire/release throughput. The uncontended case is a single thread
+ * hammering a private mutex, which should never leave the atomic fast path.
+ * The contended case has a growing number of threads fighting over one mutex
+ * with a short critical section, which exercises the adaptive spin on SMP and
+ * the block/handoff path once there are more threads than cpus.
+ */
+#define MUTEX_BENCH_COUNT (1024*1024)
+#define MUTEX_BENCH_CONTENDED_COUNT 20000
+#define MUTEX_BENCH_MAX_THREADS 8
+
+static mutex_t mutex_bench_lock;
+static volatile uint mutex_bench_shared;
+
+static int mutex_bench_thread(void *arg, uint index, const volatile bool *stop) {
+    for (int i = 0; i < MUTEX_BENCH_CONTENDED_COUNT; i++) {
+        mutex_acquire(&mutex_bench_lock);
+        mutex_bench_shared++;
+        mutex_release(&mutex_bench_lock);
+    }
+
+    return 0;
+}
+
+static void mutex_bench(void) {
+    mutex_t m;
+    mutex_init(&m);
+
+    printf("mutex benchmark:\n");
+
+    uint32_t c = arch_cycle_count();
+    for (uint i = 0; i < MUTEX_BENCH_COUNT; i++) {
+        mutex_acquire(&m);
+        mutex_release(&m);
+    }
+    c = arch_cycle_count() - c;
+
+    printf("%u cycles to acquire/release uncontended mutex %u times (%u cycles per)\n",
+           c, MUTEX_BENCH_COUNT, c / MUTEX_BENCH_COUNT);
+
+    mutex_destroy(&m);
+
+    printf("contended mutex, %d acquires per thread\n", MUTEX_BENCH_CONTENDED_COUNT);
+
+    for (uint count = 1; count <= MUTEX_BENCH_MAX_THREADS; count *= 2) {
+        lk_bigtime_t elapsed;
+
+        mutex_init(&mutex_bench_lock);
+        mutex_bench_shared = 0;
+
+        int err = unittest_run_threads("mutex bench", count, 0, 0, &mutex_bench_thread, NULL, &elapsed);
+        if (err < 0) {
+            printf("\t%u threads: failed %d\n", count, err);
+            mutex_destroy(&mutex_bench_lock);
+            return;
+        }
+
+        uint64_t acquires = (uint64_t)count * MUTEX_BENCH_CONTENDED_COUNT;
+        printf("\t%u threads: %llu acquires in %llu usecs, %llu acquires/sec%s\n",
+               count, acquires, elapsed, elapsed ? acquires * 1000000ULL / elapsed : 0,
+               mutex_bench_shared == acquires ? "" : " (COUNT MISMATCH)");
+
+        mutex_destroy(&mutex_bench_lock);
+    }
+}
+
 static int thread_bench(int argc, const console_cmd_args *argv) {
     spinlock_test();
+#if WITH_SMP
+    spinlock_stress_test();
+#endif
+    mutex_bench();
 
     thread_sleep(200);
     context_switch_test();
+#if WITH_SMP
+    context_switch_scaling_test();
+#endif
 
     preempt_test();
 
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+/*
+ * Timer benchmarks: measure the cycle cost of setting, canceling and expiring
+ * kernel timers with a varying number of other timers already pending. The
+ * self validating timer tests live in kernel/test/timer_tests.c and run under
+ * `ut all`.
+ */
+#include "tests.h"
+
+#include <arch/atomic.h>
+#include <kernel/thread.h>
+#include <kernel/timer.h>
+#include <lk/err.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TIMER_BENCH_SAMPLES 1000
+
+static volatile int expire_count;
+static ulong expire_first_cycles;
+static ulong expire_last_cycles;
+
+static enum handler_return nop_callback(timer_t *t, lk_time_t now, void *arg) {
+    return INT_NO_RESCHEDULE;
+}
+
+static enum handler_return expire_callback(timer_t *t, lk_time_t now, void *arg) {
+    ulong c = arch_cycle_count();
+    if (atomic_add(&expire_count, 1) == 0)
+        expire_first_cycles = c;
+    expire_last_cycles = c;
+    return INT_NO_RESCHEDULE;
+}
+
+static void timer_bench_pending(uint pending) {
+    timer_t *background = malloc(sizeof(timer_t) * pending);
+    timer_t *samples = malloc(sizeof(timer_t) * TIMER_BENCH_SAMPLES);
+    if (!background || !samples) {
+        printf("%u pending: not enough memory, skipping\n", pending);
+        free(background);
+        free(samples);
+        return;
+    }
+
+    /* park the background timers well in the future, spread across the wheel */
+    for (uint i = 0; i < pending; i++) {
+        timer_initialize(&background[i]);
+        timer_set_oneshot(&background[i], 60000 + (i * 7919) % 600000, nop_callback, NULL);
+    }
+    for (uint i = 0; i < TIMER_BENCH_SAMPLES; i++) {
+        timer_initialize(&samples[i]);
+    }
+
+    /* insert and cancel with everything else still pending */
+    ulong c = arch_cycle_count();
+    for (uint i = 0; i < TIMER_BENCH_SAMPLES; i++) {
+        timer_set_oneshot(&samples[i], 30000 + (i * 131) % 60000, nop_callback, NULL);
+    }
+    ulong insert_cycles = arch_cycle_count() - c;
+
+    c = arch_cycle_count();
+    for (uint i = 0; i < TIMER_BENCH_SAMPLES; i++) {
+        timer_cancel(&samples[i]);
+    }
+    ulong cancel_cycles = arch_cycle_count() - c;
+
+    /* expire a batch that all come due in the same millisecond */
+    expire_count = 0;
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
+    for (uint i = 0; i < TIMER_BENCH_SAMPLES; i++) {
+        timer_set_oneshot(&samples[i], 20, expire_callback, NULL);
+    }
+    arch_interrupt_restore(state);
+    while (expire_count < TIMER_BENCH_SAMPLES) {
+        thread_sleep(10);
+    }
+    ulong expire_cycles = expire_last_cycles - expire_first_cycles;
+
+    printf("%6u pending: insert %lu, cancel %lu, expire %lu cycles per timer\n", pending,
+           insert_cycles / TIMER_BENCH_SAMPLES, cancel_cycles / TIMER_BENCH_SAMPLES,
+           expire_cycles / (TIMER_BENCH_SAMPLES - 1));
+
+    for (uint i = 0; i < pending; i++) {
+        timer_cancel(&background[i]);
+    }
+    free(background);
+    free(samples);
+}
+
+int timer_bench(int argc, const console_cmd_args *argv) {
+    static const uint pending_counts[] = { 10, 1000, 100000 };
+
+    for (uint i = 0; i < countof(pending_counts); i++) {
+        timer_bench_pending(pending_counts[i]);
+    }
+
+    return NO_ERROR;
+}
@@ -64,6 +64,11 @@ static inline ulong arch_cycle_count(void) {
     return ARM64_READ_SYSREG(pmccntr_el0);
 }
 
+/* hint to the cpu that we are in a spin wait loop */
+static inline void arch_spinloop_pause(void) {
+    __asm__ volatile("yield" ::: "memory");
+}
+
 /* use the cpu local thread context pointer to store current_thread */
 static inline struct thread *arch_get_current_thread(void) {
     return (struct thread *)ARM64_READ_SYSREG(tpidr_el1);
@@ -9,19 +9,36 @@
 
 #include <lk/compiler.h>
 #include <arch/ops.h>
+#include <arch/ticket_spinlock.h>
 #include <stdbool.h>
 
 __BEGIN_CDECLS
 
 #define SPIN_LOCK_INITIAL_VALUE (0)
 
+#if WITH_SMP && WITH_TICKET_SPINLOCKS
+typedef uint32_t spin_lock_t;
+
+static inline void arch_spin_lock(spin_lock_t *lock) {
+    ticket_spin_lock(lock);
+}
+
+static inline int arch_spin_trylock(spin_lock_t *lock) {
+    return ticket_spin_trylock(lock);
+}
+
+static inline void arch_spin_unlock(spin_lock_t *lock) {
+    ticket_spin_unlock(lock);
+}
+#elif WITH_SMP
 typedef unsigned long spin_lock_t;
 
-#if WITH_SMP
 void arch_spin_lock(spin_lock_t *lock);
 int arch_spin_trylock(spin_lock_t *lock);
 void arch_spin_unlock(spin_lock_t *lock);
 #else
+typedef unsigned long spin_lock_t;
+
 static inline void arch_spin_lock(spin_lock_t *lock) {
     *lock = 1;
 }
@@ -40,7 +57,11 @@ static inline void arch_spin_lock_init(spin_lock_t *lock) {
 }
 
 static inline bool arch_spin_lock_held(spin_lock_t *lock) {
+#if WITH_SMP && WITH_TICKET_SPINLOCKS
+    return ticket_spin_lock_held(lock);
+#else
     return *lock != 0;
+#endif
 }
 
 __END_CDECLS
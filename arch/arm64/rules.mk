@@ -22,10 +22,16 @@ MODULE_SRCS += \
 # if its requested we build with SMP, default to 8 cpus
 ifeq (true,$(call TOBOOL,$(WITH_SMP)))
 SMP_MAX_CPUS ?= 8
+# fair ticket locks from arch/ticket_spinlock.h instead of the exclusive
+# monitor loop in spinlock.S
+WITH_TICKET_SPINLOCKS ?= 1
 
 GLOBAL_DEFINES += \
     WITH_SMP=1 \
     SMP_MAX_CPUS=$(SMP_MAX_CPUS)
+ifeq (true,$(call TOBOOL,$(WITH_TICKET_SPINLOCKS)))
+GLOBAL_DEFINES += WITH_TICKET_SPINLOCKS=1
+endif
 else
 GLOBAL_DEFINES += \
     SMP_MAX_CPUS=1
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#pragma once
+
+#include <arch/ops.h>
+#include <lk/compiler.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+__BEGIN_CDECLS
+
+/*
+ * Portable ticket spinlock, for architectures that select it with
+ * WITH_TICKET_SPINLOCKS in place of their own test and set lock.
+ *
+ * The lock is a single 32 bit word so it still fits the scalar spin_lock_t
+ * and the all zero initializer. The upper half is the next ticket to hand
+ * out and the lower half is the ticket now being served. Lockers take a
+ * ticket with one atomic add and then only read the word until their number
+ * comes up, so waiters are served in arrival order and only the unlock
+ * store invalidates their cache lines.
+ *
+ * The architecture must provide arch_spinloop_pause() in arch_ops.h.
+ */
+
+#define TICKET_SPIN_LOCK_NEXT_SHIFT 16
+#define TICKET_SPIN_LOCK_NEXT_ONE (1u << TICKET_SPIN_LOCK_NEXT_SHIFT)
+#define TICKET_SPIN_LOCK_OWNER_MASK 0xffffu
+
+static inline uint16_t ticket_spin_lock_owner(uint32_t val) {
+    return val & TICKET_SPIN_LOCK_OWNER_MASK;
+}
+
+static inline uint16_t ticket_spin_lock_next(uint32_t val) {
+    return val >> TICKET_SPIN_LOCK_NEXT_SHIFT;
+}
+
+static inline void ticket_spin_lock(uint32_t *lock) {
+    uint32_t val = __atomic_fetch_add(lock, TICKET_SPIN_LOCK_NEXT_ONE, __ATOMIC_ACQUIRE);
+    uint16_t ticket = ticket_spin_lock_next(val);
+
+    while (ticket_spin_lock_owner(val) != ticket) {
+        arch_spinloop_pause();
+        val = __atomic_load_n(lock, __ATOMIC_ACQUIRE);
+    }
+}
+
+// Returns 0 on success, non-0 on failure
+static inline int ticket_spin_trylock(uint32_t *lock) {
+    uint32_t val = __atomic_load_n(lock, __ATOMIC_RELAXED);
+
+    if (ticket_spin_lock_owner(val) != ticket_spin_lock_next(val))
+        return 1;
+
+    return !__atomic_compare_exchange_n(lock, &val, val + TICKET_SPIN_LOCK_NEXT_ONE, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void ticket_spin_unlock(uint32_t *lock) {
+    /* only the holder moves the owner half, but lockers are bumping the next
+     * half at the same time, so step it with an atomic add that never carries
+     * out of the low 16 bits */
+    uint16_t owner = ticket_spin_lock_owner(__atomic_load_n(lock, __ATOMIC_RELAXED));
+
+    if (owner != TICKET_SPIN_LOCK_OWNER_MASK)
+        __atomic_fetch_add(lock, 1, __ATOMIC_RELEASE);
+    else
+        __atomic_fetch_sub(lock, TICKET_SPIN_LOCK_OWNER_MASK, __ATOMIC_RELEASE);
+}
+
+static inline bool ticket_spin_lock_held(uint32_t *lock) {
+    uint32_t val = __atomic_load_n(lock, __ATOMIC_RELAXED);
+
+    return ticket_spin_lock_owner(val) != ticket_spin_lock_next(val);
+}
+
+__END_CDECLS
@@ -33,6 +33,12 @@ static inline ulong arch_cycle_count(void) {
 #endif
 }
 
+/* hint to the cpu that we are in a spin wait loop. Zihintpause is optional,
+ * so this is only a compiler barrier. */
+static inline void arch_spinloop_pause(void) {
+    CF;
+}
+
 static inline uint arch_curr_cpu_num(void) {
 #if WITH_SMP
     return riscv_get_percpu()->cpu_num;
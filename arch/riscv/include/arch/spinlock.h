@@ -8,6 +8,7 @@
 #pragma once
 
 #include <arch/ops.h>
+#include <arch/ticket_spinlock.h>
 #include <stdbool.h>
 #include <lk/compiler.h>
 
@@ -15,8 +16,26 @@ __BEGIN_CDECLS
 
 #define SPIN_LOCK_INITIAL_VALUE (0)
 
-typedef volatile uint32_t spin_lock_t;
+#if WITH_SMP && WITH_TICKET_SPINLOCKS
+typedef uint32_t spin_lock_t;
+
+static inline int arch_spin_trylock(spin_lock_t *lock) {
+    return ticket_spin_trylock(lock);
+}
 
+static inline void arch_spin_lock(spin_lock_t *lock) {
+    ticket_spin_lock(lock);
+}
+
+static inline void arch_spin_unlock(spin_lock_t *lock) {
+    ticket_spin_unlock(lock);
+}
+
+static inline bool arch_spin_lock_held(spin_lock_t *lock) {
+    return ticket_spin_lock_held(lock);
+}
+#else
+typedef volatile uint32_t spin_lock_t;
 
 void riscv_spin_lock(spin_lock_t *lock);
 void riscv_spin_unlock(spin_lock_t *lock);
@@ -34,13 +53,14 @@ static inline void arch_spin_unlock(spin_lock_t *lock) {
     riscv_spin_unlock(lock);
 }
 
-static inline void arch_spin_lock_init(spin_lock_t *lock) {
-    *lock = SPIN_LOCK_INITIAL_VALUE;
-}
-
 static inline bool arch_spin_lock_held(spin_lock_t *lock) {
     return *lock != 0;
 }
+#endif
+
+static inline void arch_spin_lock_init(spin_lock_t *lock) {
+    *lock = SPIN_LOCK_INITIAL_VALUE;
+}
 
 
 __END_CDECLS
@@ -35,6 +35,12 @@ GLOBAL_DEFINES += PLATFORM_HAS_DYNAMIC_TIMER=1
 
 ifeq (true,$(call TOBOOL,$(WITH_SMP)))
 GLOBAL_DEFINES += WITH_SMP=1
+# fair ticket locks from arch/ticket_spinlock.h instead of the amoswap loop
+# in spinlock.c
+WITH_TICKET_SPINLOCKS ?= 1
+ifeq (true,$(call TOBOOL,$(WITH_TICKET_SPINLOCKS)))
+GLOBAL_DEFINES += WITH_TICKET_SPINLOCKS=1
+endif
 endif
 
 ifeq ($(strip $(RISCV_MODE)),machine)
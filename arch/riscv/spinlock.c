@@ -9,7 +9,9 @@
 
 #include <stdint.h>
 
-// super simple spin lock implementation
+// super simple spin lock implementation, unless the portable ticket lock
+// in arch/ticket_spinlock.h has been selected with WITH_TICKET_SPINLOCKS
+#if !(WITH_SMP && WITH_TICKET_SPINLOCKS)
 
 int riscv_spin_trylock(spin_lock_t *lock) {
     // use a full 32/64 type since amoswap overwrites the entire register
@@ -57,3 +59,4 @@ void riscv_spin_unlock(spin_lock_t *lock) {
     *lock = 0;
 }
 
+#endif
@@ -59,6 +59,9 @@ uint32_t max_cpuid_leaf = 0;
 uint32_t max_cpuid_leaf_hyp = 0;
 uint32_t max_cpuid_leaf_ext = 0;
 
+bool __x86_string_erms;
+bool __x86_string_fsrm;
+
 // Subleaves 1..N of the leaves that enumerate something through their subleaves. Kept as
 // one flat table because it's small and only walked at boot; subleaf 0 stays in the
 // indexed arrays above.
@@ -509,6 +512,9 @@ void x86_feature_early_init(void) {
     x86_model_detect();
     x86_uarch_early_init();
     x86_apic_id_layout_init();
+
+    __x86_string_erms = x86_feature_test(X86_FEATURE_ERMS);
+    __x86_string_fsrm = x86_feature_test(X86_FEATURE_FSRM);
 }
 
 static void x86_feature_dump_cpuid(void) {
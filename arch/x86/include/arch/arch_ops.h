@@ -22,6 +22,11 @@ static inline ulong arch_cycle_count(void) {
 #endif
 }
 
+/* hint to the cpu that we are in a spin wait loop */
+static inline void arch_spinloop_pause(void) {
+    __asm__ volatile("pause" ::: "memory");
+}
+
 #if WITH_SMP
 #include <arch/x86/mp.h>
 static inline struct thread *arch_get_current_thread(void) {
@@ -8,6 +8,7 @@
 #pragma once
 
 #include <arch/ops.h>
+#include <arch/ticket_spinlock.h>
 #include <arch/x86.h>
 #include <lk/compiler.h>
 #include <stdbool.h>
@@ -16,7 +17,7 @@
 
 __BEGIN_CDECLS
 
-typedef unsigned int spin_lock_t;
+typedef uint32_t spin_lock_t;
 
 /* simple implementation of spinlocks for no smp support */
 static inline void arch_spin_lock_init(spin_lock_t *lock) {
@@ -24,10 +25,26 @@ static inline void arch_spin_lock_init(spin_lock_t *lock) {
 }
 
 static inline bool arch_spin_lock_held(spin_lock_t *lock) {
+#if WITH_SMP && WITH_TICKET_SPINLOCKS
+    return ticket_spin_lock_held(lock);
+#else
     return *lock != 0;
+#endif
+}
+
+#if WITH_SMP && WITH_TICKET_SPINLOCKS
+static inline void arch_spin_lock(spin_lock_t *lock) {
+    ticket_spin_lock(lock);
 }
 
-#if WITH_SMP
+static inline int arch_spin_trylock(spin_lock_t *lock) {
+    return ticket_spin_trylock(lock);
+}
+
+static inline void arch_spin_unlock(spin_lock_t *lock) {
+    ticket_spin_unlock(lock);
+}
+#elif WITH_SMP
 void arch_spin_lock(spin_lock_t *lock);
 int arch_spin_trylock(spin_lock_t *lock);
 void arch_spin_unlock(spin_lock_t *lock);
@@ -203,6 +203,12 @@ extern uint32_t max_cpuid_leaf;
 extern uint32_t max_cpuid_leaf_hyp;
 extern uint32_t max_cpuid_leaf_ext;
 
+// Fast string support, sampled once at boot so the libc string routines do not
+// walk the cpuid cache on every call. Until then both read false and the string
+// routines stick to the word sized rep forms.
+extern bool __x86_string_erms; // enhanced rep movsb/stosb
+extern bool __x86_string_fsrm; // fast short rep movsb
+
 /* Retrieve the specified subleaf.  This function is not cached.
  * Returns false if leaf num is invalid */
 bool x86_get_cpuid_subleaf(enum x86_cpuid_leaf_num, uint32_t subleaf, struct x86_cpuid_leaf *);
@@ -62,9 +62,15 @@ GLOBAL_DEFINES += \
 
 ifeq ($(WITH_SMP),1)
 SMP_MAX_CPUS ?= 16
+# fair ticket locks from arch/ticket_spinlock.h instead of the test and set
+# loop in spinlock.S
+WITH_TICKET_SPINLOCKS ?= 1
 GLOBAL_DEFINES += \
     WITH_SMP=1 \
     SMP_MAX_CPUS=$(SMP_MAX_CPUS)
+ifeq (true,$(call TOBOOL,$(WITH_TICKET_SPINLOCKS)))
+GLOBAL_DEFINES += WITH_TICKET_SPINLOCKS=1
+endif
 else
 GLOBAL_DEFINES += \
     SMP_MAX_CPUS=1
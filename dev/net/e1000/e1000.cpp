@@ -79,6 +79,7 @@ class e1000 {
 
     void add_pktbuf_to_rxring(pktbuf_t *pkt);
     void add_pktbuf_to_rxring_locked(pktbuf_t *pkt);
+    int rx_collect_locked(list_node *list, int budget);
 
     // counter of configured deices
     static volatile int global_count_;
@@ -104,11 +105,10 @@ class e1000 {
     uint8_t *rx_buf_ = nullptr; // rxbuffer_len * rxring_len byte buffer that rx_pktbuf[] points to
     pktbuf_t *rx_pending_pkt_ = nullptr;
 
-    // rx worker thread
-    list_node rx_queue_ = LIST_INITIAL_VALUE(rx_queue_);
-    event_t rx_event_ = EVENT_INITIAL_VALUE(rx_event_, 0, EVENT_FLAG_AUTOUNSIGNAL);
-    thread_t *rx_worker_thread_ = nullptr;
-    int rx_worker_routine();
+    // rx poller, runs with the rx interrupts masked
+    netif_poll_t rx_poll_ = {};
+    int rx_poll(int budget);
+    bool rx_poll_done();
 
     // tx ring
     tdesc *txring_ = nullptr;
@@ -230,130 +230,142 @@ handler_return e1000::irq_handler() {
         }
     }
     if (icr & (E1000_ICR_RXTO | E1000_ICR_RXO)) { // RXTO/RXO - rx work pending
-        // Packets may be ready, or descriptors may need draining after overrun.
-        auto rdh = read_reg(e1000_reg::RDH);
-        auto rdt = read_reg(e1000_reg::RDT);
-
-        while (rx_last_head_ != rdh) {
-            // copy the current rx descriptor locally for better cache performance
-            rdesc rxd;
-            copy(&rxd, rxring_ + rx_last_head_);
-
-            LTRACEF("last_head %#x RDH %#x RDT %#x\n", rx_last_head_, rdh, rdt);
-            if (LOCAL_TRACE) {
-                rxd.dump();
-            }
+        // Leave the rx interrupts masked until the poller has drained the ring.
+        // A cause read here while they're masked still means work to do.
+        write_reg(e1000_reg::IMC, E1000_ICR_RXTO | E1000_ICR_RXO);
+        netif_poll_schedule(&rx_poll_);
+        ret = INT_RESCHEDULE;
+    }
+    return ret;
+}
+
+// Walk the completed rx descriptors, putting up to budget whole packets on list.
+// Returns the number of packets.
+int e1000::rx_collect_locked(list_node *list, int budget) {
+    int count = 0;
+
+    auto rdh = read_reg(e1000_reg::RDH);
+    auto rdt = read_reg(e1000_reg::RDT);
 
-            // recover the pktbuf we queued in this spot
-            DEBUG_ASSERT(rx_pktbuf_[rx_last_head_]);
-            DEBUG_ASSERT(pktbuf_data_phys(rx_pktbuf_[rx_last_head_]) == rxd.addr);
-            pktbuf_t *pkt = rx_pktbuf_[rx_last_head_];
-
-            bool consumed_pkt = false;
-            if (rxd.status & E1000_RXD_STAT_DD) { // descriptor done, we own it now
-                bool eop = (rxd.status & E1000_RXD_STAT_EOP);
-
-                if (rxd.errors == 0) {
-                    if (rx_pending_pkt_) {
-                        // We are in the middle of a multi-descriptor packet. Append this fragment.
-                        if (pktbuf_avail_tail(rx_pending_pkt_) >= rxd.length) {
-                            // minip consumes a single contiguous pktbuf per frame. Copying this
-                            // fragment lets us present one complete packet while returning this
-                            // descriptor buffer immediately to the RX ring.
-                            pktbuf_append_data(rx_pending_pkt_, pkt->data, rxd.length);
-
-                            // This fragment buffer was consumed by copy. Recycle it to the rx ring.
-                            pktbuf_reset(pkt, 0);
-                            add_pktbuf_to_rxring_locked(pkt);
-                            consumed_pkt = true;
-
-                            if (eop) {
-                                // Packet is now complete.
-                                rx_pending_pkt_->flags |= PKTBUF_FLAG_EOF;
-                                list_add_tail(&rx_queue_, &rx_pending_pkt_->list);
-                                rx_pending_pkt_ = nullptr;
-                                event_signal(&rx_event_, false);
-                                ret = INT_RESCHEDULE;
-                            }
-                        } else {
-                            // Coalesced packet exceeded our fixed receive buffer. Drop and recover.
-                            pktbuf_reset(rx_pending_pkt_, 0);
-                            add_pktbuf_to_rxring_locked(rx_pending_pkt_);
+    while (rx_last_head_ != rdh && count < budget) {
+        // copy the current rx descriptor locally for better cache performance
+        rdesc rxd;
+        copy(&rxd, rxring_ + rx_last_head_);
+
+        LTRACEF("last_head %#x RDH %#x RDT %#x\n", rx_last_head_, rdh, rdt);
+        if (LOCAL_TRACE) {
+            rxd.dump();
+        }
+
+        // recover the pktbuf we queued in this spot
+        DEBUG_ASSERT(rx_pktbuf_[rx_last_head_]);
+        DEBUG_ASSERT(pktbuf_data_phys(rx_pktbuf_[rx_last_head_]) == rxd.addr);
+        pktbuf_t *pkt = rx_pktbuf_[rx_last_head_];
+
+        bool consumed_pkt = false;
+        if (rxd.status & E1000_RXD_STAT_DD) { // descriptor done, we own it now
+            bool eop = (rxd.status & E1000_RXD_STAT_EOP);
+
+            if (rxd.errors == 0) {
+                if (rx_pending_pkt_) {
+                    // We are in the middle of a multi-descriptor packet. Append this fragment.
+                    if (pktbuf_avail_tail(rx_pending_pkt_) >= rxd.length) {
+                        // minip consumes a single contiguous pktbuf per frame. Copying this
+                        // fragment lets us present one complete packet while returning this
+                        // descriptor buffer immediately to the RX ring.
+                        pktbuf_append_data(rx_pending_pkt_, pkt->data, rxd.length);
+
+                        // This fragment buffer was consumed by copy. Recycle it to the rx ring.
+                        pktbuf_reset(pkt, 0);
+                        add_pktbuf_to_rxring_locked(pkt);
+                        consumed_pkt = true;
+
+                        if (eop) {
+                            // Packet is now complete.
+                            rx_pending_pkt_->flags |= PKTBUF_FLAG_EOF;
+                            list_add_tail(list, &rx_pending_pkt_->list);
                             rx_pending_pkt_ = nullptr;
+                            count++;
                         }
                     } else {
-                        // Start or finish a packet from this descriptor.
-                        pkt->dlen = rxd.length;
-                        if (eop) {
-                            pkt->flags |= PKTBUF_FLAG_EOF;
-                            list_add_tail(&rx_queue_, &pkt->list);
-                            event_signal(&rx_event_, false);
-                            ret = INT_RESCHEDULE;
-                            consumed_pkt = true;
-                        } else {
-                            // Save first fragment until we see EOP.
-                            pkt->flags &= ~PKTBUF_FLAG_EOF;
-                            rx_pending_pkt_ = pkt;
-                            consumed_pkt = true;
-                        }
-                    }
-                } else {
-                    // Descriptor has errors. Drop this packet and any in-progress coalesced frame.
-                    if (rx_pending_pkt_) {
+                        // Coalesced packet exceeded our fixed receive buffer. Drop and recover.
                         pktbuf_reset(rx_pending_pkt_, 0);
                         add_pktbuf_to_rxring_locked(rx_pending_pkt_);
                         rx_pending_pkt_ = nullptr;
                     }
+                } else {
+                    // Start or finish a packet from this descriptor.
+                    pkt->dlen = rxd.length;
+                    if (eop) {
+                        pkt->flags |= PKTBUF_FLAG_EOF;
+                        list_add_tail(list, &pkt->list);
+                        consumed_pkt = true;
+                        count++;
+                    } else {
+                        // Save first fragment until we see EOP.
+                        pkt->flags &= ~PKTBUF_FLAG_EOF;
+                        rx_pending_pkt_ = pkt;
+                        consumed_pkt = true;
+                    }
+                }
+            } else {
+                // Descriptor has errors. Drop this packet and any in-progress coalesced frame.
+                if (rx_pending_pkt_) {
+                    pktbuf_reset(rx_pending_pkt_, 0);
+                    add_pktbuf_to_rxring_locked(rx_pending_pkt_);
+                    rx_pending_pkt_ = nullptr;
                 }
             }
-            if (!consumed_pkt) {
-                // TODO: return the pkt to the ring
-                add_pktbuf_to_rxring_locked(pkt);
-            }
-
-            rx_last_head_ = (rx_last_head_ + 1) % rxring_len;
         }
+        if (!consumed_pkt) {
+            // TODO: return the pkt to the ring
+            add_pktbuf_to_rxring_locked(pkt);
+        }
+
+        rx_last_head_ = (rx_last_head_ + 1) % rxring_len;
     }
-    return ret;
+
+    return count;
 }
 
-int e1000::rx_worker_routine() {
-    for (;;) {
-        event_wait(&rx_event_);
+int e1000::rx_poll(int budget) {
+    list_node rx_list = LIST_INITIAL_VALUE(rx_list);
+    int count;
 
-        // pull some packets from the received queue
-        for (;;) {
-            pktbuf_t *p;
+    {
+        AutoSpinLock guard(&lock_);
 
-            {
-                AutoSpinLock guard(&lock_);
+        count = rx_collect_locked(&rx_list, budget);
+    }
 
-                p = list_remove_head_type(&rx_queue_, pktbuf_t, list);
-            }
+    pktbuf_t *p;
+    while ((p = list_remove_head_type(&rx_list, pktbuf_t, list))) {
+        if (LOCAL_TRACE) {
+            LTRACEF("got packet: ");
+            pktbuf_dump(p);
+        }
 
-            if (!p) {
-                break; // nothing left in the queue, go back to waiting
-            }
+        // push it up the stack
+        minip_rx_driver_callback(&netif_, p);
 
-            if (LOCAL_TRACE) {
-                LTRACEF("got packet: ");
-                pktbuf_dump(p);
-            }
+        // we own the pktbuf again
 
-            // push it up the stack
-            minip_rx_driver_callback(&netif_, p);
+        // set the data pointer to the start of the buffer and set dlen to 0
+        pktbuf_reset(p, 0);
 
-            // we own the pktbuf again
+        // add it back to the rx ring at the current tail
+        add_pktbuf_to_rxring(p);
+    }
 
-            // set the data pointer to the start of the buffer and set dlen to 0
-            pktbuf_reset(p, 0);
+    return count;
+}
 
-            // add it back to the rx ring at the current tail
-            add_pktbuf_to_rxring(p);
-        }
-    }
+bool e1000::rx_poll_done() {
+    // ICR holds on to causes raised while masked, so unmasking interrupts
+    // right away for anything that came in since the last pass
+    write_reg(e1000_reg::IMS, E1000_ICR_RXTO | E1000_ICR_RXO);
 
-    return 0;
+    return false;
 }
 
 int e1000::tx(pktbuf_t *p) {
@@ -611,14 +623,21 @@ status_t e1000::init_device(pci_location_t loc, const e1000_id_features *id) {
     }
     // hexdump(rxring_, rxring_len * sizeof(rdesc));
 
-    // start rx worker thread
-    auto wrapper_lambda = [](void *arg) -> int {
-        e1000 *e = static_cast<e1000 *>(arg);
-        return e->rx_worker_routine();
+    // create the minip network interface and start the rx poller that feeds it
+    snprintf(str, sizeof(str), "e1000-%d", unit_);
+    netif_create(&netif_, str);
+
+    auto poll = [](void *arg, int budget) -> int {
+        return static_cast<e1000 *>(arg)->rx_poll(budget);
+    };
+    auto poll_done = [](void *arg) -> bool {
+        return static_cast<e1000 *>(arg)->rx_poll_done();
     };
-    snprintf(str, sizeof(str), "e1000 %d rx worker", unit_);
-    rx_worker_thread_ = thread_create(str, wrapper_lambda, this, HIGH_PRIORITY, DEFAULT_STACK_SIZE);
-    thread_resume(rx_worker_thread_);
+    snprintf(str, sizeof(str), "e1000 %d rx poll", unit_);
+    err = netif_poll_start(&rx_poll_, &netif_, str, poll, poll_done, this, 0, -1);
+    if (err != NO_ERROR) {
+        return err;
+    }
 
     // start receiver
     // enable RX, unicast permiscuous, multicast permiscuous, broadcast accept, BSIZE 2048
@@ -672,8 +691,6 @@ status_t e1000::init_device(pci_location_t loc, const e1000_id_features *id) {
     write_reg(e1000_reg::IMS, ims | E1000_ICR_TXQE | E1000_ICR_TXDW);
 
     // register this NIC instance with minip's netif layer
-    snprintf(str, sizeof(str), "e1000-%d", unit_);
-    netif_create(&netif_, str);
     auto tx = [](void *arg, pktbuf_t *p) -> int {
         auto *e = static_cast<e1000 *>(arg);
         DEBUG_ASSERT(e);
@@ -64,9 +64,8 @@ struct pcnet_state {
     mutex_t tx_lock;
 
     /* bottom half state */
-    event_t event;
+    netif_poll_t poll;
     event_t initialized;
-    bool done;
 
     netif_t netif;
 };
@@ -76,7 +75,8 @@ static status_t pcnet_read_pci_config(struct pcnet_state *state, pci_location_t
 
 static enum handler_return pcnet_irq_handler(void *arg);
 
-static int pcnet_thread(void *arg);
+static int pcnet_poll(void *arg, int budget);
+static bool pcnet_poll_done(void *arg);
 static bool pcnet_service_tx(struct pcnet_state *state);
 static bool pcnet_service_rx(struct pcnet_state *state);
 
@@ -230,17 +230,28 @@ static status_t pcnet_init_device(struct pcnet_state *state, pci_location_t loc)
 
     mutex_init(&state->tx_lock);
 
-    state->done = false;
-    event_init(&state->event, false, EVENT_FLAG_AUTOUNSIGNAL);
     event_init(&state->initialized, false, 0);
 
-    /* start up a thread to process packet activity */
-    thread_resume(
-        thread_create("[pcnet bh]", pcnet_thread, state, DEFAULT_PRIORITY, DEFAULT_STACK_SIZE));
+    char if_name[16];
+    snprintf(if_name, sizeof(if_name), "pcnet-%u", state->unit);
+    if (!netif_create(&state->netif, if_name)) {
+        res = ERR_NO_MEMORY;
+        goto error;
+    }
+
+    /* start up a poller to process packet activity */
+    res = netif_poll_start(&state->poll, &state->netif, "[pcnet bh]", pcnet_poll, pcnet_poll_done,
+                           state, 0, -1);
+    if (res != NO_ERROR) {
+        goto error;
+    }
 
     register_int_handler(state->irq, pcnet_irq_handler, state);
     unmask_interrupt(state->irq);
 
+    /* kick off init, enable ints, and start operation */
+    pcnet_write_csr(state, 0, CSR0_INIT | CSR0_IENA | CSR0_STRT);
+
     /* wait for initialization to complete */
     res = event_wait_timeout(&state->initialized, PCNET_INIT_TIMEOUT);
     if (res) {
@@ -248,13 +259,6 @@ static status_t pcnet_init_device(struct pcnet_state *state, pci_location_t loc)
         goto error;
     }
 
-    char if_name[16];
-    snprintf(if_name, sizeof(if_name), "pcnet-%u", state->unit);
-    if (!netif_create(&state->netif, if_name)) {
-        res = ERR_NO_MEMORY;
-        goto error;
-    }
-
     res = netif_set_eth(&state->netif, pcnet_send_minip_pkt, state, state->padr);
     if (res != NO_ERROR) {
         goto error;
@@ -322,53 +326,57 @@ static status_t pcnet_read_pci_config(struct pcnet_state *state, pci_location_t
 static enum handler_return pcnet_irq_handler(void *arg) {
     struct pcnet_state *state = arg;
 
+    /* stays masked until the poller runs out of work */
     mask_interrupt(state->irq);
 
-    event_signal(&state->event, false);
+    netif_poll_schedule(&state->poll);
 
     return INT_RESCHEDULE;
 }
 
-static int pcnet_thread(void *arg) {
+static int pcnet_poll(void *arg, int budget) {
     DEBUG_ASSERT(arg);
 
     struct pcnet_state *state = arg;
 
-    /* kick off init, enable ints, and start operation */
-    pcnet_write_csr(state, 0, CSR0_INIT | CSR0_IENA | CSR0_STRT);
+    uint32_t csr0 = pcnet_read_csr(state, 0);
 
-    while (!state->done) {
-        event_wait(&state->event);
+    /* ack the causes, leaving interrupts disabled at the controller */
+    pcnet_write_csr(state, 0, csr0 & ~CSR0_IENA);
 
-        uint32_t csr0 = pcnet_read_csr(state, 0);
+    if (csr0 & CSR0_IDON) {
+        /* free the init block that we no longer need */
+        free(state->ib);
+        state->ib = NULL;
 
-        /* disable interrupts at the controller */
-        pcnet_write_csr(state, 0, csr0 & ~CSR0_IENA);
+        event_signal(&state->initialized, true);
+    }
 
-        if (csr0 & CSR0_IDON) {
-            /* free the init block that we no longer need */
-            free(state->ib);
-            state->ib = NULL;
+    if (csr0 & CSR0_ERR) {
+        /* clear flags, preserve necessary enables */
+        pcnet_write_csr(state, 0, csr0 & (CSR0_TXON | CSR0_RXON));
+    }
 
-            event_signal(&state->initialized, true);
-        }
+    while (pcnet_service_tx(state))
+        ;
 
-        if (csr0 & CSR0_ERR) {
-            /* clear flags, preserve necessary enables */
-            pcnet_write_csr(state, 0, csr0 & (CSR0_TXON | CSR0_RXON | CSR0_IENA));
-        }
+    int count = 0;
+    while (count < budget && pcnet_service_rx(state)) {
+        count++;
+    }
 
-        bool again = !!(csr0 & (CSR0_RINT | CSR0_TINT));
-        while (again) {
-            again = pcnet_service_tx(state) || pcnet_service_rx(state);
-        }
+    return count;
+}
 
-        /* enable interrupts at the controller */
-        pcnet_write_csr(state, 0, CSR0_IENA);
-        unmask_interrupt(state->irq);
-    }
+static bool pcnet_poll_done(void *arg) {
+    struct pcnet_state *state = arg;
+
+    /* RINT and TINT latch, so anything that arrived since the last pass
+     * interrupts again as soon as this is turned back on */
+    pcnet_write_csr(state, 0, CSR0_IENA);
+    unmask_interrupt(state->irq);
 
-    return 0;
+    return false;
 }
 
 static bool pcnet_service_tx(struct pcnet_state *state) {
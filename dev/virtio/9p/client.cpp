@@ -25,6 +25,7 @@
 #include <dev/virtio/virtio-device.h>
 #include <dev/virtio/9p.h>
 #include <kernel/event.h>
+#include <kernel/semaphore.h>
 #include <kernel/spinlock.h>
 #include <lk/debug.h>
 #include <lk/err.h>
@@ -73,54 +74,75 @@ static void pdu_reset(struct p9_fcall *pdu)
     pdu->size = 0;
 }
 
-static status_t p9_req_prepare(struct p9_req *req,
+// Take a free request slot, waiting for one if `wait` is set. Returns NULL if
+// there is none.
+static struct p9_req *p9_req_alloc(struct virtio_9p_dev *p9dev, bool wait)
+{
+    status_t ret = wait ? sem_timedwait(&p9dev->free_reqs, VIRTIO_9P_RPC_TIMEOUT)
+                        : sem_trywait(&p9dev->free_reqs);
+    if (ret != NO_ERROR) {
+        return NULL;
+    }
+
+    AutoSpinLock lock_guard(&p9dev->lock);
+
+    for (auto &req : p9dev->reqs) {
+        if (req.status == P9_REQ_S_UNKNOWN) {
+            req.status = P9_REQ_S_INITIALIZED;
+            return &req;
+        }
+    }
+
+    panic("virtio-9p: no free request slot\n");
+}
+
+static void p9_req_free(struct virtio_9p_dev *p9dev, struct p9_req *req)
+{
+    {
+        AutoSpinLock lock_guard(&p9dev->lock);
+        req->status = P9_REQ_S_UNKNOWN;
+    }
+
+    sem_post(&p9dev->free_reqs, true);
+}
+
+static status_t p9_req_prepare(struct virtio_9p_dev *p9dev, struct p9_req *req,
                                const virtio_9p_msg_t *tmsg)
 {
-    struct virtio_9p_dev *p9dev = containerof(req, struct virtio_9p_dev, req);
-    status_t ret = NO_ERROR;
-    auto cleanup = lk::make_auto_call([req] {
+    status_t ret;
+
+    // the buffers stay with the slot, so only its first request allocates them
+    if (req->tc.capacity < p9dev->msize) {
         pdu_fini(&req->tc);
         pdu_fini(&req->rc);
-    });
 
-    if ((ret = pdu_init(&req->tc, p9dev->msize)) != NO_ERROR) {
-        return ret;
-    }
+        if ((ret = pdu_init(&req->tc, p9dev->msize)) != NO_ERROR) {
+            return ret;
+        }
 
-    if ((ret = pdu_init(&req->rc, p9dev->msize)) != NO_ERROR) {
-        return ret;
+        if ((ret = pdu_init(&req->rc, p9dev->msize)) != NO_ERROR) {
+            pdu_fini(&req->tc);
+            return ret;
+        }
     }
 
     pdu_reset(&req->tc);
     pdu_reset(&req->rc);
 
-    event_init(&req->io_event, false, EVENT_FLAG_AUTOUNSIGNAL);
-    req->status = P9_REQ_S_INITIALIZED;
-
-    // fill 9p header
+    // fill 9p header, every request but Tversion is tagged with its slot
     if (pdu_writed(&req->tc, 0) != NO_ERROR) {
         return ERR_IO;
     }
     if (pdu_writeb(&req->tc, tmsg->msg_type) != NO_ERROR) {
         return ERR_IO;
     }
-    if (pdu_writew(&req->tc, tmsg->tag) != NO_ERROR) {
+    if (pdu_writew(&req->tc, tmsg->tag == P9_TAG_NOTAG ? P9_TAG_NOTAG : req->tag) != NO_ERROR) {
         return ERR_IO;
     }
 
-    cleanup.cancel();
     return NO_ERROR;
 }
 
-static void p9_req_release(struct p9_req *req)
-{
-    req->status = P9_REQ_S_UNKNOWN;
-    event_destroy(&req->io_event);
-
-    pdu_fini(&req->tc);
-    pdu_fini(&req->rc);
-}
-
 static status_t p9_req_finalize(struct p9_req *req)
 {
     uint32_t size = req->tc.size;
@@ -170,6 +192,10 @@ static void virtio_9p_req_send(struct virtio_9p_dev *p9dev,
     AutoSpinLock lock_guard(&p9dev->lock);
 
     desc = dev->virtio_alloc_desc_chain(VIRTIO_9P_RING_IDX, 2, &idx);
+    // there are enough descriptors for every request slot
+    ASSERT(desc);
+    req->desc_head = idx;
+    p9dev->desc_tag[idx] = (uint8_t)(req - p9dev->reqs);
 
     const bool modern = dev->config_is_modern();
     vring_desc_write_len(desc, req->tc.size, modern);
@@ -195,34 +221,33 @@ static void virtio_9p_req_send(struct virtio_9p_dev *p9dev,
     dev->virtio_submit_chain(VIRTIO_9P_RING_IDX, idx);
 
     /* kick it off */
-    dev->bus()->virtio_kick(VIRTIO_9P_RING_IDX);
+    dev->virtio_kick(VIRTIO_9P_RING_IDX);
 }
 
-status_t virtio_9p_rpc(struct virtio_device *dev, const virtio_9p_msg_t *tmsg,
-                       virtio_9p_msg_t *rmsg)
+static status_t virtio_9p_rpc_submit_etc(struct virtio_device *dev, const virtio_9p_msg_t *tmsg,
+                                         struct p9_req **reqp, bool wait)
 {
-    LTRACEF("dev (%p) tmsg (%p) rmsg (%p)\n", dev, tmsg, rmsg);
+    LTRACEF("dev (%p) tmsg (%p) reqp (%p) wait %d\n", dev, tmsg, reqp, wait);
 
     auto *p9dev = (virtio_9p_dev *)dev->priv();
-    struct p9_req *req = &p9dev->req;
     status_t ret;
 
-    if (!tmsg || !rmsg) {
+    if (!tmsg || !reqp) {
         return ERR_INVALID_ARGS;
     }
 
-    // Since we allow only one outstanding request for now, we have a 9p device
-    // level lock for restricting only one rpc can be executed at a time. One
-    // day if we can support multiple outstanding requests, we should move the
-    // lock into the request allocation phase.
-    AutoLock req_lock_guard(&p9dev->req_lock);
+    // take one of the request slots, waiting for one to come free if asked to
+    struct p9_req *req = p9_req_alloc(p9dev, wait);
+    if (!req) {
+        return wait ? ERR_TIMED_OUT : ERR_NOT_READY;
+    }
+    auto cleanup = lk::make_auto_call([p9dev, req] { p9_req_free(p9dev, req); });
 
     // prepare the message header
-    ret = p9_req_prepare(req, tmsg);
+    ret = p9_req_prepare(p9dev, req, tmsg);
     if (ret != NO_ERROR) {
         return ret;
     }
-    auto cleanup = lk::make_auto_call([req] { p9_req_release(req); });
 
     // setup the T-message by its msg-type
     switch (tmsg->msg_type) {
@@ -282,9 +307,51 @@ status_t virtio_9p_rpc(struct virtio_device *dev, const virtio_9p_msg_t *tmsg,
 
     virtio_9p_req_send(p9dev, req);
 
+    cleanup.cancel();
+    *reqp = req;
+
+    return NO_ERROR;
+}
+
+status_t virtio_9p_rpc_submit(struct virtio_device *dev, const virtio_9p_msg_t *tmsg,
+                              struct p9_req **reqp)
+{
+    return virtio_9p_rpc_submit_etc(dev, tmsg, reqp, true);
+}
+
+status_t virtio_9p_rpc_try_submit(struct virtio_device *dev, const virtio_9p_msg_t *tmsg,
+                                  struct p9_req **reqp)
+{
+    return virtio_9p_rpc_submit_etc(dev, tmsg, reqp, false);
+}
+
+status_t virtio_9p_rpc_wait(struct virtio_device *dev, struct p9_req *req,
+                            virtio_9p_msg_t *rmsg)
+{
+    LTRACEF("dev (%p) req (%p) rmsg (%p)\n", dev, req, rmsg);
+
+    auto *p9dev = (virtio_9p_dev *)dev->priv();
+    status_t ret;
+
+    DEBUG_ASSERT(req);
+
     // wait for server's response
     if (event_wait_timeout(&req->io_event, VIRTIO_9P_RPC_TIMEOUT) != NO_ERROR) {
-        return ERR_TIMED_OUT;
+        AutoSpinLock lock_guard(&p9dev->lock);
+        if (req->status == P9_REQ_S_SENT) {
+            // the device still owns the buffers, so the slot is freed by the
+            // irq handler if the reply ever turns up
+            req->status = P9_REQ_S_ABANDONED;
+            return ERR_TIMED_OUT;
+        }
+
+        // the reply came in just as we gave up on it, take it after all
+        event_unsignal(&req->io_event);
+    }
+    auto cleanup = lk::make_auto_call([p9dev, req] { p9_req_free(p9dev, req); });
+
+    if (!rmsg) {
+        return ERR_INVALID_ARGS;
     }
 
     // read the message header from the returned request
@@ -335,7 +402,7 @@ status_t virtio_9p_rpc(struct virtio_device *dev, const virtio_9p_msg_t *tmsg,
             ret = p9_proto_rmkdir(req, rmsg);
             break;
         default:
-            LTRACEF("9p R-message type not supported: %u\n", tmsg->msg_type);
+            LTRACEF("9p R-message type not supported: %u\n", rmsg->msg_type);
             ret = ERR_NOT_SUPPORTED;
             return ret;
     }
@@ -343,6 +410,23 @@ status_t virtio_9p_rpc(struct virtio_device *dev, const virtio_9p_msg_t *tmsg,
     return ret;
 }
 
+status_t virtio_9p_rpc(struct virtio_device *dev, const virtio_9p_msg_t *tmsg,
+                       virtio_9p_msg_t *rmsg)
+{
+    struct p9_req *req;
+    status_t ret;
+
+    if (!rmsg) {
+        return ERR_INVALID_ARGS;
+    }
+
+    if ((ret = virtio_9p_rpc_submit(dev, tmsg, &req)) != NO_ERROR) {
+        return ret;
+    }
+
+    return virtio_9p_rpc_wait(dev, req, rmsg);
+}
+
 void virtio_9p_msg_destroy(virtio_9p_msg_t *msg)
 {
     switch (msg->msg_type) {
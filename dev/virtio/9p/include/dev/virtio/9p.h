@@ -32,8 +32,8 @@
 #define VIRTIO_9P_RING_IDX 0
 #define VIRTIO_9P_RING_SIZE 128
 
-// Assuming there can be only one outstanding request. Pick a 16-bit unsigned
-// value arbtrarily as the default tag for no good reason.
+// The client gives every request the tag of the slot it is sent from, so
+// callers can pass any tag but P9_TAG_NOTAG, which is kept as is for Tversion.
 #define P9_TAG_DEFAULT ((uint16_t)0x15)
 #define P9_TAG_NOTAG ((uint16_t)~0)
 
@@ -458,8 +458,27 @@ status_t virtio_9p_start(struct virtio_device *dev) __NONNULL();
 struct virtio_device *virtio_9p_bdev_to_virtio_device(bdev_t *bdev);
 struct virtio_device *virtio_get_9p_device(uint index);
 
+struct p9_req;
+
+// Send a T-message and wait for its R-message. Any number of threads may have
+// requests outstanding at once, up to a per device limit past which callers
+// wait for a free slot.
 status_t virtio_9p_rpc(struct virtio_device *dev, const virtio_9p_msg_t *tmsg,
                        virtio_9p_msg_t *rmsg);
+
+// The two halves of virtio_9p_rpc, for pipelining several requests from one
+// thread. tmsg and anything it points to may be reused once submit returns.
+// Every request submitted must be waited for exactly once, which frees it.
+status_t virtio_9p_rpc_submit(struct virtio_device *dev, const virtio_9p_msg_t *tmsg,
+                              struct p9_req **req);
+// As virtio_9p_rpc_submit, but returns ERR_NOT_READY instead of waiting when
+// every request slot is taken. A caller that already has requests outstanding
+// must use this and wait for one of its own, since the slots it is waiting on
+// may all be held by callers doing the same.
+status_t virtio_9p_rpc_try_submit(struct virtio_device *dev, const virtio_9p_msg_t *tmsg,
+                                  struct p9_req **req);
+status_t virtio_9p_rpc_wait(struct virtio_device *dev, struct p9_req *req,
+                            virtio_9p_msg_t *rmsg);
 void virtio_9p_msg_destroy(virtio_9p_msg_t *msg);
 ssize_t p9_dirent_read(uint8_t *data, uint32_t size, p9_dirent_t *ent);
 void p9_dirent_destroy(p9_dirent_t *ent);
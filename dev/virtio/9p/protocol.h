@@ -25,7 +25,8 @@
 
 #include <dev/virtio/9p.h>
 #include <kernel/event.h>
-#include <kernel/mutex.h>
+#include <kernel/semaphore.h>
+#include <lk/compiler.h>
 #include <lk/list.h>
 #include <sys/types.h>
 #include <string.h>
@@ -33,6 +34,11 @@
 #define VIRTIO_9P_RPC_TIMEOUT 3000 /* ms */
 #define VIRTIO_9P_DEFAULT_MSIZE (PAGE_SIZE << 5)
 
+// Requests that can be outstanding on one device at a time. Each one is a two
+// descriptor chain on the ring, and its tag is its index in the request table.
+#define VIRTIO_9P_MAX_REQS 16
+STATIC_ASSERT(VIRTIO_9P_MAX_REQS * 2 <= VIRTIO_9P_RING_SIZE);
+
 struct p9_fcall {
     uint32_t size;
 
@@ -44,16 +50,20 @@ struct p9_fcall {
 
 struct p9_req {
     int status;
+    uint16_t tag;
+    uint16_t desc_head;
     event_t io_event;
+    // allocated on first use and kept for the next request in this slot
     struct p9_fcall tc;
     struct p9_fcall rc;
 };
 
 enum {
-    P9_REQ_S_UNKNOWN = 0,
+    P9_REQ_S_UNKNOWN = 0, // free
     P9_REQ_S_INITIALIZED,
     P9_REQ_S_SENT,
     P9_REQ_S_RECEIVED,
+    P9_REQ_S_ABANDONED,   // timed out waiting, freed when the reply comes in
 };
 
 struct virtio_9p_dev {
@@ -62,8 +72,12 @@ struct virtio_9p_dev {
     bdev_t bdev;
 
     uint32_t msize;
-    struct p9_req req;
-    mutex_t req_lock;
+
+    // outstanding requests indexed by tag, free_reqs counts the free slots and
+    // desc_tag maps the head of a descriptor chain back to its request
+    struct p9_req reqs[VIRTIO_9P_MAX_REQS];
+    semaphore_t free_reqs;
+    uint8_t desc_tag[VIRTIO_9P_RING_SIZE];
 
     struct list_node list;
     spin_lock_t lock;
@@ -67,9 +67,13 @@ status_t virtio_9p_init(virtio_device *dev, uint32_t host_features)
     p9dev->dev = dev;
     dev->set_priv(p9dev);
     p9dev->lock = SPIN_LOCK_INITIAL_VALUE;
-    // Assuming there can be only one outstanding request.
-    p9dev->req.status = P9_REQ_S_UNKNOWN;
-    mutex_init(&p9dev->req_lock);
+    for (uint16_t i = 0; i < VIRTIO_9P_MAX_REQS; i++) {
+        struct p9_req *req = &p9dev->reqs[i];
+        req->status = P9_REQ_S_UNKNOWN;
+        req->tag = i;
+        event_init(&req->io_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+    }
+    sem_init(&p9dev->free_reqs, VIRTIO_9P_MAX_REQS);
     p9dev->msize = VIRTIO_9P_DEFAULT_MSIZE;
 
     // Add the 9p device to the device list
@@ -95,6 +99,9 @@ status_t virtio_9p_init(virtio_device *dev, uint32_t host_features)
     /* ack and set the driver status bit */
     dev->bus()->virtio_status_acknowledge_driver();
 
+    /* no device specific features, just the ring ones */
+    dev->virtio_set_guest_features(0);
+
     dev->virtio_alloc_ring(VIRTIO_9P_RING_IDX, VIRTIO_9P_RING_SIZE);
 
     /* set our irq handler */
@@ -154,28 +161,39 @@ static enum handler_return virtio_9p_irq_driver_callback(
     uint16_t id = e->id;
     uint16_t id_next;
     vring_desc *desc = dev->virtio_desc_index_to_desc(ring, id);
-    struct p9_req *req = &p9dev->req;
 
     LTRACEF("dev %p, ring %u, e %p, id %u, len %u\n", dev, ring, e, e->id, e->len);
 #if LOCAL_TRACE
     virtio_dump_desc(desc);
 #endif
 
-    ASSERT(req->status == P9_REQ_S_SENT);
+    ASSERT(id < VIRTIO_9P_RING_SIZE);
     ASSERT(desc);
     const bool modern = dev->config_is_modern();
     ASSERT(vring_desc_read_flags(desc, modern) & VRING_DESC_F_NEXT);
 
     spin_lock(&p9dev->lock);
 
+    // find the request this chain was sent for
+    struct p9_req *req = &p9dev->reqs[p9dev->desc_tag[id]];
+    ASSERT(req->desc_head == id);
+    ASSERT(req->status == P9_REQ_S_SENT || req->status == P9_REQ_S_ABANDONED);
+
     // drop the T-message desc
     id_next = vring_desc_read_next(desc, modern);
     desc = dev->virtio_desc_index_to_desc(VIRTIO_9P_RING_IDX, id_next);
 #if LOCAL_TRACE
     virtio_dump_desc(desc);
 #endif
-    req->rc.size = e->len;
-    req->status = P9_REQ_S_RECEIVED;
+
+    // nobody is waiting for a request that timed out, so it is freed here
+    const bool abandoned = req->status == P9_REQ_S_ABANDONED;
+    if (abandoned) {
+        req->status = P9_REQ_S_UNKNOWN;
+    } else {
+        req->rc.size = e->len;
+        req->status = P9_REQ_S_RECEIVED;
+    }
 
     // free the desc
     dev->virtio_free_desc(ring, id);
@@ -183,8 +201,12 @@ static enum handler_return virtio_9p_irq_driver_callback(
 
     spin_unlock(&p9dev->lock);
 
-    /* wake up the rpc */
-    event_signal(&req->io_event, false);
+    if (abandoned) {
+        sem_post(&p9dev->free_reqs, false);
+    } else {
+        /* wake up the rpc */
+        event_signal(&req->io_event, false);
+    }
 
     return INT_RESCHEDULE;
 }
@@ -9,6 +9,7 @@
 #include <dev/virtio/block.h>
 #include <endian.h>
 #include <inttypes.h>
+#include <arch/ops.h>
 #include <kernel/event.h>
 #include <kernel/spinlock.h>
 #include <kernel/thread.h>
@@ -20,6 +21,7 @@
 #include <lk/list.h>
 #include <lk/trace.h>
 #include <stdlib.h>
+#include <string.h>
 
 #if WITH_KERNEL_VM
 #include <kernel/vm.h>
@@ -46,7 +48,8 @@ struct virtio_blk_config {
         uint32_t opt_io_size;
     } topology;
     uint8_t writeback;
-    uint8_t unused[3];
+    uint8_t unused0;
+    uint16_t num_queues;
     uint32_t max_discard_sectors;
     uint32_t max_discard_seq;
     uint32_t discard_sector_alignment;
@@ -138,6 +141,20 @@ __MAYBE_UNUSED constexpr uint32_t VIRTIO_BLK_S_IOERR = 1;
 __MAYBE_UNUSED constexpr uint32_t VIRTIO_BLK_S_UNSUPP = 2;
 
 constexpr uint16_t VIRTIO_BLK_RING_LEN = 256;
+// with more than one queue each ring is smaller, they are all in use at once
+constexpr uint16_t VIRTIO_BLK_MQ_RING_LEN = 128;
+constexpr uint VIRTIO_BLK_MAX_QUEUES = MIN(SMP_MAX_CPUS, virtio_device::MAX_VIRTIO_RINGS);
+
+// With VIRTIO_RING_F_INDIRECT_DESC a request takes a single ring descriptor
+// pointing at a per request table holding the header, the data segments and
+// the status byte. A table never crosses a page since it is aligned to its
+// size. Requests with more segments than fit fall back to a direct chain.
+constexpr size_t VIRTIO_BLK_INDIRECT_LEN = 16;
+
+struct virtio_block_indirect {
+    vring_desc desc[VIRTIO_BLK_INDIRECT_LEN];
+};
+static_assert(sizeof(virtio_block_indirect) <= PAGE_SIZE, "indirect table must fit in a page");
 
 enum handler_return virtio_block_irq_driver_callback(virtio_device *dev, uint ring, const vring_used_elem *e);
 ssize_t virtio_bdev_read_block(bdev *bdev, void *buf, bnum_t block, uint count);
@@ -149,6 +166,21 @@ status_t virtio_bdev_write_async(
     bdev *bdev, const void *buf, off_t offset, size_t len,
     void (*callback)(void *, struct bdev *, ssize_t), void *cookie);
 
+// One per virtqueue. Requests are submitted on the queue of the cpu they are
+// issued from, and the lock only serializes that queue's ring against its own
+// completions.
+struct virtio_block_queue {
+    spin_lock_t lock;
+    uint16_t ring;
+
+    // descriptor index would be used to index into the txns array
+    // This is a simple way to keep track of which transaction entry is
+    // free, and which transaction entry corresponds to which descriptor.
+    // Hence, we allocate txns array with the same size as the ring.
+    virtio_block_txn *txns;
+    virtio_block_indirect *indirect;
+} __CPU_ALIGN;
+
 struct virtio_block_dev {
     virtio_device *dev;
 
@@ -158,7 +190,10 @@ struct virtio_block_dev {
     /* our negotiated guest features */
     uint32_t guest_features;
     bool readonly;
-    virtio_block_txn *txns;
+    bool indirect;
+
+    uint queue_count;
+    virtio_block_queue *queues;
 };
 
 
@@ -253,23 +288,55 @@ status_t virtio_block_init(virtio_device *dev) {
                              VIRTIO_BLK_F_BLK_SIZE |
                              VIRTIO_BLK_F_GEOMETRY |
                              VIRTIO_BLK_F_TOPOLOGY |
-                             VIRTIO_BLK_F_CONFIG_WCE);
-    dev->bus()->virtio_set_guest_features(0, bdev->guest_features);
+                             VIRTIO_BLK_F_CONFIG_WCE |
+                             VIRTIO_BLK_F_MQ |
+                             (1u << VIRTIO_RING_F_INDIRECT_DESC));
+    bdev->guest_features = dev->virtio_set_guest_features(bdev->guest_features);
+    bdev->indirect = (bdev->guest_features & (1u << VIRTIO_RING_F_INDIRECT_DESC)) != 0;
 
     // If supported, prefer writeback mode for better throughput.
     if (bdev->guest_features & VIRTIO_BLK_F_CONFIG_WCE) {
         dev->config_write8(offsetof(virtio_blk_config, writeback), 1);
     }
 
-    /* allocate a virtio ring */
-    dev->virtio_alloc_ring(0, VIRTIO_BLK_RING_LEN);
+    /* one queue per cpu, as far as the device and our ring table allow */
+    bdev->queue_count = 1;
+    if (bdev->guest_features & VIRTIO_BLK_F_MQ) {
+        uint16_t num_queues = dev->config_read16(offsetof(virtio_blk_config, num_queues));
+        bdev->queue_count = MAX(1u, MIN((uint)num_queues, VIRTIO_BLK_MAX_QUEUES));
+    }
+    const uint16_t ring_len = (bdev->queue_count > 1) ? VIRTIO_BLK_MQ_RING_LEN : VIRTIO_BLK_RING_LEN;
 
-    // descriptor index would be used to index into the txns array
-    // This is a simple way to keep track of which transaction entry is
-    // free, and which transaction entry corresponds to which descriptor.
-    // Hence, we allocate txns array with the same size as the ring.
-    bdev->txns = static_cast<struct virtio_block_txn *>(memalign(alignof(struct virtio_block_txn),
-                                                                 VIRTIO_BLK_RING_LEN * sizeof(struct virtio_block_txn)));
+    bdev->queues = static_cast<virtio_block_queue *>(
+        memalign(alignof(virtio_block_queue), bdev->queue_count * sizeof(virtio_block_queue)));
+    if (!bdev->queues) {
+        return ERR_NO_MEMORY;
+    }
+    for (uint q = 0; q < bdev->queue_count; q++) {
+        virtio_block_queue *queue = &bdev->queues[q];
+        memset(queue, 0, sizeof(*queue));
+        spin_lock_init(&queue->lock);
+        queue->ring = q;
+
+        /* allocate a virtio ring */
+        status_t err = dev->virtio_alloc_ring(q, ring_len);
+        if (err < 0) {
+            return err;
+        }
+
+        queue->txns = static_cast<virtio_block_txn *>(memalign(alignof(virtio_block_txn),
+                                                               ring_len * sizeof(virtio_block_txn)));
+        if (!queue->txns) {
+            return ERR_NO_MEMORY;
+        }
+        if (bdev->indirect) {
+            queue->indirect = static_cast<virtio_block_indirect *>(memalign(sizeof(virtio_block_indirect),
+                                                                            ring_len * sizeof(virtio_block_indirect)));
+            if (!queue->indirect) {
+                return ERR_NO_MEMORY;
+            }
+        }
+    }
 
     /* set our irq handler */
     dev->set_irq_callbacks(&virtio_block_irq_driver_callback, nullptr);
@@ -318,6 +385,8 @@ status_t virtio_block_init(virtio_device *dev) {
                dev->config_read8(offsetof(virtio_blk_config, writeback)) ? "enabled" : "disabled");
     }
     printf("\tsize_max %u seg_max %u\n", size_max, seg_max);
+    printf("\tqueues %u ring len %u indirect descriptors %s\n", bdev->queue_count, ring_len,
+           bdev->indirect ? "yes" : "no");
     if (host_features & VIRTIO_BLK_F_GEOMETRY) {
         printf("\tgeometry: cyl %u head %u sector %u\n",
                dev->config_read16(offsetof(virtio_blk_config, geometry.cylinders)),
@@ -355,10 +424,19 @@ namespace {
 enum handler_return virtio_block_irq_driver_callback(virtio_device *dev, uint ring, const struct vring_used_elem *e) {
     auto *bdev = (virtio_block_dev *)dev->priv();
 
-    struct virtio_block_txn *txn = &bdev->txns[e->id];
+    DEBUG_ASSERT(ring < bdev->queue_count);
+    virtio_block_queue *queue = &bdev->queues[ring];
+
+    struct virtio_block_txn *txn = &queue->txns[e->id];
     LTRACEF("dev %p, ring %u, e %p, id %u, len %u, status %d\n", dev, ring, e, e->id, e->len, txn->status);
 
+    /* grab what we need out of the txn before its descriptors can be reused */
+    auto callback = txn->callback;
+    void *cookie = txn->cookie;
+    ssize_t result = (txn->status == VIRTIO_BLK_S_OK) ? (ssize_t)txn->len : ERR_IO;
+
     /* parse our descriptor chain, add back to the free queue */
+    spin_lock(&queue->lock);
     uint16_t i = e->id;
     for (;;) {
         int next;
@@ -381,37 +459,85 @@ enum handler_return virtio_block_irq_driver_callback(virtio_device *dev, uint ri
         }
         i = next;
     }
+    spin_unlock(&queue->lock);
 
-    if (txn->callback) {
+    if (callback) {
         // async
-        ssize_t result =
-            (txn->status == VIRTIO_BLK_S_OK) ? (ssize_t)txn->len : ERR_IO;
-        LTRACEF("calling callback %p with cookie %p, len %ld\n", txn->callback,
-                txn->cookie, result);
-        txn->callback(txn->cookie, &bdev->bdev, result);
+        LTRACEF("calling callback %p with cookie %p, len %ld\n", callback, cookie, result);
+        callback(cookie, &bdev->bdev, result);
     }
 
     return INT_RESCHEDULE;
 }
 
+// Walk a buffer one physically contiguous run at a time. Returns false once
+// the buffer is used up.
+bool virtio_block_next_segment(vaddr_t *va, size_t *remaining, paddr_t *seg_pa, size_t *seg_len) {
+    if (*remaining == 0) {
+        return false;
+    }
+
+#if WITH_KERNEL_VM
+    paddr_t pa = vaddr_to_paddr((void *)*va);
+    size_t len = MIN(PAGE_ALIGN(*va + 1) - *va, *remaining);
+
+    /* extend the run while the next page is physically contiguous */
+    while (len < *remaining && vaddr_to_paddr((void *)(*va + len)) == pa + len) {
+        len += MIN((size_t)PAGE_SIZE, *remaining - len);
+    }
+#else
+    /* non VM world simply queues a single buffer that transfers the whole thing */
+    paddr_t pa = (paddr_t)*va;
+    size_t len = *remaining;
+#endif
+
+    *seg_pa = pa;
+    *seg_len = len;
+    *va += len;
+    *remaining -= len;
+    return true;
+}
+
+size_t virtio_block_count_segments(void *buf, size_t len) {
+    vaddr_t va = (vaddr_t)buf;
+    paddr_t pa;
+    size_t seg_len;
+    size_t count = 0;
+
+    while (virtio_block_next_segment(&va, &len, &pa, &seg_len)) {
+        count++;
+    }
+    return count;
+}
+
 status_t virtio_block_do_txn(virtio_device *dev, void *buf,
                              off_t offset, size_t len, bool write,
-                             bio_async_callback_t callback, void *cookie,
-                             virtio_block_txn **txn_out) {
+                             bio_async_callback_t callback, void *cookie) {
     auto *bdev = (virtio_block_dev *)dev->priv();
 
-    uint16_t i;
-    vring_desc *desc;
-
     LTRACEF("dev %p, buf %p, offset 0x%llx, len %zu\n", dev, buf, offset, len);
 
+    /* submit on this cpu's queue */
+    virtio_block_queue *queue = &bdev->queues[arch_curr_cpu_num() % bdev->queue_count];
+    const uint ring = queue->ring;
+    const bool modern = dev->config_is_modern();
+    const uint16_t data_flags = write ? 0 : VRING_DESC_F_WRITE;
+
+    const size_t segments = virtio_block_count_segments(buf, len);
+    const bool use_indirect = bdev->indirect && segments + 2 <= VIRTIO_BLK_INDIRECT_LEN;
+
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&queue->lock);
+
     /* put together a transfer */
-    desc = dev->virtio_alloc_desc_chain(0, 3, &i);
+    uint16_t i;
+    vring_desc *desc = dev->virtio_alloc_desc_chain(ring, use_indirect ? 1 : segments + 2, &i);
     LTRACEF("after alloc chain desc %p, i %u\n", desc, i);
     if (!desc) {
+        spin_unlock_irqrestore(&queue->lock, state);
         return ERR_NO_RESOURCES;
     }
-    struct virtio_block_txn *txn = &bdev->txns[i];
+
+    struct virtio_block_txn *txn = &queue->txns[i];
     /* set up the request */
     txn->req.type = dev->ring_swap32(write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN);
     txn->req.ioprio = dev->ring_swap32(0);
@@ -420,137 +546,129 @@ status_t virtio_block_do_txn(virtio_device *dev, void *buf,
     txn->callback = callback;
     txn->cookie = cookie;
     txn->len = len;
+    txn->status = 0xff;
     LTRACEF("blk_req type %u ioprio %u sector %llu\n", dev->ring_swap32(txn->req.type),
             dev->ring_swap32(txn->req.ioprio), dev->ring_swap64(txn->req.sector));
 
-    const bool modern = dev->config_is_modern();
-
-    if (txn_out) {
-        *txn_out = txn;
-    }
-
     // XXX not cache safe.
     // At the moment only tested on arm qemu, which doesn't emulate cache.
 
-    /* set up the descriptor pointing to the head */
 #if WITH_KERNEL_VM
     paddr_t req_phys = vaddr_to_paddr(&txn->req);
+    paddr_t status_phys = vaddr_to_paddr(&txn->status);
 #else
     paddr_t req_phys = (uint64_t)(uintptr_t)&txn->req;
+    paddr_t status_phys = (uint64_t)(uintptr_t)&txn->status;
 #endif
-    vring_desc_write_addr(desc, req_phys, modern);
-    vring_desc_write_len(desc, sizeof(virtio_blk_req), modern);
-    vring_desc_write_flags(desc, VRING_DESC_F_NEXT, modern);
 
-    /* set up the descriptor pointing to the buffer */
-    desc = dev->virtio_desc_index_to_desc(0, vring_desc_read_next(desc, modern));
-#if WITH_KERNEL_VM
-    /* translate the first buffer */
     vaddr_t va = (vaddr_t)buf;
-    paddr_t pa = vaddr_to_paddr((void *)va);
-    vring_desc_write_addr(desc, (uint64_t)pa, modern);
-    /* desc->len is filled in below */
-#else
-    /* non VM world simply queues a single buffer that transfers the whole thing */
-    vring_desc_write_addr(desc, (uint64_t)(uintptr_t)buf, modern);
-    vring_desc_write_len(desc, len, modern);
-#endif
-    vring_desc_write_flags(desc, (write ? 0 : VRING_DESC_F_WRITE) | VRING_DESC_F_NEXT, modern);
-
-#if WITH_KERNEL_VM
-    /* see if we need to add more descriptors due to scatter gather */
-    paddr_t next_pa = PAGE_ALIGN(pa + 1);
-    vring_desc_write_len(desc, MIN(next_pa - pa, len), modern);
-    LTRACEF("first descriptor va 0x%lx desc->addr 0x%llx desc->len %u\n", va,
-            vring_desc_read_addr(desc, modern), vring_desc_read_len(desc, modern));
-
-    size_t remaining_len = len;
-    remaining_len -= vring_desc_read_len(desc, modern);
-    while (remaining_len > 0) {
-        /* amount of source buffer handled by this iteration of the loop */
-        size_t len_tohandle = MIN(remaining_len, PAGE_SIZE);
-
-        /* translate the next page in the buffer */
-        va = PAGE_ALIGN(va + 1);
-        pa = vaddr_to_paddr((void *)va);
-        LTRACEF("va now 0x%lx, pa 0x%lx, next_pa 0x%lx, remaining len %zu\n", va, pa, next_pa, remaining_len);
-
-        /* is the new translated physical address contiguous to the last one? */
-        if (next_pa == pa) {
-            /* we can simply extend the previous descriptor by another page */
-            LTRACEF("extending last one by %zu bytes\n", len_tohandle);
-            vring_desc_write_len(desc, vring_desc_read_len(desc, modern) + len_tohandle, modern);
-        } else {
-            /* new physical page needed, allocate a new descriptor and start again */
-            uint16_t next_i = dev->virtio_alloc_desc(0);
-            vring_desc *next_desc = dev->virtio_desc_index_to_desc(0, next_i);
-            DEBUG_ASSERT(next_desc);
-
-            LTRACEF("doesn't extend, need new desc, allocated desc %i (%p)\n", next_i, next_desc);
-
-            /* fill this descriptor in and put it after the last one but before the response descriptor */
-            vring_desc_write_addr(next_desc, (uint64_t)pa, modern);
-            vring_desc_write_len(next_desc, len_tohandle, modern);
-            vring_desc_write_flags(next_desc,
-                                   (write ? 0 : VRING_DESC_F_WRITE) | VRING_DESC_F_NEXT, modern);
-            vring_desc_write_next(next_desc, vring_desc_read_next(desc, modern), modern);
-            vring_desc_write_next(desc, next_i, modern);
-
-            desc = next_desc;
+    size_t remaining = len;
+    paddr_t seg_pa;
+    size_t seg_len;
+
+    if (use_indirect) {
+        /* build the chain in the request's table, linked by table index */
+        vring_desc *table = queue->indirect[i].desc;
+        uint16_t t = 0;
+
+        vring_desc_write_addr(&table[t], req_phys, modern);
+        vring_desc_write_len(&table[t], sizeof(virtio_blk_req), modern);
+        vring_desc_write_flags(&table[t], VRING_DESC_F_NEXT, modern);
+        vring_desc_write_next(&table[t], t + 1, modern);
+        t++;
+
+        while (virtio_block_next_segment(&va, &remaining, &seg_pa, &seg_len)) {
+            vring_desc_write_addr(&table[t], seg_pa, modern);
+            vring_desc_write_len(&table[t], seg_len, modern);
+            vring_desc_write_flags(&table[t], data_flags | VRING_DESC_F_NEXT, modern);
+            vring_desc_write_next(&table[t], t + 1, modern);
+            t++;
         }
-        remaining_len -= len_tohandle;
-        next_pa += PAGE_SIZE;
-    }
-#endif
 
-    /* set up the descriptor pointing to the response */
+        vring_desc_write_addr(&table[t], status_phys, modern);
+        vring_desc_write_len(&table[t], 1, modern);
+        vring_desc_write_flags(&table[t], VRING_DESC_F_WRITE, modern);
+        vring_desc_write_next(&table[t], 0, modern);
+        t++;
+
 #if WITH_KERNEL_VM
-    paddr_t status_phys = vaddr_to_paddr(&txn->status);
+        paddr_t table_phys = vaddr_to_paddr(table);
 #else
-    paddr_t status_phys = (uint64_t)(uintptr_t)&txn->status;
+        paddr_t table_phys = (uint64_t)(uintptr_t)table;
 #endif
-    desc = dev->virtio_desc_index_to_desc(0, vring_desc_read_next(desc, modern));
-    vring_desc_write_addr(desc, status_phys, modern);
-    vring_desc_write_len(desc, 1, modern);
-    vring_desc_write_flags(desc, VRING_DESC_F_WRITE, modern);
+        vring_desc_write_addr(desc, table_phys, modern);
+        vring_desc_write_len(desc, t * sizeof(vring_desc), modern);
+        vring_desc_write_flags(desc, VRING_DESC_F_INDIRECT, modern);
+    } else {
+        /* set up the descriptor pointing to the head */
+        vring_desc_write_addr(desc, req_phys, modern);
+        vring_desc_write_len(desc, sizeof(virtio_blk_req), modern);
+        vring_desc_write_flags(desc, VRING_DESC_F_NEXT, modern);
+
+        /* one descriptor per physically contiguous run of the buffer */
+        while (virtio_block_next_segment(&va, &remaining, &seg_pa, &seg_len)) {
+            desc = dev->virtio_desc_index_to_desc(ring, vring_desc_read_next(desc, modern));
+            LTRACEF("segment pa 0x%lx len %zu\n", seg_pa, seg_len);
+            vring_desc_write_addr(desc, seg_pa, modern);
+            vring_desc_write_len(desc, seg_len, modern);
+            vring_desc_write_flags(desc, data_flags | VRING_DESC_F_NEXT, modern);
+        }
+
+        /* set up the descriptor pointing to the response */
+        desc = dev->virtio_desc_index_to_desc(ring, vring_desc_read_next(desc, modern));
+        vring_desc_write_addr(desc, status_phys, modern);
+        vring_desc_write_len(desc, 1, modern);
+        vring_desc_write_flags(desc, VRING_DESC_F_WRITE, modern);
+    }
 
     /* submit the transfer */
-    dev->virtio_submit_chain(0, i);
+    dev->virtio_submit_chain(ring, i);
+    bool kick = dev->virtio_kick_prepare(ring);
+
+    spin_unlock_irqrestore(&queue->lock, state);
 
-    /* kick it off */
-    dev->bus()->virtio_kick(0);
+    /* kick it off, if the device isn't already working through the ring */
+    if (kick) {
+        dev->virtio_notify(ring);
+    }
 
     return NO_ERROR;
 }
 
+struct sync_completion {
+    event_t event;
+    ssize_t result;
+};
+
 // TODO: handle partial block transfers
 void sync_completion_cb(void *cookie, struct bdev *dev, ssize_t bytes) {
     DEBUG_ASSERT(cookie);
-    event_t *event = (event_t *)cookie;
-    event_signal(event, false);
+    auto *completion = (sync_completion *)cookie;
+    completion->result = bytes;
+    event_signal(&completion->event, false);
 }
 
 ssize_t virtio_block_read_write(virtio_device *dev, void *buf,
                                 const off_t offset, const size_t len,
                                 const bool write) {
-    struct virtio_block_txn *txn;
-    event_t event;
-    event_init(&event, false, EVENT_FLAG_AUTOUNSIGNAL);
+    sync_completion completion;
+    event_init(&completion.event, false, EVENT_FLAG_AUTOUNSIGNAL);
+    completion.result = ERR_IO;
 
     status_t err = virtio_block_do_txn(dev, buf, offset, len, write,
-                                       &sync_completion_cb, &event, &txn);
+                                       &sync_completion_cb, &completion);
     if (err < 0) {
+        event_destroy(&completion.event);
         return err;
     }
 
     /* wait for the transfer to complete */
-    event_wait(&event);
+    event_wait(&completion.event);
+    event_destroy(&completion.event);
 
-    LTRACEF("status 0x%hhx\n", txn->status);
+    LTRACEF("result %zd\n", completion.result);
 
-    ssize_t result = (txn->status == VIRTIO_BLK_S_OK) ? (ssize_t)len : ERR_IO;
-
-    return result;
+    return completion.result;
 }
 
 ssize_t virtio_bdev_read_block(bdev *bdev, void *buf, bnum_t block, uint count) {
@@ -571,7 +689,7 @@ status_t virtio_bdev_read_async(bdev *bdev, void *buf,
         containerof(bdev, struct virtio_block_dev, bdev);
 
     return virtio_block_do_txn(dev->dev, buf, offset, len, false, callback,
-                               cookie, NULL);
+                               cookie);
 }
 
 status_t virtio_bdev_write_async(bdev *bdev, const void *buf,
@@ -586,7 +704,7 @@ status_t virtio_bdev_write_async(bdev *bdev, const void *buf,
     }
 
     return virtio_block_do_txn(dev->dev, (void *)buf, offset, len, true,
-                               callback, cookie, NULL);
+                               callback, cookie);
 }
 
 ssize_t virtio_bdev_write_block(bdev *bdev, const void *buf, bnum_t block, uint count) {
@@ -106,7 +106,7 @@ status_t send_command_response(virtio_gpu_dev *gdev, const void *cmd, size_t cmd
     gdev->dev->virtio_submit_chain(0, i);
 
     /* kick it off */
-    gdev->dev->bus()->virtio_kick(0);
+    gdev->dev->virtio_kick(0);
 
     /* wait for result */
     event_wait(&gdev->io_event);
@@ -444,7 +444,8 @@ status_t virtio_gpu_init(virtio_device *dev) {
     /* ack and set the driver status bit */
     dev->bus()->virtio_status_acknowledge_driver();
 
-    // XXX check features bits and ack/nak them
+    // no device specific features, just the ring ones
+    dev->virtio_set_guest_features(0);
 
     /* allocate a virtio ring */
     dev->virtio_alloc_ring(0, 16);
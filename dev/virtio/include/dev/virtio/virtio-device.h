@@ -19,12 +19,19 @@
 
 class virtio_device {
 public:
-    explicit virtio_device(virtio_bus *bus) : bus_(bus) {}
-    virtual ~virtio_device() {
-        delete bus_;
-    }
+    explicit virtio_device(virtio_bus *bus);
+    virtual ~virtio_device();
 
     /* api used by devices to interact with the virtio bus */
+
+    /* Accept the driver's feature word 0, along with any ring features the
+     * device offers that this layer implements. Returns the accepted word. */
+    uint32_t virtio_set_guest_features(uint32_t features);
+
+    /* Accept the driver's feature word 1 on a modern device, keeping the
+     * VERSION_1 bit the bus accepted. Returns the accepted word. */
+    uint32_t virtio_set_guest_features_word1(uint32_t features);
+
     status_t virtio_alloc_ring(uint index, uint16_t len);
 
     /* add a descriptor at index desc_index to the free list on ring_index */
@@ -42,9 +49,48 @@ public:
         return &ring_[ring_index].desc[desc_index];
     }
 
-    /* submit a chain to the avail list */
+    /* Add a chain to the avail list. The device does not see it until the
+     * next kick, so a driver can post several chains with one notification. */
     void virtio_submit_chain(uint ring_index, uint16_t desc_index);
 
+    /* Publish the chains submitted since the last kick and return whether the
+     * device asked to be notified about them. Must be serialized with
+     * virtio_submit_chain on the same ring. */
+    bool virtio_kick_prepare(uint ring_index);
+
+    /* Notify the device. Safe to call after dropping the driver's ring lock. */
+    void virtio_notify(uint ring_index);
+
+    /* virtio_kick_prepare and, if needed, virtio_notify */
+    void virtio_kick(uint ring_index) {
+        if (virtio_kick_prepare(ring_index)) {
+            virtio_notify(ring_index);
+        }
+    }
+
+    /* Polled rings. The driver takes a polled ring's completions from its
+     * own thread with virtio_ring_next_used rather than through the irq
+     * driver callback. When completions show up the interrupt turns itself
+     * off for the ring and calls the ring poll callback, and
+     * virtio_ring_poll_done turns it back on, returning true if more came in
+     * that it won't be told about. */
+    using ring_poll_callback = enum handler_return (*)(virtio_device *dev, uint ring);
+    void virtio_set_ring_polled(uint ring_index, ring_poll_callback cb);
+    bool virtio_ring_next_used(uint ring_index, vring_used_elem *e);
+    bool virtio_ring_poll_done(uint ring_index);
+
+    struct ring_stats {
+        uint64_t kicks;            // notifications sent to the device
+        uint64_t kicks_suppressed; // submissions the device didn't need a kick for
+        uint64_t completions;      // used ring entries handed to the driver
+    };
+    const ring_stats &stats(uint ring_index) const { return ring_stats_[ring_index]; }
+    uint64_t irq_count() const { return irq_count_; }
+    bool event_idx() const { return event_idx_; }
+
+    void dump_stats() const;
+    static void dump_all_stats();
+
     // accessors
     void *priv() { return priv_; }
     const void *priv() const { return priv_; }
@@ -142,9 +188,13 @@ public:
     handler_return handle_config_interrupt();
 
     // TODO: allow an aribitrary number of rings
-    static const size_t MAX_VIRTIO_RINGS = 4;
+    // Enough for a multiqueue device with a handful of queue pairs.
+    static const size_t MAX_VIRTIO_RINGS = 16;
 
 private:
+    // next in the global list of devices, for the stats command
+    virtio_device *next_device_ = {};
+
     // mmio or pci
     virtio_bus *bus_ = {};
 
@@ -164,6 +214,21 @@ private:
     uint32_t active_rings_bitmap_ = {};
     uint16_t ring_len_[MAX_VIRTIO_RINGS] = {};
     vring ring_[MAX_VIRTIO_RINGS] = {};
+
+    /* VIRTIO_F_EVENT_IDX negotiated */
+    bool event_idx_ = {};
+
+    /* rings the driver polls, and the ones handed to it and not yet done */
+    uint32_t polled_rings_bitmap_ = {};
+    uint32_t polling_rings_bitmap_ = {};
+    ring_poll_callback ring_poll_callback_ = {};
+
+    void ring_interrupt_disable(vring &ring);
+
+    /* kicks are counted under the driver's ring lock, completions and irqs
+     * in the interrupt handler */
+    ring_stats ring_stats_[MAX_VIRTIO_RINGS] = {};
+    uint64_t irq_count_ = {};
 };
 
 
@@ -20,7 +20,11 @@ class virtio_device;
 
 class virtio_pci_bus final : public virtio_bus {
 public:
-    virtio_pci_bus() = default;
+    virtio_pci_bus() {
+        for (auto &off : queue_notify_off_) {
+            off = USHRT_MAX;
+        }
+    }
     ~virtio_pci_bus() override = default;
 
     status_t init(virtio_device *dev, pci_location_t loc, size_t index);
@@ -82,8 +86,8 @@ private:
     irq_mode irq_mode_ = irq_mode::Legacy;
 
     uint32_t notify_offset_multiplier_ = {};
-    static constexpr size_t kMaxRings = 4;
-    uint16_t queue_notify_off_[kMaxRings] = { USHRT_MAX, USHRT_MAX, USHRT_MAX, USHRT_MAX };
+    static constexpr size_t kMaxRings = 16;
+    uint16_t queue_notify_off_[kMaxRings];
 
     // Given one of the config_pointer structs, return a uint8_t * pointer
     // to its mapping.
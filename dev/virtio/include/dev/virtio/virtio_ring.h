@@ -240,6 +240,9 @@ struct vring {
 
     uint16_t last_used;
 
+    uint16_t avail_idx;       /* next avail ring slot to fill */
+    uint16_t avail_published; /* avail->idx as last written for the device */
+
     struct vring_desc *desc;
 
     struct vring_avail *avail;
@@ -283,12 +286,24 @@ static inline void vring_init(struct vring *vr, unsigned int num, void *p,
     vr->free_list = 0xffff;
     vr->free_count = 0;
     vr->last_used = 0;
+    vr->avail_idx = 0;
+    vr->avail_published = 0;
     vr->desc = (struct vring_desc *)p;
     vr->avail = (struct vring_avail *)((uintptr_t)p + num*sizeof(struct vring_desc));
     vr->used = (struct vring_used *)(((uintptr_t)&vr->avail->ring[num] + sizeof(uint16_t)
                          + align-1) & ~(align - 1));
 }
 
+/* endian aware accessors for the event index fields */
+static inline uint16_t vring_read_avail_event(const struct vring *vr, bool modern) {
+    uint16_t val = vring_mem_read16((const volatile uint16_t *)&vr->used->ring[vr->num]);
+    return modern ? LE16(val) : val;
+}
+
+static inline void vring_write_used_event(struct vring *vr, uint16_t idx, bool modern) {
+    vring_mem_write16(&vring_used_event(vr), modern ? LE16(idx) : idx);
+}
+
 static inline unsigned vring_size(unsigned int num, unsigned long align) {
     return ((sizeof(struct vring_desc) * num + sizeof(uint16_t) * (3 + num)
              + align - 1) & ~(align - 1))
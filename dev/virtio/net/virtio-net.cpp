@@ -8,6 +8,7 @@
 #include <dev/virtio/net.h>
 
 #include <stdlib.h>
+#include <limits.h>
 #include <inttypes.h>
 #include <lk/debug.h>
 #include <assert.h>
@@ -18,12 +19,17 @@
 #include <lk/err.h>
 #include <kernel/thread.h>
 #include <kernel/event.h>
+#include <kernel/mp.h>
 #include <kernel/spinlock.h>
+#include <lk/console_cmd.h>
+#include <lk/pow2.h>
+#include <platform.h>
 #include <lib/pktbuf.h>
 #include <lib/minip.h>
 #include <dev/virtio/virtio-device.h>
 #include <lib/minip/netif.h>
 #include <arch/atomic.h>
+#include <arch/ops.h>
 
 #define LOCAL_TRACE 0
 
@@ -106,19 +112,61 @@ STATIC_ASSERT(sizeof(struct virtio_net_hdr) == 12);
 #define VIRTIO_NET_S_LINK_UP                (1<<0)
 #define VIRTIO_NET_S_ANNOUNCE               (1<<1)
 
+/* control queue commands */
+struct virtio_net_ctrl_hdr {
+    uint8_t cls;
+    uint8_t cmd;
+};
+STATIC_ASSERT(sizeof(struct virtio_net_ctrl_hdr) == 2);
+
+#define VIRTIO_NET_OK                       0
+#define VIRTIO_NET_ERR                      1
+
+#define VIRTIO_NET_CTRL_MQ                  4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET     0
+#define VIRTIO_NET_CTRL_MQ_RSS_CONFIG       1
+
+#define VIRTIO_NET_RSS_HASH_TYPE_IPv4       (1<<0)
+#define VIRTIO_NET_RSS_HASH_TYPE_TCPv4      (1<<1)
+#define VIRTIO_NET_RSS_HASH_TYPE_UDPv4      (1<<2)
+
+
 constexpr uint16_t TX_RING_SIZE = 64;
 constexpr uint16_t RX_RING_SIZE = 64;
+constexpr uint16_t CTRL_RING_SIZE = 8;
 
-constexpr uint32_t RING_RX = 0;
-constexpr uint32_t RING_TX = 1;
+/* queue pair n is rx ring 2n and tx ring 2n + 1, and the control queue comes
+ * after every pair the device has, so that's as many pairs as fit */
+constexpr uint VIRTIO_NET_MAX_QUEUE_PAIRS = (virtio_device::MAX_VIRTIO_RINGS - 1) / 2;
 
 constexpr size_t VIRTIO_NET_MSS = 1514;
 
-struct virtio_net_dev {
-    virtio_device *dev;
+/* largest tcp payload handed to the device for segmentation: eight full
+ * ethernet segments, which keeps a packet to a handful of pktbufs and tx
+ * descriptors */
+constexpr uint32_t VIRTIO_NET_GSO_MAX_SIZE = 8 * 1460;
+
+/* rss indirection table entries and the default toeplitz key */
+constexpr uint16_t VIRTIO_NET_RSS_TABLE_MAX = 128;
+const uint8_t rss_key[40] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2, 0x41, 0x67,
+    0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0, 0xd0, 0xca, 0x2b, 0xcb,
+    0xae, 0x7b, 0x30, 0xb4, 0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30,
+    0xf2, 0x0c, 0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+struct virtio_net_dev;
+
+/* a rx/tx virtqueue pair, with its own lock and a poller that hands its
+ * receives to the stack */
+struct virtio_net_queue {
+    virtio_net_dev *ndev;
+    uint index;
+    uint rx_ring;
+    uint tx_ring;
 
     spin_lock_t lock;
-    event_t rx_event;
+    netif_poll_t poll;
 
     /* list of active tx/rx packets to be freed at irq time */
     pktbuf_t *pending_tx_packet[TX_RING_SIZE];
@@ -126,14 +174,45 @@ struct virtio_net_dev {
 
     uint tx_pending_count;
     struct list_node completed_rx_queue;
+    uint completed_rx_count;
+
+    /* rx counters belong to the poller, tx counters to the lock */
+    uint64_t rx_packets;
+    uint64_t rx_bytes;
+    uint64_t tx_packets;
+    uint64_t tx_bytes;
+};
+
+struct virtio_net_dev {
+    struct list_node node;
+
+    virtio_device *dev;
+
+    /* negotiated features and the size of the header that goes with them */
+    uint64_t features;
+    size_t hdr_len;
+
+    /* queue pairs in use, transmits pick one by the cpu sending */
+    uint queue_count;
+    virtio_net_queue *queues;
+
+    /* control queue, only used to bring up the queue pairs */
+    uint ctrl_ring;
+    spin_lock_t ctrl_lock;
+    event_t ctrl_event;
 
     /* the minip ethernet structure */
     netif_t netif;
 };
 
+/* every device, for the stats command */
+struct list_node virtio_net_list = LIST_INITIAL_VALUE(virtio_net_list);
+
 enum handler_return virtio_net_irq_driver_callback(virtio_device *dev, uint ring, const vring_used_elem *e);
-int virtio_net_rx_worker(void *arg);
-status_t virtio_net_queue_rx(virtio_net_dev *ndev, pktbuf_t *p, bool do_kick = true);
+enum handler_return virtio_net_rx_ring_callback(virtio_device *dev, uint ring);
+int virtio_net_rx_poll(void *arg, int budget);
+bool virtio_net_rx_poll_done(void *arg);
+status_t virtio_net_queue_rx(virtio_net_queue *q, pktbuf_t *p, bool do_kick = true);
 void virtio_net_get_mac_addr(virtio_net_dev *ndev, uint8_t mac_addr[6]);
 status_t virtio_net_send_minip_pkt(void *arg, pktbuf_t *p);
 
@@ -184,6 +263,42 @@ void virtio_net_get_mac_addr(virtio_net_dev *ndev, uint8_t mac_addr[6]) {
     }
 }
 
+/* translate the stack's offload requests into the device header */
+void virtio_net_fill_tx_hdr(virtio_net_hdr *hdr, const pktbuf_t *p) {
+    if (p->flags & PKTBUF_FLAG_CSUM_PARTIAL) {
+        hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        hdr->csum_start = static_cast<uint16_t>(p->buffer + p->csum_start - p->data);
+        hdr->csum_offset = p->csum_offset;
+    }
+
+    if (p->flags & PKTBUF_FLAG_GSO_TCPV4) {
+        DEBUG_ASSERT(p->flags & PKTBUF_FLAG_CSUM_PARTIAL);
+
+        /* the device repeats everything through the tcp header in each segment */
+        const uint8_t tcp_data_offset = p->data[hdr->csum_start + 12];
+        hdr->gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+        hdr->gso_size = p->gso_size;
+        hdr->hdr_len = static_cast<uint16_t>(hdr->csum_start + (tcp_data_offset >> 4) * 4);
+    }
+}
+
+/* Fill cpus with the numbers of the cpus that are up, returning how many. A
+ * kernel built for more cpus than the machine has only starts the ones found. */
+uint virtio_net_active_cpus(int cpus[SMP_MAX_CPUS]) {
+    uint count = 0;
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        if (mp_is_cpu_active(i))
+            cpus[count++] = (int)i;
+    }
+    return count;
+}
+
+/* Transmits go out on the sending cpu's queue pair so cpus don't share a
+ * queue lock. The thread may move right after, which only costs locality. */
+virtio_net_queue *virtio_net_tx_queue(virtio_net_dev *ndev) {
+    return &ndev->queues[arch_curr_cpu_num() % ndev->queue_count];
+}
+
 status_t virtio_net_queue_tx_pktbuf(virtio_net_dev *ndev, pktbuf_t *p2) {
     virtio_device *vdev = ndev->dev;
 
@@ -192,58 +307,80 @@ status_t virtio_net_queue_tx_pktbuf(virtio_net_dev *ndev, pktbuf_t *p2) {
 
     DEBUG_ASSERT(ndev);
 
+    /* one descriptor for the header and one per buffer in the packet */
+    size_t desc_count = 1;
+    size_t len = 0;
+    for (const pktbuf_t *frag = p2; frag; frag = frag->next) {
+        desc_count++;
+        len += frag->dlen;
+    }
+
     p = pktbuf_alloc();
     if (!p)
         return ERR_NO_MEMORY;
 
     /* point our header to the base of the first pktbuf */
-    virtio_net_hdr *hdr = (virtio_net_hdr *)pktbuf_append(p, sizeof(virtio_net_hdr) - 2);
+    virtio_net_hdr *hdr = (virtio_net_hdr *)pktbuf_append(p, ndev->hdr_len);
     memset(hdr, 0, p->dlen);
+    virtio_net_fill_tx_hdr(hdr, p2);
+
+    virtio_net_queue *q = virtio_net_tx_queue(ndev);
 
-    AutoSpinLock lock_guard(&ndev->lock);
+    AutoSpinLock lock_guard(&q->lock);
 
     vring_desc *desc = {};
 
     /* only queue if we have enough tx descriptors */
-    if (ndev->tx_pending_count + 2 <= TX_RING_SIZE) {
+    if (q->tx_pending_count + desc_count <= TX_RING_SIZE) {
         /* allocate a chain of descriptors for our transfer */
-        desc = vdev->virtio_alloc_desc_chain(RING_TX, 2, &i);
+        desc = vdev->virtio_alloc_desc_chain(q->tx_ring, desc_count, &i);
     }
     if (!desc) {
         lock_guard.release();
-        TRACEF("out of virtio tx descriptors, tx_pending_count %u\n", ndev->tx_pending_count);
+        TRACEF("out of virtio tx descriptors on queue %u, tx_pending_count %u\n", q->index, q->tx_pending_count);
         pktbuf_free(p, true);
 
         return ERR_NO_MEMORY;
     }
 
-    ndev->tx_pending_count += 2;
+    q->tx_pending_count += desc_count;
+    q->tx_packets++;
+    q->tx_bytes += len;
 
     const bool modern = vdev->config_is_modern();
-    /* save a pointer to our pktbufs for the irq handler to free */
+    /* save a pointer to our pktbufs for the irq handler to free. Freeing the
+     * first buffer of the packet frees the rest of it, so the descriptors
+     * for the other buffers are left empty. */
     LTRACEF("saving pointer to pkt in index %u and %u\n", i, vring_desc_read_next(desc, modern));
-    DEBUG_ASSERT(ndev->pending_tx_packet[i] == NULL);
-    DEBUG_ASSERT(ndev->pending_tx_packet[vring_desc_read_next(desc, modern)] == NULL);
-    ndev->pending_tx_packet[i] = p;
-    ndev->pending_tx_packet[vring_desc_read_next(desc, modern)] = p2;
-
+    DEBUG_ASSERT(q->pending_tx_packet[i] == NULL);
+    q->pending_tx_packet[i] = p;
 
     /* set up the descriptor pointing to the header */
     vring_desc_write_addr(desc, pktbuf_data_phys(p), modern);
     vring_desc_write_len(desc, p->dlen, modern);
     vring_desc_write_flags(desc, vring_desc_read_flags(desc, modern) | VRING_DESC_F_NEXT, modern);
 
-    /* set up the descriptor pointing to the buffer */
-    desc = vdev->virtio_desc_index_to_desc(RING_TX, vring_desc_read_next(desc, modern));
-    vring_desc_write_addr(desc, pktbuf_data_phys(p2), modern);
-    vring_desc_write_len(desc, p2->dlen, modern);
-    vring_desc_write_flags(desc, 0, modern);
+    /* set up a descriptor pointing to each buffer */
+    for (pktbuf_t *frag = p2; frag; frag = frag->next) {
+        uint16_t index = vring_desc_read_next(desc, modern);
+        DEBUG_ASSERT(q->pending_tx_packet[index] == NULL);
+        q->pending_tx_packet[index] = (frag == p2) ? p2 : nullptr;
+
+        desc = vdev->virtio_desc_index_to_desc(q->tx_ring, index);
+        vring_desc_write_addr(desc, pktbuf_data_phys(frag), modern);
+        vring_desc_write_len(desc, frag->dlen, modern);
+        vring_desc_write_flags(desc, frag->next ? VRING_DESC_F_NEXT : 0, modern);
+    }
 
     /* submit the transfer */
-    vdev->virtio_submit_chain(RING_TX, i);
+    vdev->virtio_submit_chain(q->tx_ring, i);
 
-    /* kick it off */
-    vdev->bus()->virtio_kick(RING_TX);
+    /* kick it off, if the device wants to hear about it */
+    bool kick = vdev->virtio_kick_prepare(q->tx_ring);
+    lock_guard.release();
+    if (kick) {
+        vdev->virtio_notify(q->tx_ring);
+    }
 
     return NO_ERROR;
 }
@@ -271,30 +408,31 @@ status_t virtio_net_queue_tx(virtio_net_dev *ndev, const void *buf, size_t len)
     return err;
 }
 
-status_t virtio_net_queue_rx(virtio_net_dev *ndev, pktbuf_t *p, bool do_kick) {
+status_t virtio_net_queue_rx(virtio_net_queue *q, pktbuf_t *p, bool do_kick) {
+    virtio_net_dev *ndev = q->ndev;
     virtio_device *vdev = ndev->dev;
 
-    DEBUG_ASSERT(ndev);
     DEBUG_ASSERT(p);
 
     /* point our header to the base of the pktbuf */
     p->data = p->buffer;
     p->flags = 0;
+    p->next = NULL;
     virtio_net_hdr *hdr = (virtio_net_hdr *)p->data;
-    memset(hdr, 0, sizeof(virtio_net_hdr) - 2);
+    memset(hdr, 0, ndev->hdr_len);
 
-    p->dlen = sizeof(virtio_net_hdr) - 2 + VIRTIO_NET_MSS;
+    p->dlen = ndev->hdr_len + VIRTIO_NET_MSS;
 
-    AutoSpinLock lock_guard(&ndev->lock);
+    AutoSpinLock lock_guard(&q->lock);
 
     /* allocate a chain of descriptors for our transfer */
     uint16_t i;
-    vring_desc *desc = vdev->virtio_alloc_desc_chain(RING_RX, 1, &i);
+    vring_desc *desc = vdev->virtio_alloc_desc_chain(q->rx_ring, 1, &i);
     DEBUG_ASSERT(desc); /* shouldn't be possible not to have a descriptor ready */
 
     /* save a pointer to our pktbufs for the irq handler to use */
-    DEBUG_ASSERT(ndev->pending_rx_packet[i] == NULL);
-    ndev->pending_rx_packet[i] = p;
+    DEBUG_ASSERT(q->pending_rx_packet[i] == NULL);
+    q->pending_rx_packet[i] = p;
 
     const bool modern = vdev->config_is_modern();
     /* set up the descriptor pointing to the header */
@@ -303,22 +441,57 @@ status_t virtio_net_queue_rx(virtio_net_dev *ndev, pktbuf_t *p, bool do_kick) {
     vring_desc_write_flags(desc, VRING_DESC_F_WRITE, modern);
 
     /* submit the transfer */
-    vdev->virtio_submit_chain(RING_RX, i);
+    vdev->virtio_submit_chain(q->rx_ring, i);
 
     /* kick it off */
     if (do_kick) {
-        vdev->bus()->virtio_kick(RING_RX);
+        vdev->virtio_kick(q->rx_ring);
     }
 
     return NO_ERROR;
 }
 
+/* hand the control queue's descriptors back and wake the command's sender */
+void virtio_net_ctrl_complete(virtio_net_dev *ndev, const vring_used_elem *e) {
+    virtio_device *dev = ndev->dev;
+    const bool modern = dev->config_is_modern();
+
+    spin_lock(&ndev->ctrl_lock);
+
+    uint16_t i = e->id;
+    for (;;) {
+        vring_desc *desc = dev->virtio_desc_index_to_desc(ndev->ctrl_ring, i);
+        const bool last = !(vring_desc_read_flags(desc, modern) & VRING_DESC_F_NEXT);
+        const uint16_t next = vring_desc_read_next(desc, modern);
+
+        dev->virtio_free_desc(ndev->ctrl_ring, i);
+
+        if (last)
+            break;
+        i = next;
+    }
+
+    spin_unlock(&ndev->ctrl_lock);
+
+    event_signal(&ndev->ctrl_event, false);
+}
+
 enum handler_return virtio_net_irq_driver_callback(virtio_device *dev, uint ring, const vring_used_elem *e) {
     virtio_net_dev *ndev = (virtio_net_dev *)dev->priv();
 
     LTRACEF("dev %p, ring %u, e %p, id %u, len %u\n", dev, ring, e, e->id, e->len);
 
-    spin_lock(&ndev->lock);
+    if (ring == ndev->ctrl_ring) {
+        virtio_net_ctrl_complete(ndev, e);
+        return INT_RESCHEDULE;
+    }
+
+    /* the rx rings are polled, so this is a transmit completing */
+    DEBUG_ASSERT(ring / 2 < ndev->queue_count);
+    virtio_net_queue *q = &ndev->queues[ring / 2];
+    DEBUG_ASSERT(ring == q->tx_ring);
+
+    spin_lock(&q->lock);
 
     /* parse our descriptor chain, add back to the free queue */
     uint16_t i = e->id;
@@ -336,32 +509,14 @@ enum handler_return virtio_net_irq_driver_callback(virtio_device *dev, uint ring
 
         dev->virtio_free_desc(ring, i);
 
-        if (ring == RING_RX) {
-            /* put the freed rx buffer in a queue */
-            pktbuf_t *p = ndev->pending_rx_packet[i];
-            ndev->pending_rx_packet[i] = NULL;
+        /* free the pktbuf associated with the tx packet we just consumed,
+         * only the first buffer of a multi part packet is recorded */
+        pktbuf_t *p = q->pending_tx_packet[i];
+        q->pending_tx_packet[i] = NULL;
+        q->tx_pending_count--;
 
-            DEBUG_ASSERT(p);
-            LTRACEF("rx pktbuf %p filled\n", p);
-
-            /* trim the pktbuf according to the written length in the used element descriptor */
-            if (e->len > (sizeof(virtio_net_hdr) - 2 + VIRTIO_NET_MSS)) {
-                TRACEF("bad used len on RX %u\n", e->len);
-                p->dlen = 0;
-            } else {
-                p->dlen = e->len;
-            }
-
-            list_add_tail(&ndev->completed_rx_queue, &p->list);
-        } else { // ring == RING_TX
-            /* free the pktbuf associated with the tx packet we just consumed */
-            pktbuf_t *p = ndev->pending_tx_packet[i];
-            ndev->pending_tx_packet[i] = NULL;
-            ndev->tx_pending_count--;
-
-            DEBUG_ASSERT(p);
+        if (p) {
             LTRACEF("freeing pktbuf %p\n", p);
-
             pktbuf_free(p, false);
         }
 
@@ -370,58 +525,176 @@ enum handler_return virtio_net_irq_driver_callback(virtio_device *dev, uint ring
         i = next;
     }
 
-    spin_unlock(&ndev->lock);
+    spin_unlock(&q->lock);
 
-    /* if rx ring, signal our event */
-    if (ring == 0) {
-        event_signal(&ndev->rx_event, false);
-    }
+    return INT_RESCHEDULE;
+}
+
+/* a polled rx ring has completions, its interrupt is now off until the
+ * poller is done */
+enum handler_return virtio_net_rx_ring_callback(virtio_device *dev, uint ring) {
+    virtio_net_dev *ndev = (virtio_net_dev *)dev->priv();
+
+    DEBUG_ASSERT(ring / 2 < ndev->queue_count);
+    netif_poll_schedule(&ndev->queues[ring / 2].poll);
 
     return INT_RESCHEDULE;
 }
 
+/* Move the buffers the device has filled on to the completed rx queue.
+ * Returns the number moved. */
+uint virtio_net_reap_rx(virtio_net_queue *q) {
+    virtio_net_dev *ndev = q->ndev;
+    virtio_device *dev = ndev->dev;
+
+    uint count = 0;
+    vring_used_elem e;
+
+    AutoSpinLock lock_guard(&q->lock);
+
+    while (dev->virtio_ring_next_used(q->rx_ring, &e)) {
+        LTRACEF("queue %u, id %u, len %u\n", q->index, e.id, e.len);
+
+        /* rx chains are a single descriptor */
+        const uint16_t i = static_cast<uint16_t>(e.id);
+        dev->virtio_free_desc(q->rx_ring, i);
+
+        pktbuf_t *p = q->pending_rx_packet[i];
+        q->pending_rx_packet[i] = NULL;
+
+        DEBUG_ASSERT(p);
+        LTRACEF("rx pktbuf %p filled\n", p);
+
+        /* trim the pktbuf according to the written length in the used element descriptor */
+        if (e.len > (ndev->hdr_len + VIRTIO_NET_MSS)) {
+            TRACEF("bad used len on RX %u\n", e.len);
+            p->dlen = 0;
+        } else {
+            p->dlen = e.len;
+        }
+
+        list_add_tail(&q->completed_rx_queue, &p->list);
+        q->completed_rx_count++;
+        count++;
+    }
+
+    return count;
+}
+
 enum handler_return virtio_net_config_change_callback(virtio_device *dev) {
     return INT_NO_RESCHEDULE;
 }
 
-int virtio_net_rx_worker(void *arg) {
-    virtio_net_dev *ndev = (virtio_net_dev *)arg;
+/* Pull the next whole packet off the completed rx queue. With mergeable rx
+ * buffers a packet continues into the following num_buffers - 1 buffers,
+ * which are chained on to the first one. */
+pktbuf_t *virtio_net_dequeue_rx(virtio_net_queue *q) {
+    virtio_net_dev *ndev = q->ndev;
 
-    for (;;) {
-        event_wait(&ndev->rx_event);
-
-        /* pull some packets from the received queue */
-        for (;;) {
-            pktbuf_t *p;
-            {
-                AutoSpinLock lock_guard(&ndev->lock);
-                p = list_remove_head_type(&ndev->completed_rx_queue, pktbuf_t, list);
-            }
+    AutoSpinLock lock_guard(&q->lock);
 
-            if (!p)
-                break; /* nothing left in the queue, go back to waiting */
+    pktbuf_t *p = list_peek_head_type(&q->completed_rx_queue, pktbuf_t, list);
+    if (!p)
+        return nullptr;
+
+    uint num_buffers = 1;
+    if ((ndev->features & VIRTIO_NET_F_MRG_RXBUF) && p->dlen >= ndev->hdr_len) {
+        num_buffers = reinterpret_cast<const virtio_net_hdr *>(p->data)->num_buffers;
+        if (num_buffers == 0 || num_buffers >= RX_RING_SIZE) {
+            TRACEF("bad num_buffers %u on RX\n", num_buffers);
+            num_buffers = 1;
+            p->dlen = 0;
+        }
+    }
 
-            LTRACEF("got packet len %u\n", p->dlen);
+    /* the rest of the packet hasn't been handed back yet, the irq for it
+     * will wake us up again */
+    if (num_buffers > q->completed_rx_count)
+        return nullptr;
 
-            if (likely(netif_is_configured(&ndev->netif))) {
-                /* process our packet */
-                const auto *hdr = static_cast<const virtio_net_hdr *>(pktbuf_consume(p, sizeof(virtio_net_hdr) - 2));
-                if (hdr) {
-                    /* signal checksum offload to the stack if the device validated it */
-                    if (hdr->flags & VIRTIO_NET_HDR_F_DATA_VALID) {
-                        p->flags |= PKTBUF_FLAG_CKSUM_TCP_GOOD | PKTBUF_FLAG_CKSUM_UDP_GOOD;
-                    }
+    list_delete(&p->list);
+    for (uint n = 1; n < num_buffers; n++) {
+        pktbuf_t *frag = list_remove_head_type(&q->completed_rx_queue, pktbuf_t, list);
+        pktbuf_chain(p, frag);
+    }
+    q->completed_rx_count -= num_buffers;
 
-                    /* call up into the stack */
-                    minip_rx_driver_callback(&ndev->netif, p);
+    return p;
+}
+
+/* tell the device about rx buffers queued without a kick */
+void virtio_net_kick_rx(virtio_net_queue *q) {
+    virtio_device *vdev = q->ndev->dev;
+
+    bool kick;
+    {
+        AutoSpinLock lock_guard(&q->lock);
+        kick = vdev->virtio_kick_prepare(q->rx_ring);
+    }
+    if (kick) {
+        vdev->virtio_notify(q->rx_ring);
+    }
+}
+
+/* hand up to budget received packets to the stack */
+int virtio_net_rx_poll(void *arg, int budget) {
+    virtio_net_queue *q = (virtio_net_queue *)arg;
+    virtio_net_dev *ndev = q->ndev;
+
+    int count = 0;
+    while (count < budget) {
+        /* pull some packets from the received queue, refilling it from the
+         * ring when it runs dry */
+        pktbuf_t *p = virtio_net_dequeue_rx(q);
+        if (!p) {
+            if (virtio_net_reap_rx(q) == 0)
+                break; /* nothing left in the ring either */
+            continue;
+        }
+        count++;
+
+        LTRACEF("queue %u got packet len %u\n", q->index, pktbuf_chain_len(p));
+
+        if (likely(netif_is_configured(&ndev->netif))) {
+            /* process our packet */
+            const auto *hdr = static_cast<const virtio_net_hdr *>(pktbuf_consume(p, ndev->hdr_len));
+            if (hdr) {
+                /* signal checksum offload to the stack if the device validated it, or
+                 * if it came from the host stack with only a partial checksum */
+                if (hdr->flags & (VIRTIO_NET_HDR_F_DATA_VALID | VIRTIO_NET_HDR_F_NEEDS_CSUM)) {
+                    p->flags |= PKTBUF_FLAG_CKSUM_TCP_GOOD | PKTBUF_FLAG_CKSUM_UDP_GOOD;
                 }
+
+                q->rx_packets++;
+                q->rx_bytes += pktbuf_chain_len(p);
+
+                /* call up into the stack */
+                minip_rx_driver_callback(&ndev->netif, p);
             }
+        }
 
-            /* requeue the pktbuf in the rx queue */
-            virtio_net_queue_rx(ndev, p);
+        /* requeue the pktbufs in the rx queue */
+        while (p) {
+            pktbuf_t *next = p->next;
+            virtio_net_queue_rx(q, p, false);
+            p = next;
         }
     }
-    return 0;
+
+    /* tell the device about the requeued buffers all at once */
+    if (count > 0) {
+        virtio_net_kick_rx(q);
+    }
+
+    return count;
+}
+
+bool virtio_net_rx_poll_done(void *arg) {
+    virtio_net_queue *q = (virtio_net_queue *)arg;
+
+    /* a mergeable packet whose tail hasn't arrived waits for the interrupt
+     * that comes with it */
+    return q->ndev->dev->virtio_ring_poll_done(q->rx_ring);
 }
 
 status_t virtio_net_send_minip_pkt(void *arg, pktbuf_t *p) {
@@ -432,13 +705,6 @@ status_t virtio_net_send_minip_pkt(void *arg, pktbuf_t *p) {
     DEBUG_ASSERT(p && p->dlen);
     DEBUG_ASSERT(ndev);
 
-    if ((p->flags & PKTBUF_FLAG_EOF) == 0) {
-        /* can't handle multi part packets yet */
-        PANIC_UNIMPLEMENTED;
-
-        return ERR_NOT_IMPLEMENTED;
-    }
-
     /* hand the pktbuf off to the nic, it owns the pktbuf from now on out unless it fails */
     status_t err = virtio_net_queue_tx_pktbuf(ndev, p);
     if (err < 0) {
@@ -448,6 +714,212 @@ status_t virtio_net_send_minip_pkt(void *arg, pktbuf_t *p) {
     return err;
 }
 
+/* Run a command on the control queue and wait for the device's ack. Commands
+ * are only sent while bringing the device up, one at a time. */
+status_t virtio_net_ctrl_cmd(virtio_net_dev *ndev, uint8_t cls, uint8_t cmd, const void *data, size_t len) {
+    virtio_device *vdev = ndev->dev;
+
+    pktbuf_t *p = pktbuf_alloc();
+    if (!p)
+        return ERR_NO_MEMORY;
+
+    /* the device reads the header and data and writes the ack after them */
+    auto *hdr = static_cast<virtio_net_ctrl_hdr *>(pktbuf_append(p, sizeof(virtio_net_ctrl_hdr)));
+    hdr->cls = cls;
+    hdr->cmd = cmd;
+    memcpy(pktbuf_append(p, len), data, len);
+    const uint32_t out_len = p->dlen;
+    volatile uint8_t *ack = static_cast<uint8_t *>(pktbuf_append(p, 1));
+    *ack = VIRTIO_NET_ERR;
+
+    const bool modern = vdev->config_is_modern();
+    bool kick;
+    {
+        AutoSpinLock lock_guard(&ndev->ctrl_lock);
+
+        uint16_t i;
+        vring_desc *desc = vdev->virtio_alloc_desc_chain(ndev->ctrl_ring, 2, &i);
+        if (!desc) {
+            lock_guard.release();
+            pktbuf_free(p, true);
+            return ERR_NO_RESOURCES;
+        }
+
+        vring_desc_write_addr(desc, pktbuf_data_phys(p), modern);
+        vring_desc_write_len(desc, out_len, modern);
+
+        desc = vdev->virtio_desc_index_to_desc(ndev->ctrl_ring, vring_desc_read_next(desc, modern));
+        vring_desc_write_addr(desc, pktbuf_data_phys(p) + out_len, modern);
+        vring_desc_write_len(desc, 1, modern);
+        vring_desc_write_flags(desc, VRING_DESC_F_WRITE, modern);
+
+        vdev->virtio_submit_chain(ndev->ctrl_ring, i);
+        kick = vdev->virtio_kick_prepare(ndev->ctrl_ring);
+    }
+    if (kick) {
+        vdev->virtio_notify(ndev->ctrl_ring);
+    }
+
+    status_t err = event_wait_timeout(&ndev->ctrl_event, 1000);
+    if (err < 0) {
+        /* the device may still write the ack, so leave it the buffer */
+        TRACEF("control command %u:%u timed out\n", cls, cmd);
+        return err;
+    }
+
+    err = (*ack == VIRTIO_NET_OK) ? NO_ERROR : ERR_NOT_SUPPORTED;
+    pktbuf_free(p, true);
+
+    return err;
+}
+
+uint8_t *put_le16(uint8_t *buf, uint16_t val) {
+    val = LE16(val);
+    memcpy(buf, &val, sizeof(val));
+    return buf + sizeof(val);
+}
+
+uint8_t *put_le32(uint8_t *buf, uint32_t val) {
+    val = LE32(val);
+    memcpy(buf, &val, sizeof(val));
+    return buf + sizeof(val);
+}
+
+/* Have the device hash each flow's addresses and ports with the toeplitz key
+ * and pick its rx queue from an indirection table spread evenly over the
+ * queue pairs. The command doubles as turning the pairs on. */
+status_t virtio_net_set_rss(virtio_net_dev *ndev, uint pairs) {
+    virtio_device *dev = ndev->dev;
+
+    uint table_len = dev->config_read16(offsetof(virtio_net_config, rss_max_indirection_table_length));
+    uint key_len = dev->config_read8(offsetof(virtio_net_config, rss_max_key_size));
+    uint32_t hash_types = dev->config_read32(offsetof(virtio_net_config, supported_hash_types));
+
+    hash_types &= VIRTIO_NET_RSS_HASH_TYPE_IPv4 | VIRTIO_NET_RSS_HASH_TYPE_TCPv4 |
+                  VIRTIO_NET_RSS_HASH_TYPE_UDPv4;
+    table_len = MIN(table_len, VIRTIO_NET_RSS_TABLE_MAX);
+    key_len = MIN(key_len, sizeof(rss_key));
+    if (table_len == 0 || key_len == 0 || hash_types == 0)
+        return ERR_NOT_SUPPORTED;
+
+    /* the table is indexed by the low bits of the hash */
+    table_len = valpow2(log2_uint(table_len));
+
+    uint8_t cfg[4 + 2 + 2 + 2 * VIRTIO_NET_RSS_TABLE_MAX + 2 + 1 + sizeof(rss_key)];
+    uint8_t *ptr = cfg;
+    ptr = put_le32(ptr, hash_types);
+    ptr = put_le16(ptr, static_cast<uint16_t>(table_len - 1)); // indirection_table_mask
+    ptr = put_le16(ptr, 0); // unclassified_queue
+    for (uint i = 0; i < table_len; i++) {
+        ptr = put_le16(ptr, static_cast<uint16_t>(i % pairs));
+    }
+    ptr = put_le16(ptr, static_cast<uint16_t>(pairs)); // max_tx_vq
+    *ptr++ = static_cast<uint8_t>(key_len);
+    memcpy(ptr, rss_key, key_len);
+    ptr += key_len;
+
+    return virtio_net_ctrl_cmd(ndev, VIRTIO_NET_CTRL_MQ, VIRTIO_NET_CTRL_MQ_RSS_CONFIG, cfg, ptr - cfg);
+}
+
+/* Turn on the device's extra queue pairs, with rss if it was negotiated. Plain
+ * multiqueue devices steer a flow to the rx queue of the tx queue it last went
+ * out on, which with transmits picked by cpu keeps flows on a cpu too. Returns
+ * the number of queue pairs the device is using. */
+uint virtio_net_enable_queues(virtio_net_dev *ndev, uint pairs) {
+    if (pairs <= 1)
+        return 1;
+
+    status_t err = ERR_NOT_SUPPORTED;
+    if (ndev->features & VIRTIO_NET_F_RSS) {
+        err = virtio_net_set_rss(ndev, pairs);
+        if (err == NO_ERROR)
+            return pairs;
+        dprintf(INFO, "virtio-net: rss setup failed (%d)\n", err);
+        if (err == ERR_TIMED_OUT)
+            return 1;
+    }
+
+    uint16_t val = ndev->dev->ring_swap16(static_cast<uint16_t>(pairs));
+    err = virtio_net_ctrl_cmd(ndev, VIRTIO_NET_CTRL_MQ, VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET, &val, sizeof(val));
+    if (err < 0) {
+        dprintf(INFO, "virtio-net: failed to enable %u queue pairs (%d)\n", pairs, err);
+        return 1;
+    }
+
+    return pairs;
+}
+
+#if WITH_LIB_CONSOLE
+
+struct queue_sample {
+    uint64_t rx_packets;
+    uint64_t tx_packets;
+};
+
+void virtio_net_sample(const virtio_net_dev *ndev, queue_sample *s) {
+    for (uint i = 0; i < ndev->queue_count; i++) {
+        s[i].rx_packets = ndev->queues[i].rx_packets;
+        s[i].tx_packets = ndev->queues[i].tx_packets;
+    }
+}
+
+int cmd_virtio_net(int argc, const console_cmd_args *argv) {
+    if (argc >= 2 && !strcmp(argv[1].str, "rate")) {
+        /* packet rates per queue over an interval, to see how traffic
+         * spreads over the queues and how it scales with them */
+        lk_time_t msecs = (argc >= 3) ? (lk_time_t)argv[2].u * 1000 : 5000;
+        if (msecs == 0)
+            msecs = 1000;
+
+        virtio_net_dev *ndev;
+        list_for_every_entry(&virtio_net_list, ndev, virtio_net_dev, node) {
+            queue_sample before[VIRTIO_NET_MAX_QUEUE_PAIRS];
+            queue_sample after[VIRTIO_NET_MAX_QUEUE_PAIRS];
+
+            virtio_net_sample(ndev, before);
+            lk_bigtime_t t = current_time_hires();
+            thread_sleep(msecs);
+            t = current_time_hires() - t;
+            virtio_net_sample(ndev, after);
+
+            printf("%s: %u queue pairs, %" PRIu64 " usecs\n", ndev->netif.name, ndev->queue_count, t);
+            uint64_t rx_total = 0, tx_total = 0;
+            for (uint i = 0; i < ndev->queue_count; i++) {
+                uint64_t rx = after[i].rx_packets - before[i].rx_packets;
+                uint64_t tx = after[i].tx_packets - before[i].tx_packets;
+                printf("\tqueue %u: rx %8" PRIu64 " pps tx %8" PRIu64 " pps\n", i,
+                       rx * 1000000 / t, tx * 1000000 / t);
+                rx_total += rx;
+                tx_total += tx;
+            }
+            printf("\ttotal:   rx %8" PRIu64 " pps tx %8" PRIu64 " pps\n",
+                   rx_total * 1000000 / t, tx_total * 1000000 / t);
+        }
+        return NO_ERROR;
+    } else if (argc >= 2) {
+        printf("usage:\n");
+        printf("%s\n", argv[0].str);
+        printf("%s rate [seconds]\n", argv[0].str);
+        return ERR_INVALID_ARGS;
+    }
+
+    virtio_net_dev *ndev;
+    list_for_every_entry(&virtio_net_list, ndev, virtio_net_dev, node) {
+        printf("%s: %u queue pairs%s\n", ndev->netif.name, ndev->queue_count,
+               (ndev->features & VIRTIO_NET_F_RSS) ? ", rss" : "");
+        for (uint i = 0; i < ndev->queue_count; i++) {
+            const virtio_net_queue *q = &ndev->queues[i];
+            printf("\tqueue %u: cpu %d rx %" PRIu64 " pkts %" PRIu64 " bytes, tx %" PRIu64
+                   " pkts %" PRIu64 " bytes\n", i, q->poll.cpu, q->rx_packets, q->rx_bytes,
+                   q->tx_packets, q->tx_bytes);
+        }
+    }
+
+    return NO_ERROR;
+}
+
+#endif
+
 } // namespace
 
 status_t virtio_net_init(virtio_device *dev) {
@@ -461,9 +933,8 @@ status_t virtio_net_init(virtio_device *dev) {
     ndev->dev = dev;
     dev->set_priv(ndev);
 
-    ndev->lock = SPIN_LOCK_INITIAL_VALUE;
-    event_init(&ndev->rx_event, false, EVENT_FLAG_AUTOUNSIGNAL);
-    list_initialize(&ndev->completed_rx_queue);
+    ndev->ctrl_lock = SPIN_LOCK_INITIAL_VALUE;
+    event_init(&ndev->ctrl_event, false, EVENT_FLAG_AUTOUNSIGNAL);
 
     /* start from a known reset state */
     dev->bus()->virtio_reset_device();
@@ -490,47 +961,176 @@ status_t virtio_net_init(virtio_device *dev) {
     if (host_features & VIRTIO_NET_F_GUEST_CSUM) {
         guest_features |= VIRTIO_NET_F_GUEST_CSUM;
     }
-    dev->bus()->virtio_set_guest_features(0, guest_features);
-    dprintf(INFO, "virtio-net: guest features 0x%x%s%s%s\n",
-            guest_features,
+    if (host_features & VIRTIO_NET_F_CSUM) {
+        guest_features |= VIRTIO_NET_F_CSUM;
+    }
+    if ((host_features & VIRTIO_NET_F_HOST_TSO4) && (guest_features & VIRTIO_NET_F_CSUM)) {
+        guest_features |= VIRTIO_NET_F_HOST_TSO4;
+    }
+    if (host_features & VIRTIO_NET_F_MRG_RXBUF) {
+        guest_features |= VIRTIO_NET_F_MRG_RXBUF;
+    }
+    // Large receives are only taken if they can be spread over several rx buffers.
+    if ((host_features & VIRTIO_NET_F_GUEST_TSO4) && (guest_features & VIRTIO_NET_F_GUEST_CSUM) &&
+            (guest_features & VIRTIO_NET_F_MRG_RXBUF)) {
+        guest_features |= VIRTIO_NET_F_GUEST_TSO4;
+    }
+    // A queue pair per running cpu, turned on through the control queue. The
+    // control queue's ring follows all of the device's pairs, so it has to fit.
+    int cpus[SMP_MAX_CPUS];
+    const uint cpu_count = virtio_net_active_cpus(cpus);
+    uint max_pairs = 1;
+    if ((host_features & VIRTIO_NET_F_MQ) && (host_features & VIRTIO_NET_F_CTRL_VQ)) {
+        max_pairs = dev->config_read16(offsetof(virtio_net_config, max_virtqueue_pairs));
+    }
+    if (cpu_count > 1 && max_pairs > 1) {
+        if (max_pairs <= VIRTIO_NET_MAX_QUEUE_PAIRS) {
+            guest_features |= VIRTIO_NET_F_CTRL_VQ | VIRTIO_NET_F_MQ;
+        } else {
+            dprintf(INFO, "virtio-net: %u queue pairs need more than %zu rings, using one\n",
+                    max_pairs, virtio_device::MAX_VIRTIO_RINGS);
+        }
+    }
+    guest_features = dev->virtio_set_guest_features(guest_features);
+    ndev->features = guest_features;
+
+    // RSS lives in the upper feature word, which only modern devices have.
+    if ((guest_features & VIRTIO_NET_F_MQ) && (host_features & VIRTIO_NET_F_RSS)) {
+        uint32_t word1 = dev->virtio_set_guest_features_word1(static_cast<uint32_t>(VIRTIO_NET_F_RSS >> 32));
+        ndev->features |= static_cast<uint64_t>(word1) << 32;
+    }
+    dprintf(INFO, "virtio-net: guest features %#" PRIx64 "%s%s%s%s%s%s%s%s%s\n",
+            ndev->features,
             (guest_features & VIRTIO_NET_F_MAC) ? " MAC" : "",
             (guest_features & VIRTIO_NET_F_STATUS) ? " STATUS" : "",
-            (guest_features & VIRTIO_NET_F_GUEST_CSUM) ? " GUEST_CSUM" : "");
+            (guest_features & VIRTIO_NET_F_GUEST_CSUM) ? " GUEST_CSUM" : "",
+            (guest_features & VIRTIO_NET_F_CSUM) ? " CSUM" : "",
+            (guest_features & VIRTIO_NET_F_HOST_TSO4) ? " HOST_TSO4" : "",
+            (guest_features & VIRTIO_NET_F_GUEST_TSO4) ? " GUEST_TSO4" : "",
+            (guest_features & VIRTIO_NET_F_MRG_RXBUF) ? " MRG_RXBUF" : "",
+            (guest_features & VIRTIO_NET_F_MQ) ? " CTRL_VQ MQ" : "",
+            (ndev->features & VIRTIO_NET_F_RSS) ? " RSS" : "");
+
+    // The header carries num_buffers with mergeable rx buffers or a modern device.
+    ndev->hdr_len = (modern || (guest_features & VIRTIO_NET_F_MRG_RXBUF)) ?
+                    sizeof(virtio_net_hdr) : sizeof(virtio_net_hdr) - 2;
+
+    /* with multiqueue, as many queue pairs as the device and the running cpus allow */
+    uint pairs = 1;
+    if (guest_features & VIRTIO_NET_F_MQ) {
+        pairs = MIN(max_pairs, cpu_count);
+    }
+    ndev->queues = static_cast<virtio_net_queue *>(calloc(pairs, sizeof(virtio_net_queue)));
+    if (!ndev->queues) {
+        dev->set_priv(nullptr);
+        free(ndev);
+        return ERR_NO_MEMORY;
+    }
+    ndev->queue_count = pairs;
+    for (uint i = 0; i < pairs; i++) {
+        virtio_net_queue *q = &ndev->queues[i];
+        q->ndev = ndev;
+        q->index = i;
+        q->rx_ring = i * 2;
+        q->tx_ring = i * 2 + 1;
+        q->lock = SPIN_LOCK_INITIAL_VALUE;
+        list_initialize(&q->completed_rx_queue);
+    }
+
+    /* construct the minip netif interface for the pollers to feed */
+    char str[32];
+    static volatile int ndev_count = 0;
+    snprintf(str, sizeof(str), "virtio-net-%d", atomic_add(&ndev_count, 1));
+    netif_create(&ndev->netif, str);
+
+    /* start an rx poller per queue pair before the device can interrupt, with
+     * more than one queue each stays on its own cpu. Make do with the pairs
+     * that got one. */
+    for (uint i = 0; i < pairs; i++) {
+        snprintf(str, sizeof(str), "virtio_net_rx%u", i);
+        status_t err = netif_poll_start(&ndev->queues[i].poll, &ndev->netif, str, &virtio_net_rx_poll,
+                                        &virtio_net_rx_poll_done, &ndev->queues[i], 0,
+                                        (pairs > 1) ? cpus[i] : -1);
+        if (err < 0) {
+            dprintf(INFO, "virtio-net: failed to start rx poller %u (%d)\n", i, err);
+            if (i == 0) {
+                dev->set_priv(nullptr);
+                free(ndev->queues);
+                free(ndev);
+                return err;
+            }
+            pairs = i;
+            break;
+        }
+    }
 
     /* set our irq handler */
     dev->set_irq_callbacks(&virtio_net_irq_driver_callback, nullptr);
     dev->bus()->unmask_interrupt();
 
-    /* allocate a pair of virtio rings */
-    dev->virtio_alloc_ring(RING_RX, RX_RING_SIZE); // rx
-    dev->virtio_alloc_ring(RING_TX, TX_RING_SIZE); // tx
+    /* allocate a pair of virtio rings per queue pair, and the control queue
+     * after all of the device's pairs */
+    for (uint i = 0; i < pairs; i++) {
+        dev->virtio_alloc_ring(ndev->queues[i].rx_ring, RX_RING_SIZE);
+        dev->virtio_alloc_ring(ndev->queues[i].tx_ring, TX_RING_SIZE);
+        dev->virtio_set_ring_polled(ndev->queues[i].rx_ring, &virtio_net_rx_ring_callback);
+    }
+    ndev->ctrl_ring = UINT_MAX;
+    if (guest_features & VIRTIO_NET_F_CTRL_VQ) {
+        ndev->ctrl_ring = max_pairs * 2;
+        dev->virtio_alloc_ring(ndev->ctrl_ring, CTRL_RING_SIZE);
+    }
 
     /* set DRIVER_OK */
     dev->bus()->virtio_status_driver_ok();
 
-    /* start the rx worker thread */
-    thread_resume(thread_create("virtio_net_rx", &virtio_net_rx_worker, static_cast<void *>(ndev), HIGH_PRIORITY, DEFAULT_STACK_SIZE));
+    /* the device only uses the first pair until told otherwise */
+    ndev->queue_count = virtio_net_enable_queues(ndev, pairs);
 
-    /* queue up a bunch of rxes */
-    for (uint i = 0; i < RX_RING_SIZE - 1; i++) {
-        pktbuf_t *p = pktbuf_alloc();
-        if (p) {
-            virtio_net_queue_rx(ndev, p, false);
+    /* each queue gets an even share of the rx buffers the pktbuf pool can spare */
+    const uint count = ndev->queue_count;
+    const size_t rx_depth = MAX(MIN(pktbuf_recommended_eth_rx_depth(count * (RX_RING_SIZE - 1)) / count,
+                                    (size_t)RX_RING_SIZE - 1), (size_t)1);
+
+    for (uint i = 0; i < count; i++) {
+        virtio_net_queue *q = &ndev->queues[i];
+
+        /* queue up a bunch of rxes */
+        for (size_t n = 0; n < rx_depth; n++) {
+            pktbuf_t *p = pktbuf_alloc();
+            if (p) {
+                virtio_net_queue_rx(q, p, false);
+            }
         }
+        /* kick all at once */
+        virtio_net_kick_rx(q);
     }
-    /* kick all at once */
-    ndev->dev->bus()->virtio_kick(RING_RX);
 
-    /* construct and register the minip netif interface */
-    char str[32];
-    static volatile int ndev_count = 0;
-    snprintf(str, sizeof(str), "virtio-net-%d", atomic_add(&ndev_count, 1));
-    netif_create(&ndev->netif, str);
+    /* and register it */
     uint8_t mac[6];
     virtio_net_get_mac_addr(ndev, mac);
     netif_set_eth(&ndev->netif, virtio_net_send_minip_pkt, ndev, mac);
+    /* every packet goes out as a descriptor chain, so any buffers will do */
+    uint32_t offloads = NETIF_OFFLOAD_SG;
+    if (guest_features & VIRTIO_NET_F_CSUM) {
+        offloads |= NETIF_OFFLOAD_TX_CSUM;
+    }
+    if (guest_features & VIRTIO_NET_F_HOST_TSO4) {
+        offloads |= NETIF_OFFLOAD_TSO4;
+    }
+    netif_set_offloads(&ndev->netif, offloads, VIRTIO_NET_GSO_MAX_SIZE);
     netif_register(&ndev->netif);
 
+    list_add_tail(&virtio_net_list, &ndev->node);
+
+    dprintf(INFO, "virtio-net: %u queue pairs, %zu rx buffers each\n", count, rx_depth);
+
     return NO_ERROR;
 }
 
+#if WITH_LIB_CONSOLE
+STATIC_COMMAND_START
+STATIC_COMMAND("virtio_net", "virtio-net per queue counters and packet rates", &cmd_virtio_net)
+STATIC_COMMAND_END(virtio_net);
+#endif
+
@@ -11,11 +11,14 @@
 #include <lk/trace.h>
 #include <lk/err.h>
 #include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <lk/pow2.h>
 #include <lk/reg.h>
 #include <arch/ops.h>
+#include <kernel/spinlock.h>
 #include <sys/types.h>
 #include <dev/virtio/virtio-mmio-bus.h>
 
@@ -27,6 +30,56 @@
 
 #define LOCAL_TRACE 0
 
+static virtio_device *device_list;
+static spin_lock_t device_list_lock = SPIN_LOCK_INITIAL_VALUE;
+
+virtio_device::virtio_device(virtio_bus *bus) : bus_(bus) {
+    AutoSpinLock guard(&device_list_lock);
+    next_device_ = device_list;
+    device_list = this;
+}
+
+virtio_device::~virtio_device() {
+    {
+        AutoSpinLock guard(&device_list_lock);
+        for (virtio_device **d = &device_list; *d; d = &(*d)->next_device_) {
+            if (*d == this) {
+                *d = next_device_;
+                break;
+            }
+        }
+    }
+
+    delete bus_;
+}
+
+uint32_t virtio_device::virtio_set_guest_features(uint32_t features) {
+    uint32_t host_features = bus()->virtio_read_host_feature_word(0);
+
+    if (host_features & VIRTIO_F_EVENT_IDX) {
+        features |= VIRTIO_F_EVENT_IDX;
+    }
+    event_idx_ = (features & VIRTIO_F_EVENT_IDX) != 0;
+
+    bus()->virtio_set_guest_features(0, features);
+
+    return features;
+}
+
+uint32_t virtio_device::virtio_set_guest_features_word1(uint32_t features) {
+    if (bus()->virtio_is_legacy()) {
+        return 0;
+    }
+
+    uint32_t host_features = bus()->virtio_read_host_feature_word(1);
+    features &= host_features;
+    features |= host_features & static_cast<uint32_t>(VIRTIO_F_VERSION_1 >> 32);
+
+    bus()->virtio_set_guest_features(1, features);
+
+    return features;
+}
+
 void virtio_device::virtio_free_desc(uint ring_index, uint16_t desc_index) {
     LTRACEF("dev %p ring %u index %u free_count %u\n", this, ring_index, desc_index, ring_[ring_index].free_count);
 
@@ -105,20 +158,54 @@ void virtio_device::virtio_submit_chain(uint ring_index, uint16_t desc_index) {
 
     vring &ring = ring_[ring_index];
 
-    /* add the chain to the available list */
-    vring_avail *avail = ring.avail;
+    /* add the chain to the available list, the index is published at kick time */
+    vring_avail_write_ring(ring.avail, ring.avail_idx & ring.num_mask, desc_index, config_is_modern());
+    ring.avail_idx++;
+}
+
+bool virtio_device::virtio_kick_prepare(uint ring_index) {
+    DEBUG_ASSERT(ring_index < MAX_VIRTIO_RINGS);
+
+    vring &ring = ring_[ring_index];
     const bool modern = config_is_modern();
 
-    uint16_t avail_idx = vring_avail_read_idx(avail, modern);
+    const uint16_t old_idx = ring.avail_published;
+    const uint16_t new_idx = ring.avail_idx;
+    if (old_idx == new_idx)
+        return false;
 
-    vring_avail_write_ring(avail, avail_idx & ring.num_mask, desc_index, modern);
     // Ensure descriptor and avail ring entry writes are visible before idx update.
     wmb();
-    vring_avail_write_idx(avail, avail_idx + 1, modern);
+    vring_avail_write_idx(ring.avail, new_idx, modern);
+    ring.avail_published = new_idx;
 
 #if LOCAL_TRACE
-    hexdump(avail, 16);
+    hexdump(ring.avail, 16);
 #endif
+
+    // The device may be about to go idle, so the new index has to be visible
+    // before we look at whether it wants to hear about it.
+    mb();
+
+    bool need_kick;
+    if (event_idx_) {
+        need_kick = vring_need_event(vring_read_avail_event(&ring, modern), new_idx, old_idx);
+    } else {
+        need_kick = !(vring_used_read_flags(ring.used, modern) & VRING_USED_F_NO_NOTIFY);
+    }
+
+    if (!need_kick) {
+        ring_stats_[ring_index].kicks_suppressed++;
+    }
+
+    return need_kick;
+}
+
+void virtio_device::virtio_notify(uint ring_index) {
+    DEBUG_ASSERT(ring_index < MAX_VIRTIO_RINGS);
+
+    __atomic_fetch_add(&ring_stats_[ring_index].kicks, 1, __ATOMIC_RELAXED);
+    bus()->virtio_kick(ring_index);
 }
 
 status_t virtio_device::virtio_alloc_ring(uint index, uint16_t len) {
@@ -189,10 +276,69 @@ status_t virtio_device::virtio_alloc_ring(uint index, uint16_t len) {
     return NO_ERROR;
 }
 
+void virtio_device::virtio_set_ring_polled(uint ring_index, ring_poll_callback cb) {
+    DEBUG_ASSERT(ring_index < MAX_VIRTIO_RINGS);
+    DEBUG_ASSERT(cb);
+
+    ring_poll_callback_ = cb;
+    polled_rings_bitmap_ |= (1u << ring_index);
+}
+
+void virtio_device::ring_interrupt_disable(vring &ring) {
+    /* with event_idx the used event is left where it is, so the device won't
+     * interrupt again until it laps it */
+    if (!event_idx_) {
+        vring_avail_write_flags(ring.avail, VRING_AVAIL_F_NO_INTERRUPT, config_is_modern());
+    }
+}
+
+bool virtio_device::virtio_ring_next_used(uint ring_index, vring_used_elem *e) {
+    DEBUG_ASSERT(ring_index < MAX_VIRTIO_RINGS);
+    DEBUG_ASSERT(polled_rings_bitmap_ & (1u << ring_index));
+
+    vring &ring = ring_[ring_index];
+    const bool modern = config_is_modern();
+
+    if (vring_used_read_idx(ring.used, modern) == ring.last_used)
+        return false;
+    // Ensure device writes to used elements are visible after observing used->idx.
+    rmb();
+
+    uint i = ring.last_used & ring.num_mask;
+    e->id = vring_used_read_elem_id(ring.used, i, modern);
+    e->len = vring_used_read_elem_len(ring.used, i, modern);
+
+    ring.last_used++;
+    ring_stats_[ring_index].completions++;
+
+    return true;
+}
+
+bool virtio_device::virtio_ring_poll_done(uint ring_index) {
+    DEBUG_ASSERT(ring_index < MAX_VIRTIO_RINGS);
+
+    vring &ring = ring_[ring_index];
+    const bool modern = config_is_modern();
+
+    if (event_idx_) {
+        vring_write_used_event(&ring, ring.last_used, modern);
+    } else {
+        vring_avail_write_flags(ring.avail, 0, modern);
+    }
+    __atomic_fetch_and(&polling_rings_bitmap_, ~(1u << ring_index), __ATOMIC_ACQ_REL);
+
+    // Anything the device finished before it saw the interrupt turned back
+    // on would not raise one.
+    mb();
+    return vring_used_read_idx(ring.used, modern) != ring.last_used;
+}
+
 handler_return virtio_device::handle_queue_interrupt() {
     LTRACE_ENTRY;
     handler_return ret = INT_NO_RESCHEDULE;
 
+    irq_count_++;
+
     /* cycle through all the active rings */
     for (uint r = 0; r < MAX_VIRTIO_RINGS; r++) {
         if ((active_rings_bitmap_ & (1<<r)) == 0)
@@ -201,30 +347,56 @@ handler_return virtio_device::handle_queue_interrupt() {
         vring &ring = ring_[r];
         const bool modern = config_is_modern();
 
+        /* polled rings only get handed to the driver, once, until it's done */
+        if (polled_rings_bitmap_ & (1u << r)) {
+            if (vring_used_read_idx(ring.used, modern) != ring.last_used &&
+                    !(__atomic_fetch_or(&polling_rings_bitmap_, 1u << r, __ATOMIC_ACQ_REL) & (1u << r))) {
+                ring_interrupt_disable(ring);
+                if (ring_poll_callback_(this, r) == INT_RESCHEDULE) {
+                    ret = INT_RESCHEDULE;
+                }
+            }
+            continue;
+        }
+
         LTRACEF("desc %p, avail %p, used %p\n", ring.desc, ring.avail, ring.used);
         LTRACEF("ring %u: used flags 0x%hx idx 0x%hx last_used 0x%hx\n", r,
             vring_used_read_flags(ring.used, modern), vring_used_read_idx(ring.used, modern), ring.last_used);
 
-        uint16_t cur_idx = vring_used_read_idx(ring.used, modern);
-        // Ensure device writes to used elements are visible after observing used->idx.
-        rmb();
-        for (uint16_t used_idx = ring.last_used; used_idx != cur_idx; ++used_idx) {
-            uint i = used_idx & ring.num_mask;
-            LTRACEF("looking at idx %u\n", i);
-
-            // process chain
-            vring_used_elem used_elem = {
-                .id = vring_used_read_elem_id(ring.used, i, modern),
-                .len = vring_used_read_elem_len(ring.used, i, modern),
-            };
-            LTRACEF("id %u, len %u\n", used_elem.id, used_elem.len);
-
-            DEBUG_ASSERT(irq_driver_callback_);
-            if (irq_driver_callback_(this, r, &used_elem) == INT_RESCHEDULE) {
-                ret = INT_RESCHEDULE;
+        for (;;) {
+            uint16_t cur_idx = vring_used_read_idx(ring.used, modern);
+            // Ensure device writes to used elements are visible after observing used->idx.
+            rmb();
+            for (uint16_t used_idx = ring.last_used; used_idx != cur_idx; ++used_idx) {
+                uint i = used_idx & ring.num_mask;
+                LTRACEF("looking at idx %u\n", i);
+
+                // process chain
+                vring_used_elem used_elem = {
+                    .id = vring_used_read_elem_id(ring.used, i, modern),
+                    .len = vring_used_read_elem_len(ring.used, i, modern),
+                };
+                LTRACEF("id %u, len %u\n", used_elem.id, used_elem.len);
+
+                DEBUG_ASSERT(irq_driver_callback_);
+                if (irq_driver_callback_(this, r, &used_elem) == INT_RESCHEDULE) {
+                    ret = INT_RESCHEDULE;
+                }
+
+                ring.last_used++;
+                ring_stats_[r].completions++;
             }
 
-            ring.last_used++;
+            if (!event_idx_)
+                break;
+
+            // Ask for an interrupt on the next completion only. Anything the
+            // device finished before it saw the new event index would not
+            // raise one, so look again once it is visible.
+            vring_write_used_event(&ring, ring.last_used, modern);
+            mb();
+            if (vring_used_read_idx(ring.used, modern) == ring.last_used)
+                break;
         }
     }
 
@@ -242,3 +414,22 @@ handler_return virtio_device::handle_config_interrupt() {
 
     return ret;
 }
+
+void virtio_device::dump_stats() const {
+    printf("virtio device %p: event_idx %u irqs %" PRIu64 "\n", this, event_idx_, irq_count_);
+    for (uint r = 0; r < MAX_VIRTIO_RINGS; r++) {
+        if ((active_rings_bitmap_ & (1<<r)) == 0)
+            continue;
+
+        const ring_stats &s = ring_stats_[r];
+        printf("\tring %u: len %u kicks %" PRIu64 " suppressed %" PRIu64 " completions %" PRIu64 "\n",
+               r, ring_len_[r], s.kicks, s.kicks_suppressed, s.completions);
+    }
+}
+
+void virtio_device::dump_all_stats() {
+    // devices are only added at init time and not freed while the system runs
+    for (const virtio_device *dev = device_list; dev; dev = dev->next_device_) {
+        dev->dump_stats();
+    }
+}
@@ -177,6 +177,8 @@ void virtio_pci_bus::virtio_set_guest_features(uint32_t word, uint32_t features)
 }
 
 void virtio_pci_bus::virtio_kick(uint16_t ring_index) {
+    static_assert(kMaxRings >= virtio_device::MAX_VIRTIO_RINGS,
+                  "notify offset table smaller than the ring count");
     DEBUG_ASSERT(ring_index < virtio_device::MAX_VIRTIO_RINGS);
 
     uint16_t notify_off = queue_notify_off_[ring_index];
@@ -7,8 +7,11 @@
  */
 #include <dev/virtio.h>
 #include <dev/virtio/virtio_ring.h>
+#include <dev/virtio/virtio-device.h>
 
+#include <lk/console_cmd.h>
 #include <lk/debug.h>
+#include <lk/err.h>
 #include <lk/init.h>
 #include <stdio.h>
 #include <inttypes.h>
@@ -44,3 +47,12 @@ static void virtio_init(uint level) {
 }
 
 LK_INIT_HOOK(virtio, &virtio_init, LK_INIT_LEVEL_THREADING);
+
+static int cmd_virtio(int argc, const console_cmd_args *argv) {
+    virtio_device::dump_all_stats();
+    return NO_ERROR;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("virtio", "virtio ring kick/irq/completion counters", &cmd_virtio)
+STATIC_COMMAND_END(virtio);
@@ -78,6 +78,7 @@ static int cmd_threadstats(int argc, const console_cmd_args *argv) {
         printf("\treschedules: %lu\n", thread_stats[i].reschedules);
 #if WITH_SMP
         printf("\treschedule_ipis: %lu\n", thread_stats[i].reschedule_ipis);
+        printf("\tsteals: %lu\n", thread_stats[i].steals);
 #endif
         printf("\tcontext_switches: %lu\n", thread_stats[i].context_switches);
         printf("\tpreempts: %lu\n", thread_stats[i].preempts);
@@ -85,6 +86,10 @@ static int cmd_threadstats(int argc, const console_cmd_args *argv) {
         printf("\tinterrupts: %lu\n", thread_stats[i].interrupts);
         printf("\ttimer interrupts: %lu\n", thread_stats[i].timer_ints);
         printf("\ttimers: %lu\n", thread_stats[i].timers);
+        printf("\tmutex blocks: %lu\n", thread_stats[i].mutex_blocks);
+#if WITH_SMP
+        printf("\tmutex spin acquires: %lu\n", thread_stats[i].mutex_spin_acquires);
+#endif
     }
 
     dump_threads_stats();
@@ -13,6 +13,10 @@
 
 __BEGIN_CDECLS
 
+// Uncontended acquire and release are a single atomic operation and never
+// touch the thread lock. On SMP a contended acquire briefly spins while the
+// holder is running on another cpu before blocking.
+//
 // Rules for Mutexes:
 // - Mutexes are only safe to use from thread context.
 // - Mutexes are non-recursive.
@@ -22,7 +26,7 @@ __BEGIN_CDECLS
 
 typedef struct mutex {
     uint32_t magic;
-    int count;
+    int count; // 0 free, 1 held, +1 per blocked waiter; only touched atomically
     thread_t *holder;
     wait_queue_t wait;
 } mutex_t;
@@ -11,19 +11,43 @@
 
 __BEGIN_CDECLS
 
+#if WITH_SPINLOCK_STATS
+// Contention statistics for locks registered with spin_lock_stats_register().
+// Every lock operation looks the lock up in a small table, so this is a
+// debugging build option, off by default. See the `spinlocks` console command.
+void spin_lock_stats_register(spin_lock_t *lock, const char *name);
+void spin_lock_stats_lock(spin_lock_t *lock);
+int spin_lock_stats_trylock(spin_lock_t *lock);
+void spin_lock_stats_unlock(spin_lock_t *lock);
+#else
+static inline void spin_lock_stats_register(spin_lock_t *lock, const char *name) {}
+#endif
+
 // interrupts should already be disabled
 static inline void spin_lock(spin_lock_t *lock) {
+#if WITH_SPINLOCK_STATS
+    spin_lock_stats_lock(lock);
+#else
     arch_spin_lock(lock);
+#endif
 }
 
 // Returns 0 on success, non-0 on failure
 static inline int spin_trylock(spin_lock_t *lock) {
+#if WITH_SPINLOCK_STATS
+    return spin_lock_stats_trylock(lock);
+#else
     return arch_spin_trylock(lock);
+#endif
 }
 
 // interrupts should already be disabled
 static inline void spin_unlock(spin_lock_t *lock) {
+#if WITH_SPINLOCK_STATS
+    spin_lock_stats_unlock(lock);
+#else
     arch_spin_unlock(lock);
+#endif
 }
 
 static inline void spin_lock_init(spin_lock_t *lock) {
@@ -86,6 +86,7 @@ typedef struct thread {
 #if WITH_SMP
     int curr_cpu;
     int pinned_cpu; // only run on pinned_cpu if >= 0
+    int last_cpu; // cpu it most recently ran on, for run queue placement
 #endif
 #if WITH_KERNEL_VM
     struct vmm_aspace *aspace;
@@ -225,6 +226,14 @@ static inline int thread_pinned_cpu(const thread_t *t) {
 #endif
 }
 
+static inline int thread_last_cpu(const thread_t *t) {
+#if WITH_SMP
+    return t->last_cpu;
+#else
+    return 0;
+#endif
+}
+
 static inline void thread_set_curr_cpu(thread_t *t, int cpu) {
 #if WITH_SMP
     t->curr_cpu = cpu;
@@ -237,6 +246,12 @@ static inline void thread_set_pinned_cpu(thread_t *t, int cpu) {
 #endif
 }
 
+static inline void thread_set_last_cpu(thread_t *t, int cpu) {
+#if WITH_SMP
+    t->last_cpu = cpu;
+#endif
+}
+
 // thread local storage
 static inline __ALWAYS_INLINE uintptr_t tls_get(uint entry) {
     return get_current_thread()->tls[entry];
@@ -266,9 +281,12 @@ struct thread_stats {
     ulong interrupts; // platform code increment this
     ulong timer_ints; // timer code increment this
     ulong timers; // timer code increment this
+    ulong mutex_blocks; // contended mutex acquires that had to block
 
 #if WITH_SMP
+    ulong mutex_spin_acquires; // contended mutex acquires won by spinning
     ulong reschedule_ipis;
+    ulong steals; // threads pulled from a sibling cpu's run queue
 #endif
 };
 
@@ -35,6 +35,9 @@ typedef struct timer {
 
     timer_callback callback;
     void *arg;
+
+    // cpu whose timer wheel the timer was last queued on
+    uint cpu;
 } timer_t;
 
 // Initializes a timer to the default state. Can statically initialize a timer
@@ -47,6 +50,7 @@ typedef struct timer {
     .periodic_time = 0, \
     .callback = NULL, \
     .arg = NULL, \
+    .cpu = 0, \
 }
 
 void timer_initialize(timer_t *);
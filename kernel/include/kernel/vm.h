@@ -71,10 +71,13 @@ typedef struct vm_page {
     struct list_node node;
 
     uint flags : 8;
-    uint ref : 24;
+    uint order : 8; // log2 size of the free block, if VM_PAGE_FLAG_FREE_HEAD
+    uint ref : 16;
 } vm_page_t;
 
-#define VM_PAGE_FLAG_NONFREE  (0x1)
+#define VM_PAGE_FLAG_NONFREE   (0x1)
+#define VM_PAGE_FLAG_FREE_HEAD (0x2) // first page of a free block in the pmm
+#define VM_PAGE_FLAG_CACHED    (0x4) // free, but held in a pmm per cpu cache
 
 // Kernel address space
 // Must be declared by the platform or architecture.
@@ -106,6 +109,13 @@ static inline bool is_user_address(vaddr_t va) {
 }
 
 // physical allocator
+//
+// Free pages in each arena are kept in a buddy system: naturally aligned (by
+// physical page number) blocks of 2^order pages, with one free list per order.
+#ifndef PMM_MAX_ORDER
+#define PMM_MAX_ORDER 10
+#endif
+
 typedef struct pmm_arena {
     struct list_node node;
     const char *name;
@@ -119,7 +129,7 @@ typedef struct pmm_arena {
     size_t free_count;
 
     struct vm_page *page_array;
-    struct list_node free_list;
+    struct list_node free_list[PMM_MAX_ORDER + 1];
 } pmm_arena_t;
 
 #define PMM_ARENA_FLAG_KMAP (0x1) // this arena is already mapped and useful for kallocs
@@ -147,6 +157,10 @@ size_t pmm_free(struct list_node *list) __NONNULL((1));
 // Helper routine for the above.
 size_t pmm_free_page(vm_page_t *page) __NONNULL((1));
 
+// Number of free pages in the kernel mapped arenas. Only a snapshot, the count
+// may change as soon as it is returned.
+size_t pmm_count_free_pages(void);
+
 // Allocate a run of contiguous pages, aligned on log2 byte boundary (0-31)
 // If the optional physical address pointer is passed, return the address.
 // If the optional list is passed, append the allocate page structures to the tail of the list.
@@ -64,6 +64,73 @@ void mutex_destroy(mutex_t *m) {
     THREAD_UNLOCK(state);
 }
 
+/*
+ * m->count is 0 when the mutex is free, 1 when it is held, and one more for
+ * every thread that has committed to blocking on it. Uncontended acquire and
+ * release are a single compare and swap on it. Only the contended path takes
+ * the thread lock: a blocking waiter bumps the count and sleeps under it, and a
+ * release that sees waiters drops the count under it and hands the mutex
+ * straight to the first waiter, so the count never passes through zero and a
+ * thread on the fast path cannot barge in ahead of the queue.
+ */
+
+#if WITH_SMP
+/* how many times a would be waiter polls a mutex whose holder is running on
+ * another cpu before giving up and blocking */
+#ifndef MUTEX_SPIN_MAX
+#define MUTEX_SPIN_MAX 1000
+#endif
+
+static inline void mutex_spin_pause(void) {
+#if ARCH_X86
+    __asm__ volatile("pause" ::: "memory");
+#elif ARCH_ARM64
+    __asm__ volatile("yield" ::: "memory");
+#else
+    CF;
+#endif
+}
+
+/*
+ * Spin for a bounded time while the holder is running on another cpu, on the
+ * theory that it will drop the mutex sooner than a block and wakeup would take.
+ * Give up as soon as anyone is queued, so spinners do not starve the waiters,
+ * or if the holder is not running and a release is not coming any time soon.
+ *
+ * The holder may release the mutex and exit while we look at it. Threads made
+ * by thread_create() come out of a type stable cache whose memory is never
+ * given back, so the holder pointer always points at some thread_t, if not
+ * necessarily the same one, and at worst a stale read makes us spin or block
+ * when we should not have. A caller supplied thread_t must likewise stay
+ * around until nothing can still be looking at a mutex it held.
+ */
+static bool mutex_adaptive_spin(mutex_t *m) {
+    int cpu = arch_curr_cpu_num();
+
+    for (uint i = 0; i < MUTEX_SPIN_MAX; i++) {
+        int count = __atomic_load_n(&m->count, __ATOMIC_RELAXED);
+        if (count == 0) {
+            if (__atomic_compare_exchange_n(&m->count, &count, 1, false,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                return true;
+            continue;
+        }
+        if (count > 1)
+            return false;
+
+        /* a NULL holder is a thread between its compare and swap and setting
+         * the holder, or one on its way out; either way it is running */
+        thread_t *holder = __atomic_load_n(&m->holder, __ATOMIC_RELAXED);
+        if (holder && (holder->state != THREAD_RUNNING || thread_curr_cpu(holder) == cpu))
+            return false;
+
+        mutex_spin_pause();
+    }
+
+    return false;
+}
+#endif
+
 /**
  * @brief  Mutex wait with timeout
  *
@@ -77,17 +144,38 @@ void mutex_destroy(mutex_t *m) {
 status_t mutex_acquire_timeout(mutex_t *m, lk_time_t timeout) {
     DEBUG_ASSERT(m->magic == MUTEX_MAGIC);
 
+    thread_t *current = get_current_thread();
+
 #if LK_DEBUGLEVEL > 0
-    if (unlikely(get_current_thread() == m->holder))
+    if (unlikely(current == m->holder))
         panic("mutex_acquire_timeout: thread %p (%s) tried to acquire mutex %p it already owns.\n",
-              get_current_thread(), get_current_thread()->name, m);
+              current, current->name, m);
 #endif
     DEBUG_ASSERT(!mutex_threading_ready || !timeout || !arch_ints_disabled());
 
+    int expected = 0;
+    if (likely(__atomic_compare_exchange_n(&m->count, &expected, 1, false,
+                                           __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))) {
+        m->holder = current;
+        return NO_ERROR;
+    }
+
+    if (timeout == 0)
+        return ERR_TIMED_OUT;
+
+#if WITH_SMP
+    if (mutex_adaptive_spin(m)) {
+        THREAD_STATS_INC(mutex_spin_acquires);
+        m->holder = current;
+        return NO_ERROR;
+    }
+#endif
+
     THREAD_LOCK(state);
 
     status_t ret = NO_ERROR;
-    if (unlikely(++m->count > 1)) {
+    if (unlikely(__atomic_fetch_add(&m->count, 1, __ATOMIC_ACQUIRE) > 0)) {
+        THREAD_STATS_INC(mutex_blocks);
         ret = wait_queue_block(&m->wait, timeout);
         if (unlikely(ret < NO_ERROR)) {
             /* if the acquisition timed out, back out the acquire and exit */
@@ -97,7 +185,7 @@ status_t mutex_acquire_timeout(mutex_t *m, lk_time_t timeout) {
                  * but before we got scheduled again which makes messing with the
                  * count variable dangerous.
                  */
-                m->count--;
+                __atomic_fetch_sub(&m->count, 1, __ATOMIC_RELAXED);
             }
             /* if there was a general error, it may have been destroyed out from
              * underneath us, so just exit (which is really an invalid state anyway)
@@ -106,7 +194,7 @@ status_t mutex_acquire_timeout(mutex_t *m, lk_time_t timeout) {
         }
     }
 
-    m->holder = get_current_thread();
+    m->holder = current;
 
 err:
     THREAD_UNLOCK(state);
@@ -126,11 +214,16 @@ status_t mutex_release(mutex_t *m) {
     }
 #endif
 
-    THREAD_LOCK(state);
-
     m->holder = 0;
 
-    if (unlikely(--m->count >= 1)) {
+    int expected = 1;
+    if (likely(__atomic_compare_exchange_n(&m->count, &expected, 0, false,
+                                           __ATOMIC_RELEASE, __ATOMIC_RELAXED)))
+        return NO_ERROR;
+
+    THREAD_LOCK(state);
+
+    if (likely(__atomic_fetch_sub(&m->count, 1, __ATOMIC_RELEASE) > 1)) {
         /* release a thread */
         wait_queue_wake_one(&m->wait, true, NO_ERROR);
     }
@@ -138,4 +231,3 @@ status_t mutex_release(mutex_t *m) {
     THREAD_UNLOCK(state);
     return NO_ERROR;
 }
-
@@ -4,7 +4,8 @@ MODULE := $(LOCAL_DIR)
 
 MODULE_DEPS := \
 	lib/libc \
-	lib/heap
+	lib/heap \
+	lib/pool
 
 MODULE_SRCS := \
 	$(LOCAL_DIR)/debug.c \
@@ -17,6 +18,13 @@ MODULE_SRCS := \
 	$(LOCAL_DIR)/mp.c \
 	$(LOCAL_DIR)/port.c
 
+# per lock contention statistics, see kernel/spinlock.c
+WITH_SPINLOCK_STATS ?= 0
+ifeq (true,$(call TOBOOL,$(WITH_SPINLOCK_STATS)))
+GLOBAL_DEFINES += WITH_SPINLOCK_STATS=1
+MODULE_SRCS += $(LOCAL_DIR)/spinlock.c
+endif
+
 ifeq ($(WITH_KERNEL_VM),1)
 MODULE_DEPS += kernel/vm
 else
@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#include <kernel/spinlock.h>
+
+#include <arch/ops.h>
+#include <lk/console_cmd.h>
+#include <lk/debug.h>
+#include <lk/err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Per lock contention statistics. Registered locks live in a small open
+ * addressed table keyed by the lock's address; lookups never take a lock and
+ * registration claims a slot with a compare and swap. Every counter in an
+ * entry is only written while holding the lock it describes, so the lock
+ * itself serializes the updates.
+ */
+
+#define SPIN_LOCK_STATS_SLOTS 64 // power of 2
+
+struct spin_lock_stats {
+    spin_lock_t *lock;
+    const char *name;
+
+    ulong acquires;
+    ulong contended;
+    uint64_t spin_cycles;
+    ulong max_spin_cycles;
+    ulong max_hold_cycles;
+
+    ulong hold_start;
+};
+
+static struct spin_lock_stats spin_lock_stats[SPIN_LOCK_STATS_SLOTS];
+
+static uint spin_lock_stats_hash(spin_lock_t *lock) {
+    uintptr_t a = (uintptr_t)lock / sizeof(spin_lock_t);
+
+    return (uint)((a * 0x9e3779b1u) >> 8) & (SPIN_LOCK_STATS_SLOTS - 1);
+}
+
+static struct spin_lock_stats *spin_lock_stats_lookup(spin_lock_t *lock) {
+    uint slot = spin_lock_stats_hash(lock);
+
+    for (uint i = 0; i < SPIN_LOCK_STATS_SLOTS; i++) {
+        struct spin_lock_stats *s = &spin_lock_stats[(slot + i) & (SPIN_LOCK_STATS_SLOTS - 1)];
+        spin_lock_t *l = __atomic_load_n(&s->lock, __ATOMIC_ACQUIRE);
+        if (l == lock)
+            return s;
+        if (l == NULL)
+            return NULL;
+    }
+
+    return NULL;
+}
+
+void spin_lock_stats_register(spin_lock_t *lock, const char *name) {
+    uint slot = spin_lock_stats_hash(lock);
+
+    for (uint i = 0; i < SPIN_LOCK_STATS_SLOTS; i++) {
+        struct spin_lock_stats *s = &spin_lock_stats[(slot + i) & (SPIN_LOCK_STATS_SLOTS - 1)];
+        spin_lock_t *expected = NULL;
+        if (__atomic_compare_exchange_n(&s->lock, &expected, lock, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            s->name = name;
+            return;
+        }
+        if (expected == lock)
+            return;
+    }
+
+    dprintf(INFO, "spinlock stats: no room to track lock %p (%s)\n", lock, name);
+}
+
+static void spin_lock_stats_acquired(struct spin_lock_stats *s, ulong spin) {
+    s->acquires++;
+    if (spin) {
+        s->contended++;
+        s->spin_cycles += spin;
+        if (spin > s->max_spin_cycles)
+            s->max_spin_cycles = spin;
+    }
+    s->hold_start = arch_cycle_count();
+}
+
+void spin_lock_stats_lock(spin_lock_t *lock) {
+    struct spin_lock_stats *s = spin_lock_stats_lookup(lock);
+    ulong spin = 0;
+
+    if (arch_spin_trylock(lock)) {
+        ulong start = arch_cycle_count();
+        arch_spin_lock(lock);
+        spin = arch_cycle_count() - start;
+    }
+
+    if (s)
+        spin_lock_stats_acquired(s, spin);
+}
+
+int spin_lock_stats_trylock(spin_lock_t *lock) {
+    int ret = arch_spin_trylock(lock);
+
+    if (ret == 0) {
+        struct spin_lock_stats *s = spin_lock_stats_lookup(lock);
+        if (s)
+            spin_lock_stats_acquired(s, 0);
+    }
+
+    return ret;
+}
+
+void spin_lock_stats_unlock(spin_lock_t *lock) {
+    struct spin_lock_stats *s = spin_lock_stats_lookup(lock);
+
+    if (s) {
+        ulong hold = arch_cycle_count() - s->hold_start;
+        if (hold > s->max_hold_cycles)
+            s->max_hold_cycles = hold;
+    }
+
+    arch_spin_unlock(lock);
+}
+
+#if LK_DEBUGLEVEL > 0
+
+static int cmd_spinlocks(int argc, const console_cmd_args *argv) {
+    bool reset = false;
+
+    if (argc >= 2 && !strcmp(argv[1].str, "reset")) {
+        reset = true;
+    } else if (argc >= 2) {
+        printf("usage:\n");
+        printf("%s\n", argv[0].str);
+        printf("%s reset\n", argv[0].str);
+        return ERR_INVALID_ARGS;
+    }
+
+    if (!reset)
+        printf("%-16s %-18s %10s %10s %12s %10s %10s\n", "name", "lock", "acquires",
+               "contended", "avg spin", "max spin", "max hold");
+
+    for (uint i = 0; i < SPIN_LOCK_STATS_SLOTS; i++) {
+        struct spin_lock_stats *s = &spin_lock_stats[i];
+        if (!s->lock)
+            continue;
+
+        /* the counters are owned by the lock, so update or snapshot them
+         * under it */
+        arch_interrupt_saved_state_t state = arch_interrupt_save();
+        arch_spin_lock(s->lock);
+        struct spin_lock_stats snap = *s;
+        if (reset) {
+            s->acquires = 0;
+            s->contended = 0;
+            s->spin_cycles = 0;
+            s->max_spin_cycles = 0;
+            s->max_hold_cycles = 0;
+        }
+        arch_spin_unlock(s->lock);
+        arch_interrupt_restore(state);
+
+        if (!reset)
+            printf("%-16s %-18p %10lu %10lu %12llu %10lu %10lu\n", snap.name, snap.lock,
+                   snap.acquires, snap.contended,
+                   snap.contended ? (unsigned long long)(snap.spin_cycles / snap.contended) : 0,
+                   snap.max_spin_cycles, snap.max_hold_cycles);
+    }
+
+    if (!reset)
+        printf("spin and hold times are in cycles\n");
+
+    return NO_ERROR;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("spinlocks", "spinlock contention stats", &cmd_spinlocks)
+STATIC_COMMAND_END(spinlocks);
+
+#endif
@@ -6,6 +6,7 @@ MODULE_SRCS += \
 	$(LOCAL_DIR)/clock_tests.c \
 	$(LOCAL_DIR)/port_tests.c \
 	$(LOCAL_DIR)/thread_tests.c \
+	$(LOCAL_DIR)/timer_tests.c \
 
 MODULE_DEPS += \
 	kernel \
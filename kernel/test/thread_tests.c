@@ -21,6 +21,7 @@
 #include <rand.h>
 #include <arch/atomic.h>
 #include <kernel/event.h>
+#include <kernel/mp.h>
 #include <kernel/mutex.h>
 #include <kernel/semaphore.h>
 #include <kernel/thread.h>
@@ -338,6 +339,90 @@ static bool test_event_autounsignal(void) {
     END_TEST;
 }
 
+/* -------------------------------------------------------------------------- */
+/* spinlocks                                                                   */
+/* -------------------------------------------------------------------------- */
+
+static bool test_spinlock_basic(void) {
+    BEGIN_TEST;
+
+    spin_lock_t lock;
+    spin_lock_init(&lock);
+
+    EXPECT_FALSE(spin_lock_held(&lock), "initialized lock is held");
+
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&lock);
+    EXPECT_TRUE(spin_lock_held(&lock), "lock is not held after acquire");
+#if WITH_SMP
+    EXPECT_NE(0, spin_trylock(&lock), "trylock of a held lock succeeded");
+#endif
+    spin_unlock_irqrestore(&lock, state);
+    EXPECT_FALSE(spin_lock_held(&lock), "lock is held after release");
+
+    state = arch_interrupt_save();
+    EXPECT_EQ(0, spin_trylock(&lock), "trylock of a free lock failed");
+    EXPECT_TRUE(spin_lock_held(&lock), "lock is not held after trylock");
+    spin_unlock(&lock);
+    arch_interrupt_restore(state);
+
+    /* enough round trips to wrap any internal ticket counters */
+    state = arch_interrupt_save();
+    for (uint i = 0; i < 0x20000; i++) {
+        spin_lock(&lock);
+        spin_unlock(&lock);
+    }
+    arch_interrupt_restore(state);
+    EXPECT_FALSE(spin_lock_held(&lock), "lock is held after many round trips");
+
+    END_TEST;
+}
+
+#define SPINLOCK_ITERATIONS 10000
+
+static spin_lock_t spinlock_test_lock = SPIN_LOCK_INITIAL_VALUE;
+static volatile uint spinlock_test_value;
+
+static int spinlock_tester(void *arg) {
+    for (int i = 0; i < SPINLOCK_ITERATIONS; i++) {
+        arch_interrupt_saved_state_t state = spin_lock_irqsave(&spinlock_test_lock);
+        /* deliberately not atomic, the lock is what keeps this coherent */
+        spinlock_test_value = spinlock_test_value + 1;
+        spin_unlock_irqrestore(&spinlock_test_lock, state);
+    }
+
+    return 0;
+}
+
+static bool test_spinlock_mutual_exclusion(void) {
+    BEGIN_TEST;
+
+    spinlock_test_value = 0;
+
+    /* one thread per active cpu so the lock is really contended */
+    thread_t *threads[SMP_MAX_CPUS];
+    uint count = 0;
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        if (!mp_is_cpu_active(i))
+            continue;
+        threads[count] = thread_create("spinlock tester", &spinlock_tester, NULL,
+                                       LOW_PRIORITY, DEFAULT_STACK_SIZE);
+        ASSERT_NONNULL(threads[count], "could not create spinlock tester thread");
+        thread_set_pinned_cpu(threads[count], i);
+        count++;
+    }
+
+    for (uint i = 0; i < count; i++)
+        thread_resume(threads[i]);
+
+    for (uint i = 0; i < count; i++)
+        thread_join(threads[i], NULL, INFINITE_TIME);
+
+    EXPECT_EQ(count * SPINLOCK_ITERATIONS, spinlock_test_value, "lost updates under the lock");
+    EXPECT_FALSE(spin_lock_held(&spinlock_test_lock), "lock is held after the test");
+
+    END_TEST;
+}
+
 /* -------------------------------------------------------------------------- */
 /* atomics                                                                     */
 /* -------------------------------------------------------------------------- */
@@ -461,6 +546,8 @@ RUN_TEST(test_semaphore);
 RUN_TEST(test_event_static_init);
 RUN_TEST(test_event_broadcast);
 RUN_TEST(test_event_autounsignal);
+RUN_TEST(test_spinlock_basic);
+RUN_TEST(test_spinlock_mutual_exclusion);
 RUN_TEST(test_atomic_add);
 RUN_TEST(test_thread_join);
 RUN_TEST(test_thread_join_after_exit);
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+/*
+ * Correctness tests for kernel timers. The deadlines below are chosen to land
+ * on either side of the timer wheel's level boundaries, so that both direct
+ * expiry and cascading from coarser levels get exercised, while keeping the
+ * whole case well under a second for the boot time `ut all` run. The cost
+ * benchmarks live in app/tests/timer_tests.c.
+ */
+#include <lib/unittest.h>
+
+#include <arch/atomic.h>
+#include <kernel/event.h>
+#include <kernel/thread.h>
+#include <kernel/timer.h>
+#include <lk/err.h>
+#include <platform.h>
+
+static const lk_time_t order_delays[] = { 1, 3, 63, 64, 65, 127, 128, 129, 200, 70, 2, 300 };
+
+static timer_t order_timers[countof(order_delays)];
+static lk_time_t order_deadline[countof(order_delays)];
+static lk_time_t order_fired_at[countof(order_delays)];
+static uint order_fired_seq[countof(order_delays)];
+static volatile int order_fired_count;
+static event_t order_done;
+
+static enum handler_return order_callback(timer_t *t, lk_time_t now, void *arg) {
+    uint i = (uintptr_t)arg;
+
+    order_fired_at[i] = now;
+    order_fired_seq[i] = atomic_add(&order_fired_count, 1);
+    if (order_fired_seq[i] == countof(order_delays) - 1)
+        event_signal(&order_done, false);
+
+    return INT_NO_RESCHEDULE;
+}
+
+static bool test_timer_order(void) {
+    BEGIN_TEST;
+
+    event_init(&order_done, false, 0);
+    order_fired_count = 0;
+
+    /* keep every timer on one cpu's wheel so the firing sequence is total */
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
+    for (uint i = 0; i < countof(order_delays); i++) {
+        timer_initialize(&order_timers[i]);
+        order_deadline[i] = current_time() + order_delays[i];
+        timer_set_oneshot(&order_timers[i], order_delays[i], order_callback, (void *)(uintptr_t)i);
+    }
+    arch_interrupt_restore(state);
+
+    ASSERT_EQ(NO_ERROR, event_wait_timeout(&order_done, 5000), "timers did not all fire");
+
+    for (uint i = 0; i < countof(order_delays); i++) {
+        EXPECT_FALSE(TIME_LT(order_fired_at[i], order_deadline[i]), "timer fired early");
+        for (uint j = 0; j < countof(order_delays); j++) {
+            /* a timer due strictly later must never fire strictly first */
+            if (order_delays[j] > order_delays[i] + 1) {
+                EXPECT_LT(order_fired_seq[i], order_fired_seq[j], "timers fired out of order");
+            }
+        }
+    }
+
+    event_destroy(&order_done);
+
+    END_TEST;
+}
+
+#define CANCEL_TIMERS 32
+
+static volatile int cancel_fired_mask;
+
+static enum handler_return cancel_callback(timer_t *t, lk_time_t now, void *arg) {
+    atomic_or(&cancel_fired_mask, 1 << (uintptr_t)arg);
+    return INT_NO_RESCHEDULE;
+}
+
+static bool test_timer_cancel(void) {
+    BEGIN_TEST;
+
+    static timer_t timers[CANCEL_TIMERS];
+
+    cancel_fired_mask = 0;
+    for (uint i = 0; i < CANCEL_TIMERS; i++) {
+        timer_initialize(&timers[i]);
+        timer_set_oneshot(&timers[i], 20 + i * 3, cancel_callback, (void *)(uintptr_t)i);
+    }
+    for (uint i = 1; i < CANCEL_TIMERS; i += 2) {
+        timer_cancel(&timers[i]);
+    }
+
+    thread_sleep(20 + CANCEL_TIMERS * 3 + 50);
+
+    EXPECT_EQ(0x55555555, cancel_fired_mask, "only the uncanceled timers should fire");
+
+    /* canceling a timer that already fired is harmless */
+    for (uint i = 0; i < CANCEL_TIMERS; i++) {
+        timer_cancel(&timers[i]);
+    }
+
+    END_TEST;
+}
+
+static volatile int periodic_count;
+
+static enum handler_return periodic_callback(timer_t *t, lk_time_t now, void *arg) {
+    atomic_add(&periodic_count, 1);
+    return INT_NO_RESCHEDULE;
+}
+
+static bool test_timer_periodic(void) {
+    BEGIN_TEST;
+
+    timer_t timer;
+    timer_initialize(&timer);
+
+    periodic_count = 0;
+    timer_set_periodic(&timer, 5, periodic_callback, NULL);
+    thread_sleep(100);
+    timer_cancel(&timer);
+
+    int count = periodic_count;
+    EXPECT_GE(count, 5, "periodic timer fired too few times");
+    EXPECT_LE(count, 21, "periodic timer fired too many times");
+
+    thread_sleep(20);
+    EXPECT_EQ(count, periodic_count, "periodic timer fired after cancel");
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(timer_tests)
+RUN_TEST(test_timer_order);
+RUN_TEST(test_timer_cancel);
+RUN_TEST(test_timer_periodic);
+END_TEST_CASE(timer_tests)
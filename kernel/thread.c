@@ -23,6 +23,7 @@
 #include <kernel/mp.h>
 #include <kernel/timer.h>
 #include <lib/heap.h>
+#include <lib/kmem_cache.h>
 #include <lk/backtrace.h>
 #include <lk/debug.h>
 #include <lk/err.h>
@@ -52,12 +53,34 @@ struct list_node thread_list;
 /* master thread spinlock */
 spin_lock_t thread_lock = SPIN_LOCK_INITIAL_VALUE;
 
-/* the run queue */
-static struct list_node run_queue[NUM_PRIORITIES];
-static uint32_t run_queue_bitmap;
+/* object cache for dynamically allocated thread structures */
+static kmem_cache_t *thread_cache;
+
+/* detached threads that have exited, waiting for their structure to be freed.
+ * Protected by thread_lock; by the time anyone else holds the lock and sees a
+ * thread here it has switched away for good. */
+static struct list_node dead_thread_list = LIST_INITIAL_VALUE(dead_thread_list);
+
+/* the run queues, one per cpu.
+ *
+ * A ready thread sits in exactly one cpu's queue: the cpu it is pinned to, or
+ * for an unpinned thread the cpu picked for it when it was made runnable. A cpu
+ * only ever dequeues from its own queue, except when it is about to go idle and
+ * steals a thread that may run there from the busiest sibling. All of the
+ * queues are still covered by thread_lock, which also guards thread state and
+ * wait queues.
+ */
+struct run_queue {
+    struct list_node list[NUM_PRIORITIES];
+    uint32_t bitmap;
+    uint count;
+    int curr_priority; /* priority of the thread running on this cpu */
+} __CPU_ALIGN;
+
+static struct run_queue run_queues[SMP_MAX_CPUS];
 
 /* make sure the bitmap is large enough to cover our number of priorities */
-STATIC_ASSERT(NUM_PRIORITIES <= sizeof(run_queue_bitmap) * 8);
+STATIC_ASSERT(NUM_PRIORITIES <= sizeof(run_queues[0].bitmap) * 8);
 
 /* the idle thread(s) (statically allocated) */
 #if WITH_SMP
@@ -77,47 +100,134 @@ static void idle_thread_routine(void) __NO_RETURN;
 static timer_t preempt_timer[SMP_MAX_CPUS];
 #endif
 
+/* pick the cpu whose run queue a ready thread should be placed on */
+static uint select_cpu_for_thread(thread_t *t) {
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    int pinned_cpu = thread_pinned_cpu(t);
+    if (pinned_cpu >= 0)
+        return pinned_cpu;
+
+#if WITH_SMP
+    uint local_cpu = arch_curr_cpu_num();
+    int last_cpu = thread_last_cpu(t);
+    mp_cpu_mask_t active = mp.active_cpus;
+
+    /* the current thread going back in the queue stays local */
+    if (t == get_current_thread())
+        return local_cpu;
+
+    /* an idle cpu with nothing queued can take it right away, preferring
+     * the one it last ran on */
+    mp_cpu_mask_t idle = mp_get_idle_mask() & active;
+    if (last_cpu >= 0 && (idle & (1U << last_cpu)) && run_queues[last_cpu].count == 0)
+        return last_cpu;
+    for (uint cpu = 0; idle != 0 && cpu < SMP_MAX_CPUS; cpu++) {
+        if ((idle & (1U << cpu)) && run_queues[cpu].count == 0)
+            return cpu;
+    }
+
+    /* otherwise see if it would preempt a lower priority thread somewhere,
+     * leaving cpus running realtime threads alone */
+    mp_cpu_mask_t candidates = active & ~mp_get_realtime_mask();
+    int target = -1;
+    int lowest = t->priority;
+    for (uint cpu = 0; candidates != 0 && cpu < SMP_MAX_CPUS; cpu++) {
+        if ((candidates & (1U << cpu)) && run_queues[cpu].curr_priority < lowest) {
+            lowest = run_queues[cpu].curr_priority;
+            target = cpu;
+        }
+    }
+    if (target >= 0)
+        return target;
+
+    /* everyone is busy with at least as important work, queue it where it
+     * last ran to keep its cache footprint */
+    if (last_cpu >= 0 && (candidates & (1U << last_cpu)))
+        return last_cpu;
+
+    return local_cpu;
+#else
+    return 0;
+#endif
+}
+
 /* run queue manipulation */
-static void insert_in_run_queue_head(thread_t *t) {
+static uint insert_in_run_queue_head(thread_t *t) {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
     DEBUG_ASSERT(t->state == THREAD_READY);
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
     DEBUG_ASSERT(arch_ints_disabled());
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
-    list_add_head(&run_queue[t->priority], &t->queue_node);
-    run_queue_bitmap |= (1<<t->priority);
+    uint cpu = select_cpu_for_thread(t);
+    struct run_queue *rq = &run_queues[cpu];
+
+    list_add_head(&rq->list[t->priority], &t->queue_node);
+    rq->bitmap |= (1<<t->priority);
+    rq->count++;
+
+    return cpu;
 }
 
-static void insert_in_run_queue_tail(thread_t *t) {
+static uint insert_in_run_queue_tail(thread_t *t) {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
     DEBUG_ASSERT(t->state == THREAD_READY);
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
     DEBUG_ASSERT(arch_ints_disabled());
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
-    list_add_tail(&run_queue[t->priority], &t->queue_node);
-    run_queue_bitmap |= (1<<t->priority);
+    uint cpu = select_cpu_for_thread(t);
+    struct run_queue *rq = &run_queues[cpu];
+
+    list_add_tail(&rq->list[t->priority], &t->queue_node);
+    rq->bitmap |= (1<<t->priority);
+    rq->count++;
+
+    return cpu;
 }
 
-static void wakeup_cpu_for_thread(thread_t *t)
-{
-    /* Wake up the core to which this thread is pinned
-     * or wake up all if thread is unpinned */
-    int pinned_cpu = thread_pinned_cpu(t);
-    if (pinned_cpu < 0)
-        mp_reschedule(MP_CPU_ALL_BUT_LOCAL, 0);
-    else
-        mp_reschedule(1U << pinned_cpu, 0);
+static void remove_from_run_queue(struct run_queue *rq, thread_t *t) {
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(list_in_list(&t->queue_node));
+    DEBUG_ASSERT(rq->count > 0);
+
+    list_delete(&t->queue_node);
+    rq->count--;
+    if (list_is_empty(&rq->list[t->priority]))
+        rq->bitmap &= ~(1<<t->priority);
+}
+
+/* Wake up the core whose run queue this thread was placed on. */
+static void wakeup_cpu_for_thread(uint cpu) {
+    mp_reschedule(1U << cpu, 0);
 }
 
 static void init_thread_struct(thread_t *t, const char *name) {
     memset(t, 0, sizeof(thread_t));
     t->magic = THREAD_MAGIC;
     thread_set_pinned_cpu(t, -1);
+    thread_set_last_cpu(t, -1);
     strlcpy(t->name, name, sizeof(t->name));
 }
 
+/* free the structures of detached threads that have exited since the last call */
+static void thread_free_dead(void) {
+    if (list_is_empty(&dead_thread_list))
+        return;
+
+    struct list_node list = LIST_INITIAL_VALUE(list);
+    THREAD_LOCK(state);
+    struct list_node *node;
+    while ((node = list_remove_head(&dead_thread_list)))
+        list_add_tail(&list, node);
+    THREAD_UNLOCK(state);
+
+    thread_t *t;
+    while ((t = list_remove_head_type(&list, thread_t, thread_list_node)))
+        kmem_cache_free(thread_cache, t);
+}
+
 /**
  * @brief  Create a new thread
  *
@@ -149,7 +259,9 @@ thread_t *thread_create_etc(thread_t *t, const char *name, thread_start_routine
     unsigned int flags = 0;
 
     if (!t) {
-        t = malloc(sizeof(thread_t));
+        DEBUG_ASSERT(thread_cache);
+        thread_free_dead();
+        t = kmem_cache_alloc(thread_cache);
         if (!t)
             return NULL;
         flags |= THREAD_FLAG_FREE_STRUCT;
@@ -181,7 +293,7 @@ thread_t *thread_create_etc(thread_t *t, const char *name, thread_start_routine
         t->stack = malloc(stack_size);
         if (!t->stack) {
             if (flags & THREAD_FLAG_FREE_STRUCT)
-                free(t);
+                kmem_cache_free(thread_cache, t);
             return NULL;
         }
         flags |= THREAD_FLAG_FREE_STACK;
@@ -285,12 +397,12 @@ status_t thread_resume(thread_t *t) {
     THREAD_LOCK(state);
     if (t->state == THREAD_SUSPENDED) {
         t->state = THREAD_READY;
-        insert_in_run_queue_head(t);
+        uint cpu = insert_in_run_queue_head(t);
         if (!ints_disabled) /* HACK, don't resced into bootstrap thread before idle thread is set up */
             resched = true;
-    }
 
-    wakeup_cpu_for_thread(t);
+        wakeup_cpu_for_thread(cpu);
+    }
 
     THREAD_UNLOCK(state);
 
@@ -350,7 +462,7 @@ status_t thread_join(thread_t *t, int *retcode, lk_time_t timeout) {
         free(t->stack);
 
     if (t->flags & THREAD_FLAG_FREE_STRUCT)
-        free(t);
+        kmem_cache_free(thread_cache, t);
 
     return NO_ERROR;
 }
@@ -416,7 +528,7 @@ void thread_exit(int retcode) {
         }
 
         if (current_thread->flags & THREAD_FLAG_FREE_STRUCT)
-            heap_delayed_free(current_thread);
+            list_add_tail(&dead_thread_list, &current_thread->thread_list_node);
     } else {
         /* signal if anyone is waiting */
         wait_queue_wake_all(&current_thread->retcode_wait_queue, false, 0);
@@ -433,30 +545,67 @@ static void idle_thread_routine(void) {
         arch_idle();
 }
 
-static thread_t *get_top_thread(int cpu) {
-    thread_t *newthread;
-    uint32_t local_run_queue_bitmap = run_queue_bitmap;
+#if WITH_SMP
+/* Pull the highest priority thread that may run here off the busiest sibling's
+ * run queue. Only called by a cpu that has nothing of its own left to run.
+ */
+static thread_t *steal_thread(uint cpu) {
+    struct run_queue *busiest = NULL;
 
-    while (local_run_queue_bitmap) {
-        /* find the first (remaining) queue with a thread in it */
-        uint next_queue = sizeof(run_queue_bitmap) * 8 - 1 - __builtin_clz(local_run_queue_bitmap);
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        if (i == cpu || run_queues[i].count == 0)
+            continue;
+        if (!busiest || run_queues[i].count > busiest->count)
+            busiest = &run_queues[i];
+    }
+    if (!busiest)
+        return NULL;
+
+    uint32_t bitmap = busiest->bitmap;
+    while (bitmap) {
+        uint next_queue = sizeof(bitmap) * 8 - 1 - __builtin_clz(bitmap);
+
+        thread_t *t;
+        list_for_every_entry(&busiest->list[next_queue], t, thread_t, queue_node) {
+            if (t->pinned_cpu < 0 || t->pinned_cpu == (int)cpu) {
+                remove_from_run_queue(busiest, t);
+                THREAD_STATS_INC(steals);
+                return t;
+            }
+        }
 
-        list_for_every_entry(&run_queue[next_queue], newthread, thread_t, queue_node) {
-#if WITH_SMP
-            if (newthread->pinned_cpu < 0 || newthread->pinned_cpu == cpu)
+        bitmap &= ~(1<<next_queue);
+    }
+
+    return NULL;
+}
 #endif
-            {
-                list_delete(&newthread->queue_node);
 
-                if (list_is_empty(&run_queue[next_queue]))
-                    run_queue_bitmap &= ~(1<<next_queue);
+static thread_t *get_top_thread(uint cpu) {
+    struct run_queue *rq = &run_queues[cpu];
 
-                return newthread;
-            }
-        }
+    while (likely(rq->bitmap)) {
+        uint next_queue = sizeof(rq->bitmap) * 8 - 1 - __builtin_clz(rq->bitmap);
+        thread_t *newthread = list_peek_head_type(&rq->list[next_queue], thread_t, queue_node);
+
+        remove_from_run_queue(rq, newthread);
 
-        local_run_queue_bitmap &= ~(1<<next_queue);
+        int pinned_cpu = thread_pinned_cpu(newthread);
+        if (likely(pinned_cpu < 0 || pinned_cpu == (int)cpu))
+            return newthread;
+
+        /* thread_set_pinned_cpu() moved it elsewhere while it was queued
+         * here, hand it over to the cpu it now belongs on */
+        wakeup_cpu_for_thread(insert_in_run_queue_head(newthread));
     }
+
+#if WITH_SMP
+    /* about to go idle, see if a sibling has spare work */
+    thread_t *stolen = steal_thread(cpu);
+    if (stolen)
+        return stolen;
+#endif
+
     /* no threads to run, select the idle thread for this cpu */
     return idle_thread(cpu);
 }
@@ -489,6 +638,7 @@ void thread_resched(void) {
     DEBUG_ASSERT(newthread);
 
     newthread->state = THREAD_RUNNING;
+    run_queues[cpu].curr_priority = newthread->priority;
 
     oldthread = current_thread;
 
@@ -502,6 +652,7 @@ void thread_resched(void) {
 
     /* mark the cpu ownership of the threads */
     thread_set_curr_cpu(oldthread, -1);
+    thread_set_last_cpu(oldthread, cpu);
     thread_set_curr_cpu(newthread, cpu);
 
 #if WITH_SMP
@@ -627,7 +778,9 @@ void thread_yield(void) {
     current_thread->state = THREAD_READY;
     current_thread->remaining_quantum = 0;
     if (likely(!thread_is_idle(current_thread))) { /* idle thread doesn't go in the run queue */
-        insert_in_run_queue_tail(current_thread);
+        /* normally our own queue, unless we were just pinned elsewhere */
+        uint cpu = insert_in_run_queue_tail(current_thread);
+        wakeup_cpu_for_thread(cpu);
     }
     thread_resched();
 
@@ -667,10 +820,12 @@ void thread_preempt(void) {
     /* we are being preempted, so we get to go back into the front of the run queue if we have quantum left */
     current_thread->state = THREAD_READY;
     if (likely(!thread_is_idle(current_thread))) { /* idle thread doesn't go in the run queue */
+        uint cpu;
         if (current_thread->remaining_quantum > 0)
-            insert_in_run_queue_head(current_thread);
+            cpu = insert_in_run_queue_head(current_thread);
         else
-            insert_in_run_queue_tail(current_thread); /* if we're out of quantum, go to the tail of the queue */
+            cpu = insert_in_run_queue_tail(current_thread); /* if we're out of quantum, go to the tail of the queue */
+        wakeup_cpu_for_thread(cpu);
     }
     thread_resched();
 
@@ -706,8 +861,8 @@ void thread_unblock(thread_t *t, bool resched) {
     DEBUG_ASSERT(!thread_is_idle(t));
 
     t->state = THREAD_READY;
-    insert_in_run_queue_head(t);
-    wakeup_cpu_for_thread(t);
+    uint cpu = insert_in_run_queue_head(t);
+    wakeup_cpu_for_thread(cpu);
 
     if (resched)
         thread_resched();
@@ -737,7 +892,8 @@ static enum handler_return thread_sleep_handler(timer_t *timer, lk_time_t now, v
     THREAD_LOCK(state);
 
     t->state = THREAD_READY;
-    insert_in_run_queue_head(t);
+    uint cpu = insert_in_run_queue_head(t);
+    wakeup_cpu_for_thread(cpu);
 
     THREAD_UNLOCK(state);
 
@@ -782,9 +938,13 @@ void thread_init_early(void) {
 
     DEBUG_ASSERT(arch_curr_cpu_num() == 0);
 
+    spin_lock_stats_register(&thread_lock, "thread");
+
     /* initialize the run queues */
-    for (i=0; i < NUM_PRIORITIES; i++)
-        list_initialize(&run_queue[i]);
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        for (i=0; i < NUM_PRIORITIES; i++)
+            list_initialize(&run_queues[cpu].list[i]);
+    }
 
     /* initialize the thread list */
     list_initialize(&thread_list);
@@ -810,6 +970,12 @@ void thread_init_early(void) {
  * This function is called once at boot time
  */
 void thread_init(void) {
+    thread_cache = kmem_cache_create("thread", sizeof(thread_t), __alignof(thread_t), NULL);
+    if (!thread_cache)
+        panic("failed to create thread cache\n");
+    /* mutex_adaptive_spin() reads the holder's state without holding anything */
+    kmem_cache_set_type_stable(thread_cache);
+
 #if PLATFORM_HAS_DYNAMIC_TIMER
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
         timer_initialize(&preempt_timer[i]);
@@ -842,7 +1008,8 @@ void thread_set_priority(int priority) {
     current_thread->priority = priority;
 
     current_thread->state = THREAD_READY;
-    insert_in_run_queue_head(current_thread);
+    uint cpu = insert_in_run_queue_head(current_thread);
+    wakeup_cpu_for_thread(cpu);
     thread_resched();
 
     THREAD_UNLOCK(state);
@@ -1193,8 +1360,8 @@ int wait_queue_wake_one(wait_queue_t *wait, bool reschedule, status_t wait_queue
             current_thread->state = THREAD_READY;
             insert_in_run_queue_head(current_thread);
         }
-        insert_in_run_queue_head(t);
-        wakeup_cpu_for_thread(t);
+        uint cpu = insert_in_run_queue_head(t);
+        wakeup_cpu_for_thread(cpu);
         if (reschedule) {
             thread_resched();
         }
@@ -1247,14 +1414,7 @@ int wait_queue_wake_all(wait_queue_t *wait, bool reschedule, status_t wait_queue
         t->state = THREAD_READY;
         t->wait_queue_block_ret = wait_queue_error;
         t->blocking_wait_queue = NULL;
-        int pinned_cpu = thread_pinned_cpu(t);
-        if (pinned_cpu < 0) {
-            /* assumes MP_CPU_ALL_BUT_LOCAL is defined as all bits on */
-            cpu_mask = MP_CPU_ALL_BUT_LOCAL;
-        } else {
-            cpu_mask |= (1U << pinned_cpu);
-        }
-        insert_in_run_queue_head(t);
+        cpu_mask |= (1U << insert_in_run_queue_head(t));
         ret++;
     }
 
@@ -1313,8 +1473,8 @@ status_t thread_unblock_from_wait_queue(thread_t *t, status_t wait_queue_error)
     t->blocking_wait_queue = NULL;
     t->state = THREAD_READY;
     t->wait_queue_block_ret = wait_queue_error;
-    insert_in_run_queue_head(t);
-    wakeup_cpu_for_thread(t);
+    uint cpu = insert_in_run_queue_head(t);
+    wakeup_cpu_for_thread(cpu);
 
     return NO_ERROR;
 }
@@ -34,10 +34,41 @@
 
 #define LOCAL_TRACE 0
 
-spin_lock_t timer_lock;
+/* Pending timers live in a per cpu hierarchical timing wheel. Level 0 has one
+ * slot per millisecond, and every level above it spans TIMER_WHEEL_SLOTS times
+ * as much time per slot as the one below. A timer is hashed into the lowest
+ * level whose current block contains its deadline, so setting and canceling a
+ * timer are O(1) regardless of how many are pending. When the wheel time reaches
+ * the start of an occupied slot on a higher level, the timers in it are
+ * cascaded down into the finer levels.
+ */
+#ifndef TIMER_WHEEL_BITS
+#define TIMER_WHEEL_BITS 6
+#endif
+#define TIMER_WHEEL_SLOTS (1U << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS ((32 + TIMER_WHEEL_BITS - 1) / TIMER_WHEEL_BITS)
+
+/* one bit per slot in a uint64_t occupancy bitmap */
+STATIC_ASSERT(TIMER_WHEEL_BITS <= 6);
+/* the top level wraps around with lk_time_t */
+STATIC_ASSERT(sizeof(lk_time_t) == 4);
 
 struct timer_state {
-    struct list_node timer_queue;
+    spin_lock_t lock;
+
+    /* the next millisecond the wheel has not processed yet */
+    lk_time_t wheel_time;
+    uint count;
+
+#if PLATFORM_HAS_DYNAMIC_TIMER
+    /* deadline the platform timer is currently armed for, if any */
+    bool armed;
+    lk_time_t armed_time;
+#endif
+
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+    struct list_node wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
 } __CPU_ALIGN;
 
 static struct timer_state timers[SMP_MAX_CPUS];
@@ -51,23 +82,130 @@ void timer_initialize(timer_t *timer) {
     *timer = (timer_t)TIMER_INITIAL_VALUE(*timer);
 }
 
-static void insert_timer_in_queue(uint cpu, timer_t *timer) {
-    timer_t *entry;
+static inline uint wheel_shift(uint level) {
+    return level * TIMER_WHEEL_BITS;
+}
 
-    DEBUG_ASSERT(arch_ints_disabled());
+static inline uint wheel_index(lk_time_t t, uint level) {
+    return (t >> wheel_shift(level)) & TIMER_WHEEL_MASK;
+}
+
+/* the first millisecond of the block of the level above that t falls in */
+static inline lk_time_t wheel_block_start(lk_time_t t, uint level) {
+    uint shift = wheel_shift(level + 1);
+    if (shift >= 32)
+        return 0;
+    return t & ~((1U << shift) - 1);
+}
+
+static void wheel_insert(struct timer_state *ts, timer_t *timer) {
+    lk_time_t key = timer->scheduled_time;
+
+    /* anything already due goes in the slot about to be processed */
+    if (TIME_LT(key, ts->wheel_time))
+        key = ts->wheel_time;
 
-    LTRACEF("timer %p, cpu %u, scheduled %u, periodic %u\n", timer, cpu, timer->scheduled_time, timer->periodic_time);
+    uint level;
+    for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+        if (wheel_block_start(key, level) == wheel_block_start(ts->wheel_time, level))
+            break;
+    }
+
+    uint index = wheel_index(key, level);
+    list_add_tail(&ts->wheel[level][index], &timer->node);
+    ts->occupied[level] |= 1ULL << index;
+}
 
-    list_for_every_entry(&timers[cpu].timer_queue, entry, timer_t, node) {
-        if (TIME_GT(entry->scheduled_time, timer->scheduled_time)) {
-            list_add_before(&entry->node, &timer->node);
-            return;
+static void wheel_remove(struct timer_state *ts, timer_t *timer) {
+    /* if it is alone in its slot, both neighbours are the slot's list head */
+    struct list_node *head = (timer->node.next == timer->node.prev) ? timer->node.next : NULL;
+
+    list_delete(&timer->node);
+
+    if (head) {
+        uint slot = head - &ts->wheel[0][0];
+        DEBUG_ASSERT(slot < TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS);
+        ts->occupied[slot / TIMER_WHEEL_SLOTS] &= ~(1ULL << (slot % TIMER_WHEEL_SLOTS));
+    }
+}
+
+/* Find the soonest time at or after wheel_time at which the wheel has work to
+ * do, either a level 0 slot to expire or a higher level slot to cascade.
+ */
+static bool wheel_next_event(const struct timer_state *ts, lk_time_t *next) {
+    const lk_time_t base = ts->wheel_time;
+    bool found = false;
+
+    for (uint level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        uint64_t occupied = ts->occupied[level];
+        if (!occupied)
+            continue;
+
+        /* slots behind the current one only exist on the top level, where they
+         * are the next lap around */
+        uint64_t ahead = occupied & (~0ULL << wheel_index(base, level));
+        DEBUG_ASSERT(ahead || level == TIMER_WHEEL_LEVELS - 1);
+        uint slot = __builtin_ctzll(ahead ? ahead : occupied);
+
+        lk_time_t t = wheel_block_start(base, level) + ((lk_time_t)slot << wheel_shift(level));
+        if (TIME_LT(t, base))
+            t = base;
+
+        if (!found || t - base < *next - base)
+            *next = t;
+        found = true;
+    }
+
+    return found;
+}
+
+/* move every timer in a higher level slot down into the finer levels */
+static void wheel_cascade(struct timer_state *ts, uint level, uint index) {
+    timer_t *timer;
+
+    while ((timer = list_remove_head_type(&ts->wheel[level][index], timer_t, node))) {
+        wheel_insert(ts, timer);
+    }
+    ts->occupied[level] &= ~(1ULL << index);
+}
+
+/* With nothing pending before now, jump the wheel forward so new timers hash
+ * relative to the present instead of to whenever it last ticked.
+ */
+static void wheel_catch_up(struct timer_state *ts, lk_time_t now) {
+    lk_time_t next;
+
+    if (TIME_GT(now, ts->wheel_time) &&
+            (!wheel_next_event(ts, &next) || TIME_GT(next, now))) {
+        ts->wheel_time = now;
+    }
+}
+
+#if PLATFORM_HAS_DYNAMIC_TIMER
+/* arm the local platform timer for the next thing the wheel needs to do */
+static void update_platform_timer(struct timer_state *ts, lk_time_t now) {
+    lk_time_t next;
+
+    if (!wheel_next_event(ts, &next)) {
+        if (ts->armed) {
+            LTRACEF("clearing old hw timer, nothing in the wheel\n");
+            platform_stop_timer();
+            ts->armed = false;
         }
+        return;
     }
 
-    /* walked off the end of the list */
-    list_add_tail(&timers[cpu].timer_queue, &timer->node);
+    if (ts->armed && ts->armed_time == next)
+        return;
+
+    lk_time_t delay = TIME_LT(next, now) ? 0 : next - now;
+
+    LTRACEF("setting new timer for %u msecs\n", (uint)delay);
+    platform_set_oneshot_timer(timer_tick, NULL, delay);
+    ts->armed = true;
+    ts->armed_time = next;
 }
+#endif
 
 static void timer_set(timer_t *timer, lk_time_t delay, lk_time_t period, timer_callback callback, void *arg) {
     lk_time_t now;
@@ -88,20 +226,23 @@ static void timer_set(timer_t *timer, lk_time_t delay, lk_time_t period, timer_c
 
     LTRACEF("scheduled time %u\n", timer->scheduled_time);
 
-    arch_interrupt_saved_state_t state = spin_lock_irqsave(&timer_lock);
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
 
     uint cpu = arch_curr_cpu_num();
-    insert_timer_in_queue(cpu, timer);
+    struct timer_state *ts = &timers[cpu];
+
+    spin_lock(&ts->lock);
+
+    wheel_catch_up(ts, now);
+    timer->cpu = cpu;
+    wheel_insert(ts, timer);
+    ts->count++;
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
-    if (list_peek_head_type(&timers[cpu].timer_queue, timer_t, node) == timer) {
-        /* we just modified the head of the timer queue */
-        LTRACEF("setting new timer for %u msecs\n", delay);
-        platform_set_oneshot_timer(timer_tick, NULL, delay);
-    }
+    update_platform_timer(ts, now);
 #endif
 
-    spin_unlock_irqrestore(&timer_lock, state);
+    spin_unlock_irqrestore(&ts->lock, state);
 }
 
 /**
@@ -150,16 +291,23 @@ void timer_set_periodic(timer_t *timer, lk_time_t period, timer_callback callbac
 void timer_cancel(timer_t *timer) {
     DEBUG_ASSERT(timer->magic == TIMER_MAGIC);
 
-    arch_interrupt_saved_state_t state = spin_lock_irqsave(&timer_lock);
-
-#if PLATFORM_HAS_DYNAMIC_TIMER
-    uint cpu = arch_curr_cpu_num();
-
-    timer_t *oldhead = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
-#endif
+    /* lock the wheel of whichever cpu the timer was last set on */
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
+    struct timer_state *ts;
+    for (;;) {
+        uint cpu = *(volatile uint *)&timer->cpu;
+        ts = &timers[cpu];
+        spin_lock(&ts->lock);
+        if (likely(timer->cpu == cpu))
+            break;
+        spin_unlock(&ts->lock);
+    }
 
-    if (list_in_list(&timer->node))
-        list_delete(&timer->node);
+    bool was_queued = list_in_list(&timer->node);
+    if (was_queued) {
+        wheel_remove(ts, timer);
+        ts->count--;
+    }
 
     /* to keep it from being reinserted into the queue if called from
      * periodic timer callback.
@@ -169,26 +317,14 @@ void timer_cancel(timer_t *timer) {
     timer->arg = NULL;
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
-    /* see if we've just modified the head of the timer queue */
-    timer_t *newhead = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
-    if (newhead == NULL) {
-        LTRACEF("clearing old hw timer, nothing in the queue\n");
-        platform_stop_timer();
-    } else if (newhead != oldhead) {
-        lk_time_t delay;
-        lk_time_t now = current_time();
-
-        if (TIME_LT(newhead->scheduled_time, now))
-            delay = 0;
-        else
-            delay = newhead->scheduled_time - now;
-
-        LTRACEF("setting new timer to %u\n", (uint) delay);
-        platform_set_oneshot_timer(timer_tick, NULL, delay);
+    /* only the local platform timer can be reprogrammed, a remote cpu will at
+     * worst take one spurious tick */
+    if (was_queued && ts == &timers[arch_curr_cpu_num()]) {
+        update_platform_timer(ts, current_time());
     }
 #endif
 
-    spin_unlock_irqrestore(&timer_lock, state);
+    spin_unlock_irqrestore(&ts->lock, state);
 }
 
 /* called at interrupt time to process any pending timers */
@@ -202,73 +338,89 @@ static enum handler_return timer_tick(void *arg, lk_time_t now) {
 //  KEVLOG_TIMER_TICK(); // enable only if necessary
 
     uint cpu = arch_curr_cpu_num();
+    struct timer_state *ts = &timers[cpu];
 
     LTRACEF("cpu %u now %u, sp %p\n", cpu, now, __GET_FRAME());
 
-    spin_lock(&timer_lock);
+    spin_lock(&ts->lock);
+
+#if PLATFORM_HAS_DYNAMIC_TIMER
+    /* the platform timer is one shot, so it is no longer armed */
+    ts->armed = false;
+#endif
 
     for (;;) {
         /* see if there's an event to process */
-        timer = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
-        if (likely(timer == 0))
+        lk_time_t next;
+        if (!wheel_next_event(ts, &next) || TIME_GT(next, now)) {
+            if (TIME_GT(now + 1, ts->wheel_time))
+                ts->wheel_time = now + 1;
             break;
-        LTRACEF("next item on timer queue %p at %u now %u (%p, arg %p)\n", timer, timer->scheduled_time, now, timer->callback, timer->arg);
-        if (likely(TIME_LT(now, timer->scheduled_time)))
-            break;
-
-        /* process it */
-        LTRACEF("timer %p\n", timer);
-        DEBUG_ASSERT(timer && timer->magic == TIMER_MAGIC);
-        list_delete(&timer->node);
-
-        /* we pulled it off the list, release the list lock to handle it */
-        spin_unlock(&timer_lock);
-
-        LTRACEF("dequeued timer %p, scheduled %u periodic %u\n", timer, timer->scheduled_time, timer->periodic_time);
-
-        THREAD_STATS_INC(timers);
-
-        bool periodic = timer->periodic_time > 0;
-
-        LTRACEF("timer %p firing callback %p, arg %p\n", timer, timer->callback, timer->arg);
-        KEVLOG_TIMER_CALL(timer->callback, timer->arg);
-        if (timer->callback(timer, now, timer->arg) == INT_RESCHEDULE)
-            ret = INT_RESCHEDULE;
-
-        /* it may have been requeued or periodic, grab the lock so we can safely inspect it */
-        spin_lock(&timer_lock);
+        }
+        ts->wheel_time = next;
+
+        /* cascade any higher level slot that starts here, coarsest first */
+        for (uint level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+            if ((next & ((1U << wheel_shift(level)) - 1)) != 0)
+                continue;
+            uint index = wheel_index(next, level);
+            if (ts->occupied[level] & (1ULL << index))
+                wheel_cascade(ts, level, index);
+        }
 
-        /* if it was a periodic timer and it hasn't been requeued
-         * by the callback put it back in the list
-         */
-        if (periodic && !list_in_list(&timer->node) && timer->periodic_time > 0) {
-            LTRACEF("periodic timer, period %u\n", timer->periodic_time);
-            timer->scheduled_time += timer->periodic_time;
-            if (unlikely(TIME_LT(timer->scheduled_time, now))) {
-                timer->scheduled_time = now + timer->periodic_time;
+        /* fire everything in the level 0 slot for this millisecond */
+        struct list_node *slot = &ts->wheel[0][wheel_index(next, 0)];
+        while ((timer = list_peek_head_type(slot, timer_t, node))) {
+            LTRACEF("next item on timer wheel %p at %u now %u (%p, arg %p)\n", timer, timer->scheduled_time, now, timer->callback, timer->arg);
+
+            /* process it */
+            DEBUG_ASSERT(timer && timer->magic == TIMER_MAGIC);
+            DEBUG_ASSERT(!TIME_GT(timer->scheduled_time, now));
+            wheel_remove(ts, timer);
+            ts->count--;
+
+            /* we pulled it off the wheel, release the lock to handle it */
+            spin_unlock(&ts->lock);
+
+            LTRACEF("dequeued timer %p, scheduled %u periodic %u\n", timer, timer->scheduled_time, timer->periodic_time);
+
+            THREAD_STATS_INC(timers);
+
+            bool periodic = timer->periodic_time > 0;
+
+            LTRACEF("timer %p firing callback %p, arg %p\n", timer, timer->callback, timer->arg);
+            KEVLOG_TIMER_CALL(timer->callback, timer->arg);
+            if (timer->callback(timer, now, timer->arg) == INT_RESCHEDULE)
+                ret = INT_RESCHEDULE;
+
+            /* it may have been requeued or periodic, grab the lock so we can safely inspect it */
+            spin_lock(&ts->lock);
+
+            /* if it was a periodic timer and it hasn't been requeued
+             * by the callback put it back in the wheel
+             */
+            if (periodic && !list_in_list(&timer->node) && timer->periodic_time > 0) {
+                LTRACEF("periodic timer, period %u\n", timer->periodic_time);
+                timer->scheduled_time += timer->periodic_time;
+                if (unlikely(TIME_LT(timer->scheduled_time, now))) {
+                    timer->scheduled_time = now + timer->periodic_time;
+                }
+                timer->cpu = cpu;
+                wheel_insert(ts, timer);
+                ts->count++;
             }
-            insert_timer_in_queue(cpu, timer);
         }
     }
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
     /* reset the timer to the next event */
-    timer = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
-    if (timer) {
-        /* has to be the case or it would have fired already */
-        DEBUG_ASSERT(TIME_GT(timer->scheduled_time, now));
-
-        lk_time_t delay = timer->scheduled_time - now;
+    update_platform_timer(ts, now);
 
-        LTRACEF("setting new timer for %u msecs for event %p\n", (uint)delay, timer);
-        platform_set_oneshot_timer(timer_tick, NULL, delay);
-    }
-
-    /* we're done manipulating the timer queue */
-    spin_unlock(&timer_lock);
+    /* we're done manipulating the timer wheel */
+    spin_unlock(&ts->lock);
 #else
     /* release the timer lock before calling the tick handler */
-    spin_unlock(&timer_lock);
+    spin_unlock(&ts->lock);
 
     /* let the scheduler have a shot to do quantum expiration, etc */
     /* in case of dynamic timer, the scheduler will set up a periodic timer */
@@ -280,9 +432,16 @@ static enum handler_return timer_tick(void *arg, lk_time_t now) {
 }
 
 void timer_init(void) {
-    timer_lock = SPIN_LOCK_INITIAL_VALUE;
+    lk_time_t now = current_time();
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
-        list_initialize(&timers[i].timer_queue);
+        spin_lock_init(&timers[i].lock);
+        spin_lock_stats_register(&timers[i].lock, "timer");
+        timers[i].wheel_time = now;
+        for (uint level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+            for (uint slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+                list_initialize(&timers[i].wheel[level][slot]);
+            }
+        }
     }
 #if !PLATFORM_HAS_DYNAMIC_TIMER
     /* register for a periodic timer tick */
@@ -7,8 +7,10 @@
  */
 #include <kernel/vm.h>
 
+#include <arch/ops.h>
 #include <assert.h>
 #include <kernel/mutex.h>
+#include <kernel/spinlock.h>
 #include <lk/console_cmd.h>
 #include <lk/err.h>
 #include <lk/list.h>
@@ -36,17 +38,33 @@ static mutex_t lock = MUTEX_INITIAL_VALUE(lock);
 
 struct list_node *get_arena_list(void) { return &arena_list; }
 
+/* the arena most recently matched by page_to_arena(), checked first since runs
+ * of pages being freed or translated usually come from the same arena */
+static pmm_arena_t *last_arena;
+
 static inline bool page_is_free(const vm_page_t *page) {
     return !(page->flags & VM_PAGE_FLAG_NONFREE);
 }
 
-paddr_t vm_page_to_paddr(const vm_page_t *page) {
-    pmm_arena_t *a;
+static pmm_arena_t *page_to_arena(const vm_page_t *page) {
+    pmm_arena_t *a = last_arena;
+    if (likely(a && PAGE_BELONGS_TO_ARENA(page, a)))
+        return a;
+
     list_for_every_entry(&arena_list, a, pmm_arena_t, node) {
         if (PAGE_BELONGS_TO_ARENA(page, a)) {
-            return PAGE_ADDRESS_FROM_ARENA(page, a);
+            last_arena = a;
+            return a;
         }
     }
+    return NULL;
+}
+
+paddr_t vm_page_to_paddr(const vm_page_t *page) {
+    pmm_arena_t *a = page_to_arena(page);
+    if (a) {
+        return PAGE_ADDRESS_FROM_ARENA(page, a);
+    }
     return -1;
 }
 
@@ -61,9 +79,417 @@ vm_page_t *paddr_to_vm_page(paddr_t addr) {
     return NULL;
 }
 
+/* Buddy system helpers.
+ *
+ * Blocks are aligned on their size in physical page numbers rather than on
+ * their offset into the arena, so a block of order n is always aligned to
+ * 2^n pages in physical memory, regardless of where the arena starts. The head
+ * page of a free block carries VM_PAGE_FLAG_FREE_HEAD and the order, and is the
+ * only page of the block on a free list. Every page of a free block has
+ * VM_PAGE_FLAG_NONFREE clear.
+ */
+static inline size_t arena_page_count(const pmm_arena_t *a) {
+    return a->size / PAGE_SIZE;
+}
+
+static inline paddr_t arena_pfn(const pmm_arena_t *a, size_t index) {
+    return a->base / PAGE_SIZE + index;
+}
+
+/* the largest order a block starting at index may have within the arena */
+static uint arena_max_order_at(const pmm_arena_t *a, size_t index, size_t limit) {
+    uint order = 0;
+    paddr_t pfn = arena_pfn(a, index);
+
+    while (order < PMM_MAX_ORDER &&
+            (pfn & (1UL << order)) == 0 &&
+            index + (2UL << order) <= limit) {
+        order++;
+    }
+    return order;
+}
+
+static void arena_add_free_block(pmm_arena_t *a, size_t index, uint order) {
+    vm_page_t *page = &a->page_array[index];
+
+    DEBUG_ASSERT(order <= PMM_MAX_ORDER);
+    DEBUG_ASSERT((arena_pfn(a, index) & ((1UL << order) - 1)) == 0);
+    DEBUG_ASSERT(!list_in_list(&page->node));
+
+    page->flags |= VM_PAGE_FLAG_FREE_HEAD;
+    page->order = order;
+    list_add_head(&a->free_list[order], &page->node);
+}
+
+static void arena_remove_free_block(pmm_arena_t *a, size_t index) {
+    vm_page_t *page = &a->page_array[index];
+
+    DEBUG_ASSERT(page->flags & VM_PAGE_FLAG_FREE_HEAD);
+
+    list_delete(&page->node);
+    page->flags &= ~VM_PAGE_FLAG_FREE_HEAD;
+}
+
+/* Return a single page to the arena, merging it with its buddies as far up as
+ * they are free.
+ */
+static void arena_free_page(pmm_arena_t *a, size_t index) {
+    vm_page_t *page = &a->page_array[index];
+
+    DEBUG_ASSERT(page->flags & VM_PAGE_FLAG_NONFREE);
+    page->flags &= ~VM_PAGE_FLAG_NONFREE;
+    a->free_count++;
+
+    uint order = 0;
+    while (order < PMM_MAX_ORDER) {
+        paddr_t pfn = arena_pfn(a, index);
+        paddr_t buddy_pfn = pfn ^ (1UL << order);
+
+        /* the buddy has to lie entirely inside the arena */
+        if (buddy_pfn < arena_pfn(a, 0) ||
+                buddy_pfn + (1UL << order) > arena_pfn(a, arena_page_count(a)))
+            break;
+
+        size_t buddy = index + (buddy_pfn - pfn);
+        vm_page_t *b = &a->page_array[buddy];
+        if (!(b->flags & VM_PAGE_FLAG_FREE_HEAD) || b->order != order)
+            break;
+
+        arena_remove_free_block(a, buddy);
+        if (buddy < index)
+            index = buddy;
+        order++;
+    }
+
+    arena_add_free_block(a, index, order);
+}
+
+/* Take a free block of at least the given order off the free lists, splitting
+ * a larger one if needed. Returns the index of the block or -1.
+ */
+static ssize_t arena_alloc_block(pmm_arena_t *a, uint order) {
+    uint found;
+    for (found = order; found <= PMM_MAX_ORDER; found++) {
+        if (!list_is_empty(&a->free_list[found]))
+            break;
+    }
+    if (found > PMM_MAX_ORDER)
+        return -1;
+
+    vm_page_t *page = list_peek_head_type(&a->free_list[found], vm_page_t, node);
+    size_t index = page - a->page_array;
+    arena_remove_free_block(a, index);
+
+    /* give the upper halves back until the block is the right size */
+    while (found > order) {
+        found--;
+        arena_add_free_block(a, index + (1UL << found), found);
+    }
+
+    return index;
+}
+
+/* Pull one specific free page out of whatever free block contains it,
+ * returning the rest of that block to the free lists.
+ */
+static void arena_carve_page(pmm_arena_t *a, size_t index) {
+    DEBUG_ASSERT(page_is_free(&a->page_array[index]));
+
+    /* find the head of the free block containing this page */
+    paddr_t pfn = arena_pfn(a, index);
+    size_t head = index;
+    uint order;
+    for (order = 0; order <= PMM_MAX_ORDER; order++) {
+        size_t candidate = index - (pfn & ((1UL << order) - 1));
+        if (candidate <= index && candidate < arena_page_count(a)) {
+            vm_page_t *p = &a->page_array[candidate];
+            if ((p->flags & VM_PAGE_FLAG_FREE_HEAD) && p->order == order) {
+                head = candidate;
+                break;
+            }
+        }
+    }
+    DEBUG_ASSERT(order <= PMM_MAX_ORDER);
+
+    arena_remove_free_block(a, head);
+
+    /* split down, freeing the half that does not contain the page each time */
+    while (order > 0) {
+        order--;
+        size_t upper = head + (1UL << order);
+        if (index >= upper) {
+            arena_add_free_block(a, head, order);
+            head = upper;
+        } else {
+            arena_add_free_block(a, upper, order);
+        }
+    }
+    DEBUG_ASSERT(head == index);
+}
+
+static void arena_mark_allocated(pmm_arena_t *a, size_t index, struct list_node *list) {
+    vm_page_t *page = &a->page_array[index];
+
+    DEBUG_ASSERT(page_is_free(page));
+    DEBUG_ASSERT(!list_in_list(&page->node));
+
+    page->flags |= VM_PAGE_FLAG_NONFREE;
+    a->free_count--;
+    if (list)
+        list_add_tail(list, &page->node);
+}
+
+/* hand a run of pages starting at an allocated block back one aligned block
+ * at a time, without merging into the part being kept */
+static void arena_free_run(pmm_arena_t *a, size_t index, size_t count) {
+    while (count > 0) {
+        uint order = arena_max_order_at(a, index, index + count);
+        for (size_t i = 0; i < (1UL << order); i++) {
+            a->page_array[index + i].flags &= ~VM_PAGE_FLAG_NONFREE;
+        }
+        a->free_count += 1UL << order;
+        arena_add_free_block(a, index, order);
+        index += 1UL << order;
+        count -= 1UL << order;
+    }
+}
+
+/* walk the arenas in order, allocating as many pages as we can from each */
+static size_t alloc_pages_locked(uint count, struct list_node *list, bool kmap_only) {
+    DEBUG_ASSERT(is_mutex_held(&lock));
+
+    uint allocated = 0;
+    pmm_arena_t *a;
+    list_for_every_entry(&arena_list, a, pmm_arena_t, node) {
+        if (kmap_only && !(a->flags & PMM_ARENA_FLAG_KMAP))
+            continue;
+
+        while (allocated < count && a->free_count > 0) {
+            /* take the biggest block that does not overshoot, preferring
+             * already free smaller blocks over splitting a larger one */
+            uint want = MIN(log2_uint(count - allocated), PMM_MAX_ORDER);
+            ssize_t index = -1;
+            uint order;
+            for (order = want + 1; order-- > 0; ) {
+                if (!list_is_empty(&a->free_list[order])) {
+                    index = arena_alloc_block(a, order);
+                    break;
+                }
+            }
+            if (index < 0) {
+                order = want;
+                index = arena_alloc_block(a, order);
+                if (index < 0)
+                    break;
+            }
+
+            for (size_t i = 0; i < (1UL << order); i++) {
+                arena_mark_allocated(a, index + i, list);
+            }
+            allocated += 1U << order;
+        }
+        if (allocated == count)
+            break;
+    }
+
+    return allocated;
+}
+
+static size_t free_pages_locked(struct list_node *list) {
+    DEBUG_ASSERT(is_mutex_held(&lock));
+
+    size_t count = 0;
+    while (!list_is_empty(list)) {
+        vm_page_t *page = list_remove_head_type(list, vm_page_t, node);
+
+        DEBUG_ASSERT(!list_in_list(&page->node));
+        DEBUG_ASSERT(page->flags & VM_PAGE_FLAG_NONFREE);
+
+        /* see which arena this page belongs to and add it */
+        pmm_arena_t *a = page_to_arena(page);
+        if (a) {
+            page->flags &= ~VM_PAGE_FLAG_CACHED;
+            arena_free_page(a, page - a->page_array);
+            count++;
+        }
+    }
+
+    return count;
+}
+
+/* Per cpu page caches.
+ *
+ * Single page allocations and frees go through a small per cpu stack of pages
+ * taken out of the KMAP arenas, so the common case only touches the local
+ * cpu's cache line and never takes the pmm mutex. A cache is refilled and
+ * drained PMM_PCPU_CACHE_BATCH pages at a time. Cached pages are allocated as
+ * far as the arenas are concerned and carry VM_PAGE_FLAG_CACHED; anything that
+ * needs them back (pmm_alloc_range on a cached page, running out of memory)
+ * drains every cache into the arenas first.
+ */
+#ifndef PMM_PCPU_CACHE_SIZE
+#define PMM_PCPU_CACHE_SIZE 64
+#endif
+#define PMM_PCPU_CACHE_BATCH (PMM_PCPU_CACHE_SIZE / 4)
+
+struct pmm_pcpu_cache {
+    spin_lock_t lock;
+    uint count;
+    struct list_node pages;
+
+    /* stats */
+    ulong hits;
+    ulong misses;
+    ulong refills;
+    ulong drains;
+} __CPU_ALIGN;
+
+static struct pmm_pcpu_cache pcpu_cache[SMP_MAX_CPUS];
+
+static void pcpu_cache_init(void) {
+    static bool initialized;
+
+    if (initialized)
+        return;
+
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        spin_lock_init(&pcpu_cache[i].lock);
+        list_initialize(&pcpu_cache[i].pages);
+    }
+    initialized = true;
+}
+
+/* pull count pages off the cold end of a cache, cache lock held */
+static void pcpu_cache_take_locked(struct pmm_pcpu_cache *c, uint count, struct list_node *list) {
+    while (count-- > 0 && c->count > 0) {
+        vm_page_t *page = list_remove_tail_type(&c->pages, vm_page_t, node);
+        list_add_head(list, &page->node);
+        c->count--;
+    }
+}
+
+/* return every cached page to the arenas, pmm lock held */
+static size_t pcpu_cache_drain_all_locked(void) {
+    DEBUG_ASSERT(is_mutex_held(&lock));
+
+    struct list_node list = LIST_INITIAL_VALUE(list);
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        struct pmm_pcpu_cache *c = &pcpu_cache[i];
+
+        arch_interrupt_saved_state_t state = spin_lock_irqsave(&c->lock);
+        if (c->count > 0)
+            c->drains++;
+        pcpu_cache_take_locked(c, c->count, &list);
+        spin_unlock_irqrestore(&c->lock, state);
+    }
+
+    return free_pages_locked(&list);
+}
+
+static vm_page_t *pcpu_cache_alloc(void) {
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
+    struct pmm_pcpu_cache *c = &pcpu_cache[arch_curr_cpu_num()];
+
+    spin_lock(&c->lock);
+    vm_page_t *page = list_remove_head_type(&c->pages, vm_page_t, node);
+    if (page) {
+        c->count--;
+        c->hits++;
+    } else {
+        c->misses++;
+    }
+    spin_unlock(&c->lock);
+    arch_interrupt_restore(state);
+
+    if (page) {
+        DEBUG_ASSERT(page->flags & VM_PAGE_FLAG_CACHED);
+        page->flags &= ~VM_PAGE_FLAG_CACHED;
+    }
+    return page;
+}
+
+/* grab a batch of pages for the local cache, handing the first one back */
+static vm_page_t *pcpu_cache_refill(void) {
+    struct list_node list = LIST_INITIAL_VALUE(list);
+
+    mutex_acquire(&lock);
+    size_t count = alloc_pages_locked(PMM_PCPU_CACHE_BATCH, &list, true);
+    mutex_release(&lock);
+
+    if (count == 0)
+        return NULL;
+
+    vm_page_t *first = list_remove_head_type(&list, vm_page_t, node);
+    count--;
+
+    vm_page_t *page;
+    list_for_every_entry(&list, page, vm_page_t, node) {
+        page->flags |= VM_PAGE_FLAG_CACHED;
+    }
+
+    /* we may have migrated while not holding the cache lock, so whichever cpu
+     * we are on now gets the batch */
+    struct list_node excess = LIST_INITIAL_VALUE(excess);
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
+    struct pmm_pcpu_cache *c = &pcpu_cache[arch_curr_cpu_num()];
+
+    spin_lock(&c->lock);
+    c->refills++;
+    while ((page = list_remove_head_type(&list, vm_page_t, node))) {
+        if (c->count < PMM_PCPU_CACHE_SIZE) {
+            list_add_tail(&c->pages, &page->node);
+            c->count++;
+        } else {
+            list_add_tail(&excess, &page->node);
+        }
+    }
+    spin_unlock(&c->lock);
+    arch_interrupt_restore(state);
+
+    if (!list_is_empty(&excess)) {
+        mutex_acquire(&lock);
+        free_pages_locked(&excess);
+        mutex_release(&lock);
+    }
+
+    return first;
+}
+
+static bool pcpu_cache_free(vm_page_t *page) {
+    pmm_arena_t *a = page_to_arena(page);
+    if (!a || !(a->flags & PMM_ARENA_FLAG_KMAP))
+        return false;
+
+    page->flags |= VM_PAGE_FLAG_CACHED;
+
+    struct list_node drain = LIST_INITIAL_VALUE(drain);
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
+    struct pmm_pcpu_cache *c = &pcpu_cache[arch_curr_cpu_num()];
+
+    spin_lock(&c->lock);
+    list_add_head(&c->pages, &page->node);
+    c->count++;
+    if (c->count > PMM_PCPU_CACHE_SIZE) {
+        pcpu_cache_take_locked(c, PMM_PCPU_CACHE_BATCH, &drain);
+        c->drains++;
+    }
+    spin_unlock(&c->lock);
+    arch_interrupt_restore(state);
+
+    if (!list_is_empty(&drain)) {
+        mutex_acquire(&lock);
+        free_pages_locked(&drain);
+        mutex_release(&lock);
+    }
+
+    return true;
+}
+
 status_t pmm_add_arena(pmm_arena_t *arena) {
     LTRACEF("arena %p name '%s' base 0x%lx size 0x%zx\n", arena, arena->name, arena->base, arena->size);
 
+    pcpu_cache_init();
+
     DEBUG_ASSERT(IS_PAGE_ALIGNED(arena->base));
     DEBUG_ASSERT(IS_PAGE_ALIGNED(arena->size));
     DEBUG_ASSERT(arena->size > 0);
@@ -84,7 +510,9 @@ done_add:
 
     /* zero out some of the structure */
     arena->free_count = 0;
-    list_initialize(&arena->free_list);
+    for (uint i = 0; i <= PMM_MAX_ORDER; i++) {
+        list_initialize(&arena->free_list[i]);
+    }
 
     /* allocate an array of pages to back this one */
     size_t page_count = arena->size / PAGE_SIZE;
@@ -93,13 +521,13 @@ done_add:
     /* initialize all of the pages */
     memset(arena->page_array, 0, page_count * sizeof(vm_page_t));
 
-    /* add them to the free list */
-    for (size_t i = 0; i < page_count; i++) {
-        vm_page_t *p = &arena->page_array[i];
-
-        list_add_tail(&arena->free_list, &p->node);
+    /* carve the arena into the largest aligned free blocks that fit */
+    for (size_t i = 0; i < page_count; ) {
+        uint order = arena_max_order_at(arena, i, page_count);
 
-        arena->free_count++;
+        arena_add_free_block(arena, i, order);
+        arena->free_count += 1UL << order;
+        i += 1UL << order;
     }
 
     return NO_ERROR;
@@ -111,35 +539,30 @@ size_t pmm_alloc_pages(uint count, struct list_node *list) {
     /* list must be initialized prior to calling this */
     DEBUG_ASSERT(list);
 
-    uint allocated = 0;
     if (count == 0)
         return 0;
 
     mutex_acquire(&lock);
 
-    /* walk the arenas in order, allocating as many pages as we can from each */
-    pmm_arena_t *a;
-    list_for_every_entry(&arena_list, a, pmm_arena_t, node) {
-        while (allocated < count && a->free_count > 0) {
-            vm_page_t *page = list_remove_head_type(&a->free_list, vm_page_t, node);
-            if (!page)
-                goto done;
-
-            a->free_count--;
-
-            page->flags |= VM_PAGE_FLAG_NONFREE;
-            list_add_tail(list, &page->node);
-
-            allocated++;
-        }
+    size_t allocated = alloc_pages_locked(count, list, false);
+    if (allocated < count && pcpu_cache_drain_all_locked() > 0) {
+        allocated += alloc_pages_locked(count - allocated, list, false);
     }
 
-done:
     mutex_release(&lock);
     return allocated;
 }
 
 vm_page_t *pmm_alloc_page(void) {
+    vm_page_t *page = pcpu_cache_alloc();
+    if (page)
+        return page;
+
+    page = pcpu_cache_refill();
+    if (page)
+        return page;
+
+    /* no KMAP memory left to cache, try everything else */
     struct list_node list = LIST_INITIAL_VALUE(list);
 
     size_t ret = pmm_alloc_pages(1, &list);
@@ -174,18 +597,18 @@ size_t pmm_alloc_range(paddr_t address, uint count, struct list_node *list) {
             DEBUG_ASSERT(index < a->size / PAGE_SIZE);
 
             vm_page_t *page = &a->page_array[index];
+            if (page->flags & VM_PAGE_FLAG_CACHED) {
+                /* free, but sitting in a cpu cache */
+                pcpu_cache_drain_all_locked();
+            }
             if (page->flags & VM_PAGE_FLAG_NONFREE) {
                 /* we hit an allocated page */
                 break;
             }
 
-            DEBUG_ASSERT(list_in_list(&page->node));
+            arena_carve_page(a, index);
+            arena_mark_allocated(a, index, list);
 
-            list_delete(&page->node);
-            page->flags |= VM_PAGE_FLAG_NONFREE;
-            list_add_tail(list, &page->node);
-
-            a->free_count--;
             allocated++;
             address += PAGE_SIZE;
         }
@@ -204,33 +627,32 @@ size_t pmm_free(struct list_node *list) {
     DEBUG_ASSERT(list);
 
     mutex_acquire(&lock);
+    size_t count = free_pages_locked(list);
+    mutex_release(&lock);
 
-    size_t count = 0;
-    while (!list_is_empty(list)) {
-        vm_page_t *page = list_remove_head_type(list, vm_page_t, node);
-
-        DEBUG_ASSERT(!list_in_list(&page->node));
-        DEBUG_ASSERT(page->flags & VM_PAGE_FLAG_NONFREE);
+    return count;
+}
 
-        /* see which arena this page belongs to and add it */
-        pmm_arena_t *a;
-        list_for_every_entry(&arena_list, a, pmm_arena_t, node) {
-            if (PAGE_BELONGS_TO_ARENA(page, a)) {
-                page->flags &= ~VM_PAGE_FLAG_NONFREE;
+size_t pmm_count_free_pages(void) {
+    size_t count = 0;
 
-                list_add_head(&a->free_list, &page->node);
-                a->free_count++;
-                count++;
-                break;
-            }
-        }
+    mutex_acquire(&lock);
+    pmm_arena_t *a;
+    list_for_every_entry(&arena_list, a, pmm_arena_t, node) {
+        if (a->flags & PMM_ARENA_FLAG_KMAP)
+            count += a->free_count;
     }
-
     mutex_release(&lock);
+
     return count;
 }
 
 size_t pmm_free_page(vm_page_t *page) {
+    DEBUG_ASSERT(page->flags & VM_PAGE_FLAG_NONFREE);
+
+    if (pcpu_cache_free(page))
+        return 1;
+
     struct list_node list;
     list_initialize(&list);
 
@@ -266,6 +688,12 @@ size_t pmm_free_kpages(void *_ptr, uint count) {
 
     uint8_t *ptr = (uint8_t *)_ptr;
 
+    /* fast path for single page */
+    if (count == 1) {
+        vm_page_t *p = paddr_to_vm_page(vaddr_to_paddr(ptr));
+        return p ? pmm_free_page(p) : 0;
+    }
+
     struct list_node list;
     list_initialize(&list);
 
@@ -282,6 +710,46 @@ size_t pmm_free_kpages(void *_ptr, uint count) {
     return pmm_free(&list);
 }
 
+/* Find a free run that cannot be satisfied by a single buddy block by
+ * scanning the page array at alignment boundaries.
+ */
+static ssize_t arena_find_large_run(pmm_arena_t *a, uint count, uint8_t alignment_log2) {
+    /* calculate the starting offset into this arena, based on the
+     * base address of the arena to handle the case where the arena
+     * is not aligned on the same boundary requested.
+     */
+    paddr_t rounded_base = ROUNDUP(a->base, 1UL << alignment_log2);
+    if (rounded_base < a->base || rounded_base > a->base + a->size - 1)
+        return -1;
+
+    uint aligned_offset = (rounded_base - a->base) / PAGE_SIZE;
+    uint start = aligned_offset;
+    LTRACEF("starting search at aligned offset %u\n", start);
+    LTRACEF("arena base 0x%lx size %zu\n", a->base, a->size);
+
+retry:
+    /* search while we're still within the arena and have a chance of finding a slot
+       (start + count < end of arena) */
+    while ((start < a->size / PAGE_SIZE) &&
+            ((start + count) <= a->size / PAGE_SIZE)) {
+        vm_page_t *p = &a->page_array[start];
+        for (uint i = 0; i < count; i++) {
+            if (p->flags & VM_PAGE_FLAG_NONFREE) {
+                /* this run is broken, break out of the inner loop.
+                 * start over at the next alignment boundary
+                 */
+                start = ROUNDUP(start - aligned_offset + i + 1, 1UL << (alignment_log2 - PAGE_SIZE_SHIFT)) + aligned_offset;
+                goto retry;
+            }
+            p++;
+        }
+
+        return start;
+    }
+
+    return -1;
+}
+
 size_t pmm_alloc_contiguous(uint count, uint8_t alignment_log2, paddr_t *pa, struct list_node *list) {
     LTRACEF("count %u, align %u\n", count, alignment_log2);
 
@@ -290,68 +758,68 @@ size_t pmm_alloc_contiguous(uint count, uint8_t alignment_log2, paddr_t *pa, str
     if (alignment_log2 < PAGE_SIZE_SHIFT)
         alignment_log2 = PAGE_SIZE_SHIFT;
 
+    /* a buddy block of this order is big enough and, being aligned on its own
+     * size, aligned enough */
+    uint order = MAX(log2_uint(round_up_pow2_u32(count)), (uint)(alignment_log2 - PAGE_SIZE_SHIFT));
+
     mutex_acquire(&lock);
 
+    bool drained = false;
+retry:;
     pmm_arena_t *a;
     list_for_every_entry(&arena_list, a, pmm_arena_t, node) {
         // XXX make this a flag to only search kmap?
-        if (a->flags & PMM_ARENA_FLAG_KMAP) {
-            /* walk the list starting at alignment boundaries.
-             * calculate the starting offset into this arena, based on the
-             * base address of the arena to handle the case where the arena
-             * is not aligned on the same boundary requested.
-             */
-            paddr_t rounded_base = ROUNDUP(a->base, 1UL << alignment_log2);
-            if (rounded_base < a->base || rounded_base > a->base + a->size - 1)
-                continue;
-
-            uint aligned_offset = (rounded_base - a->base) / PAGE_SIZE;
-            uint start = aligned_offset;
-            LTRACEF("starting search at aligned offset %u\n", start);
-            LTRACEF("arena base 0x%lx size %zu\n", a->base, a->size);
+        if (!(a->flags & PMM_ARENA_FLAG_KMAP))
+            continue;
+        if (a->free_count < count)
+            continue;
+
+        ssize_t start = -1;
+        if (order <= PMM_MAX_ORDER)
+            start = arena_alloc_block(a, order);
+
+        if (start >= 0) {
+            /* the block was taken off the free lists whole, mark it allocated
+             * and give back whatever is past the end of the request */
+            for (size_t i = 0; i < (1UL << order); i++) {
+                a->page_array[start + i].flags |= VM_PAGE_FLAG_NONFREE;
+            }
+            a->free_count -= 1UL << order;
+            arena_free_run(a, start + count, (1UL << order) - count);
 
-retry:
-            /* search while we're still within the arena and have a chance of finding a slot
-               (start + count < end of arena) */
-            while ((start < a->size / PAGE_SIZE) &&
-                    ((start + count) <= a->size / PAGE_SIZE)) {
-                vm_page_t *p = &a->page_array[start];
+            if (list) {
                 for (uint i = 0; i < count; i++) {
-                    if (p->flags & VM_PAGE_FLAG_NONFREE) {
-                        /* this run is broken, break out of the inner loop.
-                         * start over at the next alignment boundary
-                         */
-                        start = ROUNDUP(start - aligned_offset + i + 1, 1UL << (alignment_log2 - PAGE_SIZE_SHIFT)) + aligned_offset;
-                        goto retry;
-                    }
-                    p++;
+                    list_add_tail(list, &a->page_array[start + i].node);
                 }
+            }
+        } else {
+            /* too big for a single block, or no block of that order is free
+             * but a run spanning several smaller ones might be */
+            start = arena_find_large_run(a, count, alignment_log2);
+            if (start < 0)
+                continue;
 
-                /* we found a run */
-                LTRACEF("found run from pn %u to %u\n", start, start + count);
-
-                /* remove the pages from the run out of the free list */
-                for (uint i = start; i < start + count; i++) {
-                    p = &a->page_array[i];
-                    DEBUG_ASSERT(!(p->flags & VM_PAGE_FLAG_NONFREE));
-                    DEBUG_ASSERT(list_in_list(&p->node));
+            for (uint i = 0; i < count; i++) {
+                arena_carve_page(a, start + i);
+                arena_mark_allocated(a, start + i, list);
+            }
+        }
 
-                    list_delete(&p->node);
-                    p->flags |= VM_PAGE_FLAG_NONFREE;
-                    a->free_count--;
+        LTRACEF("found run from pn %zd to %zd\n", start, start + count);
 
-                    if (list)
-                        list_add_tail(list, &p->node);
-                }
+        if (pa)
+            *pa = a->base + start * PAGE_SIZE;
 
-                if (pa)
-                    *pa = a->base + start * PAGE_SIZE;
+        mutex_release(&lock);
 
-                mutex_release(&lock);
+        return count;
+    }
 
-                return count;
-            }
-        }
+    /* pages sitting in the cpu caches may be what breaks up the run */
+    if (!drained) {
+        drained = true;
+        if (pcpu_cache_drain_all_locked() > 0)
+            goto retry;
     }
 
     mutex_release(&lock);
@@ -377,6 +845,30 @@ static void dump_arena(const pmm_arena_t *arena, bool dump_pages) {
         }
     }
 
+    /* dump the buddy free lists */
+    size_t largest = 0;
+    size_t largest_count = 0;
+    printf("\tfree blocks by order:");
+    for (uint order = 0; order <= PMM_MAX_ORDER; order++) {
+        size_t blocks = 0;
+        const vm_page_t *p;
+        list_for_every_entry(&arena->free_list[order], p, const vm_page_t, node) {
+            blocks++;
+        }
+        if (blocks > 0) {
+            largest = 1UL << order;
+            largest_count = blocks;
+        }
+        printf(" %zu", blocks);
+    }
+    printf("\n");
+
+    /* fragmentation is the share of free pages outside blocks of the largest free size */
+    size_t frag = 0;
+    if (arena->free_count > 0)
+        frag = 100 - (largest * largest_count * 100) / arena->free_count;
+    printf("\tlargest free block %zu pages, fragmentation %zu%%\n", largest, frag);
+
     /* dump the free pages */
     printf("\tfree ranges:\n");
     ssize_t last = -1;
@@ -405,6 +897,7 @@ notenoughargs:
 usage:
         printf("usage:\n");
         printf("%s arenas\n", argv[0].str);
+        printf("%s caches\n", argv[0].str);
         printf("%s alloc <count>\n", argv[0].str);
         printf("%s alloc_range <address> <count>\n", argv[0].str);
         printf("%s alloc_kpages <count>\n", argv[0].str);
@@ -421,6 +914,12 @@ usage:
         list_for_every_entry(&arena_list, a, pmm_arena_t, node) {
             dump_arena(a, false);
         }
+    } else if (!strcmp(argv[1].str, "caches")) {
+        for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+            const struct pmm_pcpu_cache *c = &pcpu_cache[i];
+            printf("cpu %u: %u pages cached, %lu hits, %lu misses, %lu refills, %lu drains\n",
+                   i, c->count, c->hits, c->misses, c->refills, c->drains);
+        }
     } else if (!strcmp(argv[1].str, "alloc")) {
         if (argc < 3) goto notenoughargs;
 
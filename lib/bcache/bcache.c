@@ -5,181 +5,635 @@
  * license that can be found in the LICENSE file or at
  * https://opensource.org/licenses/MIT
  */
+#include <arch/defines.h>
 #include <lk/list.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include <assert.h>
+#include <inttypes.h>
 #include <string.h>
 #include <sys/types.h>
+#include <lk/console_cmd.h>
 #include <lk/debug.h>
+#include <lk/pow2.h>
 #include <lk/trace.h>
 #include <lk/err.h>
+#include <kernel/event.h>
+#include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
+#if WITH_KERNEL_VM
+#include <kernel/vm.h>
+#endif
 #include <lib/bcache.h>
 #include <lib/bio.h>
 
 #define LOCAL_TRACE 0
 
+/* memory handed to a cache created with a block count of 0: with the vm,
+ * 1/BCACHE_FREE_MEM_FRACTION of the free pages at the time, up to
+ * BCACHE_DEFAULT_BYTES */
+#ifndef BCACHE_DEFAULT_BYTES
+#if WITH_KERNEL_VM
+#define BCACHE_DEFAULT_BYTES (8 * 1024 * 1024)
+#else
+#define BCACHE_DEFAULT_BYTES (256 * 1024)
+#endif
+#endif
+#define BCACHE_FREE_MEM_FRACTION 32
+
+#define BCACHE_MIN_BLOCKS 16
+
+/* largest single device transfer, for read-ahead and for write-back of runs
+ * of dirty blocks */
+#ifndef BCACHE_MAX_IO_BYTES
+#define BCACHE_MAX_IO_BYTES (64 * 1024)
+#endif
+
+/* most direct transfers a bulk read or write has in flight at once */
+#ifndef BCACHE_DIRECT_MAX_INFLIGHT
+#define BCACHE_DIRECT_MAX_INFLIGHT 8
+#endif
+
+/* block data is carved out of allocations of about this size */
+#define BCACHE_ARENA_BYTES (64 * 1024)
+
+/* the write-back thread runs this often, or early once 1/BCACHE_DIRTY_RATIO
+ * of the cache is dirty */
+#define BCACHE_FLUSH_INTERVAL 1000 /* msecs */
+#define BCACHE_DIRTY_RATIO 4
+
+/* first read-ahead window once misses look sequential, in blocks. It
+ * doubles on every sequential miss up to the max transfer size. */
+#define BCACHE_RA_MIN_BLOCKS 4
+
+/* how many dirty blocks eviction looks past for a clean one before writing
+ * back the oldest */
+#define BCACHE_EVICT_SCAN 64
+
 struct bcache_block {
-    struct list_node node;
+    struct list_node node;          /* free list or lru list */
+    struct list_node dirty_node;    /* dirty list, while is_dirty */
+    struct bcache_block *hash_next;
     bnum_t blocknum;
     int ref_count;
     bool is_dirty;
+    bool readahead;                 /* read ahead and not yet asked for */
     void *ptr;
 };
 
 struct bcache_stats {
-    uint32_t hits;
-    uint32_t depth;
-    uint32_t misses;
-    uint32_t reads;
-    uint32_t writes;
+    uint64_t hits;
+    uint64_t depth;
+    uint64_t misses;
+    uint64_t reads;
+    uint64_t read_blocks;
+    uint64_t ra_blocks;
+    uint64_t ra_hits;
+    uint64_t writes;
+    uint64_t write_blocks;
+    uint64_t evictions;
+    uint64_t dirty_evictions;
+    uint64_t direct_reads;
+    uint64_t direct_writes;
+    uint64_t direct_blocks;
 };
 
 struct bcache {
+    struct list_node node;
     bdev_t *dev;
     size_t block_size;
     int count;
     struct bcache_stats stats;
 
+    /* device blocks per cache block when whole block i/o can be used, or 0 */
+    uint dev_blocks_per_block;
+    /* cache blocks that fit on the device */
+    bnum_t block_limit;
+
+    mutex_t lock;
+
     struct list_node free_list;
     struct list_node lru_list;
+    struct list_node dirty_list;
+    int dirty_count;
+
+    struct bcache_block **hash;
+    uint hash_shift;
 
     struct bcache_block *blocks;
+    void **arenas;
+    uint arena_count;
+
+    /* staging for multi block transfers */
+    void *io_buf;
+    uint max_io_blocks;
+    struct bcache_block **fill_blocks;
+    struct bcache_block **wb_blocks;
+
+    /* sequential miss detection for read-ahead */
+    bnum_t ra_next;
+    uint ra_window;
+
+    /* write-back thread */
+    thread_t *flusher;
+    event_t flush_event;
+    bool stopping;
+
     bool read_only;
 };
 
+static struct list_node cache_list = LIST_INITIAL_VALUE(cache_list);
+static mutex_t cache_list_lock = MUTEX_INITIAL_VALUE(cache_list_lock);
+
+static int bcache_flusher(void *arg);
+
+static void free_cache(struct bcache *cache) {
+    for (uint i = 0; i < cache->arena_count; i++)
+        free(cache->arenas[i]);
+    free(cache->arenas);
+    free(cache->blocks);
+    free(cache->hash);
+    free(cache->io_buf);
+    free(cache->fill_blocks);
+    free(cache->wb_blocks);
+    free(cache);
+}
+
+static size_t bcache_default_bytes(void) {
+#if WITH_KERNEL_VM
+    return MIN(pmm_count_free_pages() * PAGE_SIZE / BCACHE_FREE_MEM_FRACTION,
+               (size_t)BCACHE_DEFAULT_BYTES);
+#else
+    return BCACHE_DEFAULT_BYTES;
+#endif
+}
+
 bcache_t bcache_create(bdev_t *dev, size_t block_size, int block_count) {
     struct bcache *cache;
 
-    cache = malloc(sizeof(struct bcache));
+    DEBUG_ASSERT(dev);
+    DEBUG_ASSERT(block_size > 0);
+
+    if (block_count <= 0)
+        block_count = MAX(bcache_default_bytes() / block_size, BCACHE_MIN_BLOCKS);
+
+    /* no point holding more blocks than the device has */
+    bnum_t block_limit = (bnum_t)MIN((uint64_t)dev->total_size / block_size, (bnum_t)-1);
+    if ((uint64_t)block_count > MAX(block_limit, BCACHE_MIN_BLOCKS))
+        block_count = MAX(block_limit, BCACHE_MIN_BLOCKS);
+
+    cache = calloc(1, sizeof(struct bcache));
+    if (!cache)
+        return NULL;
 
     cache->dev = dev;
     cache->block_size = block_size;
-    cache->count = block_count;
     cache->read_only = false;
-    memset(&cache->stats, 0, sizeof(cache->stats));
+    cache->ra_next = (bnum_t)-1;
+    mutex_init(&cache->lock);
+    event_init(&cache->flush_event, false, EVENT_FLAG_AUTOUNSIGNAL);
 
     list_initialize(&cache->free_list);
     list_initialize(&cache->lru_list);
-
-    cache->blocks = malloc(sizeof(struct bcache_block) * block_count);
-    int i;
-    for (i=0; i < block_count; i++) {
-        cache->blocks[i].ref_count = 0;
-        cache->blocks[i].is_dirty = false;
-        cache->blocks[i].ptr = malloc(block_size);
-        // add to the free list
-        list_add_head(&cache->free_list, &cache->blocks[i].node);
+    list_initialize(&cache->dirty_list);
+
+    /* go straight to the block i/o routines when cache blocks are made of
+     * whole, suitably aligned device blocks and the buffer is aligned too */
+    if (block_size % dev->block_size == 0 && IS_ALIGNED(block_size, CACHE_LINE))
+        cache->dev_blocks_per_block = block_size / dev->block_size;
+    cache->block_limit = block_limit;
+
+    cache->max_io_blocks = MAX(BCACHE_MAX_IO_BYTES / block_size, 1);
+    cache->io_buf = memalign(CACHE_LINE, cache->max_io_blocks * block_size);
+    cache->fill_blocks = calloc(cache->max_io_blocks, sizeof(struct bcache_block *));
+    cache->wb_blocks = calloc(cache->max_io_blocks, sizeof(struct bcache_block *));
+
+    cache->hash_shift = MAX(log2_uint(round_up_pow2_u32(block_count)), 1);
+    cache->hash = calloc(1u << cache->hash_shift, sizeof(struct bcache_block *));
+
+    uint per_arena = MAX(BCACHE_ARENA_BYTES / block_size, 1);
+    cache->blocks = calloc(block_count, sizeof(struct bcache_block));
+    cache->arenas = calloc((block_count + per_arena - 1) / per_arena, sizeof(void *));
+
+    if (!cache->io_buf || !cache->fill_blocks || !cache->wb_blocks || !cache->hash ||
+            !cache->blocks || !cache->arenas)
+        goto err;
+
+    /* carve the block data out of a few large allocations. If memory runs
+     * out part way, run with what we got. */
+    int i = 0;
+    while (i < block_count) {
+        uint n = MIN(per_arena, (uint)(block_count - i));
+        uint8_t *arena = memalign(CACHE_LINE, n * block_size);
+        if (!arena)
+            break;
+        cache->arenas[cache->arena_count++] = arena;
+
+        for (uint j = 0; j < n; j++, i++) {
+            cache->blocks[i].ptr = arena + j * block_size;
+            // add to the free list
+            list_add_tail(&cache->free_list, &cache->blocks[i].node);
+        }
     }
+    if (i < BCACHE_MIN_BLOCKS && i < block_count)
+        goto err;
+    cache->count = i;
+
+    LTRACEF("dev %s, %d blocks of %zu bytes, %u hash buckets\n", dev->name, cache->count,
+            block_size, 1u << cache->hash_shift);
+
+    cache->flusher = thread_create("bcache flush", bcache_flusher, cache, LOW_PRIORITY,
+                                   DEFAULT_STACK_SIZE);
+    if (!cache->flusher)
+        goto err;
+    thread_resume(cache->flusher);
+
+    mutex_acquire(&cache_list_lock);
+    list_add_tail(&cache_list, &cache->node);
+    mutex_release(&cache_list_lock);
 
     return (bcache_t)cache;
+
+err:
+    free_cache(cache);
+    return NULL;
 }
 
 void bcache_set_read_only(bcache_t _cache, bool ro) {
     struct bcache *cache = _cache;
+
+    mutex_acquire(&cache->lock);
     cache->read_only = ro;
+    mutex_release(&cache->lock);
+}
+
+/* block lookup by number */
+static inline uint hash_index(const struct bcache *cache, bnum_t blocknum) {
+    return (uint32_t)(blocknum * 0x9e3779b1u) >> (32 - cache->hash_shift);
+}
+
+static struct bcache_block *hash_lookup(struct bcache *cache, bnum_t blocknum, uint32_t *depth) {
+    struct bcache_block *block = cache->hash[hash_index(cache, blocknum)];
+    uint32_t d = 1;
+
+    for (; block; block = block->hash_next, d++) {
+        if (block->blocknum == blocknum)
+            break;
+    }
+    if (depth)
+        *depth = d;
+
+    return block;
+}
+
+static void hash_insert(struct bcache *cache, struct bcache_block *block) {
+    uint i = hash_index(cache, block->blocknum);
+
+    block->hash_next = cache->hash[i];
+    cache->hash[i] = block;
+}
+
+static void hash_remove(struct bcache *cache, struct bcache_block *block) {
+    struct bcache_block **prev = &cache->hash[hash_index(cache, block->blocknum)];
+
+    while (*prev != block) {
+        DEBUG_ASSERT(*prev);
+        prev = &(*prev)->hash_next;
+    }
+    *prev = block->hash_next;
+    block->hash_next = NULL;
+}
+
+static void set_dirty(struct bcache *cache, struct bcache_block *block) {
+    if (block->is_dirty)
+        return;
+
+    block->is_dirty = true;
+    list_add_tail(&cache->dirty_list, &block->dirty_node);
+
+    /* wake the write-back thread early once enough of the cache is dirty */
+    if (++cache->dirty_count == cache->count / BCACHE_DIRTY_RATIO)
+        event_signal(&cache->flush_event, false);
+}
+
+static void clear_dirty(struct bcache *cache, struct bcache_block *block) {
+    if (!block->is_dirty)
+        return;
+
+    block->is_dirty = false;
+    list_delete(&block->dirty_node);
+    cache->dirty_count--;
+}
+
+static ssize_t dev_read(struct bcache *cache, void *buf, bnum_t blocknum, uint count) {
+    ssize_t rc;
+
+    if (cache->dev_blocks_per_block && IS_ALIGNED(buf, CACHE_LINE)) {
+        rc = bio_read_block(cache->dev, buf, blocknum * cache->dev_blocks_per_block,
+                            count * cache->dev_blocks_per_block);
+    } else {
+        rc = bio_read(cache->dev, buf, (off_t)blocknum * cache->block_size,
+                      count * cache->block_size);
+    }
+    if (rc >= 0 && (size_t)rc != count * cache->block_size)
+        rc = ERR_IO;
+
+    return rc;
+}
+
+static ssize_t dev_write(struct bcache *cache, const void *buf, bnum_t blocknum, uint count) {
+    ssize_t rc;
+
+    if (cache->dev_blocks_per_block && IS_ALIGNED(buf, CACHE_LINE)) {
+        rc = bio_write_block(cache->dev, buf, blocknum * cache->dev_blocks_per_block,
+                             count * cache->dev_blocks_per_block);
+    } else {
+        rc = bio_write(cache->dev, buf, (off_t)blocknum * cache->block_size,
+                       count * cache->block_size);
+    }
+    if (rc >= 0 && (size_t)rc != count * cache->block_size)
+        rc = ERR_IO;
+
+    return rc;
 }
 
-static int flush_block(struct bcache *cache, struct bcache_block *block) {
-    int rc;
+static inline bool can_write_back(const struct bcache_block *block, bool held_too) {
+    return block && block->is_dirty && (held_too || block->ref_count == 0);
+}
 
+/* write back block along with the dirty blocks on either side of it in one
+ * transfer. Blocks someone holds a reference to are only included if
+ * held_too is set. Returns the number of blocks written. */
+static int write_run(struct bcache *cache, struct bcache_block *block, bool held_too) {
     if (cache->read_only)
         return ERR_NOT_ALLOWED;
 
-    rc = bio_write(cache->dev, block->ptr,
-                   (off_t)block->blocknum * cache->block_size,
+    /* find the start of the run */
+    bnum_t start = block->blocknum;
+    uint count = 1;
+    while (count < cache->max_io_blocks && start > 0 &&
+            can_write_back(hash_lookup(cache, start - 1, NULL), held_too)) {
+        start--;
+        count++;
+    }
+
+    /* and gather it going forward from there */
+    count = 0;
+    for (bnum_t num = start; count < cache->max_io_blocks; num++) {
+        struct bcache_block *b = (num == block->blocknum) ? block : hash_lookup(cache, num, NULL);
+        if (!can_write_back(b, held_too))
+            break;
+        cache->wb_blocks[count++] = b;
+    }
+    DEBUG_ASSERT(count > 0);
+
+    const void *buf = block->ptr;
+    if (count > 1) {
+        for (uint i = 0; i < count; i++)
+            memcpy((uint8_t *)cache->io_buf + i * cache->block_size, cache->wb_blocks[i]->ptr,
                    cache->block_size);
+        buf = cache->io_buf;
+    }
+
+    LTRACEF("blocks %u-%u\n", start, start + count - 1);
+
+    ssize_t rc = dev_write(cache, buf, start, count);
     if (rc < 0)
-        goto exit;
+        return (int)rc;
 
-    block->is_dirty = false;
+    for (uint i = 0; i < count; i++)
+        clear_dirty(cache, cache->wb_blocks[i]);
     cache->stats.writes++;
-    rc = 0;
-exit:
-    return (rc);
+    cache->stats.write_blocks += count;
+
+    return (int)count;
+}
+
+/* write back the run around the oldest dirty block that can be written.
+ * Returns the number of blocks written, 0 if there was nothing to do. */
+static int flush_one(struct bcache *cache, bool held_too) {
+    struct bcache_block *block;
+
+    list_for_every_entry(&cache->dirty_list, block, struct bcache_block, dirty_node) {
+        if (can_write_back(block, held_too))
+            return write_run(cache, block, held_too);
+    }
+
+    return 0;
+}
+
+static int bcache_flusher(void *arg) {
+    struct bcache *cache = arg;
+
+    for (;;) {
+        event_wait_timeout(&cache->flush_event, BCACHE_FLUSH_INTERVAL);
+
+        /* a run at a time, so readers get in between the writes. Blocks
+         * someone holds are left for bcache_flush() or a later pass, since
+         * they may be in the middle of being changed. */
+        int rc;
+        do {
+            mutex_acquire(&cache->lock);
+            bool stopping = cache->stopping;
+            rc = stopping ? 0 : flush_one(cache, false);
+            mutex_release(&cache->lock);
+
+            if (stopping)
+                return 0;
+        } while (rc > 0);
+    }
 }
 
 void bcache_destroy(bcache_t _cache) {
     struct bcache *cache = _cache;
     int i;
 
+    mutex_acquire(&cache->lock);
+    cache->stopping = true;
+    mutex_release(&cache->lock);
+    event_signal(&cache->flush_event, true);
+    thread_join(cache->flusher, NULL, INFINITE_TIME);
+
+    mutex_acquire(&cache_list_lock);
+    list_delete(&cache->node);
+    mutex_release(&cache_list_lock);
+
     for (i=0; i < cache->count; i++) {
         DEBUG_ASSERT(cache->blocks[i].ref_count == 0);
 
         if (cache->blocks[i].is_dirty)
             printf("warning: freeing dirty block %u\n",
                    cache->blocks[i].blocknum);
-
-        free(cache->blocks[i].ptr);
     }
 
-    free(cache);
+    free_cache(cache);
 }
 
 /* find a block if it's already present */
-static struct bcache_block *find_block(struct bcache *cache, uint blocknum) {
-    uint32_t depth = 0;
+static struct bcache_block *find_block(struct bcache *cache, bnum_t blocknum) {
+    uint32_t depth;
     struct bcache_block *block;
 
     LTRACEF("num %u\n", blocknum);
 
-    block = NULL;
-    list_for_every_entry(&cache->lru_list, block, struct bcache_block, node) {
-        LTRACEF("looking at entry %p, num %u\n", block, block->blocknum);
-        depth++;
-
-        if (block->blocknum == blocknum) {
-            list_delete(&block->node);
-            list_add_tail(&cache->lru_list, &block->node);
-            cache->stats.hits++;
-            cache->stats.depth += depth;
-            return block;
-        }
+    block = hash_lookup(cache, blocknum, &depth);
+    if (!block) {
+        cache->stats.misses++;
+        return NULL;
     }
 
-    cache->stats.misses++;
-    return NULL;
+    list_delete(&block->node);
+    list_add_tail(&cache->lru_list, &block->node);
+    cache->stats.hits++;
+    cache->stats.depth += depth;
+    if (block->readahead) {
+        block->readahead = false;
+        cache->stats.ra_hits++;
+    }
+
+    return block;
 }
 
 /* allocate a new block */
 static struct bcache_block *alloc_block(struct bcache *cache) {
-    int err;
     struct bcache_block *block;
 
     /* pop one off the free list if it's present */
     block = list_remove_head_type(&cache->free_list, struct bcache_block, node);
     if (block) {
         block->ref_count = 0;
+        block->readahead = false;
         list_add_tail(&cache->lru_list, &block->node);
         LTRACEF("found block %p on free list\n", block);
         return block;
     }
 
-    /* walk the lru, looking for a free block */
+    /* walk the lru from the oldest end, preferring a clean block but
+     * settling for the oldest dirty one if none turns up soon */
+    struct bcache_block *victim = NULL;
+    uint scanned = 0;
     list_for_every_entry(&cache->lru_list, block, struct bcache_block, node) {
         LTRACEF("looking at %p, num %u\n", block, block->blocknum);
-        if (block->ref_count == 0) {
-            if (block->is_dirty) {
-                /* if the oldest block in the list that's available is dirty, write
-                 * it back first.
-                 */
-                err = flush_block(cache, block);
-                if (err)
-                    return NULL;
-            }
-
-            // add it to the tail of the lru
-            list_delete(&block->node);
-            list_add_tail(&cache->lru_list, &block->node);
-            return block;
+        if (block->ref_count != 0)
+            continue;
+        if (!block->is_dirty) {
+            victim = block;
+            break;
         }
+        if (!victim)
+            victim = block;
+        if (++scanned >= BCACHE_EVICT_SCAN)
+            break;
+    }
+    if (!victim)
+        return NULL;
+
+    if (victim->is_dirty) {
+        /* write it back first, and let the write-back thread know it's
+         * falling behind */
+        int err = write_run(cache, victim, false);
+        if (err < 0)
+            return NULL;
+        cache->stats.dirty_evictions++;
+        event_signal(&cache->flush_event, false);
     }
 
-    return NULL;
+    hash_remove(cache, victim);
+    cache->stats.evictions++;
+    victim->readahead = false;
+
+    // add it to the tail of the lru
+    list_delete(&victim->node);
+    list_add_tail(&cache->lru_list, &victim->node);
+    return victim;
 }
 
-static struct bcache_block *find_or_fill_block(struct bcache *cache, uint blocknum) {
-    int err;
+/* give back a block from alloc_block() that never made it into the hash */
+static void release_block(struct bcache *cache, struct bcache_block *block) {
+    DEBUG_ASSERT(!block->is_dirty);
+
+    list_delete(&block->node);
+    list_add_head(&cache->free_list, &block->node);
+}
+
+/* read a block that missed into the cache. When misses look sequential the
+ * blocks after it come along in the same device read. */
+static struct bcache_block *fill_block(struct bcache *cache, bnum_t blocknum) {
+    if (blocknum == cache->ra_next) {
+        /* never read ahead more than a quarter of the cache, or it starts
+         * pushing out what it read ahead last time before it gets used */
+        uint max_window = MAX(MIN(cache->max_io_blocks, (uint)cache->count / 4), 1);
+        cache->ra_window = MIN(MAX(cache->ra_window * 2, BCACHE_RA_MIN_BLOCKS), max_window);
+    } else {
+        /* an unrelated miss, likely metadata in the middle of a sequential
+         * read; back off rather than losing the stream entirely */
+        cache->ra_window /= 2;
+    }
+
+    uint want = MAX(cache->ra_window, 1);
+    if (blocknum < cache->block_limit)
+        want = MIN(want, cache->block_limit - blocknum);
+    else
+        want = 1;
+
+    for (;;) {
+        /* allocate the blocks for the run, stopping short at one that's
+         * already cached. The ones we get are pinned so allocating the rest
+         * can't take them back. */
+        uint count = 0;
+        while (count < want) {
+            if (count > 0 && hash_lookup(cache, blocknum + count, NULL))
+                break;
+
+            struct bcache_block *block = alloc_block(cache);
+            if (!block)
+                break;
+
+            block->blocknum = blocknum + count;
+            block->ref_count++;
+            cache->fill_blocks[count++] = block;
+        }
+        if (count == 0)
+            return NULL;
+
+        void *buf = (count == 1) ? cache->fill_blocks[0]->ptr : cache->io_buf;
+        ssize_t err = dev_read(cache, buf, blocknum, count);
+        if (err < 0) {
+            for (uint i = 0; i < count; i++) {
+                cache->fill_blocks[i]->ref_count--;
+                release_block(cache, cache->fill_blocks[i]);
+            }
+
+            /* don't let a bad block further along fail this one */
+            if (count > 1) {
+                want = 1;
+                continue;
+            }
+            return NULL;
+        }
 
+        for (uint i = 0; i < count; i++) {
+            struct bcache_block *block = cache->fill_blocks[i];
+
+            if (count > 1)
+                memcpy(block->ptr, (uint8_t *)cache->io_buf + i * cache->block_size,
+                       cache->block_size);
+            block->ref_count--;
+            block->readahead = (i > 0);
+            hash_insert(cache, block);
+        }
+
+        cache->stats.reads++;
+        cache->stats.read_blocks += count;
+        cache->stats.ra_blocks += count - 1;
+        cache->ra_next = blocknum + count;
+
+        return cache->fill_blocks[0];
+    }
+}
+
+static struct bcache_block *find_or_fill_block(struct bcache *cache, bnum_t blocknum) {
     LTRACEF("block %u\n", blocknum);
 
     /* see if it's already in the cache */
@@ -188,20 +642,11 @@ static struct bcache_block *find_or_fill_block(struct bcache *cache, uint blockn
         LTRACEF("wasn't allocated\n");
 
         /* allocate a new block and fill it */
-        block = alloc_block(cache);
-        DEBUG_ASSERT(block);
-
-        LTRACEF("wasn't allocated, new block %p\n", block);
-
-        block->blocknum = blocknum;
-        err = bio_read(cache->dev, block->ptr, (off_t)blocknum * cache->block_size, cache->block_size);
-        if (err < 0) {
-            /* free the block, return an error */
-            list_add_tail(&cache->free_list, &block->node);
+        block = fill_block(cache, blocknum);
+        if (block == NULL)
             return NULL;
-        }
 
-        cache->stats.reads++;
+        LTRACEF("wasn't allocated, new block %p\n", block);
     }
 
     DEBUG_ASSERT(block->blocknum == blocknum);
@@ -214,14 +659,217 @@ int bcache_read_block(bcache_t _cache, void *buf, uint blocknum) {
 
     LTRACEF("buf %p, blocknum %u\n", buf, blocknum);
 
+    mutex_acquire(&cache->lock);
+
     struct bcache_block *block = find_or_fill_block(cache, blocknum);
-    if (block == NULL) {
-        /* error */
-        return -1;
+    if (block)
+        memcpy(buf, block->ptr, cache->block_size);
+
+    mutex_release(&cache->lock);
+
+    /* error */
+    return block ? 0 : -1;
+}
+
+/* copy a block's new contents out of a direct write covering it */
+static void update_cached_block(struct bcache *cache, struct bcache_block *block,
+                                const void *buf, bnum_t blocknum) {
+    memcpy(block->ptr, (const uint8_t *)buf + (block->blocknum - blocknum) * cache->block_size,
+           cache->block_size);
+    clear_dirty(cache, block);
+}
+
+struct direct_batch {
+    spin_lock_t lock;       /* held across a completion's count drop and signal */
+    event_t done;
+    int pending;            /* transfers in flight */
+    int err;
+};
+
+struct direct_req {
+    struct direct_batch *batch;
+    size_t len;
+};
+
+static void direct_io_cb(void *cookie, bdev_t *dev, ssize_t status) {
+    struct direct_req *req = cookie;
+    struct direct_batch *batch = req->batch;
+
+    if (status >= 0 && (size_t)status != req->len)
+        status = ERR_IO;
+
+    /* may be in interrupt context. The submitter can only see the count reach
+     * zero, and so tear down the batch, once the signal is done with. */
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&batch->lock);
+    if (status < 0)
+        batch->err = (int)status;
+    batch->pending--;
+    event_signal(&batch->done, false);
+    spin_unlock_irqrestore(&batch->lock, state);
+}
+
+/* wait until no more than max transfers of the batch are in flight */
+static void direct_batch_wait(struct direct_batch *batch, int max) {
+    for (;;) {
+        arch_interrupt_saved_state_t state = spin_lock_irqsave(&batch->lock);
+        int pending = batch->pending;
+        spin_unlock_irqrestore(&batch->lock, state);
+        if (pending <= max)
+            return;
+        event_wait(&batch->done);
     }
+}
 
-    memcpy(buf, block->ptr, cache->block_size);
-    return 0;
+/* Move the runs between memory and the device, up to BCACHE_DIRECT_MAX_INFLIGHT
+ * at a time through the async bio path so the device can work on them
+ * together. A run the device will not take asynchronously, because it has no
+ * async path or no room for another request right now, is done synchronously
+ * once the ones ahead of it are done. */
+static int dev_io_runs(struct bcache *cache, const struct bcache_run *runs, uint count,
+                       bool write) {
+    struct direct_batch batch;
+    struct direct_req reqs[BCACHE_DIRECT_MAX_INFLIGHT];
+    int err = NO_ERROR;
+
+    spin_lock_init(&batch.lock);
+    event_init(&batch.done, false, EVENT_FLAG_AUTOUNSIGNAL);
+
+    for (uint i = 0; i < count && err == NO_ERROR; i += BCACHE_DIRECT_MAX_INFLIGHT) {
+        const uint n = MIN(count - i, (uint)BCACHE_DIRECT_MAX_INFLIGHT);
+
+        batch.pending = 0;
+        batch.err = NO_ERROR;
+
+        for (uint j = 0; j < n; j++) {
+            const struct bcache_run *run = &runs[i + j];
+            const off_t offset = (off_t)run->block * cache->block_size;
+            const size_t len = (size_t)run->count * cache->block_size;
+
+            /* bio completes an empty transfer without calling back */
+            if (bio_trim_range(cache->dev, offset, len) != len) {
+                batch.err = ERR_IO;
+                break;
+            }
+
+            reqs[j].batch = &batch;
+            reqs[j].len = len;
+            arch_interrupt_saved_state_t state = spin_lock_irqsave(&batch.lock);
+            batch.pending++;
+            spin_unlock_irqrestore(&batch.lock, state);
+            status_t rc = write ? bio_write_async(cache->dev, run->buf, offset, len,
+                                                  &direct_io_cb, &reqs[j])
+                                : bio_read_async(cache->dev, run->buf, offset, len,
+                                                 &direct_io_cb, &reqs[j]);
+            if (rc < 0) {
+                state = spin_lock_irqsave(&batch.lock);
+                batch.pending--;
+                spin_unlock_irqrestore(&batch.lock, state);
+                direct_batch_wait(&batch, 0);
+                ssize_t ret = write ? dev_write(cache, run->buf, run->block, run->count)
+                                    : dev_read(cache, run->buf, run->block, run->count);
+                if (ret < 0)
+                    batch.err = (int)ret;
+            }
+        }
+
+        direct_batch_wait(&batch, 0);
+        err = batch.err;
+    }
+
+    event_destroy(&batch.done);
+
+    return err;
+}
+
+int bcache_read_direct_runs(bcache_t _cache, const struct bcache_run *runs, uint count) {
+    struct bcache *cache = _cache;
+
+    LTRACEF("runs %p, count %u\n", runs, count);
+
+    if (count == 0)
+        return 0;
+
+    mutex_acquire(&cache->lock);
+
+    int err = dev_io_runs(cache, runs, count, false);
+    if (err >= 0) {
+        for (uint i = 0; i < count; i++) {
+            const struct bcache_run *run = &runs[i];
+
+            cache->stats.direct_reads++;
+            cache->stats.direct_blocks += run->count;
+
+            /* dirty blocks in the cache are newer than what's on the device */
+            struct bcache_block *block;
+            list_for_every_entry(&cache->dirty_list, block, struct bcache_block, dirty_node) {
+                if (block->blocknum - run->block < run->count)
+                    memcpy((uint8_t *)run->buf + (block->blocknum - run->block) * cache->block_size,
+                           block->ptr, cache->block_size);
+            }
+        }
+    }
+
+    mutex_release(&cache->lock);
+
+    return (err < 0) ? err : 0;
+}
+
+int bcache_write_direct_runs(bcache_t _cache, const struct bcache_run *runs, uint count) {
+    struct bcache *cache = _cache;
+
+    LTRACEF("runs %p, count %u\n", runs, count);
+
+    if (count == 0)
+        return 0;
+
+    mutex_acquire(&cache->lock);
+
+    if (cache->read_only) {
+        mutex_release(&cache->lock);
+        return ERR_NOT_ALLOWED;
+    }
+
+    int err = dev_io_runs(cache, runs, count, true);
+    if (err >= 0) {
+        for (uint i = 0; i < count; i++) {
+            const struct bcache_run *run = &runs[i];
+
+            cache->stats.direct_writes++;
+            cache->stats.direct_blocks += run->count;
+
+            /* bring any cached copies up to date, which also makes them clean */
+            struct bcache_block *block;
+            if (run->count > (uint)cache->count) {
+                list_for_every_entry(&cache->lru_list, block, struct bcache_block, node) {
+                    if (block->blocknum - run->block < run->count)
+                        update_cached_block(cache, block, run->buf, run->block);
+                }
+            } else {
+                for (uint j = 0; j < run->count; j++) {
+                    block = hash_lookup(cache, run->block + j, NULL);
+                    if (block)
+                        update_cached_block(cache, block, run->buf, run->block);
+                }
+            }
+        }
+    }
+
+    mutex_release(&cache->lock);
+
+    return (err < 0) ? err : 0;
+}
+
+int bcache_read_direct(bcache_t cache, void *buf, uint blocknum, uint count) {
+    const struct bcache_run run = { .buf = buf, .block = blocknum, .count = count };
+
+    return bcache_read_direct_runs(cache, &run, count ? 1 : 0);
+}
+
+int bcache_write_direct(bcache_t cache, const void *buf, uint blocknum, uint count) {
+    /* only read from on a write */
+    const struct bcache_run run = { .buf = (void *)buf, .block = blocknum, .count = count };
+
+    return bcache_write_direct_runs(cache, &run, count ? 1 : 0);
 }
 
 int bcache_get_block(bcache_t _cache, void **ptr, uint blocknum) {
@@ -231,17 +879,19 @@ int bcache_get_block(bcache_t _cache, void **ptr, uint blocknum) {
 
     DEBUG_ASSERT(ptr);
 
+    mutex_acquire(&cache->lock);
+
     struct bcache_block *block = find_or_fill_block(cache, blocknum);
-    if (block == NULL) {
-        /* error */
-        return -1;
+    if (block) {
+        /* increment the ref count to keep it from being freed */
+        block->ref_count++;
+        *ptr = block->ptr;
     }
 
-    /* increment the ref count to keep it from being freed */
-    block->ref_count++;
-    *ptr = block->ptr;
+    mutex_release(&cache->lock);
 
-    return 0;
+    /* error */
+    return block ? 0 : -1;
 }
 
 int bcache_put_block(bcache_t _cache, uint blocknum) {
@@ -249,7 +899,9 @@ int bcache_put_block(bcache_t _cache, uint blocknum) {
 
     LTRACEF("blocknum %u\n", blocknum);
 
-    struct bcache_block *block = find_block(cache, blocknum);
+    mutex_acquire(&cache->lock);
+
+    struct bcache_block *block = hash_lookup(cache, blocknum, NULL);
 
     /* be pretty hard on the caller for now */
     DEBUG_ASSERT(block);
@@ -257,6 +909,8 @@ int bcache_put_block(bcache_t _cache, uint blocknum) {
 
     block->ref_count--;
 
+    mutex_release(&cache->lock);
+
     return 0;
 }
 
@@ -265,18 +919,23 @@ int bcache_mark_block_dirty(bcache_t priv, uint blocknum) {
     struct bcache *cache = priv;
     struct bcache_block *block;
 
-    if (cache->read_only)
-        return ERR_NOT_ALLOWED;
+    mutex_acquire(&cache->lock);
 
-    block = find_block(cache, blocknum);
+    if (cache->read_only) {
+        err = ERR_NOT_ALLOWED;
+        goto exit;
+    }
+
+    block = hash_lookup(cache, blocknum, NULL);
     if (!block) {
         err = -1;
         goto exit;
     }
 
-    block->is_dirty = true;
+    set_dirty(cache, block);
     err = 0;
 exit:
+    mutex_release(&cache->lock);
     return (err);
 }
 
@@ -285,8 +944,12 @@ int bcache_zero_block(bcache_t priv, uint blocknum) {
     struct bcache *cache = priv;
     struct bcache_block *block;
 
-    if (cache->read_only)
-        return ERR_NOT_ALLOWED;
+    mutex_acquire(&cache->lock);
+
+    if (cache->read_only) {
+        err = ERR_NOT_ALLOWED;
+        goto exit;
+    }
 
     block = find_block(cache, blocknum);
     if (!block) {
@@ -297,46 +960,78 @@ int bcache_zero_block(bcache_t priv, uint blocknum) {
         }
 
         block->blocknum = blocknum;
+        hash_insert(cache, block);
     }
 
     memset(block->ptr, 0, cache->block_size);
-    block->is_dirty = true;
+    set_dirty(cache, block);
     err = 0;
 exit:
+    mutex_release(&cache->lock);
     return (err);
 }
 
 int bcache_flush(bcache_t priv) {
     int err;
     struct bcache *cache = priv;
-    struct bcache_block *block;
 
-    list_for_every_entry(&cache->lru_list, block, struct bcache_block, node) {
-        if (block->is_dirty) {
-            err = flush_block(cache, block);
-            if (err)
-                goto exit;
-        }
-    }
+    mutex_acquire(&cache->lock);
+
+    do {
+        err = flush_one(cache, true);
+    } while (err > 0);
+
+    mutex_release(&cache->lock);
 
-    err = 0;
-exit:
     return (err);
 }
 
+static uint percent(uint64_t part, uint64_t total) {
+    return total ? (uint)((part * 100) / total) : 0;
+}
+
 void bcache_dump(bcache_t priv, const char *name) {
-    uint32_t finds;
+    uint64_t finds;
     struct bcache *cache = priv;
 
-    finds = cache->stats.hits + cache->stats.misses;
+    mutex_acquire(&cache->lock);
+
+    struct bcache_stats stats = cache->stats;
+    int dirty = cache->dirty_count;
+
+    mutex_release(&cache->lock);
 
-    printf("%s: hits=%u(%u%%) depth=%u misses=%u(%u%%) reads=%u writes=%u\n",
-           name,
-           cache->stats.hits,
-           finds ? (cache->stats.hits * 100) / finds : 0,
-           cache->stats.hits ? cache->stats.depth / cache->stats.hits : 0,
-           cache->stats.misses,
-           finds ? (cache->stats.misses * 100) / finds : 0,
-           cache->stats.reads,
-           cache->stats.writes);
+    finds = stats.hits + stats.misses;
+
+    printf("%s: %d blocks of %zu bytes, %d dirty\n", name, cache->count, cache->block_size, dirty);
+    printf("\thits=%" PRIu64 "(%u%%) depth=%" PRIu64 " misses=%" PRIu64 "(%u%%)\n",
+           stats.hits, percent(stats.hits, finds),
+           stats.hits ? stats.depth / stats.hits : 0,
+           stats.misses, percent(stats.misses, finds));
+    printf("\treads=%" PRIu64 " (%" PRIu64 " blocks) readahead=%" PRIu64 " (%u%% used)\n",
+           stats.reads, stats.read_blocks, stats.ra_blocks, percent(stats.ra_hits, stats.ra_blocks));
+    printf("\twrites=%" PRIu64 " (%" PRIu64 " blocks) evictions=%" PRIu64 " (%" PRIu64 " dirty)\n",
+           stats.writes, stats.write_blocks, stats.evictions, stats.dirty_evictions);
+    printf("\tdirect reads=%" PRIu64 " writes=%" PRIu64 " (%" PRIu64 " blocks)\n",
+           stats.direct_reads, stats.direct_writes, stats.direct_blocks);
 }
+
+#if WITH_LIB_CONSOLE
+
+static int cmd_bcache(int argc, const console_cmd_args *argv) {
+    struct bcache *cache;
+
+    mutex_acquire(&cache_list_lock);
+    list_for_every_entry(&cache_list, cache, struct bcache, node) {
+        bcache_dump(cache, cache->dev->name);
+    }
+    mutex_release(&cache_list_lock);
+
+    return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("bcache", "block cache statistics", &cmd_bcache)
+STATIC_COMMAND_END(bcache);
+
+#endif
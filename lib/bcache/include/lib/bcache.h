@@ -14,12 +14,35 @@ __BEGIN_CDECLS
 
 typedef void *bcache_t;
 
+// Create a cache of block_size blocks over dev. A block_count of 0 sizes the
+// cache from the free memory, up to BCACHE_DEFAULT_BYTES. The cache never holds
+// more blocks than the device has. Dirty blocks are written back by a
+// background thread as well as on bcache_flush(), and sequential misses read
+// ahead. Returns NULL if out of memory.
 bcache_t bcache_create(bdev_t *dev, size_t block_size, int block_count);
 void bcache_set_read_only(bcache_t priv, bool ro);
 void bcache_destroy(bcache_t);
 
 int bcache_read_block(bcache_t, void *, uint block);
 
+// Move count whole blocks straight between buf and the device in a single
+// transfer, for bulk i/o that would only churn the cache. Reads see dirty
+// cached blocks and writes update any cached copies.
+int bcache_read_direct(bcache_t, void *buf, uint block, uint count);
+int bcache_write_direct(bcache_t, const void *buf, uint block, uint count);
+
+// The same for several runs of blocks at once, such as the extents of a
+// fragmented file. The runs go to the device together through the async bio
+// path where it has one, so they overlap. buf is only read from on a write.
+struct bcache_run {
+    void *buf;
+    uint block;
+    uint count;
+};
+
+int bcache_read_direct_runs(bcache_t, const struct bcache_run *runs, uint count);
+int bcache_write_direct_runs(bcache_t, const struct bcache_run *runs, uint count);
+
 // get and put a pointer directly to the block
 int bcache_get_block(bcache_t, void **, uint block);
 int bcache_put_block(bcache_t, uint block);
@@ -8,4 +8,6 @@ MODULE_DEPS += lib/libcpp
 MODULE_SRCS += \
 	$(LOCAL_DIR)/bcache.c
 
+MODULE_OPTIONS := test
+
 include make/module.mk
@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#include <arch/defines.h>
+#include <kernel/thread.h>
+#include <lib/bcache.h>
+#include <lib/bio.h>
+#include <lib/unittest.h>
+#include <lk/debug.h>
+#include <lk/err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_SIZE   ((size_t)512)
+#define DEV_BLOCKS   1024
+#define CACHE_BLOCKS 64
+
+// A memory backed device that counts the block transfers made to it, so the
+// tests can see how the cache batches its i/o.
+typedef struct count_bdev {
+    bdev_t dev;
+    uint8_t *mem;
+    int reads;
+    int writes;
+} count_bdev_t;
+
+static ssize_t count_bdev_read_block(struct bdev *bdev, void *buf, bnum_t block, uint count) {
+    count_bdev_t *c = (count_bdev_t *)bdev;
+
+    count = bio_trim_block_range(bdev, block, count);
+    memcpy(buf, c->mem + (size_t)block * BLOCK_SIZE, (size_t)count * BLOCK_SIZE);
+    c->reads++;
+
+    return (ssize_t)(count * BLOCK_SIZE);
+}
+
+static ssize_t count_bdev_write_block(struct bdev *bdev, const void *buf, bnum_t block, uint count) {
+    count_bdev_t *c = (count_bdev_t *)bdev;
+
+    count = bio_trim_block_range(bdev, block, count);
+    memcpy(c->mem + (size_t)block * BLOCK_SIZE, buf, (size_t)count * BLOCK_SIZE);
+    c->writes++;
+
+    return (ssize_t)(count * BLOCK_SIZE);
+}
+
+static count_bdev_t test_dev;
+
+static bdev_t *open_test_dev(void) {
+    memset(&test_dev, 0, sizeof(test_dev));
+    test_dev.mem = memalign(CACHE_LINE, DEV_BLOCKS * BLOCK_SIZE);
+    if (!test_dev.mem) {
+        return NULL;
+    }
+
+    // every block starts out filled with its own number
+    for (size_t i = 0; i < DEV_BLOCKS; i++) {
+        memset(test_dev.mem + i * BLOCK_SIZE, (int)(i & 0xff), BLOCK_SIZE);
+    }
+
+    bio_initialize_bdev(&test_dev.dev, "bcache_test", BLOCK_SIZE, DEV_BLOCKS, 0, NULL,
+                        BIO_FLAGS_NONE);
+    test_dev.dev.read_block = count_bdev_read_block;
+    test_dev.dev.write_block = count_bdev_write_block;
+    bio_register_device(&test_dev.dev);
+
+    return bio_open("bcache_test");
+}
+
+static void close_test_dev(bdev_t *dev) {
+    bio_close(dev);
+    bio_unregister_device(dev);
+    free(test_dev.mem);
+    test_dev.mem = NULL;
+}
+
+static bool block_is(const uint8_t *buf, uint8_t val) {
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        if (buf[i] != val) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool cached_reads(void) {
+    BEGIN_TEST;
+
+    bdev_t *dev = open_test_dev();
+    ASSERT_NONNULL(dev, "");
+    bcache_t cache = bcache_create(dev, BLOCK_SIZE, CACHE_BLOCKS);
+    ASSERT_NONNULL(cache, "");
+
+    uint8_t *buf = malloc(BLOCK_SIZE);
+    ASSERT_NONNULL(buf, "");
+
+    // scattered reads over several times the cache size, so blocks get evicted
+    for (uint i = 0; i < CACHE_BLOCKS * 4; i++) {
+        uint block = (i * 37) % DEV_BLOCKS;
+        ASSERT_EQ(0, bcache_read_block(cache, buf, block), "");
+        if (!block_is(buf, block & 0xff)) {
+            unittest_printf("block %u read back wrong\n", block);
+            ASSERT_TRUE(false, "block contents");
+        }
+    }
+
+    // a block just read comes from the cache
+    ASSERT_EQ(0, bcache_read_block(cache, buf, 5), "");
+    int reads = test_dev.reads;
+    ASSERT_EQ(0, bcache_read_block(cache, buf, 5), "");
+    EXPECT_EQ(reads, test_dev.reads, "cached block was read again");
+    EXPECT_TRUE(block_is(buf, 5), "");
+
+    // and so does one held by get_block
+    void *ptr;
+    ASSERT_EQ(0, bcache_get_block(cache, &ptr, 6), "");
+    reads = test_dev.reads;
+    ASSERT_EQ(0, bcache_read_block(cache, buf, 6), "");
+    EXPECT_EQ(reads, test_dev.reads, "held block was read again");
+    EXPECT_EQ(0, memcmp(buf, ptr, BLOCK_SIZE), "");
+    bcache_put_block(cache, 6);
+
+    free(buf);
+    bcache_destroy(cache);
+    close_test_dev(dev);
+
+    END_TEST;
+}
+
+static bool sequential_readahead(void) {
+    BEGIN_TEST;
+
+    bdev_t *dev = open_test_dev();
+    ASSERT_NONNULL(dev, "");
+    bcache_t cache = bcache_create(dev, BLOCK_SIZE, CACHE_BLOCKS);
+    ASSERT_NONNULL(cache, "");
+
+    uint8_t *buf = malloc(BLOCK_SIZE);
+    ASSERT_NONNULL(buf, "");
+
+    // a front to back scan should take far fewer device reads than blocks
+    const uint scan = DEV_BLOCKS / 2;
+    for (uint block = 0; block < scan; block++) {
+        ASSERT_EQ(0, bcache_read_block(cache, buf, block), "");
+        if (!block_is(buf, block & 0xff)) {
+            unittest_printf("block %u read back wrong\n", block);
+            ASSERT_TRUE(false, "block contents");
+        }
+    }
+    EXPECT_LT(test_dev.reads, (int)(scan / 4), "sequential reads were not batched");
+
+    // reading ahead stops at the end of the device
+    for (uint block = DEV_BLOCKS - 8; block < DEV_BLOCKS; block++) {
+        ASSERT_EQ(0, bcache_read_block(cache, buf, block), "");
+        EXPECT_TRUE(block_is(buf, block & 0xff), "");
+    }
+
+    free(buf);
+    bcache_destroy(cache);
+    close_test_dev(dev);
+
+    END_TEST;
+}
+
+static bool write_back(void) {
+    BEGIN_TEST;
+
+    bdev_t *dev = open_test_dev();
+    ASSERT_NONNULL(dev, "");
+    bcache_t cache = bcache_create(dev, BLOCK_SIZE, CACHE_BLOCKS);
+    ASSERT_NONNULL(cache, "");
+
+    // dirty a run of blocks, then flush it
+    const uint first = 100;
+    const uint count = 16;
+    for (uint i = 0; i < count; i++) {
+        void *ptr;
+        ASSERT_EQ(0, bcache_get_block(cache, &ptr, first + i), "");
+        memset(ptr, 0xa5, BLOCK_SIZE);
+        EXPECT_EQ(0, bcache_mark_block_dirty(cache, first + i), "");
+        bcache_put_block(cache, first + i);
+    }
+    EXPECT_EQ(0, bcache_flush(cache), "");
+    for (uint i = 0; i < count; i++) {
+        EXPECT_TRUE(block_is(test_dev.mem + (first + i) * BLOCK_SIZE, 0xa5), "");
+    }
+    EXPECT_TRUE(block_is(test_dev.mem + (first + count) * BLOCK_SIZE, (first + count) & 0xff),
+                "block past the run was written");
+
+    // neighbouring dirty blocks go out together
+    EXPECT_LT(test_dev.writes, (int)count, "dirty run was not coalesced");
+
+    // zeroed blocks are dirty without ever being read
+    int reads = test_dev.reads;
+    EXPECT_EQ(0, bcache_zero_block(cache, 500), "");
+    EXPECT_EQ(reads, test_dev.reads, "");
+    EXPECT_EQ(0, bcache_flush(cache), "");
+    EXPECT_TRUE(block_is(test_dev.mem + 500 * BLOCK_SIZE, 0), "");
+
+    // dirtying more than the cache holds forces write back on eviction
+    for (uint block = 200; block < 200 + CACHE_BLOCKS * 3; block++) {
+        ASSERT_EQ(0, bcache_zero_block(cache, block), "");
+    }
+    EXPECT_EQ(0, bcache_flush(cache), "");
+    for (uint block = 200; block < 200 + CACHE_BLOCKS * 3; block++) {
+        if (!block_is(test_dev.mem + block * BLOCK_SIZE, 0)) {
+            unittest_printf("block %u was not written back\n", block);
+            ASSERT_TRUE(false, "evicted dirty block");
+        }
+    }
+
+    // nothing can be dirtied once read only
+    bcache_set_read_only(cache, true);
+    EXPECT_EQ(ERR_NOT_ALLOWED, bcache_zero_block(cache, 600), "");
+
+    bcache_destroy(cache);
+    close_test_dev(dev);
+
+    END_TEST;
+}
+
+static bool background_write_back(void) {
+    BEGIN_TEST;
+
+    bdev_t *dev = open_test_dev();
+    ASSERT_NONNULL(dev, "");
+
+    // sized from free memory, capped at the size of the device
+    bcache_t cache = bcache_create(dev, BLOCK_SIZE, 0);
+    ASSERT_NONNULL(cache, "");
+
+    ASSERT_EQ(0, bcache_zero_block(cache, 42), "");
+
+    // the write-back thread should get it out without a flush
+    for (int i = 0; i < 50 && test_dev.writes == 0; i++) {
+        thread_sleep(100);
+    }
+    EXPECT_TRUE(block_is(test_dev.mem + 42 * BLOCK_SIZE, 0), "dirty block was not written back");
+
+    bcache_destroy(cache);
+    close_test_dev(dev);
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(bcache_tests)
+RUN_TEST(cached_reads)
+RUN_TEST(sequential_readahead)
+RUN_TEST(write_back)
+RUN_TEST(background_write_back)
+END_TEST_CASE(bcache_tests)
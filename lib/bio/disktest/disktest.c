@@ -21,6 +21,7 @@
 
 #define DEFAULT_BLOCK_SIZE 512ULL
 #define DEFAULT_ITERATIONS 100000ULL
+#define DEFAULT_BENCH_ITERATIONS 10000ULL
 #define MAX_IO_BLOCKS      32ULL
 
 static void usage(const char *prog) {
@@ -31,10 +32,12 @@ static void usage(const char *prog) {
             "  %s verify <path> [block_size]\n"
             "  %s read_rand <path> [block_size] [iterations]\n"
             "  %s read_write <path> [block_size] [iterations]\n"
+            "  %s bench <path> [block_size] [iterations]\n"
             "Defaults:\n"
             "  block_size: %llu bytes\n"
-            "  iterations: %llu\n",
-            prog, prog, prog, prog, prog, DEFAULT_BLOCK_SIZE, DEFAULT_ITERATIONS);
+            "  iterations: %llu (%llu per queue depth for bench)\n",
+            prog, prog, prog, prog, prog, prog, DEFAULT_BLOCK_SIZE, DEFAULT_ITERATIONS,
+            DEFAULT_BENCH_ITERATIONS);
 }
 
 static void print_help(const char *prog) {
@@ -51,6 +54,11 @@ static void print_help(const char *prog) {
            DEFAULT_ITERATIONS);
     printf("  read_write <path> [block_size] [iterations]\n");
     printf("    Randomly read/verify, then overwrite blocks with a new seed and verify.\n\n");
+    printf("  bench <path> [block_size] [iterations]\n");
+    printf("    Random single block reads at queue depth 1 to %u, reporting IOPS and\n",
+           DT_BACKEND_MAX_QUEUE_DEPTH);
+    printf("    latency per depth (default iterations per depth: %llu).\n\n",
+           DEFAULT_BENCH_ITERATIONS);
     printf("Defaults:\n");
     printf("  block_size: %llu bytes\n", DEFAULT_BLOCK_SIZE);
     printf("  iterations: %llu\n", DEFAULT_ITERATIONS);
@@ -61,6 +69,7 @@ static void print_help(const char *prog) {
     printf("  %s verify test.img 512\n", prog);
     printf("  %s read_rand test.img 4096 1000\n", prog);
     printf("  %s read_write test.img 4096 1000\n", prog);
+    printf("  %s bench test.img 4096 10000\n", prog);
 }
 
 static int parse_u64(const char *s, uint64_t *out) {
@@ -648,6 +657,137 @@ static int do_read_write(void *backend_ctx, uint64_t block_size, uint64_t iterat
     return 0;
 }
 
+static int compare_u64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *)a;
+    const uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Random single block reads at queue depths 1, 2, 4 ... DT_BACKEND_MAX_QUEUE_DEPTH,
+// reporting IOPS and per read completion latency at each depth. Data is not verified.
+static int do_bench(void *backend_ctx, uint64_t block_size, uint64_t iterations) {
+    uint64_t total_bytes;
+    uint64_t blocks;
+
+    if (dt_backend_get_target_size(backend_ctx, block_size, &total_bytes, &blocks) != 0) {
+        return 1;
+    }
+
+    if (blocks == 0) {
+        fprintf(stderr, "bench: target has zero blocks\n");
+        return 1;
+    }
+
+    if (block_size > (SIZE_MAX / DT_BACKEND_MAX_QUEUE_DEPTH) ||
+        iterations > (SIZE_MAX / sizeof(uint64_t))) {
+        dt_backend_set_error(EOVERFLOW);
+        dt_backend_perror("bench");
+        return 1;
+    }
+
+    uint8_t *const buf = malloc((size_t)(block_size * DT_BACKEND_MAX_QUEUE_DEPTH));
+    uint64_t *const latency = malloc((size_t)iterations * sizeof(uint64_t));
+    if (buf == NULL || latency == NULL) {
+        dt_backend_perror("malloc");
+        free(buf);
+        free(latency);
+        return 1;
+    }
+
+    uint64_t submit_time[DT_BACKEND_MAX_QUEUE_DEPTH];
+    unsigned int free_slots[DT_BACKEND_MAX_QUEUE_DEPTH];
+    uint64_t rng_state = ((uint64_t)dt_backend_seed() << 32) ^ total_bytes ^ 0x62656eULL;
+    int ret = 0;
+
+    printf("%5s %10s %10s %10s %10s %10s %10s\n",
+           "qd", "iops", "KiB/s", "avg us", "p50 us", "p99 us", "max us");
+
+    for (unsigned int qd = 1; qd <= DT_BACKEND_MAX_QUEUE_DEPTH && ret == 0; qd *= 2) {
+        unsigned int free_count = 0;
+        for (unsigned int s = 0; s < qd; ++s) {
+            free_slots[free_count++] = s;
+        }
+
+        uint64_t submitted = 0;
+        uint64_t completed = 0;
+        uint64_t latency_sum = 0;
+        const uint64_t start = dt_backend_time_usec();
+
+        while (completed < iterations) {
+            // keep the queue full
+            while (free_count > 0 && submitted < iterations) {
+                const unsigned int slot = free_slots[free_count - 1];
+                const uint64_t block_index = rng_next(&rng_state) % blocks;
+
+                submit_time[slot] = dt_backend_time_usec();
+                if (dt_backend_read_async(backend_ctx, slot, block_index, block_size, 1,
+                                          buf + (slot * block_size)) != 0) {
+                    if (dt_backend_get_error() == EAGAIN && free_count < qd) {
+                        // the device is full, wait for something to finish
+                        break;
+                    }
+                    dt_backend_perror("read_async");
+                    ret = 1;
+                    break;
+                }
+                free_count--;
+                submitted++;
+            }
+            if (ret != 0) {
+                break;
+            }
+
+            unsigned int slot;
+            int64_t result;
+            if (dt_backend_reap(backend_ctx, &slot, &result) != 0) {
+                dt_backend_perror("reap");
+                ret = 1;
+                break;
+            }
+            const uint64_t lat = dt_backend_time_usec() - submit_time[slot];
+            if (result != (int64_t)block_size) {
+                fprintf(stderr, "bench: read failed at queue depth %u: %" PRId64 "\n", qd, result);
+                ret = 1;
+            }
+            latency[completed++] = lat;
+            latency_sum += lat;
+            free_slots[free_count++] = slot;
+        }
+
+        // drain anything still outstanding after an error
+        while (free_count < qd && submitted > completed) {
+            unsigned int slot;
+            int64_t result;
+            if (dt_backend_reap(backend_ctx, &slot, &result) != 0) {
+                break;
+            }
+            free_count++;
+            completed++;
+        }
+
+        if (ret != 0) {
+            break;
+        }
+
+        const uint64_t elapsed = dt_backend_time_usec() - start;
+        qsort(latency, (size_t)iterations, sizeof(uint64_t), compare_u64);
+
+        const uint64_t iops = elapsed ? (iterations * 1000000ULL) / elapsed : 0;
+        printf("%5u %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n",
+               qd,
+               iops,
+               (iops * block_size) / 1024,
+               latency_sum / iterations,
+               latency[iterations / 2],
+               latency[(iterations * 99) / 100],
+               latency[iterations - 1]);
+    }
+
+    free(buf);
+    free(latency);
+    return ret;
+}
+
 static void print_test_params(const char *cmd, uint64_t block_size, uint64_t iterations) {
     printf("disktest: starting %s (block_size=%" PRIu64 ", iterations=%" PRIu64 ")\n",
            cmd,
@@ -692,7 +832,12 @@ static int disktest_main(int argc, const char **argv) {
         }
     }
 
-    if (strcmp(cmd, "read_rand") == 0 || strcmp(cmd, "read_write") == 0) {
+    if (strcmp(cmd, "bench") == 0) {
+        iterations = DEFAULT_BENCH_ITERATIONS;
+    }
+
+    if (strcmp(cmd, "read_rand") == 0 || strcmp(cmd, "read_write") == 0 ||
+        strcmp(cmd, "bench") == 0) {
         if (argc >= 5) {
             if (parse_u64(argv[4], &iterations) != 0 || iterations == 0) {
                 fprintf(stderr, "Invalid iterations: %s\n", argv[4]);
@@ -727,6 +872,9 @@ static int disktest_main(int argc, const char **argv) {
     } else if (strcmp(cmd, "read_write") == 0) {
         print_test_params(cmd, block_size, iterations);
         ret = do_read_write(backend_ctx, block_size, iterations);
+    } else if (strcmp(cmd, "bench") == 0) {
+        print_test_params(cmd, block_size, iterations);
+        ret = do_bench(backend_ctx, block_size, iterations);
     } else {
         fprintf(stderr, "Unknown command: %s\n", cmd);
         usage(argv[0]);
@@ -24,6 +24,23 @@ int64_t dt_backend_write_blocks(void *context,
                                 uint64_t block_count,
                                 const uint8_t *buf);
 int dt_backend_get_target_size(void *context, uint64_t block_size, uint64_t *total_bytes, uint64_t *blocks);
+
+// Asynchronous reads for the queue depth benchmark. Up to
+// DT_BACKEND_MAX_QUEUE_DEPTH reads may be outstanding, each tagged with a slot
+// below that limit. A read that cannot be queued right now fails with EAGAIN.
+// dt_backend_reap waits for any outstanding read and returns its slot and
+// result. Backends without real async I/O complete the read before
+// dt_backend_read_async returns.
+#define DT_BACKEND_MAX_QUEUE_DEPTH 128U
+
+int dt_backend_read_async(void *context,
+                          unsigned int slot,
+                          uint64_t block_idx,
+                          uint64_t block_size,
+                          uint64_t block_count,
+                          uint8_t *buf);
+int dt_backend_reap(void *context, unsigned int *slot, int64_t *result);
+uint64_t dt_backend_time_usec(void);
 int dt_backend_flush(void *context);
 unsigned int dt_backend_seed(void);
 void dt_backend_set_error(int err);
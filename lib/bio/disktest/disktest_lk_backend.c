@@ -9,15 +9,35 @@
 
 #include <errno.h>
 #include <inttypes.h>
+#include <kernel/semaphore.h>
+#include <kernel/spinlock.h>
 #include <lib/bio.h>
 #include <lk/err.h>
+#include <platform.h>
 #include <platform/time.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-typedef struct DtLkBackendContext {
+typedef struct DtLkBackendContext DtLkBackendContext;
+
+typedef struct DtLkAsyncRead {
+    DtLkBackendContext *ctx;
+    unsigned int slot;
+} DtLkAsyncRead;
+
+struct DtLkBackendContext {
     bdev_t *dev;
-} DtLkBackendContext;
+
+    // async reads complete from the driver, possibly in interrupt context, into
+    // this ring; done_sem counts the entries waiting to be reaped
+    spin_lock_t lock;
+    semaphore_t done_sem;
+    unsigned int done_head;
+    unsigned int done_tail;
+    unsigned int done_slot[DT_BACKEND_MAX_QUEUE_DEPTH];
+    int64_t done_result[DT_BACKEND_MAX_QUEUE_DEPTH];
+    DtLkAsyncRead reads[DT_BACKEND_MAX_QUEUE_DEPTH];
+};
 
 static int dt_last_error;
 
@@ -46,6 +66,8 @@ static int map_status_to_errno(int rc) {
             return ENOTSUP;
         case ERR_NO_MEMORY:
             return ENOMEM;
+        case ERR_NO_RESOURCES:
+            return EAGAIN;
         default:
             return EIO;
     }
@@ -77,6 +99,14 @@ int dt_backend_open(const char *path, bool need_write, void **out_context) {
     }
 
     ctx->dev = dev;
+    spin_lock_init(&ctx->lock);
+    sem_init(&ctx->done_sem, 0);
+    ctx->done_head = 0;
+    ctx->done_tail = 0;
+    for (unsigned int i = 0; i < DT_BACKEND_MAX_QUEUE_DEPTH; i++) {
+        ctx->reads[i].ctx = ctx;
+        ctx->reads[i].slot = i;
+    }
     *out_context = ctx;
     return 0;
 }
@@ -89,6 +119,7 @@ int dt_backend_close(void *context) {
         return -1;
     }
 
+    sem_destroy(&ctx->done_sem);
     bio_close(ctx->dev);
     free(ctx);
     return 0;
@@ -150,6 +181,83 @@ int64_t dt_backend_write_blocks(void *context,
     return (int64_t)rc;
 }
 
+static void dt_read_complete(DtLkBackendContext *ctx, unsigned int slot, int64_t result) {
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&ctx->lock);
+    const unsigned int i = ctx->done_head % DT_BACKEND_MAX_QUEUE_DEPTH;
+    ctx->done_slot[i] = slot;
+    ctx->done_result[i] = result;
+    ctx->done_head++;
+    spin_unlock_irqrestore(&ctx->lock, state);
+
+    sem_post(&ctx->done_sem, false);
+}
+
+static void dt_read_async_callback(void *cookie, bdev_t *dev, ssize_t status) {
+    DtLkAsyncRead *read = (DtLkAsyncRead *)cookie;
+
+    dt_read_complete(read->ctx, read->slot, (int64_t)status);
+}
+
+int dt_backend_read_async(void *context,
+                          unsigned int slot,
+                          uint64_t block_idx,
+                          uint64_t block_size,
+                          uint64_t block_count,
+                          uint8_t *buf) {
+    DtLkBackendContext *ctx = (DtLkBackendContext *)context;
+
+    if (ctx == NULL || buf == NULL || block_count == 0 || slot >= DT_BACKEND_MAX_QUEUE_DEPTH) {
+        dt_backend_set_error(EINVAL);
+        return -1;
+    }
+
+    if (block_size > (UINT64_MAX / block_count) || block_size * block_count > SIZE_MAX) {
+        dt_backend_set_error(EOVERFLOW);
+        return -1;
+    }
+
+    const size_t transfer_size = (size_t)(block_size * block_count);
+    const off_t byte_offset = (off_t)(block_idx * block_size);
+    status_t rc = bio_read_async(ctx->dev, buf, byte_offset, transfer_size,
+                                 dt_read_async_callback, &ctx->reads[slot]);
+    if (rc == ERR_NOT_SUPPORTED) {
+        // no async path in this device, do it inline
+        const ssize_t rd = bio_read(ctx->dev, buf, byte_offset, transfer_size);
+        dt_read_complete(ctx, slot, (int64_t)rd);
+        return 0;
+    }
+    if (rc < 0) {
+        dt_backend_set_error(map_status_to_errno((int)rc));
+        return -1;
+    }
+
+    return 0;
+}
+
+int dt_backend_reap(void *context, unsigned int *slot, int64_t *result) {
+    DtLkBackendContext *ctx = (DtLkBackendContext *)context;
+
+    if (ctx == NULL || slot == NULL || result == NULL) {
+        dt_backend_set_error(EINVAL);
+        return -1;
+    }
+
+    sem_wait(&ctx->done_sem);
+
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&ctx->lock);
+    const unsigned int i = ctx->done_tail % DT_BACKEND_MAX_QUEUE_DEPTH;
+    *slot = ctx->done_slot[i];
+    *result = ctx->done_result[i];
+    ctx->done_tail++;
+    spin_unlock_irqrestore(&ctx->lock, state);
+
+    return 0;
+}
+
+uint64_t dt_backend_time_usec(void) {
+    return (uint64_t)current_time_hires();
+}
+
 int dt_backend_get_target_size(void *context, uint64_t block_size, uint64_t *total_bytes, uint64_t *blocks) {
     DtLkBackendContext *ctx = (DtLkBackendContext *)context;
 
@@ -20,6 +20,12 @@
 
 typedef struct DtPosixBackendContext {
     int fd;
+
+    // reads are done synchronously, this just holds their results until reaped
+    unsigned int done_head;
+    unsigned int done_tail;
+    unsigned int done_slot[DT_BACKEND_MAX_QUEUE_DEPTH];
+    int64_t done_result[DT_BACKEND_MAX_QUEUE_DEPTH];
 } DtPosixBackendContext;
 
 void dt_backend_set_error(int err) {
@@ -53,6 +59,8 @@ int dt_backend_open(const char *path, bool need_write, void **out_context) {
     }
 
     ctx->fd = fd;
+    ctx->done_head = 0;
+    ctx->done_tail = 0;
     *out_context = ctx;
     return 0;
 }
@@ -116,6 +124,59 @@ int64_t dt_backend_write_blocks(void *context,
     return (int64_t)pwrite(ctx->fd, buf, transfer_size, byte_offset);
 }
 
+int dt_backend_read_async(void *context,
+                          unsigned int slot,
+                          uint64_t block_idx,
+                          uint64_t block_size,
+                          uint64_t block_count,
+                          uint8_t *buf) {
+    DtPosixBackendContext *ctx = (DtPosixBackendContext *)context;
+
+    if (ctx == NULL || slot >= DT_BACKEND_MAX_QUEUE_DEPTH) {
+        dt_backend_set_error(EINVAL);
+        return -1;
+    }
+
+    if (ctx->done_head - ctx->done_tail == DT_BACKEND_MAX_QUEUE_DEPTH) {
+        dt_backend_set_error(EAGAIN);
+        return -1;
+    }
+
+    const int64_t rc = dt_backend_read_blocks(context, block_idx, block_size, block_count, buf);
+    const unsigned int i = ctx->done_head % DT_BACKEND_MAX_QUEUE_DEPTH;
+    ctx->done_slot[i] = slot;
+    ctx->done_result[i] = rc;
+    ctx->done_head++;
+    return 0;
+}
+
+int dt_backend_reap(void *context, unsigned int *slot, int64_t *result) {
+    DtPosixBackendContext *ctx = (DtPosixBackendContext *)context;
+
+    if (ctx == NULL || slot == NULL || result == NULL) {
+        dt_backend_set_error(EINVAL);
+        return -1;
+    }
+
+    if (ctx->done_head == ctx->done_tail) {
+        dt_backend_set_error(EAGAIN);
+        return -1;
+    }
+
+    const unsigned int i = ctx->done_tail % DT_BACKEND_MAX_QUEUE_DEPTH;
+    *slot = ctx->done_slot[i];
+    *result = ctx->done_result[i];
+    ctx->done_tail++;
+    return 0;
+}
+
+uint64_t dt_backend_time_usec(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
 int dt_backend_get_target_size(void *context, uint64_t block_size, uint64_t *total_bytes, uint64_t *blocks) {
     DtPosixBackendContext *ctx = (DtPosixBackendContext *)context;
 
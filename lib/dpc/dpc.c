@@ -5,73 +5,250 @@
  * license that can be found in the LICENSE file or at
  * https://opensource.org/licenses/MIT
  */
+#include <assert.h>
 #include <lk/debug.h>
 #include <stddef.h>
-#include <lk/list.h>
-#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <lk/console_cmd.h>
 #include <lk/err.h>
 #include <lib/dpc.h>
+#include <arch/ops.h>
 #include <kernel/thread.h>
 #include <kernel/event.h>
+#include <lib/kmem_cache.h>
 #include <lk/init.h>
+#include <platform.h>
 
-struct dpc {
-    struct list_node node;
+/*
+ * Each cpu has a worker thread pinned to it and a queue that is a singly
+ * linked stack of dpcs. Producers push with a compare and swap; the worker
+ * takes the whole stack with a single exchange and reverses it to run the
+ * dpcs in the order they were queued. Pushing onto an empty queue is what
+ * signals the worker, so a busy worker is not woken once per dpc.
+ */
 
-    dpc_callback cb;
-    void *arg;
+/* latency histogram buckets: bucket 0 is under 1us, bucket n covers
+ * [2^(n-1), 2^n) usecs, and the last bucket is open ended */
+#define DPC_LATENCY_BUCKETS 16
+
+enum {
+    DPC_STATE_IDLE = 0,
+    DPC_STATE_QUEUED,
 };
 
-static struct list_node dpc_list = LIST_INITIAL_VALUE(dpc_list);
-static event_t dpc_event;
+/* dpc_t.flags, internal */
+#define DPC_INTERNAL_FLAG_ALLOCATED 0x1
 
-static int dpc_thread_routine(void *arg);
+struct dpc_cpu {
+    dpc_t *head;
+    event_t event;
+    volatile int running;
 
-status_t dpc_queue(dpc_callback cb, void *arg, uint flags) {
-    struct dpc *dpc;
+    /* stats; queued is bumped by producers, the rest only by the worker */
+    volatile int queued;
+    ulong ran;
+    lk_bigtime_t total_latency;
+    lk_bigtime_t max_latency;
+    ulong latency_hist[DPC_LATENCY_BUCKETS];
+} __CPU_ALIGN;
+
+static struct dpc_cpu dpc_cpus[SMP_MAX_CPUS];
+static kmem_cache_t *dpc_cache;
+
+void dpc_initialize(dpc_t *dpc, dpc_callback cb, void *arg) {
+    *dpc = (dpc_t)DPC_INITIAL_VALUE(*dpc, cb, arg);
+}
+
+status_t dpc_enqueue(dpc_t *dpc, int cpu, uint flags) {
+    DEBUG_ASSERT(dpc->magic == DPC_MAGIC);
+
+    if (cpu != DPC_CPU_LOCAL && (cpu < 0 || cpu >= SMP_MAX_CPUS))
+        return ERR_INVALID_ARGS;
+
+    int expected = DPC_STATE_IDLE;
+    if (!__atomic_compare_exchange_n(&dpc->state, &expected, DPC_STATE_QUEUED, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return ERR_ALREADY_EXISTS;
+
+    if (cpu == DPC_CPU_LOCAL)
+        cpu = arch_curr_cpu_num();
+
+    /* cpus without a worker yet hand their work to the boot cpu, which will
+     * pick up anything queued before its own worker starts */
+    struct dpc_cpu *c = &dpc_cpus[cpu];
+    if (!__atomic_load_n(&c->running, __ATOMIC_SEQ_CST))
+        c = &dpc_cpus[0];
+
+    dpc->queue_time = current_time_hires();
+
+    dpc_t *head = __atomic_load_n(&c->head, __ATOMIC_RELAXED);
+    do {
+        dpc->next = head;
+    } while (!__atomic_compare_exchange_n(&c->head, &head, dpc, true,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
 
-    dpc = malloc(sizeof(struct dpc));
+    __atomic_fetch_add(&c->queued, 1, __ATOMIC_RELAXED);
 
+    /* only the push onto an empty queue needs to wake the worker. If the
+     * worker is not running yet it drains the queue when it starts. */
+    if (head == NULL && __atomic_load_n(&c->running, __ATOMIC_SEQ_CST)) {
+        bool resched = !(flags & DPC_FLAG_NORESCHED) && !arch_ints_disabled();
+        event_signal(&c->event, resched);
+    }
+
+    return NO_ERROR;
+}
+
+status_t dpc_queue(dpc_callback cb, void *arg, uint flags) {
+    DEBUG_ASSERT(dpc_cache);
+
+    dpc_t *dpc = kmem_cache_alloc(dpc_cache);
     if (dpc == NULL)
         return ERR_NO_MEMORY;
 
-    dpc->cb = cb;
-    dpc->arg = arg;
-    enter_critical_section();
-    list_add_tail(&dpc_list, &dpc->node);
-    event_signal(&dpc_event, (flags & DPC_FLAG_NORESCHED) ? false : true);
-    exit_critical_section();
+    dpc_initialize(dpc, cb, arg);
+    dpc->flags = DPC_INTERNAL_FLAG_ALLOCATED;
 
-    return NO_ERROR;
+    status_t err = dpc_enqueue(dpc, DPC_CPU_LOCAL, flags);
+    DEBUG_ASSERT(err == NO_ERROR);
+
+    return err;
 }
 
-static int dpc_thread_routine(void *arg) {
-    for (;;) {
-        event_wait(&dpc_event);
+static void dpc_record_latency(struct dpc_cpu *c, lk_bigtime_t latency) {
+    uint bucket = 0;
+    if (latency > 0)
+        bucket = MIN(64 - __builtin_clzll(latency), DPC_LATENCY_BUCKETS - 1);
 
-        enter_critical_section();
-        struct dpc *dpc = list_remove_head_type(&dpc_list, struct dpc, node);
-        if (!dpc)
-            event_unsignal(&dpc_event);
-        exit_critical_section();
+    c->latency_hist[bucket]++;
+    c->total_latency += latency;
+    if (latency > c->max_latency)
+        c->max_latency = latency;
+    c->ran++;
+}
 
-        if (dpc) {
-//          dprintf("dpc calling %p, arg %p\n", dpc->cb, dpc->arg);
-            dpc->cb(dpc->arg);
+static void dpc_run_queue(struct dpc_cpu *c) {
+    dpc_t *list = __atomic_exchange_n(&c->head, NULL, __ATOMIC_ACQUIRE);
 
-            free(dpc);
-        }
+    /* the queue is newest first, flip it around */
+    dpc_t *fifo = NULL;
+    while (list) {
+        dpc_t *next = list->next;
+        list->next = fifo;
+        fifo = list;
+        list = next;
+    }
+
+    while (fifo) {
+        dpc_t *dpc = fifo;
+        fifo = dpc->next;
+
+        DEBUG_ASSERT(dpc->magic == DPC_MAGIC);
+        DEBUG_ASSERT(dpc->state == DPC_STATE_QUEUED);
+
+        dpc_record_latency(c, current_time_hires() - dpc->queue_time);
+
+        /* once the state goes back to idle the owner may requeue or reuse
+         * the dpc, so pull everything out of it first */
+        dpc_callback cb = dpc->cb;
+        void *arg = dpc->arg;
+        bool allocated = dpc->flags & DPC_INTERNAL_FLAG_ALLOCATED;
+        dpc->next = NULL;
+        __atomic_store_n(&dpc->state, DPC_STATE_IDLE, __ATOMIC_RELEASE);
+
+//      dprintf("dpc calling %p, arg %p\n", cb, arg);
+        cb(arg);
+
+        if (allocated)
+            kmem_cache_free(dpc_cache, dpc);
+    }
+}
+
+static int dpc_thread_routine(void *arg) {
+    struct dpc_cpu *c = arg;
+
+    for (;;) {
+        dpc_run_queue(c);
+        event_wait(&c->event);
     }
 
     return 0;
 }
 
 static void dpc_init(uint level) {
-    event_init(&dpc_event, false, 0);
+    uint cpu = arch_curr_cpu_num();
+    struct dpc_cpu *c = &dpc_cpus[cpu];
+
+    if (cpu == 0) {
+        dpc_cache = kmem_cache_create("dpc", sizeof(dpc_t), __alignof(dpc_t), NULL);
+        if (!dpc_cache)
+            panic("failed to create dpc cache\n");
+    }
 
-    thread_detach_and_resume(thread_create("dpc", &dpc_thread_routine, NULL, DPC_PRIORITY, DEFAULT_STACK_SIZE));
+    event_init(&c->event, false, EVENT_FLAG_AUTOUNSIGNAL);
+
+    char name[32];
+    snprintf(name, sizeof(name), "dpc %u", cpu);
+    thread_t *t = thread_create(name, &dpc_thread_routine, c, DPC_PRIORITY, DEFAULT_STACK_SIZE);
+    if (!t)
+        panic("failed to create dpc thread\n");
+    thread_set_pinned_cpu(t, cpu);
+
+    /* from here on producers signal the event instead of leaving work for
+     * the worker's first pass */
+    __atomic_store_n(&c->running, 1, __ATOMIC_SEQ_CST);
+
+    thread_detach_and_resume(t);
 }
 
-LK_INIT_HOOK(libdpc, &dpc_init, LK_INIT_LEVEL_THREADING);
+LK_INIT_HOOK_FLAGS(libdpc, &dpc_init, LK_INIT_LEVEL_THREADING, LK_INIT_FLAG_ALL_CPUS);
+
+#if LK_DEBUGLEVEL > 0
+
+static int cmd_dpc(int argc, const console_cmd_args *argv) {
+    if (argc >= 2 && !strcmp(argv[1].str, "reset")) {
+        for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+            struct dpc_cpu *c = &dpc_cpus[i];
+            c->queued = 0;
+            c->ran = 0;
+            c->total_latency = 0;
+            c->max_latency = 0;
+            memset(c->latency_hist, 0, sizeof(c->latency_hist));
+        }
+        return NO_ERROR;
+    } else if (argc >= 2) {
+        printf("usage:\n");
+        printf("%s\n", argv[0].str);
+        printf("%s reset\n", argv[0].str);
+        return ERR_INVALID_ARGS;
+    }
+
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        struct dpc_cpu *c = &dpc_cpus[i];
+        if (!c->running)
+            continue;
+
+        printf("cpu %u: queued %d ran %lu, latency avg %llu max %llu usecs\n", i,
+               c->queued, c->ran, c->ran ? c->total_latency / c->ran : 0, c->max_latency);
+        for (uint b = 0; b < DPC_LATENCY_BUCKETS; b++) {
+            if (!c->latency_hist[b])
+                continue;
+            if (b == 0)
+                printf("\t      < 1us: %lu\n", c->latency_hist[b]);
+            else if (b == DPC_LATENCY_BUCKETS - 1)
+                printf("\t>= %6uus: %lu\n", 1u << (b - 1), c->latency_hist[b]);
+            else
+                printf("\t < %6uus: %lu\n", 1u << b, c->latency_hist[b]);
+        }
+    }
+
+    return NO_ERROR;
+}
 
+STATIC_COMMAND_START
+STATIC_COMMAND("dpc", "deferred procedure call stats", &cmd_dpc)
+STATIC_COMMAND_END(dpc);
 
+#endif
@@ -7,12 +7,69 @@
  */
 #pragma once
 
+#include <lk/compiler.h>
 #include <lk/list.h>
 #include <sys/types.h>
 
+__BEGIN_CDECLS
+
+/*
+ * Deferred procedure calls.
+ *
+ * A dpc runs a callback later in thread context, on a per cpu worker thread
+ * at DPC_PRIORITY. Each cpu has its own lock free queue, so queuing never
+ * takes a lock or allocates, and is safe from interrupt context.
+ *
+ * The caller owns the dpc_t. It may be queued again as soon as its callback
+ * has started running, and must not be freed while it is queued.
+ */
+
 typedef void (*dpc_callback)(void *arg);
 
+#define DPC_MAGIC (0x64706320) // 'dpc '
+
+typedef struct dpc {
+    int magic;
+    volatile int state;
+    struct dpc *next;
+
+    dpc_callback cb;
+    void *arg;
+    uint flags;
+    lk_bigtime_t queue_time;
+} dpc_t;
+
+#define DPC_INITIAL_VALUE(d, _cb, _arg) \
+{ \
+    .magic = DPC_MAGIC, \
+    .state = 0, \
+    .next = NULL, \
+    .cb = (_cb), \
+    .arg = (_arg), \
+    .flags = 0, \
+    .queue_time = 0, \
+}
+
+/* flags for dpc_queue and dpc_enqueue */
 #define DPC_FLAG_NORESCHED 0x1
 
+/* run on the calling cpu */
+#define DPC_CPU_LOCAL (-1)
+
+void dpc_initialize(dpc_t *dpc, dpc_callback cb, void *arg);
+
+/*
+ * Queue a caller owned dpc to run on the given cpu's worker, or the current
+ * cpu's with DPC_CPU_LOCAL. Returns ERR_ALREADY_EXISTS if it is already
+ * queued and has not started running yet.
+ */
+status_t dpc_enqueue(dpc_t *dpc, int cpu, uint flags);
+
+/*
+ * Queue a one shot callback on the current cpu. The dpc_t is allocated from
+ * an object cache and released once the callback returns, so this may fail
+ * with ERR_NO_MEMORY; prefer dpc_enqueue with an embedded dpc_t.
+ */
 status_t dpc_queue(dpc_callback, void *arg, uint flags);
 
+__END_CDECLS
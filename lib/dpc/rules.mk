@@ -1,8 +1,11 @@
 LOCAL_DIR := $(GET_LOCAL_DIR)
 
 MODULE := $(LOCAL_DIR)
+MODULE_OPTIONS := test
 
 MODULE_SRCS += \
 	$(LOCAL_DIR)/dpc.c
 
+MODULE_DEPS += lib/pool
+
 include make/module.mk
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#include <lib/dpc.h>
+#include <lib/unittest.h>
+
+#include <arch/atomic.h>
+#include <arch/ops.h>
+#include <kernel/event.h>
+#include <kernel/mp.h>
+#include <kernel/thread.h>
+#include <lk/err.h>
+
+#define ORDER_DPCS 8
+
+static dpc_t order_dpcs[ORDER_DPCS];
+static uint order_seq[ORDER_DPCS];
+static volatile int order_count;
+static event_t order_done;
+
+static void order_callback(void *arg) {
+    uint i = (uintptr_t)arg;
+
+    order_seq[i] = atomic_add(&order_count, 1);
+    if (order_seq[i] == ORDER_DPCS - 1)
+        event_signal(&order_done, false);
+}
+
+static bool test_dpc_order(void) {
+    BEGIN_TEST;
+
+    event_init(&order_done, false, 0);
+    order_count = 0;
+
+    /* with interrupts off the local worker cannot run until everything is
+     * queued, and a queued dpc cannot be queued again */
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
+    for (uint i = 0; i < ORDER_DPCS; i++) {
+        dpc_initialize(&order_dpcs[i], order_callback, (void *)(uintptr_t)i);
+        EXPECT_EQ(NO_ERROR, dpc_enqueue(&order_dpcs[i], DPC_CPU_LOCAL, DPC_FLAG_NORESCHED),
+                  "queue failed");
+    }
+    EXPECT_EQ(ERR_ALREADY_EXISTS, dpc_enqueue(&order_dpcs[0], DPC_CPU_LOCAL, DPC_FLAG_NORESCHED),
+              "double queue should fail");
+    arch_interrupt_restore(state);
+
+    ASSERT_EQ(NO_ERROR, event_wait_timeout(&order_done, 5000), "dpcs did not all run");
+    EXPECT_EQ(ORDER_DPCS, order_count, "dpc ran more than once");
+    for (uint i = 0; i < ORDER_DPCS; i++) {
+        EXPECT_EQ(i, order_seq[i], "dpcs ran out of order");
+    }
+
+    /* once run, a dpc can be queued again */
+    event_unsignal(&order_done);
+    order_count = ORDER_DPCS - 1;
+    EXPECT_EQ(NO_ERROR, dpc_enqueue(&order_dpcs[ORDER_DPCS - 1], DPC_CPU_LOCAL, 0),
+              "requeue failed");
+    ASSERT_EQ(NO_ERROR, event_wait_timeout(&order_done, 5000), "requeued dpc did not run");
+
+    event_destroy(&order_done);
+
+    END_TEST;
+}
+
+struct affinity_arg {
+    event_t done;
+    uint cpu;
+};
+
+static void affinity_callback(void *_arg) {
+    struct affinity_arg *arg = _arg;
+
+    arg->cpu = arch_curr_cpu_num();
+    event_signal(&arg->done, false);
+}
+
+static bool test_dpc_affinity(void) {
+    BEGIN_TEST;
+
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!mp_is_cpu_active(cpu))
+            continue;
+
+        struct affinity_arg arg;
+        event_init(&arg.done, false, 0);
+        arg.cpu = UINT32_MAX;
+
+        dpc_t dpc;
+        dpc_initialize(&dpc, affinity_callback, &arg);
+        ASSERT_EQ(NO_ERROR, dpc_enqueue(&dpc, cpu, 0), "queue failed");
+        ASSERT_EQ(NO_ERROR, event_wait_timeout(&arg.done, 5000), "dpc did not run");
+        EXPECT_EQ(cpu, arg.cpu, "dpc ran on the wrong cpu");
+
+        event_destroy(&arg.done);
+    }
+
+    dpc_t dpc;
+    dpc_initialize(&dpc, affinity_callback, NULL);
+    EXPECT_EQ(ERR_INVALID_ARGS, dpc_enqueue(&dpc, SMP_MAX_CPUS, 0), "bad cpu should fail");
+
+    END_TEST;
+}
+
+static event_t oneshot_done;
+
+static void oneshot_callback(void *arg) {
+    event_signal(&oneshot_done, false);
+}
+
+static bool test_dpc_queue_oneshot(void) {
+    BEGIN_TEST;
+
+    event_init(&oneshot_done, false, 0);
+    ASSERT_EQ(NO_ERROR, dpc_queue(oneshot_callback, NULL, 0), "queue failed");
+    EXPECT_EQ(NO_ERROR, event_wait_timeout(&oneshot_done, 5000), "dpc did not run");
+    event_destroy(&oneshot_done);
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(dpc_tests)
+RUN_TEST(test_dpc_order);
+RUN_TEST(test_dpc_affinity);
+RUN_TEST(test_dpc_queue_oneshot);
+END_TEST_CASE(dpc_tests)
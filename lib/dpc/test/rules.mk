@@ -0,0 +1,12 @@
+LOCAL_DIR := $(GET_LOCAL_DIR)
+
+MODULE := $(LOCAL_DIR)
+
+MODULE_SRCS += \
+	$(LOCAL_DIR)/dpc_tests.c
+
+MODULE_DEPS += \
+	lib/dpc \
+	lib/unittest
+
+include make/module.mk
@@ -21,6 +21,7 @@
  * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
+#include <arch/atomic.h>
 #include <dev/virtio/9p.h>
 
 #include <lk/err.h>
@@ -217,84 +218,168 @@ err:
     return ret;
 }
 
+// One page sized Tread or Twrite of a pipelined transfer.
+struct v9fs_io {
+    struct p9_req *req;
+    off_t offset;
+    uint32_t count;
+};
+
+// Send one request of a transfer. Waiting for a request slot while holding
+// others could deadlock with other threads doing the same, so with requests
+// already in flight this fails with ERR_NOT_READY rather than wait, and the
+// caller takes back a reply of its own first.
+static status_t v9fs_io_submit(v9fs_file_t *file, const virtio_9p_msg_t *tmsg,
+                               struct p9_req **req, size_t inflight) {
+    if (inflight > 0) {
+        return virtio_9p_rpc_try_submit(file->v9fs->dev, tmsg, req);
+    }
+    return virtio_9p_rpc_submit(file->v9fs->dev, tmsg, req);
+}
+
+// Large transfers keep up to V9FS_IO_DEPTH requests in flight and take the
+// replies back in order. A short reply means the ones after it were sent for
+// the wrong offsets, so they are dropped and the transfer carries on from
+// where the short one stopped.
 static ssize_t read_file_impl(v9fs_file_t *file, void *buf, off_t offset,
                               size_t len) {
+    struct v9fs_io io[V9FS_IO_DEPTH];
+    size_t head = 0, inflight = 0;
+    const off_t end = offset + len;
+    off_t pos = offset;  // everything before pos has been copied out
+    off_t next = offset; // where the next Tread starts
     status_t err = NO_ERROR;
-    ssize_t rlen = 0;
-    uint32_t readcount;
-
-    while (len > 0) {
-        virtio_9p_msg_t tread = {
-            .msg_type = P9_TREAD,
-            .tag = P9_TAG_DEFAULT,
-            .msg.tread = {
-                .fid = file->fid.fid, .offset = offset, .count = MIN(len, PAGE_SIZE)}};
-        virtio_9p_msg_t rread = {};
-
-        if ((err = virtio_9p_rpc(file->v9fs->dev, &tread, &rread)) != NO_ERROR) {
-            break;
+    bool eof = false;
+
+    for (;;) {
+        while (err == NO_ERROR && !eof && inflight < V9FS_IO_DEPTH && next < end) {
+            struct v9fs_io *tio = &io[(head + inflight) % V9FS_IO_DEPTH];
+            tio->offset = next;
+            tio->count = MIN((size_t)(end - next), (size_t)PAGE_SIZE);
+
+            virtio_9p_msg_t tread = {
+                .msg_type = P9_TREAD,
+                .tag = P9_TAG_DEFAULT,
+                .msg.tread = {
+                    .fid = file->fid.fid, .offset = tio->offset, .count = tio->count}};
+
+            if ((err = v9fs_io_submit(file, &tread, &tio->req, inflight)) != NO_ERROR) {
+                if (err == ERR_NOT_READY) {
+                    // take a reply back before asking again
+                    err = NO_ERROR;
+                }
+                break;
+            }
+            next += tio->count;
+            inflight++;
         }
 
-        if (rread.msg_type != P9_RREAD) {
-            err = ERR_IO;
+        if (inflight == 0) {
             break;
         }
 
-        readcount = rread.msg.rread.count;
+        struct v9fs_io *rio = &io[head];
+        head = (head + 1) % V9FS_IO_DEPTH;
+        inflight--;
 
-        memcpy(&((uint8_t *)buf)[rlen], rread.msg.rread.data, readcount);
+        virtio_9p_msg_t rread = {};
+        status_t ret = virtio_9p_rpc_wait(file->v9fs->dev, rio->req, &rread);
+        if (ret == NO_ERROR && rread.msg_type != P9_RREAD) {
+            ret = ERR_IO;
+        }
 
-        offset += readcount;
-        rlen += readcount;
-        len -= readcount;
+        if (ret != NO_ERROR) {
+            if (err == NO_ERROR) {
+                err = ret;
+            }
+        } else if (err == NO_ERROR && !eof && rio->offset == pos) {
+            uint32_t readcount = MIN(rread.msg.rread.count, rio->count);
+
+            memcpy((uint8_t *)buf + (pos - offset), rread.msg.rread.data, readcount);
+            pos += readcount;
+
+            if (readcount == 0) {
+                // read to the end of the file
+                eof = true;
+            } else if (readcount < rio->count) {
+                next = pos;
+            }
+        }
 
         virtio_9p_msg_destroy(&rread);
-
-        // read to the end of the file
-        if (rread.msg.rread.count == 0) {
-            break;
-        }
     }
 
-    return err == NO_ERROR ? rlen : err;
+    return err == NO_ERROR ? pos - offset : err;
 }
 
 static ssize_t write_file_impl(v9fs_file_t *file, const void *buf, off_t offset,
                                size_t len) {
+    struct v9fs_io io[V9FS_IO_DEPTH];
+    size_t head = 0, inflight = 0;
+    const off_t end = offset + len;
+    off_t pos = offset;  // everything before pos is known to be written
+    off_t next = offset; // where the next Twrite starts
     status_t err = NO_ERROR;
-    ssize_t wlen = 0;
-    uint32_t writecount;
-    const uint8_t *cpos = buf;
-
-    while (len > 0) {
-        virtio_9p_msg_t twrite = {
-            .msg_type = P9_TWRITE,
-            .tag = P9_TAG_DEFAULT,
-            .msg.twrite = {
-                .fid = file->fid.fid, .offset = offset, .data = cpos, .count = MIN(len, PAGE_SIZE)}};
-        virtio_9p_msg_t rwrite = {};
 
-        if ((err = virtio_9p_rpc(file->v9fs->dev, &twrite, &rwrite)) !=
-            NO_ERROR) {
-            break;
+    for (;;) {
+        while (err == NO_ERROR && inflight < V9FS_IO_DEPTH && next < end) {
+            struct v9fs_io *tio = &io[(head + inflight) % V9FS_IO_DEPTH];
+            tio->offset = next;
+            tio->count = MIN((size_t)(end - next), (size_t)PAGE_SIZE);
+
+            virtio_9p_msg_t twrite = {
+                .msg_type = P9_TWRITE,
+                .tag = P9_TAG_DEFAULT,
+                .msg.twrite = {
+                    .fid = file->fid.fid,
+                    .offset = tio->offset,
+                    .data = (const uint8_t *)buf + (tio->offset - offset),
+                    .count = tio->count}};
+
+            if ((err = v9fs_io_submit(file, &twrite, &tio->req, inflight)) != NO_ERROR) {
+                if (err == ERR_NOT_READY) {
+                    // take a reply back before asking again
+                    err = NO_ERROR;
+                }
+                break;
+            }
+            next += tio->count;
+            inflight++;
         }
 
-        if (rwrite.msg_type != P9_RWRITE) {
-            err = ERR_IO;
+        if (inflight == 0) {
             break;
         }
 
-        writecount = rwrite.msg.rwrite.count;
+        struct v9fs_io *rio = &io[head];
+        head = (head + 1) % V9FS_IO_DEPTH;
+        inflight--;
 
-        offset += writecount;
-        cpos += writecount;
-        wlen += writecount;
-        len -= writecount;
+        virtio_9p_msg_t rwrite = {};
+        status_t ret = virtio_9p_rpc_wait(file->v9fs->dev, rio->req, &rwrite);
+        if (ret == NO_ERROR && (rwrite.msg_type != P9_RWRITE || rwrite.msg.rwrite.count == 0)) {
+            ret = ERR_IO;
+        }
+
+        if (ret != NO_ERROR) {
+            if (err == NO_ERROR) {
+                err = ret;
+            }
+        } else if (err == NO_ERROR && rio->offset == pos) {
+            uint32_t writecount = MIN(rwrite.msg.rwrite.count, rio->count);
+
+            pos += writecount;
+            if (writecount < rio->count) {
+                // the later writes in flight are of the same data, and are
+                // simply sent again from here
+                next = pos;
+            }
+        }
 
         virtio_9p_msg_destroy(&rwrite);
     }
 
-    return err == NO_ERROR ? wlen : err;
+    return err == NO_ERROR ? pos - offset : err;
 }
 
 #define fs_page_index(off) ((off) / V9FS_FILE_PAGE_BUFFER_SIZE)
@@ -321,8 +406,71 @@ static bool fs_page_hit(struct fs_page_buffer *buf, off_t offset) {
     return fs_page_index(offset) == buf->index;
 }
 
+// Send a Tread for page `index` without waiting for it, for the next page
+// miss to pick up. Read-ahead is only worth a request slot that is free right
+// now, and only while fewer than V9FS_MAX_READAHEADS of them are out.
+static void fs_page_readahead_start(v9fs_file_t *file, off_t index) {
+    DEBUG_ASSERT(!file->ra_req);
+
+    v9fs_t *v9fs = file->v9fs;
+    if (atomic_add(&v9fs->readaheads, 1) >= V9FS_MAX_READAHEADS) {
+        atomic_add(&v9fs->readaheads, -1);
+        return;
+    }
+
+    virtio_9p_msg_t tread = {
+        .msg_type = P9_TREAD,
+        .tag = P9_TAG_DEFAULT,
+        .msg.tread = {
+            .fid = file->fid.fid,
+            .offset = fs_page_start_by_index(index),
+            .count = V9FS_FILE_PAGE_BUFFER_SIZE}};
+
+    if (virtio_9p_rpc_try_submit(v9fs->dev, &tread, &file->ra_req) != NO_ERROR) {
+        file->ra_req = NULL;
+        atomic_add(&v9fs->readaheads, -1);
+        return;
+    }
+    file->ra_index = index;
+}
+
+// Wait for the read-ahead and copy what it read into `data`, if not NULL.
+static ssize_t fs_page_readahead_finish(v9fs_file_t *file, uint8_t *data) {
+    virtio_9p_msg_t rread = {};
+    ssize_t ret;
+
+    ret = virtio_9p_rpc_wait(file->v9fs->dev, file->ra_req, &rread);
+    file->ra_req = NULL;
+    atomic_add(&file->v9fs->readaheads, -1);
+
+    if (ret == NO_ERROR) {
+        if (rread.msg_type != P9_RREAD) {
+            ret = ERR_IO;
+        } else {
+            ret = MIN(rread.msg.rread.count, V9FS_FILE_PAGE_BUFFER_SIZE);
+            if (data) {
+                memcpy(data, rread.msg.rread.data, ret);
+            }
+        }
+    }
+
+    virtio_9p_msg_destroy(&rread);
+
+    return ret;
+}
+
+// Anything written to the file has to wait until an overlapping read-ahead is
+// out of the way, and it is simplest to never leave one behind.
+static void fs_page_readahead_drop(v9fs_file_t *file) {
+    if (file->ra_req) {
+        fs_page_readahead_finish(file, NULL);
+    }
+}
+
 static void fs_page_update(v9fs_file_t *file, off_t offset) {
-    ssize_t rsize;
+    const off_t index = fs_page_index(offset);
+    ssize_t rsize = -1;
+    bool sequential;
 
     if (fs_page_hit(&file->pg_buf, offset) &&
         !file->pg_buf.need_update) {
@@ -337,14 +485,52 @@ static void fs_page_update(v9fs_file_t *file, off_t offset) {
         file->pg_buf.dirty = false;
     }
 
+    sequential = !file->pg_buf.need_update && index == file->pg_buf.index + 1;
+
     memset(file->pg_buf.data, 0, V9FS_FILE_PAGE_BUFFER_SIZE);
-    rsize =
-        read_file_impl(file, file->pg_buf.data, fs_page_start_by_offset(offset),
-                       V9FS_FILE_PAGE_BUFFER_SIZE);
+    if (file->ra_req && file->ra_index == index) {
+        rsize = fs_page_readahead_finish(file, file->pg_buf.data);
+        sequential = true;
+    }
+    fs_page_readahead_drop(file);
+
+    // a short read-ahead is most likely the end of the file, but only a full
+    // read tells that apart from the server splitting the reply
+    if (rsize < V9FS_FILE_PAGE_BUFFER_SIZE) {
+        rsize = read_file_impl(file, file->pg_buf.data,
+                               fs_page_start_by_offset(offset),
+                               V9FS_FILE_PAGE_BUFFER_SIZE);
+    }
     file->pg_buf.size = rsize;
-    file->pg_buf.index = fs_page_index(offset);
+    file->pg_buf.index = index;
     file->pg_buf.need_update = false;
     file->pg_buf.dirty = false;
+
+    // stay a page ahead of sequential access, unless this was the last page
+    if (sequential && rsize == V9FS_FILE_PAGE_BUFFER_SIZE) {
+        fs_page_readahead_start(file, index + 1);
+    }
+}
+
+// Transfers too large for the page buffer go around it, so first write back
+// a dirty page they overlap, and after a write drop the stale copy.
+static void fs_page_sync(v9fs_file_t *file, off_t offset, size_t size,
+                         bool invalidate) {
+    if (file->pg_buf.need_update ||
+        file->pg_buf.index < fs_page_index(offset) ||
+        file->pg_buf.index > fs_page_index(offset + (off_t)size - 1)) {
+        return;
+    }
+
+    if (file->pg_buf.dirty) {
+        write_file_impl(file, file->pg_buf.data,
+                        fs_page_start_by_index(file->pg_buf.index),
+                        file->pg_buf.size);
+        file->pg_buf.dirty = false;
+    }
+    if (invalidate) {
+        file->pg_buf.need_update = true;
+    }
 }
 
 static ssize_t fs_page_read(v9fs_file_t *file, void *buf, off_t offset,
@@ -392,6 +578,7 @@ ssize_t v9fs_read_file(filecookie *fcookie, void *buf, off_t offset, size_t len)
     if (fs_valid_page(offset, len)) {
         rsize = fs_page_read(file, buf, offset, len);
     } else {
+        fs_page_sync(file, offset, len, false);
         rsize = read_file_impl(file, buf, offset, len);
     }
 
@@ -421,6 +608,8 @@ ssize_t v9fs_write_file(filecookie *fcookie, const void *buf, off_t offset,
     if (fs_valid_page(offset, len)) {
         rsize = fs_page_write(file, buf, offset, len);
     } else {
+        fs_page_readahead_drop(file);
+        fs_page_sync(file, offset, len, true);
         rsize = write_file_impl(file, buf, offset, len);
     }
 
@@ -444,6 +633,8 @@ status_t v9fs_close_file(filecookie *fcookie) {
         return ret;
     }
 
+    fs_page_readahead_drop(file);
+
     if (file->pg_buf.dirty) {
         // writeback the dirty page
         write_file_impl(file, file->pg_buf.data,
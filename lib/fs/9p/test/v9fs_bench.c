@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#include <arch/defines.h>
+#include <inttypes.h>
+#include <kernel/thread.h>
+#include <lib/fs.h>
+#include <lk/console_cmd.h>
+#include <lk/err.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if WITH_LIB_CONSOLE
+
+// File throughput on a virtfs share, by transfer size from one thread and by
+// number of threads reading at once, each through its own handle. Writes a
+// scratch file, v9fs_bench.bin, to the root of the share.
+
+#define V9FS_MOUNT_POINT "/v9p"
+#define V9FS_NAME        "9p"
+#define V9P_BDEV_NAME    "v9p0"
+#define BENCH_FILE       V9FS_MOUNT_POINT "/v9fs_bench.bin"
+
+#define BENCH_IO_SIZE (64 * 1024)
+#define MAX_THREADS   8
+
+static void print_rate(const char *op, size_t size, uint64_t bytes, lk_bigtime_t usecs) {
+    if (usecs == 0) {
+        usecs = 1;
+    }
+    // bytes per usec is MB/s
+    uint64_t centi_mbs = bytes * 100 / usecs;
+    printf("\t%-8s %8zu: %6" PRIu64 ".%02" PRIu64 " MB/s\n", op, size, centi_mbs / 100,
+           centi_mbs % 100);
+}
+
+static status_t read_range(off_t offset, size_t len, size_t io_size) {
+    filehandle *handle;
+    status_t err = fs_open_file(BENCH_FILE, &handle);
+    if (err < 0) {
+        return err;
+    }
+
+    uint8_t *buf = memalign(CACHE_LINE, io_size);
+    if (!buf) {
+        fs_close_file(handle);
+        return ERR_NO_MEMORY;
+    }
+
+    for (size_t done = 0; done < len; done += io_size) {
+        ssize_t ret = fs_read_file(handle, buf, offset + done, MIN(io_size, len - done));
+        if (ret != (ssize_t)MIN(io_size, len - done)) {
+            err = ret < 0 ? (status_t)ret : ERR_IO;
+            break;
+        }
+    }
+
+    free(buf);
+    fs_close_file(handle);
+
+    return err;
+}
+
+struct reader {
+    off_t offset;
+    size_t len;
+};
+
+static int reader_thread(void *arg) {
+    struct reader *r = arg;
+
+    return read_range(r->offset, r->len, BENCH_IO_SIZE);
+}
+
+static status_t bench_threads(int nthreads, size_t file_bytes) {
+    struct reader readers[MAX_THREADS];
+    thread_t *threads[MAX_THREADS];
+    const size_t slice = file_bytes / nthreads;
+    status_t err = NO_ERROR;
+
+    int started = 0;
+    lk_bigtime_t start = current_time_hires();
+    for (int i = 0; i < nthreads; i++) {
+        readers[i].offset = (off_t)i * slice;
+        readers[i].len = slice;
+        threads[i] = thread_create("v9fs bench", reader_thread, &readers[i],
+                                   DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        if (!threads[i]) {
+            err = ERR_NO_MEMORY;
+            break;
+        }
+        thread_resume(threads[i]);
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        int ret;
+        thread_join(threads[i], &ret, INFINITE_TIME);
+        if (ret < 0 && err == NO_ERROR) {
+            err = ret;
+        }
+    }
+    if (err == NO_ERROR) {
+        print_rate("threads", (size_t)nthreads, slice * nthreads, current_time_hires() - start);
+    }
+
+    return err;
+}
+
+static status_t write_bench_file(size_t file_bytes) {
+    filehandle *handle;
+    status_t err = fs_create_file(BENCH_FILE, &handle, 0);
+    if (err < 0) {
+        return err;
+    }
+
+    uint8_t *buf = memalign(CACHE_LINE, BENCH_IO_SIZE);
+    if (!buf) {
+        fs_close_file(handle);
+        return ERR_NO_MEMORY;
+    }
+    memset(buf, 0x55, BENCH_IO_SIZE);
+
+    lk_bigtime_t start = current_time_hires();
+    for (size_t off = 0; off < file_bytes; off += BENCH_IO_SIZE) {
+        ssize_t ret = fs_write_file(handle, buf, off, BENCH_IO_SIZE);
+        if (ret != BENCH_IO_SIZE) {
+            err = ret < 0 ? (status_t)ret : ERR_IO;
+            break;
+        }
+    }
+    if (err == NO_ERROR) {
+        print_rate("write", BENCH_IO_SIZE, file_bytes, current_time_hires() - start);
+    }
+
+    free(buf);
+    fs_close_file(handle);
+
+    return err;
+}
+
+static int cmd_v9fs_bench(int argc, const console_cmd_args *argv) {
+    size_t mb = 16;
+    if (argc >= 2) {
+        mb = argv[1].u;
+    }
+    if (mb == 0 || mb > 256) {
+        printf("usage: %s [file size in MB, 1-256]\n", argv[0].str);
+        return ERR_INVALID_ARGS;
+    }
+    const size_t file_bytes = mb * 1024 * 1024;
+
+    status_t err = fs_mount(V9FS_MOUNT_POINT, V9FS_NAME, V9P_BDEV_NAME, FS_MOUNT_OPTION_NONE);
+    if (err < 0) {
+        printf("failed to mount %s on %s: %d\n", V9P_BDEV_NAME, V9FS_MOUNT_POINT, err);
+        return err;
+    }
+
+    printf("%zu MB file:\n", mb);
+    err = write_bench_file(file_bytes);
+    if (err < 0) {
+        printf("write failed: %d\n", err);
+        goto out;
+    }
+
+    // one thread: small reads go through the page buffer and its read-ahead,
+    // large ones are pipelined a page per request
+    static const size_t sizes[] = {512, 4096, BENCH_IO_SIZE, 1024 * 1024};
+    for (size_t i = 0; i < countof(sizes); i++) {
+        lk_bigtime_t start = current_time_hires();
+        err = read_range(0, file_bytes, sizes[i]);
+        if (err < 0) {
+            printf("read of %zu bytes failed: %d\n", sizes[i], err);
+            goto out;
+        }
+        print_rate("read", sizes[i], file_bytes, current_time_hires() - start);
+    }
+
+    // several threads, each with a slice of the file and its own handle
+    for (int n = 1; n <= MAX_THREADS; n *= 2) {
+        err = bench_threads(n, file_bytes);
+        if (err < 0) {
+            printf("read with %d threads failed: %d\n", n, err);
+            goto out;
+        }
+    }
+
+out:
+    fs_unmount(V9FS_MOUNT_POINT);
+
+    return err;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("v9fs_bench", "9p file throughput by transfer size and concurrency", &cmd_v9fs_bench)
+STATIC_COMMAND_END(v9fs_bench);
+
+#endif // WITH_LIB_CONSOLE
@@ -42,11 +42,21 @@ typedef struct v9fs {
 
     struct list_node files;
     struct list_node dirs;
+
+    // read-aheads outstanding across all files, see V9FS_MAX_READAHEADS
+    volatile int readaheads;
 } v9fs_t;
 
 #define V9FS_FILE_PAGE_BUFFER_SIZE (1 << 12)
 #define V9FS_FILE_LOCK_TIMEOUT     3000
 
+// Treads or Twrites of a page each that one large transfer keeps in flight
+#define V9FS_IO_DEPTH 4
+
+// Read-aheads hold a request slot until the file's next page miss, however
+// long that is, so only a few of the device's slots may go to them at once.
+#define V9FS_MAX_READAHEADS 4
+
 typedef struct v9fs_file {
     v9fs_t *v9fs;
     v9fs_fid_t fid;
@@ -61,6 +71,10 @@ typedef struct v9fs_file {
         bool dirty;
         uint8_t data[V9FS_FILE_PAGE_BUFFER_SIZE];
     } pg_buf;
+
+    // Tread of the page after pg_buf, sent while small reads look sequential
+    struct p9_req *ra_req;
+    off_t ra_index;
 } v9fs_file_t;
 
 typedef struct v9fs_dir {
@@ -17,6 +17,34 @@
 
 #define LOCAL_TRACE 0
 
+/* Features that change how the data is laid out, of which we can read these.
+ * RECOVER is left out: the journal is never replayed, so a volume that needs
+ * it would give back stale data. FLEX_BG needs nothing special: it only moves
+ * the bitmaps and inode tables, and the group descriptors say where to. */
+#define EXT2_INCOMPAT_READABLE (EXT2_FEATURE_INCOMPAT_FILETYPE | \
+                                EXT3_FEATURE_INCOMPAT_EXTENTS | \
+                                EXT4_FEATURE_INCOMPAT_64BIT | \
+                                EXT4_FEATURE_INCOMPAT_MMP | \
+                                EXT4_FEATURE_INCOMPAT_FLEX_BG | \
+                                EXT4_FEATURE_INCOMPAT_EA_INODE | \
+                                EXT4_FEATURE_INCOMPAT_CSUM_SEED | \
+                                EXT4_FEATURE_INCOMPAT_LARGEDIR)
+
+/* Read only compatible features only constrain writers, and we never write, but
+ * stick to the ones known not to change how file data is found. */
+#define EXT2_RO_COMPAT_READABLE (EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER | \
+                                 EXT2_FEATURE_RO_COMPAT_LARGE_FILE | \
+                                 EXT2_FEATURE_RO_COMPAT_BTREE_DIR | \
+                                 EXT4_FEATURE_RO_COMPAT_HUGE_FILE | \
+                                 EXT4_FEATURE_RO_COMPAT_GDT_CSUM | \
+                                 EXT4_FEATURE_RO_COMPAT_DIR_NLINK | \
+                                 EXT4_FEATURE_RO_COMPAT_EXTRA_ISIZE | \
+                                 EXT4_FEATURE_RO_COMPAT_QUOTA | \
+                                 EXT4_FEATURE_RO_COMPAT_METADATA_CSUM | \
+                                 EXT4_FEATURE_RO_COMPAT_READONLY | \
+                                 EXT4_FEATURE_RO_COMPAT_PROJECT | \
+                                 EXT4_FEATURE_RO_COMPAT_ORPHAN_PRESENT)
+
 static void endian_swap_superblock(struct ext2_super_block *sb) {
     LE32SWAP(sb->s_inodes_count);
     LE32SWAP(sb->s_blocks_count);
@@ -57,6 +85,10 @@ static void endian_swap_superblock(struct ext2_super_block *sb) {
     LE32SWAP(sb->s_last_orphan);
     LE32SWAP(sb->s_default_mount_opts);
     LE32SWAP(sb->s_first_meta_bg);
+
+    /* ext4 */
+    LE16SWAP(sb->s_desc_size);
+    LE32SWAP(sb->s_blocks_count_hi);
 }
 
 static void endian_swap_inode(struct ext2_inode *inode) {
@@ -104,7 +136,10 @@ status_t ext2_mount(bdev_t *dev, fscookie **cookie, enum fs_mount_options option
         return ERR_NOT_FOUND;
     }
 
-    ext2_t *ext2 = malloc(sizeof(ext2_t));
+    ext2_t *ext2 = calloc(1, sizeof(ext2_t));
+    if (!ext2) {
+        return ERR_NO_MEMORY;
+    }
     ext2->dev = dev;
 
     err = bio_read(dev, &ext2->sb, 1024, sizeof(struct ext2_super_block));
@@ -117,7 +152,7 @@ status_t ext2_mount(bdev_t *dev, fscookie **cookie, enum fs_mount_options option
     /* see if the superblock is good */
     if (ext2->sb.s_magic != EXT2_SUPER_MAGIC) {
         err = -1;
-        return err;
+        goto err;
     }
 
     /* calculate group count, rounded up */
@@ -138,27 +173,65 @@ status_t ext2_mount(bdev_t *dev, fscookie **cookie, enum fs_mount_options option
     /* we only support dynamic revs */
     if (ext2->sb.s_rev_level > EXT2_DYNAMIC_REV) {
         err = -2;
-        return err;
+        goto err;
     }
 
     /* make sure it doesn't have any ro features we don't support */
-    if (ext2->sb.s_feature_ro_compat & ~(EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER | EXT2_FEATURE_RO_COMPAT_LARGE_FILE)) {
+    if (ext2->sb.s_feature_ro_compat & ~EXT2_RO_COMPAT_READABLE) {
         err = -3;
-        return err;
+        goto err;
     }
 
-    /* read in all the group descriptors */
+    /* or any that would stop us finding the data at all */
+    if (ext2->sb.s_feature_incompat & EXT3_FEATURE_INCOMPAT_RECOVER) {
+        dprintf(INFO, "ext2: journal needs recovery, which is not supported\n");
+    }
+    if (ext2->sb.s_feature_incompat & ~EXT2_INCOMPAT_READABLE) {
+        LTRACEF("unsupported incompat features 0x%x\n",
+                ext2->sb.s_feature_incompat & ~EXT2_INCOMPAT_READABLE);
+        err = ERR_NOT_SUPPORTED;
+        goto err;
+    }
+
+    /* the block cache and bio take 32 bit block numbers, so a 64bit volume is
+     * fine as long as it does not actually have more blocks than that. every
+     * block number in it then has a zero high half. */
+    size_t desc_size = EXT2_MIN_DESC_SIZE;
+    if (ext2->sb.s_feature_incompat & EXT4_FEATURE_INCOMPAT_64BIT) {
+        if (ext2->sb.s_blocks_count_hi != 0) {
+            err = ERR_NOT_SUPPORTED;
+            goto err;
+        }
+        desc_size = ext2->sb.s_desc_size;
+        if (desc_size < EXT4_MIN_DESC_SIZE_64BIT || desc_size > EXT4_MAX_DESC_SIZE ||
+                (desc_size & (desc_size - 1)) != 0) {
+            err = ERR_BAD_STATE;
+            goto err;
+        }
+    }
+
+    /* read in all the group descriptors. they start in the block after the
+     * superblock, and with 64bit each is desc_size bytes of which the first
+     * 32 hold the ext2 layout. */
     ext2->gd = malloc(sizeof(struct ext2_group_desc) * ext2->s_group_count);
-    err = bio_read(ext2->dev, (void *)ext2->gd,
-                   (EXT2_BLOCK_SIZE(ext2->sb) == 4096) ? 4096 : 2048,
-                   sizeof(struct ext2_group_desc) * ext2->s_group_count);
+    uint8_t *gd_raw = malloc(desc_size * ext2->s_group_count);
+    if (!ext2->gd || !gd_raw) {
+        free(gd_raw);
+        err = ERR_NO_MEMORY;
+        goto err;
+    }
+    err = bio_read(ext2->dev, gd_raw,
+                   (off_t)(ext2->sb.s_first_data_block + 1) * EXT2_BLOCK_SIZE(ext2->sb),
+                   desc_size * ext2->s_group_count);
     if (err < 0) {
+        free(gd_raw);
         err = -4;
-        return err;
+        goto err;
     }
 
     int i;
     for (i = 0; i < ext2->s_group_count; i++) {
+        memcpy(&ext2->gd[i], gd_raw + desc_size * i, sizeof(struct ext2_group_desc));
         endian_swap_group_desc(&ext2->gd[i]);
         LTRACEF("group %d:\n", i);
         LTRACEF("\tblock bitmap %d\n", ext2->gd[i].bg_block_bitmap);
@@ -168,9 +241,14 @@ status_t ext2_mount(bdev_t *dev, fscookie **cookie, enum fs_mount_options option
         LTRACEF("\tfree inodes %d\n", ext2->gd[i].bg_free_inodes_count);
         LTRACEF("\tused dirs %d\n", ext2->gd[i].bg_used_dirs_count);
     }
+    free(gd_raw);
 
     /* initialize the block cache */
-    ext2->cache = bcache_create(ext2->dev, EXT2_BLOCK_SIZE(ext2->sb), 4);
+    ext2->cache = bcache_create(ext2->dev, EXT2_BLOCK_SIZE(ext2->sb), 0);
+    if (!ext2->cache) {
+        err = ERR_NO_MEMORY;
+        goto err;
+    }
 
     /* load the first inode */
     err = ext2_load_inode(ext2, EXT2_ROOT_INO, &ext2->root_inode);
@@ -187,6 +265,10 @@ status_t ext2_mount(bdev_t *dev, fscookie **cookie, enum fs_mount_options option
 err:
     LTRACEF("exiting with err code %d\n", err);
 
+    if (ext2->cache) {
+        bcache_destroy(ext2->cache);
+    }
+    free(ext2->gd);
     free(ext2);
     return err;
 }
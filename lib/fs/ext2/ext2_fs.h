@@ -16,6 +16,7 @@
 #ifndef _LINUX_EXT2_FS_H
 #define _LINUX_EXT2_FS_H
 
+#include <lk/compiler.h>
 #include <stdint.h>
 #include <sys/types.h>
 
@@ -77,6 +78,15 @@ struct ext2_group_desc {
     uint32_t bg_reserved[3];
 };
 
+/*
+ * With the ext4 64bit feature group descriptors grow to s_desc_size bytes, the
+ * extra carrying the high halves of the fields above. The low halves keep the
+ * ext2 layout.
+ */
+#define EXT2_MIN_DESC_SIZE       32
+#define EXT4_MIN_DESC_SIZE_64BIT 64
+#define EXT4_MAX_DESC_SIZE       EXT2_MIN_BLOCK_SIZE
+
 /*
  * Macro-instructions used to manage group descriptors
  */
@@ -152,6 +162,47 @@ struct ext2_inode {
 
 #define i_size_high i_dir_acl
 
+/*
+ * Inode flags
+ */
+#define EXT4_EXTENTS_FL 0x00080000 /* Inode uses extents */
+
+/*
+ * ext4 extent tree. An inode with EXT4_EXTENTS_FL set keeps the root of the
+ * tree in i_block: a header followed by up to four entries. Interior nodes hold
+ * ext4_extent_idx entries pointing at blocks holding further nodes, leaves hold
+ * ext4_extent entries, each mapping a run of file blocks to physical blocks.
+ */
+#define EXT4_EXT_MAGIC 0xf30a
+
+struct ext4_extent_header {
+    uint16_t eh_magic;      /* EXT4_EXT_MAGIC */
+    uint16_t eh_entries;    /* number of valid entries */
+    uint16_t eh_max;        /* capacity of store in entries */
+    uint16_t eh_depth;      /* 0 for a leaf */
+    uint32_t eh_generation; /* generation of the tree */
+};
+
+struct ext4_extent {
+    uint32_t ee_block;    /* first logical block extent covers */
+    uint16_t ee_len;      /* number of blocks covered by extent */
+    uint16_t ee_start_hi; /* high 16 bits of physical block */
+    uint32_t ee_start_lo; /* low 32 bits of physical block */
+};
+
+struct ext4_extent_idx {
+    uint32_t ei_block;   /* index covers logical blocks from 'block' */
+    uint32_t ei_leaf_lo; /* low 32 bits of physical block of the next level */
+    uint16_t ei_leaf_hi; /* high 16 bits of physical block */
+    uint16_t ei_unused;
+};
+
+/*
+ * An ee_len above this marks an extent as allocated but not yet written, which
+ * reads back as zeroes. Its length is then ee_len - EXT4_EXT_INIT_MAX_LEN.
+ */
+#define EXT4_EXT_INIT_MAX_LEN 32768
+
 #define i_reserved1 osd1.linux1.l_i_reserved1
 #define i_frag      osd2.linux2.l_i_frag
 #define i_fsize     osd2.linux2.l_i_fsize
@@ -276,11 +327,29 @@ struct ext2_super_block {
     uint32_t s_last_orphan;     /* start of list of inodes to delete */
     uint32_t s_hash_seed[4];    /* HTREE hash seed */
     uint8_t s_def_hash_version; /* Default hash version to use */
-    uint8_t s_reserved_char_pad;
-    uint16_t s_reserved_word_pad;
+    uint8_t s_jnl_backup_type;
+    uint16_t s_desc_size; /* size of group descriptor, with 64bit */
     uint32_t s_default_mount_opts;
     uint32_t s_first_meta_bg; /* First metablock block group */
-    uint32_t s_reserved[190]; /* Padding to the end of the block */
+    /*
+     * ext4 additions
+     */
+    uint32_t s_mkfs_time;            /* When the filesystem was created */
+    uint32_t s_jnl_blocks[17];       /* Backup of the journal inode */
+    uint32_t s_blocks_count_hi;      /* Blocks count, high 32 bits */
+    uint32_t s_r_blocks_count_hi;    /* Reserved blocks count, high 32 bits */
+    uint32_t s_free_blocks_count_hi; /* Free blocks count, high 32 bits */
+    uint16_t s_min_extra_isize;      /* All inodes have at least # bytes */
+    uint16_t s_want_extra_isize;     /* New inodes should reserve # bytes */
+    uint32_t s_flags;                /* Miscellaneous flags */
+    uint16_t s_raid_stride;          /* RAID stride */
+    uint16_t s_mmp_interval;         /* # seconds to wait in MMP checking */
+    uint64_t s_mmp_block;            /* Block for multi-mount protection */
+    uint32_t s_raid_stripe_width;    /* blocks on all data disks (N*stride) */
+    uint8_t s_log_groups_per_flex;   /* FLEX_BG group size */
+    uint8_t s_checksum_type;         /* metadata checksum algorithm used */
+    uint16_t s_reserved_pad;
+    uint32_t s_reserved[162]; /* Padding to the end of the block */
 };
 
 /*
@@ -334,16 +403,36 @@ struct ext2_super_block {
 #define EXT2_FEATURE_COMPAT_DIR_INDEX     0x0020
 #define EXT2_FEATURE_COMPAT_ANY           0xffffffff
 
-#define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER 0x0001
-#define EXT2_FEATURE_RO_COMPAT_LARGE_FILE   0x0002
-#define EXT2_FEATURE_RO_COMPAT_BTREE_DIR    0x0004
-#define EXT2_FEATURE_RO_COMPAT_ANY          0xffffffff
+#define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER   0x0001
+#define EXT2_FEATURE_RO_COMPAT_LARGE_FILE     0x0002
+#define EXT2_FEATURE_RO_COMPAT_BTREE_DIR      0x0004
+#define EXT4_FEATURE_RO_COMPAT_HUGE_FILE      0x0008
+#define EXT4_FEATURE_RO_COMPAT_GDT_CSUM       0x0010
+#define EXT4_FEATURE_RO_COMPAT_DIR_NLINK      0x0020
+#define EXT4_FEATURE_RO_COMPAT_EXTRA_ISIZE    0x0040
+#define EXT4_FEATURE_RO_COMPAT_QUOTA          0x0100
+#define EXT4_FEATURE_RO_COMPAT_BIGALLOC       0x0200
+#define EXT4_FEATURE_RO_COMPAT_METADATA_CSUM  0x0400
+#define EXT4_FEATURE_RO_COMPAT_READONLY       0x1000
+#define EXT4_FEATURE_RO_COMPAT_PROJECT        0x2000
+#define EXT4_FEATURE_RO_COMPAT_ORPHAN_PRESENT 0x10000
+#define EXT2_FEATURE_RO_COMPAT_ANY            0xffffffff
 
 #define EXT2_FEATURE_INCOMPAT_COMPRESSION 0x0001
 #define EXT2_FEATURE_INCOMPAT_FILETYPE    0x0002
 #define EXT3_FEATURE_INCOMPAT_RECOVER     0x0004
 #define EXT3_FEATURE_INCOMPAT_JOURNAL_DEV 0x0008
 #define EXT2_FEATURE_INCOMPAT_META_BG     0x0010
+#define EXT3_FEATURE_INCOMPAT_EXTENTS     0x0040
+#define EXT4_FEATURE_INCOMPAT_64BIT       0x0080
+#define EXT4_FEATURE_INCOMPAT_MMP         0x0100
+#define EXT4_FEATURE_INCOMPAT_FLEX_BG     0x0200
+#define EXT4_FEATURE_INCOMPAT_EA_INODE    0x0400
+#define EXT4_FEATURE_INCOMPAT_DIRDATA     0x1000
+#define EXT4_FEATURE_INCOMPAT_CSUM_SEED   0x2000
+#define EXT4_FEATURE_INCOMPAT_LARGEDIR    0x4000
+#define EXT4_FEATURE_INCOMPAT_INLINE_DATA 0x8000
+#define EXT4_FEATURE_INCOMPAT_ENCRYPT     0x10000
 #define EXT2_FEATURE_INCOMPAT_ANY         0xffffffff
 
 #define EXT2_FEATURE_COMPAT_SUPP   EXT2_FEATURE_COMPAT_EXT_ATTR
@@ -427,4 +516,9 @@ enum {
 #define EXT2_DIR_REC_LEN(name_len) (((name_len) + 8 + EXT2_DIR_ROUND) & \
                                     ~EXT2_DIR_ROUND)
 
+STATIC_ASSERT(sizeof(struct ext2_super_block) == 1024);
+STATIC_ASSERT(sizeof(struct ext4_extent_header) == 12);
+STATIC_ASSERT(sizeof(struct ext4_extent) == 12);
+STATIC_ASSERT(sizeof(struct ext4_extent_idx) == 12);
+
 #endif /* _LINUX_EXT2_FS_H */
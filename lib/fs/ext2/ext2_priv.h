@@ -31,11 +31,20 @@ struct cache_block {
     void *ptr;
 };
 
+/* the last run of blocks a file block lookup resolved to, so that reading on
+ * through a file does not go back to the block map for every block */
+struct ext2_block_run {
+    uint32_t file_block; /* first file block of the run */
+    uint32_t count;      /* length of the run, 0 if nothing is cached */
+    blocknum_t phys;     /* first physical block, 0 if the run is a hole */
+};
+
 /* open file handle */
 typedef struct {
     ext2_t *ext2;
 
     struct cache_block ind_cache[3]; // cache of indirect blocks as they're scanned
+    struct ext2_block_run run_cache;
     struct ext2_inode inode;
 } ext2_file_t;
 
@@ -49,7 +58,9 @@ int ext2_get_block(ext2_t *ext2, void **ptr, blocknum_t bnum);
 int ext2_put_block(ext2_t *ext2, blocknum_t bnum);
 
 off_t ext2_file_len(ext2_t *ext2, struct ext2_inode *inode);
-ssize_t ext2_read_inode(ext2_t *ext2, struct ext2_inode *inode, void *buf, off_t offset, size_t len);
+/* run may be NULL, or carry the last lookup from one read of inode to the next */
+ssize_t ext2_read_inode(ext2_t *ext2, struct ext2_inode *inode, struct ext2_block_run *run,
+                        void *buf, off_t offset, size_t len);
 int ext2_read_link(ext2_t *ext2, struct ext2_inode *inode, char *str, size_t len);
 
 /* fs api */
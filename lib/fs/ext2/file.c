@@ -54,7 +54,7 @@ ssize_t ext2_read_file(filecookie *fcookie, void *buf, off_t offset, size_t len)
     }
 
     // read from the inode
-    err = ext2_read_inode(file->ext2, &file->inode, buf, offset, len);
+    err = ext2_read_inode(file->ext2, &file->inode, &file->run_cache, buf, offset, len);
 
     return err;
 }
@@ -109,8 +109,9 @@ int ext2_read_link(ext2_t *ext2, struct ext2_inode *inode, char *str, size_t len
         return ERR_NO_MEMORY;
     }
 
-    if (linklen > 60) {
-        int err = ext2_read_inode(ext2, inode, str, 0, linklen);
+    /* short links live in i_block itself, unless it holds an extent tree */
+    if (linklen > 60 || (inode->i_flags & EXT4_EXTENTS_FL)) {
+        int err = ext2_read_inode(ext2, inode, NULL, str, 0, linklen);
         if (err < 0) {
             return err;
         }
@@ -8,6 +8,7 @@
 
 #include "ext2_priv.h"
 #include <lk/debug.h>
+#include <lk/err.h>
 #include <lk/trace.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,11 +27,13 @@ int ext2_put_block(ext2_t *ext2, blocknum_t bnum) {
     return bcache_put_block(ext2->cache, bnum);
 }
 
+/* reads of at least this many bytes of physically contiguous blocks go to the
+ * device in one request rather than a block at a time through the cache */
+#define EXT2_DIRECT_READ_MIN_BYTES (16 * 1024)
+
 static int ext2_calculate_block_pointer_pos(ext2_t *ext2, blocknum_t block_to_find, uint32_t *level, uint32_t pos[]) {
     uint32_t block_ptr_per_block, block_ptr_per_2nd_block;
 
-    // XXX optimize this
-
     // See if it's in the direct blocks
     if (block_to_find < EXT2_NDIR_BLOCKS) {
         *level = 0;
@@ -71,10 +74,12 @@ static int ext2_calculate_block_pointer_pos(ext2_t *ext2, blocknum_t block_to_fi
     }
 
     // The block requested must be too big.
-    return -1;
+    return ERR_OUT_OF_RANGE;
 }
 
 // This function returns a pointer to the cache block that corresponds to the indirect block pointer.
+// If one of the tables on the way down is missing the range is a hole, and this
+// succeeds with *cache_block set to NULL.
 static int ext2_get_indirect_block_pointer_cache_block(ext2_t *ext2, struct ext2_inode *inode,
                                                        blocknum_t **cache_block, uint32_t level, uint32_t pos[], uint *block_loaded) {
     uint32_t current_level = 0;
@@ -83,7 +88,7 @@ static int ext2_get_indirect_block_pointer_cache_block(ext2_t *ext2, struct ext2
     int err;
 
     if ((level > 3) || (level == 0)) {
-        err = -1;
+        err = ERR_INVALID_ARGS;
         goto error;
     }
 
@@ -95,7 +100,7 @@ static int ext2_get_indirect_block_pointer_cache_block(ext2_t *ext2, struct ext2
         }
 
         if (current_block == 0) {
-            err = -1;
+            err = 0;
             goto error;
         }
 
@@ -123,48 +128,235 @@ error:
     return err;
 }
 
-/* translate a file block to a physical block */
-static blocknum_t file_block_to_fs_block(ext2_t *ext2, struct ext2_inode *inode, uint fileblock) {
+/* translate a file block of an indirect mapped inode to a physical block, and
+ * count how many blocks after it in the same table follow on contiguously */
+static int ext2_ind_map_block(ext2_t *ext2, struct ext2_inode *inode, uint fileblock,
+                              blocknum_t *phys, uint32_t *count) {
     int err;
-    blocknum_t block;
-
-    LTRACEF("inode %p, fileblock %u\n", inode, fileblock);
 
     uint32_t pos[4];
     uint32_t level = 0;
-    ext2_calculate_block_pointer_pos(ext2, fileblock, &level, pos);
+    err = ext2_calculate_block_pointer_pos(ext2, fileblock, &level, pos);
+    if (err < 0) {
+        return err;
+    }
 
     LTRACEF("level %d, pos 0x%x 0x%x 0x%x 0x%x\n", level, pos[0], pos[1], pos[2], pos[3]);
 
+    const uint32_t *table;
+    uint32_t entries;
+    blocknum_t table_block = 0;
     if (level == 0) {
-        /* direct block, just return it directly */
-        block = LE32(inode->i_block[fileblock]);
+        /* direct block, scan the inode itself */
+        table = inode->i_block;
+        entries = EXT2_NDIR_BLOCKS;
     } else {
-        /* at least one level of indirection, get a pointer to the final indirect block table and dereference it */
+        /* at least one level of indirection, get a pointer to the final indirect block table */
         blocknum_t *ind_table;
-        blocknum_t phys_block;
-        err = ext2_get_indirect_block_pointer_cache_block(ext2, inode, &ind_table, level, pos, &phys_block);
+        err = ext2_get_indirect_block_pointer_cache_block(ext2, inode, &ind_table, level, pos, &table_block);
         if (err < 0) {
+            return err;
+        }
+        if (!ind_table) {
+            *phys = 0;
+            *count = 1;
             return 0;
         }
+        table = ind_table;
+        entries = EXT2_ADDR_PER_BLOCK(ext2->sb);
+    }
 
-        /* dereference the final entry in the final table */
-        block = LE32(ind_table[pos[level]]);
-        LTRACEF("block %u, indirect_block %u\n", block, phys_block);
+    /* dereference the entry, then see how far the run (or hole) goes */
+    const uint32_t first = pos[level];
+    blocknum_t block = LE32(table[first]);
+    uint32_t n = 1;
+    while (first + n < entries &&
+            LE32(table[first + n]) == (block ? block + n : 0)) {
+        n++;
+    }
 
-        /* release the ref on the cache block */
-        ext2_put_block(ext2, phys_block);
+    /* release the ref on the cache block */
+    if (table_block) {
+        ext2_put_block(ext2, table_block);
     }
 
-    LTRACEF("returning %u\n", block);
+    LTRACEF("block %u, run %u, indirect_block %u\n", block, n, table_block);
 
-    return block;
+    *phys = block;
+    *count = n;
+    return 0;
 }
 
-ssize_t ext2_read_inode(ext2_t *ext2, struct ext2_inode *inode, void *_buf, off_t offset, size_t len) {
+/* translate a file block of an extent mapped inode to a physical block, and the
+ * number of blocks from there to the end of the extent (or hole) containing it */
+static int ext4_extent_map_block(ext2_t *ext2, struct ext2_inode *inode, uint fileblock,
+                                 blocknum_t *phys, uint32_t *count) {
+    const struct ext4_extent_header *eh = (const struct ext4_extent_header *)inode->i_block;
+    size_t node_bytes = sizeof(inode->i_block);
+    blocknum_t held = 0;
+    int err = 0;
+
+    /* first file block past the subtree being searched, bounds any hole found */
+    uint64_t next_start = (uint64_t)UINT32_MAX + 1;
+
+    for (int level = 0;; level++) {
+        uint16_t entries = LE16(eh->eh_entries);
+        uint16_t depth = LE16(eh->eh_depth);
+        const size_t capacity = (node_bytes - sizeof(*eh)) / sizeof(struct ext4_extent);
+        if (LE16(eh->eh_magic) != EXT4_EXT_MAGIC || entries > LE16(eh->eh_max) ||
+                LE16(eh->eh_max) > capacity || level > 5) {
+            LTRACEF("bad extent node at level %d\n", level);
+            err = ERR_BAD_STATE;
+            break;
+        }
+
+        /* find the last entry starting at or before fileblock; the first file
+         * block of both entry types is at the same offset */
+        const uint32_t *first_block = (const uint32_t *)(eh + 1);
+        const size_t stride = sizeof(struct ext4_extent) / sizeof(uint32_t);
+        int lo = 0;
+        int hi = entries;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (LE32(first_block[mid * stride]) <= fileblock) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        const int i = lo - 1;
+        if (lo < entries) {
+            next_start = MIN(next_start, LE32(first_block[lo * stride]));
+        }
+
+        if (depth == 0) {
+            const struct ext4_extent *ex = (const struct ext4_extent *)(eh + 1);
+            uint32_t len = 0;
+            bool uninit = false;
+            if (i >= 0) {
+                len = LE16(ex[i].ee_len);
+                if (len > EXT4_EXT_INIT_MAX_LEN) {
+                    len -= EXT4_EXT_INIT_MAX_LEN;
+                    uninit = true;
+                }
+            }
+
+            if (i < 0 || fileblock - LE32(ex[i].ee_block) >= len) {
+                /* in a hole */
+                *phys = 0;
+                *count = MIN(next_start - fileblock, UINT32_MAX);
+            } else {
+                const uint32_t offset = fileblock - LE32(ex[i].ee_block);
+                if (LE16(ex[i].ee_start_hi) != 0) {
+                    /* the cache and bio only take 32 bit block numbers */
+                    err = ERR_OUT_OF_RANGE;
+                    break;
+                }
+                /* allocated but never written blocks read as zeroes */
+                *phys = uninit ? 0 : LE32(ex[i].ee_start_lo) + offset;
+                *count = len - offset;
+            }
+            break;
+        }
+
+        if (i < 0) {
+            /* before the first index entry, a hole up to it */
+            *phys = 0;
+            *count = MIN(next_start - fileblock, UINT32_MAX);
+            break;
+        }
+
+        const struct ext4_extent_idx *ix = (const struct ext4_extent_idx *)(eh + 1);
+        if (LE16(ix[i].ei_leaf_hi) != 0) {
+            err = ERR_OUT_OF_RANGE;
+            break;
+        }
+        blocknum_t child = LE32(ix[i].ei_leaf_lo);
+
+        /* step down a level */
+        if (held) {
+            ext2_put_block(ext2, held);
+            held = 0;
+        }
+        void *ptr;
+        err = ext2_get_block(ext2, &ptr, child);
+        if (err < 0) {
+            break;
+        }
+        held = child;
+        eh = ptr;
+        node_bytes = EXT2_BLOCK_SIZE(ext2->sb);
+        if (LE16(eh->eh_depth) != depth - 1) {
+            LTRACEF("extent node %u at wrong depth\n", child);
+            err = ERR_BAD_STATE;
+            break;
+        }
+    }
+
+    if (held) {
+        ext2_put_block(ext2, held);
+    }
+
+    return err;
+}
+
+/* translate a file block to a physical block, returning the length of the run
+ * of blocks it starts that are contiguous on disk. *phys is 0 for a hole. */
+static int ext2_map_block(ext2_t *ext2, struct ext2_inode *inode, struct ext2_block_run *run,
+                          uint fileblock, blocknum_t *phys, uint32_t *count) {
+    LTRACEF("inode %p, fileblock %u\n", inode, fileblock);
+
+    /* still inside the run the last lookup found? */
+    if (run->count > 0 && fileblock - run->file_block < run->count) {
+        const uint32_t offset = fileblock - run->file_block;
+        *phys = run->phys ? run->phys + offset : 0;
+        *count = run->count - offset;
+        return 0;
+    }
+
+    int err;
+    if (inode->i_flags & EXT4_EXTENTS_FL) {
+        err = ext4_extent_map_block(ext2, inode, fileblock, phys, count);
+    } else {
+        err = ext2_ind_map_block(ext2, inode, fileblock, phys, count);
+    }
+    if (err < 0) {
+        run->count = 0;
+        return err;
+    }
+
+    LTRACEF("returning %u, run %u\n", *phys, *count);
+
+    run->file_block = fileblock;
+    run->phys = *phys;
+    run->count = *count;
+
+    return 0;
+}
+
+/* read a single file block, zero filling holes */
+static int ext2_read_file_block(ext2_t *ext2, struct ext2_inode *inode, struct ext2_block_run *run,
+                                void *buf, uint fileblock) {
+    blocknum_t phys_block;
+    uint32_t count;
+    int err = ext2_map_block(ext2, inode, run, fileblock, &phys_block, &count);
+    if (err < 0) {
+        return err;
+    }
+
+    if (phys_block == 0) {
+        memset(buf, 0, EXT2_BLOCK_SIZE(ext2->sb));
+        return 0;
+    }
+    return ext2_read_block(ext2, buf, phys_block);
+}
+
+ssize_t ext2_read_inode(ext2_t *ext2, struct ext2_inode *inode, struct ext2_block_run *run,
+                        void *_buf, off_t offset, size_t len) {
     int err = 0;
     size_t bytes_read = 0;
     uint8_t *buf = _buf;
+    const uint32_t block_size = EXT2_BLOCK_SIZE(ext2->sb);
 
     /* calculate the file size */
     off_t file_size = ext2_file_len(ext2, inode);
@@ -182,24 +374,28 @@ ssize_t ext2_read_inode(ext2_t *ext2, struct ext2_inode *inode, void *_buf, off_
         return 0;
     }
 
+    /* without a caller's run cache, still avoid a lookup per block within this read */
+    struct ext2_block_run local_run = {0};
+    if (!run) {
+        run = &local_run;
+    }
+
     /* calculate the starting file block */
-    uint file_block = offset / EXT2_BLOCK_SIZE(ext2->sb);
+    uint file_block = offset / block_size;
 
     /* handle partial first block */
-    if ((offset % EXT2_BLOCK_SIZE(ext2->sb)) != 0) {
-        uint8_t temp[EXT2_BLOCK_SIZE(ext2->sb)];
+    if ((offset % block_size) != 0) {
+        uint8_t temp[block_size];
 
         /* calculate the block and read it */
-        blocknum_t phys_block = file_block_to_fs_block(ext2, inode, file_block);
-        if (phys_block == 0) {
-            memset(temp, 0, EXT2_BLOCK_SIZE(ext2->sb));
-        } else {
-            ext2_read_block(ext2, temp, phys_block);
+        err = ext2_read_file_block(ext2, inode, run, temp, file_block);
+        if (err < 0) {
+            goto done;
         }
 
         /* copy out what we need */
-        size_t block_offset = offset % EXT2_BLOCK_SIZE(ext2->sb);
-        size_t tocopy = MIN(len, EXT2_BLOCK_SIZE(ext2->sb) - block_offset);
+        size_t block_offset = offset % block_size;
+        size_t tocopy = MIN(len, block_size - block_offset);
         memcpy(buf, temp + block_offset, tocopy);
 
         /* increment our stuff */
@@ -209,33 +405,44 @@ ssize_t ext2_read_inode(ext2_t *ext2, struct ext2_inode *inode, void *_buf, off_
         buf += tocopy;
     }
 
-    /* handle middle blocks */
-    while (len >= EXT2_BLOCK_SIZE(ext2->sb)) {
-        /* calculate the block and read it */
-        blocknum_t phys_block = file_block_to_fs_block(ext2, inode, file_block);
+    /* handle middle blocks a physically contiguous run at a time */
+    while (len >= block_size) {
+        blocknum_t phys_block;
+        uint32_t count;
+        err = ext2_map_block(ext2, inode, run, file_block, &phys_block, &count);
+        if (err < 0) {
+            goto done;
+        }
+        count = MIN(count, len / block_size);
+
         if (phys_block == 0) {
-            memset(buf, 0, EXT2_BLOCK_SIZE(ext2->sb));
+            memset(buf, 0, (size_t)count * block_size);
+        } else if ((size_t)count * block_size >= EXT2_DIRECT_READ_MIN_BYTES) {
+            err = bcache_read_direct(ext2->cache, buf, phys_block, count);
         } else {
-            ext2_read_block(ext2, buf, phys_block);
+            for (uint32_t i = 0; i < count && err >= 0; i++) {
+                err = ext2_read_block(ext2, buf + (size_t)i * block_size, phys_block + i);
+            }
+        }
+        if (err < 0) {
+            goto done;
         }
 
         /* increment our stuff */
-        file_block++;
-        len -= EXT2_BLOCK_SIZE(ext2->sb);
-        bytes_read += EXT2_BLOCK_SIZE(ext2->sb);
-        buf += EXT2_BLOCK_SIZE(ext2->sb);
+        file_block += count;
+        len -= (size_t)count * block_size;
+        bytes_read += (size_t)count * block_size;
+        buf += (size_t)count * block_size;
     }
 
     /* handle partial last block */
     if (len > 0) {
-        uint8_t temp[EXT2_BLOCK_SIZE(ext2->sb)];
+        uint8_t temp[block_size];
 
         /* calculate the block and read it */
-        blocknum_t phys_block = file_block_to_fs_block(ext2, inode, file_block);
-        if (phys_block == 0) {
-            memset(temp, 0, EXT2_BLOCK_SIZE(ext2->sb));
-        } else {
-            ext2_read_block(ext2, temp, phys_block);
+        err = ext2_read_file_block(ext2, inode, run, temp, file_block);
+        if (err < 0) {
+            goto done;
         }
 
         /* copy out what we need */
@@ -245,6 +452,7 @@ ssize_t ext2_read_inode(ext2_t *ext2, struct ext2_inode *inode, void *_buf, off_
         bytes_read += len;
     }
 
+done:
     LTRACEF("err %d, bytes_read %zu\n", err, bytes_read);
 
     return (err < 0) ? err : (ssize_t)bytes_read;
@@ -13,4 +13,6 @@ MODULE_SRCS += \
 	$(LOCAL_DIR)/io.c \
 	$(LOCAL_DIR)/file.c
 
+MODULE_OPTIONS := test
+
 include make/module.mk
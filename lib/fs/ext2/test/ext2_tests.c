@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#include <arch/defines.h>
+#include <lib/bio.h>
+#include <lib/cmdline.h>
+#include <lib/fs.h>
+#include <lib/unittest.h>
+#include <lk/debug.h>
+#include <lk/err.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Read back the tree that mkimage.py puts on every test image. The device is
+// named by test.ext2.device on the command line; without it the tests pass
+// without doing anything.
+
+#define TEST_PATH "/ext2test"
+
+// keep these in step with mkimage.py
+#define PATTERN_SIZE  (3 * 1024 * 1024 + 1234)
+#define SPARSE_HOLE   (1024 * 1024)
+#define SPARSE_STRIDE (64 * 1024)
+#define SPARSE_CHUNK  4096
+#define SPARSE_CHUNKS 40
+#define SPARSE_SIZE   (SPARSE_HOLE + SPARSE_CHUNKS * SPARSE_STRIDE + 100000)
+#define SMALL_TEXT    "hello ext2\n"
+
+static uint8_t pattern_byte(size_t i, unsigned seed) {
+    return (uint8_t)(((i / 512) * 31 + i * 7 + seed) & 0xff);
+}
+
+static bool matches_pattern(const uint8_t *buf, size_t offset, size_t len, unsigned seed) {
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] != pattern_byte(offset + i, seed)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool all_zero(const uint8_t *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static const char *test_device(void) {
+    static char device_name[128];
+
+    size_t len = 0;
+    if (cmdline_get_string("test.ext2.device", device_name, sizeof(device_name), &len) < 0 ||
+        len == 0) {
+        return NULL;
+    }
+    bdev_t *dev = bio_open(device_name);
+    if (!dev) {
+        return NULL;
+    }
+    bio_close(dev);
+
+    return device_name;
+}
+
+static ssize_t read_whole(const char *path, void *buf, size_t len, uint64_t *size) {
+    filehandle *handle;
+    status_t err = fs_open_file(path, &handle);
+    if (err < 0) {
+        return err;
+    }
+
+    struct file_stat stat;
+    err = fs_stat_file(handle, &stat);
+    if (err < 0) {
+        fs_close_file(handle);
+        return err;
+    }
+    *size = stat.size;
+
+    ssize_t ret = fs_read_file(handle, buf, 0, len);
+    fs_close_file(handle);
+
+    return ret;
+}
+
+static bool small_files(void) {
+    BEGIN_TEST;
+
+    char buf[64];
+    uint64_t size;
+    static const char *paths[] = {
+        TEST_PATH "/dir/nested/small.txt",
+        TEST_PATH "/link",      // target stored in the inode
+        TEST_PATH "/longlink",  // target stored in a block
+    };
+    for (size_t i = 0; i < countof(paths); i++) {
+        memset(buf, 0, sizeof(buf));
+        ssize_t ret = read_whole(paths[i], buf, sizeof(buf), &size);
+        EXPECT_EQ((ssize_t)strlen(SMALL_TEXT), ret, paths[i]);
+        EXPECT_EQ(strlen(SMALL_TEXT), size, paths[i]);
+        EXPECT_EQ(0, strcmp(SMALL_TEXT, buf), paths[i]);
+    }
+
+    filehandle *handle;
+    EXPECT_EQ(ERR_NOT_FOUND, fs_open_file(TEST_PATH "/dir/missing", &handle), "");
+
+    END_TEST;
+}
+
+static bool large_file(void) {
+    BEGIN_TEST;
+
+    uint8_t *buf = memalign(CACHE_LINE, PATTERN_SIZE);
+    ASSERT_NONNULL(buf, "");
+
+    // one read, which goes to the device a run of blocks at a time
+    uint64_t size;
+    ssize_t ret = read_whole(TEST_PATH "/pattern.bin", buf, PATTERN_SIZE, &size);
+    EXPECT_EQ(PATTERN_SIZE, ret, "");
+    EXPECT_EQ(PATTERN_SIZE, size, "");
+    EXPECT_TRUE(matches_pattern(buf, 0, PATTERN_SIZE, 11), "whole file read");
+
+    // then again in odd sized pieces that straddle block boundaries
+    filehandle *handle;
+    ASSERT_EQ(NO_ERROR, fs_open_file(TEST_PATH "/pattern.bin", &handle), "");
+    memset(buf, 0, PATTERN_SIZE);
+    const size_t chunks[] = {1, 511, 4097, 65537, 300001};
+    size_t offset = 0;
+    for (size_t i = 0; offset < PATTERN_SIZE; i++) {
+        size_t len = MIN(chunks[i % countof(chunks)], PATTERN_SIZE - offset);
+        ret = fs_read_file(handle, buf + offset, offset, len);
+        if (ret != (ssize_t)len) {
+            EXPECT_EQ((ssize_t)len, ret, "short read");
+            break;
+        }
+        offset += len;
+    }
+    EXPECT_TRUE(matches_pattern(buf, 0, PATTERN_SIZE, 11), "chunked read");
+
+    // reading off the end comes back short
+    ret = fs_read_file(handle, buf, PATTERN_SIZE - 10, 100);
+    EXPECT_EQ(10, ret, "");
+    fs_close_file(handle);
+
+    free(buf);
+
+    END_TEST;
+}
+
+static bool sparse_file(void) {
+    BEGIN_TEST;
+
+    uint8_t *buf = memalign(CACHE_LINE, SPARSE_SIZE);
+    ASSERT_NONNULL(buf, "");
+    memset(buf, 0xa5, SPARSE_SIZE);
+
+    uint64_t size;
+    ssize_t ret = read_whole(TEST_PATH "/sparse.bin", buf, SPARSE_SIZE, &size);
+    EXPECT_EQ(SPARSE_SIZE, ret, "");
+    EXPECT_EQ(SPARSE_SIZE, size, "");
+
+    EXPECT_TRUE(all_zero(buf, SPARSE_HOLE), "leading hole");
+    for (size_t k = 0; k < SPARSE_CHUNKS; k++) {
+        const uint8_t *chunk = buf + SPARSE_HOLE + k * SPARSE_STRIDE;
+        EXPECT_TRUE(matches_pattern(chunk, 0, SPARSE_CHUNK, k), "data chunk");
+        EXPECT_TRUE(all_zero(chunk + SPARSE_CHUNK, SPARSE_STRIDE - SPARSE_CHUNK), "hole");
+    }
+    EXPECT_TRUE(all_zero(buf + SPARSE_HOLE + SPARSE_CHUNKS * SPARSE_STRIDE, 100000),
+                "trailing hole");
+
+    free(buf);
+
+    END_TEST;
+}
+
+static bool ext2_image(void) {
+    BEGIN_TEST;
+
+    const char *device = test_device();
+    if (!device) {
+        unittest_printf(" no test.ext2.device, skipping ");
+        return true;
+    }
+
+    ASSERT_EQ(NO_ERROR, fs_mount(TEST_PATH, "ext2", device, FS_MOUNT_OPTION_NONE), "");
+
+    all_ok &= small_files();
+    all_ok &= large_file();
+    all_ok &= sparse_file();
+
+    EXPECT_EQ(NO_ERROR, fs_unmount(TEST_PATH), "");
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(ext2_tests)
+RUN_TEST(ext2_image)
+END_TEST_CASE(ext2_tests)
@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+"""Build the ext2/ext4 test disk images.
+
+Each image holds the same small tree, built with mke2fs -d, for the in-guest
+tests in ext2_tests.c to read back. The formats cover both ways the driver finds
+a file's blocks: block maps (ext2) and extent trees (ext4, which mkfs.ext4 also
+formats 64bit with flex_bg and metadata checksums by default).
+
+Requires mke2fs 1.43 or newer, for -d.
+
+  ./mkimage.py                 build every image
+  ./mkimage.py --type ext4     just one
+  ./mkimage.py --out-dir DIR   somewhere other than this directory
+
+Then boot a test build with the image attached and
+test.ext2.device=<device name> on the kernel command line, and run `ut ext2_tests`.
+"""
+
+import argparse
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+IMAGES = {
+    'ext2': ['mkfs.ext2', '-b', '1024'],
+    'ext4': ['mkfs.ext4', '-b', '4096'],
+    'ext4-1k': ['mkfs.ext4', '-b', '1024', '-O', '^64bit'],
+}
+IMAGE_SIZE = '64M'
+
+# Keep these in step with ext2_tests.c.
+PATTERN_SIZE = 3 * 1024 * 1024 + 1234
+SPARSE_HOLE = 1024 * 1024
+SPARSE_STRIDE = 64 * 1024
+SPARSE_CHUNK = 4096
+SPARSE_CHUNKS = 40
+SPARSE_SIZE = SPARSE_HOLE + SPARSE_CHUNKS * SPARSE_STRIDE + 100000
+SMALL_TEXT = b'hello ext2\n'
+
+
+def pattern_bytes(size, seed):
+    """Every byte depends on its offset and on which 512 byte block it is in,
+    so a block read from the wrong place does not match."""
+    return bytes((((i // 512) * 31 + i * 7 + seed) & 0xff) for i in range(size))
+
+
+def build_tree(root):
+    os.makedirs(os.path.join(root, 'dir', 'nested'))
+    with open(os.path.join(root, 'dir', 'nested', 'small.txt'), 'wb') as f:
+        f.write(SMALL_TEXT)
+    with open(os.path.join(root, 'pattern.bin'), 'wb') as f:
+        f.write(pattern_bytes(PATTERN_SIZE, 11))
+
+    # a file that is mostly holes, with enough separate pieces of data to need
+    # more than the four extents that fit in the inode
+    with open(os.path.join(root, 'sparse.bin'), 'wb') as f:
+        for k in range(SPARSE_CHUNKS):
+            f.seek(SPARSE_HOLE + k * SPARSE_STRIDE)
+            f.write(pattern_bytes(SPARSE_CHUNK, k))
+        f.truncate(SPARSE_SIZE)
+
+    # one link short enough to live in the inode, one that needs a block
+    os.symlink('dir/nested/small.txt', os.path.join(root, 'link'))
+    os.symlink('./' * 30 + 'dir/nested/small.txt', os.path.join(root, 'longlink'))
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__,
+                                formatter_class=argparse.RawDescriptionHelpFormatter)
+    p.add_argument('--type', action='append', dest='types', choices=sorted(IMAGES),
+                   help='image type to build (default: all). May be repeated.')
+    p.add_argument('--out-dir', default=HERE,
+                   help='where to write images (default: this directory)')
+    args = p.parse_args()
+
+    for tool in {cmd[0] for cmd in IMAGES.values()}:
+        if shutil.which(tool) is None:
+            sys.exit(f'missing required tool {tool}: install e2fsprogs')
+
+    os.makedirs(args.out_dir, exist_ok=True)
+    with tempfile.TemporaryDirectory() as root:
+        build_tree(root)
+        for name in args.types or sorted(IMAGES):
+            path = os.path.join(args.out_dir, f'blk.bin.{name}')
+            if os.path.exists(path):
+                os.remove(path)
+            cmd = IMAGES[name] + ['-q', '-F', '-d', root, path, IMAGE_SIZE]
+            print('  ' + ' '.join(cmd))
+            subprocess.run(cmd, check=True)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,14 @@
+LOCAL_DIR := $(GET_LOCAL_DIR)
+
+MODULE := $(LOCAL_DIR)
+
+MODULE_SRCS += $(LOCAL_DIR)/ext2_tests.c
+
+MODULE_DEPS += \
+	lib/bio \
+	lib/cmdline \
+	lib/fs \
+	lib/fs/ext2 \
+	lib/unittest
+
+include make/module.mk
@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#include "extent_cache.h"
+
+#include <inttypes.h>
+#include <kernel/spinlock.h>
+#include <lib/fs/fat.h>
+#include <lk/console_cmd.h>
+#include <lk/debug.h>
+#include <lk/err.h>
+#include <lk/trace.h>
+#include <new>
+#include <stdio.h>
+#include <string.h>
+
+#include "fat_fs.h"
+#include "fat_priv.h"
+
+#define LOCAL_TRACE FAT_GLOBAL_TRACE(0)
+
+namespace {
+
+// shared by every mount, each of which has its own lock
+SpinLock stats_lock;
+fat_extent_stats_t stats;
+
+void account(uint32_t logical, uint32_t walked) {
+    AutoSpinLock guard(&stats_lock);
+    stats.lookups++;
+    stats.hops_walked += walked;
+    if (logical > walked) {
+        stats.hops_avoided += logical - walked;
+    }
+}
+
+} // anonymous namespace
+
+void fat_get_extent_stats(fat_extent_stats_t *out) {
+    AutoSpinLock guard(&stats_lock);
+    *out = stats;
+}
+
+status_t fat_extent_cache::lookup(uint32_t start_cluster, uint32_t logical, uint32_t *cluster,
+                                  uint32_t *run) {
+    DEBUG_ASSERT(fat_->lock.is_held());
+
+    if (start_cluster < 2 || start_cluster >= fat_->info().total_clusters) {
+        return ERR_IO;
+    }
+
+    // the owner should have reset us if its chain moved, but it costs nothing to check
+    if (count_ > 0 && extents_[0].physical != start_cluster) {
+        reset();
+    }
+
+    uint32_t walked = 0;
+    if (logical >= mapped_) {
+        status_t err = extend(start_cluster, logical, &walked);
+        account(logical, walked);
+        if (err < 0) {
+            return err;
+        }
+    } else {
+        account(logical, 0);
+    }
+
+    if (logical < mapped_) {
+        const extent &e = find(logical);
+        *cluster = e.physical + (logical - e.logical);
+        *run = e.count - (logical - e.logical);
+    } else {
+        // past what the map holds, the walk left the cursor on it
+        DEBUG_ASSERT(cursor_valid_ && cursor_logical_ == logical);
+        *cluster = cursor_physical_;
+        *run = 1;
+    }
+
+    LTRACEF_LEVEL(2, "logical %u -> cluster %u run %u (walked %u)\n", logical, *cluster, *run, walked);
+
+    return NO_ERROR;
+}
+
+// Walk the chain up to logical cluster `logical`, starting from the furthest
+// known point that is not past it, and record what is found while there is room.
+status_t fat_extent_cache::extend(uint32_t start_cluster, uint32_t logical, uint32_t *walked) {
+    uint32_t pos;
+    uint32_t cluster;
+    if (mapped_ > 0) {
+        const extent &last = extents_[count_ - 1];
+        pos = mapped_ - 1;
+        cluster = last.physical + last.count - 1;
+    } else {
+        if (!extents_) {
+            extents_.reset(new (std::nothrow) extent[kMaxExtents]);
+        }
+        pos = 0;
+        cluster = start_cluster;
+        if (extents_) {
+            extents_[0] = {0, start_cluster, 1};
+            count_ = 1;
+            mapped_ = 1;
+        }
+    }
+    if (cursor_valid_ && cursor_logical_ > pos && cursor_logical_ <= logical) {
+        pos = cursor_logical_;
+        cluster = cursor_physical_;
+    }
+
+    while (pos < logical) {
+        uint32_t next = fat_next_cluster_in_chain(fat_, cluster);
+        (*walked)++;
+        if (is_eof_cluster(next)) {
+            return ERR_OUT_OF_RANGE;
+        }
+        if (next < 2 || next >= fat_->info().total_clusters) {
+            return ERR_IO;
+        }
+        pos++;
+
+        // still building the map: grow the last run or start a new one
+        if (pos == mapped_) {
+            extent &last = extents_[count_ - 1];
+            if (next == cluster + 1) {
+                last.count++;
+                mapped_++;
+            } else if (count_ < kMaxExtents) {
+                extents_[count_++] = {pos, next, 1};
+                mapped_++;
+            }
+        }
+        cluster = next;
+    }
+
+    if (pos >= mapped_) {
+        cursor_valid_ = true;
+        cursor_logical_ = pos;
+        cursor_physical_ = cluster;
+    }
+
+    return NO_ERROR;
+}
+
+const fat_extent_cache::extent &fat_extent_cache::find(uint32_t logical) const {
+    DEBUG_ASSERT(logical < mapped_);
+
+    // runs are sorted and back to back, find the last one starting at or before logical
+    size_t lo = 0;
+    size_t hi = count_;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (extents_[mid].logical <= logical) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    DEBUG_ASSERT(logical - extents_[lo].logical < extents_[lo].count);
+    return extents_[lo];
+}
+
+void fat_extent_cache::truncate(uint32_t clusters) {
+    if (cursor_valid_ && cursor_logical_ >= clusters) {
+        cursor_valid_ = false;
+    }
+    if (clusters >= mapped_) {
+        return;
+    }
+
+    while (count_ > 0 && extents_[count_ - 1].logical >= clusters) {
+        count_--;
+    }
+    if (count_ > 0) {
+        extent &last = extents_[count_ - 1];
+        last.count = clusters - last.logical;
+    }
+    mapped_ = clusters;
+}
+
+#if WITH_LIB_CONSOLE
+
+namespace {
+
+int cmd_fat_extents(int argc, const console_cmd_args *argv) {
+    fat_extent_stats_t s;
+    fat_get_extent_stats(&s);
+
+    printf("fat extent maps: lookups %" PRIu64 " hops walked %" PRIu64 " avoided %" PRIu64 "\n",
+           s.lookups, s.hops_walked, s.hops_avoided);
+
+    return 0;
+}
+
+} // anonymous namespace
+
+STATIC_COMMAND_START
+STATIC_COMMAND("fat_extents", "fat cluster extent map stats", &cmd_fat_extents)
+STATIC_COMMAND_END(fat_extents);
+
+#endif // WITH_LIB_CONSOLE
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#pragma once
+
+#include <lk/cpp.h>
+#include <memory>
+#include <stdint.h>
+#include <sys/types.h>
+
+class fat_fs;
+
+// Per open file map from logical cluster index to physical cluster, so that
+// seeking into a file does not have to walk the FAT from its start cluster one
+// entry at a time.
+//
+// The map is a sorted array of runs of physically contiguous clusters covering
+// a prefix of the chain. It is built lazily: a lookup past the end of what is
+// mapped walks on from the last known cluster and records what it finds. Growing
+// the chain needs no maintenance, since nothing past the mapped prefix is ever
+// recorded; shrinking it or moving its start must call truncate() or reset().
+//
+// Memory is bounded at kMaxExtents runs per file. Once that fills, or if it
+// could not be allocated at all, lookups past the mapped prefix walk on from a
+// single cursor instead, which keeps sequential access cheap even on a badly
+// fragmented file.
+//
+// Must be called with the fs lock held.
+class fat_extent_cache {
+  public:
+    explicit fat_extent_cache(fat_fs *fat) : fat_(fat) {}
+    ~fat_extent_cache() = default;
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(fat_extent_cache);
+
+    // Find the physical cluster holding logical cluster `logical` of the chain
+    // that begins at `start_cluster`. *run is set to the number of clusters from
+    // there on known to be physically contiguous, at least 1. Returns
+    // ERR_OUT_OF_RANGE past the end of the chain, ERR_IO if it is corrupt.
+    status_t lookup(uint32_t start_cluster, uint32_t logical, uint32_t *cluster, uint32_t *run);
+
+    // Forget everything at or past logical cluster `clusters`.
+    void truncate(uint32_t clusters);
+    void reset() { truncate(0); }
+
+  private:
+    struct extent {
+        uint32_t logical;
+        uint32_t physical;
+        uint32_t count;
+    };
+
+    static constexpr size_t kMaxExtents = 64;
+
+    status_t extend(uint32_t start_cluster, uint32_t logical, uint32_t *walked);
+    const extent &find(uint32_t logical) const;
+
+    fat_fs *fat_;
+
+    // allocated on the first lookup, so files only ever stat'd or read from
+    // their first cluster cost nothing
+    std::unique_ptr<extent[]> extents_;
+    size_t count_ = 0;
+    uint32_t mapped_ = 0; // logical clusters [0, mapped_) are in extents_
+
+    // furthest point reached past the mapped prefix once extents_ is full
+    bool cursor_valid_ = false;
+    uint32_t cursor_logical_ = 0;
+    uint32_t cursor_physical_ = 0;
+};
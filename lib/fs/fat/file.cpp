@@ -24,10 +24,31 @@
 
 #define LOCAL_TRACE FAT_GLOBAL_TRACE(0)
 
+namespace {
+
+// Reads and writes with at least this much in whole sectors move those sectors
+// straight between the caller's buffer and the disk, one transfer per physically
+// contiguous run of clusters, instead of a sector at a time through the bcache.
+constexpr uint32_t kDirectIoMinBytes = 16 * 1024;
+
+// How many of those runs are handed to the bcache, and so can be in flight on
+// the device, at once.
+constexpr size_t kDirectIoRuns = 8;
+
+} // anonymous namespace
+
 fat_file::fat_file(fat_fs *f)
-    : fs_(f) {}
+    : fs_(f), extents_(f) {}
 fat_file::~fat_file() = default;
 
+// Find the physical cluster holding byte `offset` of the file, and how many
+// clusters from there on are physically contiguous.
+status_t fat_file::cluster_for_offset_locked(uint32_t offset, uint32_t *cluster, uint32_t *run) {
+    DEBUG_ASSERT(fs_->lock.is_held());
+
+    return extents_.lookup(start_cluster_, offset / fs_->info().bytes_per_cluster, cluster, run);
+}
+
 status_t fat_file::zero_range_locked(uint32_t offset, uint32_t len) {
     DEBUG_ASSERT(fs_->lock.is_held());
 
@@ -35,18 +56,18 @@ status_t fat_file::zero_range_locked(uint32_t offset, uint32_t len) {
         return NO_ERROR;
     }
 
-    if (start_cluster_ < 2 || start_cluster_ >= fs_->info().total_clusters) {
-        return ERR_IO;
+    uint32_t cluster, run;
+    status_t err = cluster_for_offset_locked(offset, &cluster, &run);
+    if (err < 0) {
+        return err;
     }
 
-    uint32_t logical_cluster = offset / fs_->info().bytes_per_cluster;
     uint32_t sector_within_cluster =
         (offset % fs_->info().bytes_per_cluster) / fs_->info().bytes_per_sector;
     uint32_t offset_within_sector = offset % fs_->info().bytes_per_sector;
 
-    file_block_iterator fbi(fs_, start_cluster_);
-    status_t err = fbi.next_sectors(logical_cluster * fs_->info().sectors_per_cluster +
-                                    sector_within_cluster);
+    file_block_iterator fbi(fs_, cluster);
+    err = fbi.next_sectors(sector_within_cluster);
     if (err < 0) {
         return err;
     }
@@ -198,19 +219,57 @@ ssize_t fat_file::read_file_priv(void *_buf, const off_t offset, size_t len) {
 
     LTRACEF("trimmed offset %lld len %zu\n", offset, len);
 
-    // create a file block iterator and push it forward to the starting point
-    uint32_t logical_cluster = offset / fs_->info().bytes_per_cluster;
+    // big reads move their whole sectors straight into buf, only the partial
+    // sectors at either end go through the bcache
+    const uint32_t start = (uint32_t)offset;
+    const uint32_t bps = fs_->info().bytes_per_sector;
+    const size_t head = MIN((size_t)((bps - start % bps) % bps), len);
+    const size_t bulk = (len - head) / bps * bps;
+    if (bulk < kDirectIoMinBytes) {
+        return read_cached_locked(buf, start, len);
+    }
+
+    ssize_t err;
+    if (head > 0) {
+        err = read_cached_locked(buf, start, head);
+        if (err < 0) {
+            return err;
+        }
+    }
+    err = direct_io_locked(buf + head, start + head, bulk, false);
+    if (err < 0) {
+        return err;
+    }
+    if (head + bulk < len) {
+        err = read_cached_locked(buf + head + bulk, start + head + bulk, len - head - bulk);
+        if (err < 0) {
+            return err;
+        }
+    }
+
+    return len;
+}
+
+ssize_t fat_file::read_cached_locked(uint8_t *buf, uint32_t offset, size_t len) {
+    DEBUG_ASSERT(fs_->lock.is_held());
+
+    // find the cluster the read starts in without walking the chain to it
+    uint32_t cluster, run;
+    status_t err = cluster_for_offset_locked(offset, &cluster, &run);
+    if (err < 0) {
+        return err;
+    }
+
     uint32_t sector_within_cluster = (offset % fs_->info().bytes_per_cluster) / fs_->info().bytes_per_sector;
     uint32_t offset_within_sector = offset % fs_->info().bytes_per_sector;
 
-    LTRACEF("starting off logical cluster %u, sector within %u, offset within %u\n",
-            logical_cluster, sector_within_cluster, offset_within_sector);
+    LTRACEF("starting off cluster %u, sector within %u, offset within %u\n",
+            cluster, sector_within_cluster, offset_within_sector);
 
-    file_block_iterator fbi(fs_, start_cluster_);
-
-    // move it forward to our index point
+    // create a file block iterator there and push it forward to the starting point
     // also loads the buffer
-    status_t err = fbi.next_sectors(logical_cluster * fs_->info().sectors_per_cluster + sector_within_cluster);
+    file_block_iterator fbi(fs_, cluster);
+    err = fbi.next_sectors(sector_within_cluster);
     if (err < 0) {
         LTRACEF("error moving up to starting point!\n");
         return err;
@@ -403,8 +462,18 @@ status_t fat_file::truncate_file_priv(uint64_t _len) {
 
             // TODO: compartmentalize this cluster extension/shrinking so DIR code can reuse it
 
-            // walk to the end of the existing cluster chain
-            const uint32_t existing_chain_end = fat_find_last_cluster_in_chain(fs_, start_cluster_);
+            // find the end of the existing cluster chain. the extent map gets
+            // there without a walk; only fall back to one if the chain runs on
+            // past what the length says it should
+            uint32_t existing_chain_end = 0;
+            if (current_cluster_count > 0) {
+                uint32_t run;
+                status_t err = extents_.lookup(start_cluster_, current_cluster_count - 1,
+                                               &existing_chain_end, &run);
+                if (err < 0 || !is_eof_cluster(fat_next_cluster_in_chain(fs_, existing_chain_end))) {
+                    existing_chain_end = fat_find_last_cluster_in_chain(fs_, start_cluster_);
+                }
+            }
 
             uint32_t first_cluster;
             uint32_t last_cluster;
@@ -459,24 +528,24 @@ status_t fat_file::truncate_file_priv(uint64_t _len) {
                 }
 
                 // Find the last cluster that remains part of the truncated file.
-                uint32_t keep_last = start_cluster_;
-                for (uint32_t i = 1; i < new_cluster_count; i++) {
-                    uint32_t next = fat_next_cluster_in_chain(fs_, keep_last);
-                    if (is_eof_cluster(next) || next < 2 || next >= fs_->info().total_clusters) {
-                        return ERR_IO;
-                    }
-                    keep_last = next;
+                uint32_t keep_last, run;
+                status_t err = extents_.lookup(start_cluster_, new_cluster_count - 1, &keep_last, &run);
+                if (err < 0) {
+                    return ERR_IO;
                 }
 
                 uint32_t first_free = fat_next_cluster_in_chain(fs_, keep_last);
                 if (!is_eof_cluster(first_free)) {
-                    status_t err = fat_truncate_cluster_chain(fs_, keep_last);
+                    err = fat_truncate_cluster_chain(fs_, keep_last);
                     if (err != NO_ERROR) {
                         return err;
                     }
                 }
             }
 
+            // the chain is shorter now, or gone entirely
+            extents_.truncate(new_cluster_count);
+
             status_t err = fat_dir_update_entry(fs_, dir_loc_, new_start_cluster, len32);
             if (err != NO_ERROR) {
                 return err;
@@ -527,14 +596,51 @@ ssize_t fat_file::write_file_priv(const void *_buf, const off_t offset, size_t l
 
     AutoLock guard(fs_->lock);
 
-    uint32_t logical_cluster = offset / fs_->info().bytes_per_cluster;
+    // the same split as reads: whole sectors in bulk go straight to the disk
+    const uint32_t start = (uint32_t)offset;
+    const uint32_t bps = fs_->info().bytes_per_sector;
+    const size_t head = MIN((size_t)((bps - start % bps) % bps), len);
+    const size_t bulk = (len - head) / bps * bps;
+    status_t err;
+    if (bulk < kDirectIoMinBytes) {
+        err = write_cached_locked(buf, start, len);
+    } else {
+        err = NO_ERROR;
+        if (head > 0) {
+            err = write_cached_locked(buf, start, head);
+        }
+        if (err == NO_ERROR) {
+            // direct_io_locked() only reads from buf when writing
+            err = direct_io_locked(const_cast<uint8_t *>(buf) + head, start + head, bulk, true);
+        }
+        if (err == NO_ERROR && head + bulk < len) {
+            err = write_cached_locked(buf + head + bulk, start + head + bulk, len - head - bulk);
+        }
+    }
+    if (err < 0) {
+        return err;
+    }
+
+    bcache_flush(fs_->bcache());
+
+    return len;
+}
+
+status_t fat_file::write_cached_locked(const uint8_t *buf, uint32_t offset, size_t len) {
+    DEBUG_ASSERT(fs_->lock.is_held());
+
+    uint32_t cluster, run;
+    status_t err = cluster_for_offset_locked(offset, &cluster, &run);
+    if (err < 0) {
+        return err;
+    }
+
     uint32_t sector_within_cluster =
         (offset % fs_->info().bytes_per_cluster) / fs_->info().bytes_per_sector;
     uint32_t offset_within_sector = offset % fs_->info().bytes_per_sector;
 
-    file_block_iterator fbi(fs_, start_cluster_);
-    status_t err = fbi.next_sectors(logical_cluster * fs_->info().sectors_per_cluster +
-                                    sector_within_cluster);
+    file_block_iterator fbi(fs_, cluster);
+    err = fbi.next_sectors(sector_within_cluster);
     if (err < 0) {
         return err;
     }
@@ -565,9 +671,67 @@ ssize_t fat_file::write_file_priv(const void *_buf, const off_t offset, size_t l
         }
     }
 
-    bcache_flush(fs_->bcache());
+    return NO_ERROR;
+}
+
+// Move whole sectors straight between buf and the disk through the bcache's
+// direct path, one transfer per run of physically contiguous clusters. The runs
+// are handed over a batch at a time so the device can have several in flight.
+// offset and len must be multiples of the sector size.
+status_t fat_file::direct_io_locked(uint8_t *buf, uint32_t offset, size_t len, bool write) {
+    DEBUG_ASSERT(fs_->lock.is_held());
+
+    const uint32_t bps = fs_->info().bytes_per_sector;
+    const uint32_t spc = fs_->info().sectors_per_cluster;
+    const uint32_t bpc = fs_->info().bytes_per_cluster;
+    DEBUG_ASSERT(offset % bps == 0 && len % bps == 0);
+
+    LTRACEF("offset %u len %zu write %d\n", offset, len, write);
+
+    bcache_run runs[kDirectIoRuns];
+    uint run_count = 0;
+
+    auto issue = [&]() -> status_t {
+        int ret = write ? bcache_write_direct_runs(fs_->bcache(), runs, run_count)
+                        : bcache_read_direct_runs(fs_->bcache(), runs, run_count);
+        run_count = 0;
+        return ret;
+    };
+
+    size_t remaining = len / bps;
+    while (remaining > 0) {
+        // the extent map knows how far the chain stays physically contiguous
+        uint32_t cluster, run_clusters;
+        status_t err = cluster_for_offset_locked(offset, &cluster, &run_clusters);
+        if (err < 0) {
+            return (err == ERR_OUT_OF_RANGE) ? ERR_IO : err;
+        }
+
+        const uint32_t sector_within_cluster = (offset % bpc) / bps;
+        const size_t run = MIN((size_t)run_clusters * spc - sector_within_cluster, remaining);
+
+        uint32_t sector = fat_sector_for_cluster(fs_, cluster);
+        if (sector == 0xffffffff) {
+            return ERR_IO;
+        }
+        sector += sector_within_cluster;
+
+        LTRACEF("run of %zu sectors at sector %u\n", run, sector);
+
+        runs[run_count++] = { buf, sector, (uint)run };
+        if (run_count == countof(runs)) {
+            err = issue();
+            if (err < 0) {
+                return err;
+            }
+        }
+
+        buf += run * bps;
+        offset += run * bps;
+        remaining -= run;
+    }
 
-    return written;
+    return (run_count > 0) ? issue() : NO_ERROR;
 }
 
 // static
@@ -7,6 +7,7 @@
  */
 #pragma once
 
+#include "extent_cache.h"
 #include "fat_fs.h"
 #include "fat_priv.h"
 #include <inttypes.h>
@@ -43,6 +44,10 @@ class fat_file {
     status_t close_file_priv(bool *last_ref);
     status_t truncate_file_priv(uint64_t len);
     status_t zero_range_locked(uint32_t offset, uint32_t len);
+    status_t cluster_for_offset_locked(uint32_t offset, uint32_t *cluster, uint32_t *run);
+    ssize_t read_cached_locked(uint8_t *buf, uint32_t offset, size_t len);
+    status_t write_cached_locked(const uint8_t *buf, uint32_t offset, size_t len);
+    status_t direct_io_locked(uint8_t *buf, uint32_t offset, size_t len, bool write);
 
   protected:
     // increment the ref and add/remove the file from the fs list
@@ -61,6 +66,9 @@ class fat_file {
     uint32_t start_cluster_ = 0;
     uint32_t length_ = 0;
 
+    // logical to physical cluster map for the chain at start_cluster_
+    fat_extent_cache extents_;
+
     // saved attributes from our dir entry
     fat_attribute attributes_ = fat_attribute(0);
 };
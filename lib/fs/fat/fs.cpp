@@ -470,11 +470,13 @@ status_t fat_fs::mount(bdev_t *dev, fscookie **cookie, enum fs_mount_options opt
 
     info->bytes_per_cluster = info->sectors_per_cluster * info->bytes_per_sector;
 
-    int bcache_size = MIN(16, 64 * info->sectors_per_cluster);
+    dprintf(INFO, "FAT: creating bcache of %u byte entries\n", info->bytes_per_sector);
 
-    dprintf(INFO, "FAT: creating bcache of %d entries of %u bytes\n", bcache_size, info->bytes_per_sector);
-
-    fat->bcache_ = bcache_create(fat->dev(), info->bytes_per_sector, bcache_size);
+    // let the bcache size itself
+    fat->bcache_ = bcache_create(fat->dev(), info->bytes_per_sector, 0);
+    if (!fat->bcache_) {
+        return ERR_NO_MEMORY;
+    }
 
     if (fat->read_only_) {
         bcache_set_read_only(fat->bcache_, true);
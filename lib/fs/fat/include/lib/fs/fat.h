@@ -46,4 +46,18 @@ typedef struct fat_format_args {
     uint32_t volume_id;
 } fat_format_args_t;
 
+// Counters for the per file cluster extent maps, summed over every FAT mount.
+// A lookup maps a logical cluster of a file to its physical cluster; walking
+// the FAT from the file's start cluster to get there would take one hop (one
+// FAT entry read) per logical cluster.
+typedef struct fat_extent_stats {
+    uint64_t lookups;
+    // FAT entries actually read to answer the lookups
+    uint64_t hops_walked;
+    // entries a walk from the start cluster would have read on top of those
+    uint64_t hops_avoided;
+} fat_extent_stats_t;
+
+void fat_get_extent_stats(fat_extent_stats_t *stats);
+
 __END_CDECLS
@@ -8,6 +8,7 @@ MODULE_DEPS += lib/fs
 MODULE_DEPS += lib/libcpp
 
 MODULE_SRCS += $(LOCAL_DIR)/dir.cpp
+MODULE_SRCS += $(LOCAL_DIR)/extent_cache.cpp
 MODULE_SRCS += $(LOCAL_DIR)/fat.cpp
 MODULE_SRCS += $(LOCAL_DIR)/file.cpp
 MODULE_SRCS += $(LOCAL_DIR)/format.cpp
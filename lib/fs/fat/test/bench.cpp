@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+
+#include <arch/defines.h>
+#include <inttypes.h>
+#include <lib/fs.h>
+#include <lk/console_cmd.h>
+#include <lk/cpp.h>
+#include <lk/err.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ramdisk.h"
+
+#if WITH_LIB_CONSOLE
+
+// File throughput on a RAM backed volume, per transfer size. The device costs
+// nothing here, so what is measured is the driver and cache overhead: small
+// transfers go through the block cache a sector at a time, large ones go to the
+// device a cluster run at a time.
+
+namespace {
+
+using fat_test::ram_volume;
+
+constexpr const char *kMountPath = "/fatbench";
+constexpr const char *kDeviceName = "fatbench0";
+constexpr size_t kBenchSizes[] = {512, 4096, 65536, 1024 * 1024};
+
+void print_rate(const char *op, size_t size, uint64_t bytes, lk_bigtime_t usecs) {
+    if (usecs == 0) {
+        usecs = 1;
+    }
+    // bytes per usec is MB/s
+    uint64_t centi_mbs = bytes * 100 / usecs;
+    printf("\t%-5s %8zu bytes: %6" PRIu64 ".%02" PRIu64 " MB/s\n", op, size, centi_mbs / 100,
+           centi_mbs % 100);
+}
+
+status_t bench_size(const char *path, uint8_t *buf, size_t size, size_t file_bytes) {
+    filehandle *fh = nullptr;
+    status_t err = fs_open_file(path, &fh);
+    if (err < 0) {
+        return err;
+    }
+    auto close_fh = lk::make_auto_call([&]() { fs_close_file(fh); });
+
+    lk_bigtime_t start = current_time_hires();
+    for (size_t off = 0; off < file_bytes; off += size) {
+        ssize_t ret = fs_write_file(fh, buf, off, size);
+        if (ret != (ssize_t)size) {
+            return ret < 0 ? (status_t)ret : ERR_IO;
+        }
+    }
+    print_rate("write", size, file_bytes, current_time_hires() - start);
+
+    start = current_time_hires();
+    for (size_t off = 0; off < file_bytes; off += size) {
+        ssize_t ret = fs_read_file(fh, buf, off, size);
+        if (ret != (ssize_t)size) {
+            return ret < 0 ? (status_t)ret : ERR_IO;
+        }
+    }
+    print_rate("read", size, file_bytes, current_time_hires() - start);
+
+    return NO_ERROR;
+}
+
+int cmd_fat_bench(int argc, const console_cmd_args *argv) {
+    size_t mb = 16;
+    if (argc >= 2) {
+        mb = argv[1].u;
+    }
+    if (mb == 0 || mb > 128) {
+        printf("usage: %s [file size in MB, 1-128]\n", argv[0].str);
+        return ERR_INVALID_ARGS;
+    }
+    const size_t file_bytes = mb * 1024 * 1024;
+
+    // FAT16 with 4K clusters, leaving room for the file and a little slack
+    fat_test::geometry g = {"bench", 16, 512, 8, (uint32_t)MAX(file_bytes / 4096 + 256, 4200u)};
+    ram_volume vol;
+    status_t err = vol.create(kDeviceName, kMountPath, fat_test::volume_size_for(g),
+                              fat_test::format_args_for(g));
+    if (err < 0) {
+        printf("failed to create volume: %d\n", err);
+        return err;
+    }
+
+    char path[FS_MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/bench", vol.path());
+    filehandle *fh = nullptr;
+    err = fs_create_file(path, &fh, 0);
+    if (err < 0) {
+        printf("failed to create file: %d\n", err);
+        return err;
+    }
+    fs_close_file(fh);
+
+    const size_t buf_len = kBenchSizes[countof(kBenchSizes) - 1];
+    auto *buf = static_cast<uint8_t *>(memalign(CACHE_LINE, buf_len));
+    if (!buf) {
+        printf("failed to allocate buffer\n");
+        return ERR_NO_MEMORY;
+    }
+    memset(buf, 0x55, buf_len);
+
+    printf("%zu MB file:\n", mb);
+    for (size_t size : kBenchSizes) {
+        err = bench_size(path, buf, size, file_bytes);
+        if (err < 0) {
+            printf("transfer of %zu bytes failed: %d\n", size, err);
+            break;
+        }
+    }
+
+    free(buf);
+    return err;
+}
+
+} // namespace
+
+STATIC_COMMAND_START
+STATIC_COMMAND("fat_bench", "fat file read/write throughput on a ram volume", &cmd_fat_bench)
+STATIC_COMMAND_END(fat_bench);
+
+#endif // WITH_LIB_CONSOLE
@@ -463,6 +463,181 @@ bool test_fat_mount_rejects_malformed() {
     END_TEST;
 }
 
+// Large transfers skip the bcache for their whole sectors and go to the disk a
+// contiguous cluster run at a time. Make the runs short by fragmenting the file,
+// start and end mid sector so the cached path handles the edges, and mix small
+// cached writes with big direct ones to check each sees the other's data.
+bool test_fat_ram_bulk_io() {
+    BEGIN_TEST;
+
+    fat_test::geometry g = {"bulk", 16, 512, 4, 4096};
+    ram_volume vol;
+    const auto args = fat_test::format_args_for(g);
+    status_t err = vol.create(kDeviceName, kMountPath, fat_test::volume_size_for(g), args);
+    if (err == ERR_NO_MEMORY) {
+        unittest_printf(" volume would not allocate, skipping ");
+        return true;
+    }
+    ASSERT_EQ(NO_ERROR, err);
+
+    char path_a[FS_MAX_PATH_LEN];
+    char path_b[FS_MAX_PATH_LEN];
+    snprintf(path_a, sizeof(path_a), "%s/bulk_a", vol.path());
+    snprintf(path_b, sizeof(path_b), "%s/bulk_b", vol.path());
+
+    filehandle *fa = nullptr;
+    filehandle *fb = nullptr;
+    ASSERT_EQ(NO_ERROR, fs_create_file(path_a, &fa, 0));
+    auto close_fa = lk::make_auto_call([&]() { fs_close_file(fa); });
+    ASSERT_EQ(NO_ERROR, fs_create_file(path_b, &fb, 0));
+    auto close_fb = lk::make_auto_call([&]() { fs_close_file(fb); });
+
+    // grow the two files a few clusters at a time in turn, so neither one's
+    // chain is contiguous for long
+    const size_t cluster = 512 * 4;
+    const size_t size = cluster * 96;
+    std::unique_ptr<uint8_t[]> wbuf(new (std::nothrow) uint8_t[size]);
+    std::unique_ptr<uint8_t[]> rbuf(new (std::nothrow) uint8_t[size]);
+    ASSERT_NONNULL(wbuf.get());
+    ASSERT_NONNULL(rbuf.get());
+    memset(wbuf.get(), 0, size);
+    for (size_t off = 0; off < size; off += cluster * 3) {
+        ASSERT_EQ((ssize_t)(cluster * 3), fs_write_file(fa, wbuf.get(), off, cluster * 3));
+        ASSERT_EQ((ssize_t)cluster, fs_write_file(fb, wbuf.get(), off / 3, cluster));
+    }
+
+    // one big unaligned write over nearly all of it, read back the same way
+    const uint64_t offset = 100;
+    const size_t len = size - 300;
+    fill_pattern(wbuf.get(), len, 0x5555, offset);
+    ASSERT_EQ((ssize_t)len, fs_write_file(fa, wbuf.get(), offset, len));
+    memset(rbuf.get(), 0, size);
+    ASSERT_EQ((ssize_t)len, fs_read_file(fa, rbuf.get(), offset, len));
+    EXPECT_EQ(len, check_pattern(rbuf.get(), len, 0x5555, offset));
+
+    // a small write goes through the cache; a big read over it has to see it
+    uint8_t small[700];
+    fill_pattern(small, sizeof(small), 0x6666, 20000);
+    ASSERT_EQ((ssize_t)sizeof(small), fs_write_file(fa, small, 20000, sizeof(small)));
+    ASSERT_EQ((ssize_t)size, fs_read_file(fa, rbuf.get(), 0, size));
+    EXPECT_EQ(sizeof(small), check_pattern(rbuf.get() + 20000, sizeof(small), 0x6666, 20000));
+    EXPECT_EQ(20000u - offset, check_pattern(rbuf.get() + offset, 20000 - offset, 0x5555, offset));
+
+    // and a small read after a big write must not see stale cached data
+    fill_pattern(wbuf.get(), size, 0x7777, 0);
+    ASSERT_EQ((ssize_t)size, fs_write_file(fa, wbuf.get(), 0, size));
+    ASSERT_EQ((ssize_t)sizeof(small), fs_read_file(fa, small, 20000, sizeof(small)));
+    EXPECT_EQ(sizeof(small), check_pattern(small, sizeof(small), 0x7777, 20000));
+
+    // the other file must not have been touched
+    memset(rbuf.get(), 0xff, size / 3);
+    ASSERT_EQ((ssize_t)(size / 3), fs_read_file(fb, rbuf.get(), 0, size / 3));
+    for (size_t i = 0; i < size / 3; i++) {
+        if (rbuf[i] != 0) {
+            UNITTEST_FAIL_TRACEF("neighbouring file changed at offset %zu\n", i);
+            all_ok = false;
+            break;
+        }
+    }
+
+    // everything reached the device
+    close_fa.call();
+    close_fb.call();
+    ASSERT_EQ(NO_ERROR, vol.remount());
+    EXPECT_TRUE(verify_file_contents(path_a, 0x7777, 0, size, size));
+
+    END_TEST;
+}
+
+// Each file keeps a map of its cluster runs so a seek does not walk the FAT
+// from the start. Fragment a file into more runs than the map holds, then check
+// that seeks anywhere in it read the right data, that repeated seeks to the end
+// walk nothing, and that the map follows the chain through shrink and regrowth.
+bool test_fat_ram_extent_map() {
+    BEGIN_TEST;
+
+    fat_test::geometry g = {"extents", 16, 512, 1, 4200};
+    ram_volume vol;
+    const auto args = fat_test::format_args_for(g);
+    status_t err = vol.create(kDeviceName, kMountPath, fat_test::volume_size_for(g), args);
+    if (err == ERR_NO_MEMORY) {
+        unittest_printf(" volume would not allocate, skipping ");
+        return true;
+    }
+    ASSERT_EQ(NO_ERROR, err);
+
+    char path_a[FS_MAX_PATH_LEN];
+    char path_b[FS_MAX_PATH_LEN];
+    snprintf(path_a, sizeof(path_a), "%s/frag_a", vol.path());
+    snprintf(path_b, sizeof(path_b), "%s/frag_b", vol.path());
+
+    filehandle *fa = nullptr;
+    filehandle *fb = nullptr;
+    ASSERT_EQ(NO_ERROR, fs_create_file(path_a, &fa, 0));
+    auto close_fa = lk::make_auto_call([&]() { fs_close_file(fa); });
+    ASSERT_EQ(NO_ERROR, fs_create_file(path_b, &fb, 0));
+    auto close_fb = lk::make_auto_call([&]() { fs_close_file(fb); });
+
+    // alternate single cluster appends, so every cluster of a is its own run
+    const size_t cluster = 512;
+    const size_t clusters = 300;
+    const size_t size = cluster * clusters;
+    uint8_t buf[cluster];
+    memset(buf, 0, sizeof(buf));
+    for (size_t i = 0; i < clusters; i++) {
+        fill_pattern(buf, cluster, 0x8888, i * cluster);
+        ASSERT_EQ((ssize_t)cluster, fs_write_file(fa, buf, i * cluster, cluster));
+        memset(buf, 0, sizeof(buf));
+        ASSERT_EQ((ssize_t)cluster, fs_write_file(fb, buf, i * cluster, cluster));
+    }
+
+    // seeks anywhere, in an order that goes both ways
+    for (size_t i = 0; i < clusters; i++) {
+        const size_t c = (i * 7919) % clusters;
+        ASSERT_EQ((ssize_t)cluster, fs_read_file(fa, buf, c * cluster, cluster));
+        if (check_pattern(buf, cluster, 0x8888, c * cluster) != cluster) {
+            UNITTEST_FAIL_TRACEF("cluster %zu read back wrong\n", c);
+            all_ok = false;
+            break;
+        }
+    }
+
+    // once the tail has been found, going back there reads no FAT entries
+    ASSERT_EQ((ssize_t)cluster, fs_read_file(fa, buf, size - cluster, cluster));
+    fat_extent_stats_t before;
+    fat_get_extent_stats(&before);
+    ASSERT_EQ((ssize_t)cluster, fs_read_file(fa, buf, size - cluster, cluster));
+    ASSERT_EQ((ssize_t)cluster, fs_read_file(fa, buf, cluster * 10, cluster));
+    fat_extent_stats_t after;
+    fat_get_extent_stats(&after);
+    EXPECT_EQ(before.hops_walked, after.hops_walked);
+    EXPECT_LT(before.hops_avoided, after.hops_avoided);
+
+    // shrink into the middle of the mapped runs, grow again and check both halves
+    const size_t keep = cluster * 40 + 100;
+    ASSERT_EQ(NO_ERROR, fs_truncate_file(fa, keep));
+    std::unique_ptr<uint8_t[]> big(new (std::nothrow) uint8_t[size]);
+    ASSERT_NONNULL(big.get());
+    fill_pattern(big.get(), size - keep, 0x9999, keep);
+    ASSERT_EQ((ssize_t)(size - keep), fs_write_file(fa, big.get(), keep, size - keep));
+
+    ASSERT_EQ((ssize_t)size, fs_read_file(fa, big.get(), 0, size));
+    EXPECT_EQ(keep, check_pattern(big.get(), keep, 0x8888, 0));
+    EXPECT_EQ(size - keep, check_pattern(big.get() + keep, size - keep, 0x9999, keep));
+
+    // and to nothing, which moves the start of the chain
+    ASSERT_EQ(NO_ERROR, fs_truncate_file(fa, 0));
+    fill_pattern(big.get(), size, 0xaaaa, 0);
+    ASSERT_EQ((ssize_t)size, fs_write_file(fa, big.get(), 0, size));
+
+    close_fa.call();
+    close_fb.call();
+    ASSERT_EQ(NO_ERROR, vol.remount());
+    EXPECT_TRUE(verify_file_contents(path_a, 0xaaaa, 0, size, size));
+
+    END_TEST;
+}
+
 } // anonymous namespace
 
 BEGIN_TEST_CASE(fat_ram)
@@ -470,4 +645,6 @@ RUN_TEST(test_fat_ram_geometries)
 RUN_TEST(test_fat_ram_format_roundtrip)
 RUN_TEST(test_fat_format_rejects_impossible_geometry)
 RUN_TEST(test_fat_mount_rejects_malformed)
+RUN_TEST(test_fat_ram_bulk_io)
+RUN_TEST(test_fat_ram_extent_map)
 END_TEST_CASE(fat_ram)
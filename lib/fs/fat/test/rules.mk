@@ -7,6 +7,7 @@ MODULE_DEPS += lib/cmdline
 MODULE_DEPS += lib/libcpp
 MODULE_DEPS += lib/unittest
 
+MODULE_SRCS += $(LOCAL_DIR)/bench.cpp
 MODULE_SRCS += $(LOCAL_DIR)/ram_tests.cpp
 MODULE_SRCS += $(LOCAL_DIR)/ramdisk.cpp
 MODULE_SRCS += $(LOCAL_DIR)/stress.cpp
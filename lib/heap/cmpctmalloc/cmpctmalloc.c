@@ -25,6 +25,11 @@
 // Allocation strategy takes place with a global mutex.  Freelist entries are
 // kept in linked lists with 8 different sizes per binary order of magnitude
 // and the header size is two words with eager coalescing on free.
+//
+// In front of that, each cpu caches a few freed blocks for each of the small
+// HEAP_ALIGN-spaced buckets. Small allocations and frees are served from the
+// local cache without taking the mutex, and blocks move between the caches
+// and the free lists CPU_CACHE_BATCH at a time.
 
 #ifdef DEBUG
 #define CMPCT_DEBUG
@@ -86,6 +91,17 @@ void cmpct_dump(void) {
             dump_free(&free_area->header);
         }
     }
+
+    dprintf(INFO, "\tcpu caches:\n");
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        const struct cpu_cache *cache = &theheap.cpu_cache[cpu];
+        unsigned int cached = 0;
+        for (int i = 0; i < CPU_CACHE_BUCKETS; i++) {
+            cached += cache->count[i];
+        }
+        dprintf(INFO, "\t\tcpu %u: %u blocks cached, %lu hits, %lu misses, %lu drains\n",
+                cpu, cached, cache->hits, cache->misses, cache->drains);
+    }
     unlock();
 }
 
@@ -293,6 +309,9 @@ static void *large_alloc(size_t size) {
 }
 
 void cmpct_trim(void) {
+    // Cached blocks could be holding on to otherwise free pages.
+    cmpct_cpu_cache_flush();
+
     // Look at free list entries that are at least as large as one page plus a
     // header. They might be at the start or the end of a block, so we can trim
     // them and free the page(s).
@@ -362,29 +381,19 @@ void cmpct_trim(void) {
     unlock();
 }
 
-void *cmpct_alloc(size_t size) {
-    if (size == 0u) {
-        return NULL;
-    }
-
-    if (size + sizeof(header_t) > (1u << HEAP_ALLOC_VIRTUAL_BITS)) {
-        return large_alloc(size);
-    }
-
-    size_t rounded_up;
-    int start_bucket = size_to_index_allocating(size, &rounded_up);
-
-    rounded_up += sizeof(header_t);
-
-    lock();
+// Carve an allocation out of the free lists.  rounded_up includes the header.
+// Called with the lock.
+static void *alloc_locked(size_t size, int start_bucket, size_t rounded_up, bool may_grow) {
     int bucket = find_nonempty_bucket(start_bucket);
     if (bucket == -1) {
+        if (!may_grow) {
+            return NULL;
+        }
         // Grow heap by at least 12% if we can.
         size_t growby = MIN(1u << HEAP_ALLOC_VIRTUAL_BITS,
                             MAX(theheap.size >> 3, MAX(HEAP_GROW_SIZE, rounded_up)));
         while (heap_grow(growby, NULL) < 0) {
             if (growby <= rounded_up) {
-                unlock();
                 return NULL;
             }
             growby = MAX(growby >> 1, rounded_up);
@@ -408,12 +417,235 @@ void *cmpct_alloc(size_t size) {
     } else {
         unlink_free(head, bucket);
     }
-    void *result = create_allocation_header(head, 0, head->header.size, head->header.left);
+    return create_allocation_header(head, 0, head->header.size, head->header.left);
+}
+
+// Return an allocated block to the free lists, coalescing with its neighbors.
+// Called with the lock.
+static void free_locked(header_t *header) {
+    size_t size = header->size;
+    header_t *left = header->left;
+    if (left != NULL && is_tagged_as_free(left)) {
+        // Coalesce with left free object.
+        unlink_free_unknown_bucket((free_t *)left);
+        header_t *right = right_header(header);
+        if (is_tagged_as_free(right)) {
+            // Coalesce both sides.
+            unlink_free_unknown_bucket((free_t *)right);
+            header_t *right_right = right_header(right);
+            FixLeftPointer(right_right, left);
+            free_memory(left, left->left, left->size + size + right->size);
+        } else {
+            // Coalesce only left.
+            FixLeftPointer(right, left);
+            free_memory(left, left->left, left->size + size);
+        }
+    } else {
+        header_t *right = right_header(header);
+        if (is_tagged_as_free(right)) {
+            // Coalesce only right.
+            header_t *right_right = right_header(right);
+            unlink_free_unknown_bucket((free_t *)right);
+            FixLeftPointer(right_right, header);
+            free_memory(header, left, size + right->size);
+        } else {
+            free_memory(header, left, size);
+        }
+    }
+}
+
+// Free a chain of blocks linked through their payloads.
+static void free_chain_locked(void *payload) {
+    while (payload != NULL) {
+        void *next = *(void **)payload;
+        free_locked((header_t *)payload - 1);
+        payload = next;
+    }
+}
+
+#ifdef CMPCT_DEBUG
+// Blocks in a cpu cache keep their allocated header, so the word after the
+// cache link marks them instead, to catch a cached block being freed again.
+#define CACHED_MAGIC ((uintptr_t)0x63616368) // 'cach'
+
+static inline uintptr_t *cached_mark(void *payload) {
+    return (uintptr_t *)payload + 1;
+}
+
+static inline bool is_marked_as_cached(void *payload) {
+    return *cached_mark(payload) == ((uintptr_t)payload ^ CACHED_MAGIC);
+}
+#endif
+
+static void *cpu_cache_alloc(int bucket) {
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
+    struct cpu_cache *cache = &theheap.cpu_cache[arch_curr_cpu_num()];
+
+    spin_lock(&cache->lock);
+    void *payload = cache->blocks[bucket];
+    if (payload != NULL) {
+        cache->blocks[bucket] = *(void **)payload;
+        cache->count[bucket]--;
+        cache->hits++;
+#ifdef CMPCT_DEBUG
+        DEBUG_ASSERT(is_marked_as_cached(payload));
+        *cached_mark(payload) = 0;
+#endif
+    } else {
+        cache->misses++;
+    }
+    spin_unlock(&cache->lock);
+    arch_interrupt_restore(state);
+
+    return payload;
+}
+
+// Push a chain of blocks onto the local cache.  Whatever does not fit is
+// returned as a chain for the caller to free.
+static void *cpu_cache_push(int bucket, void *chain) {
+    void *excess = NULL;
+
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
+    struct cpu_cache *cache = &theheap.cpu_cache[arch_curr_cpu_num()];
+
+    spin_lock(&cache->lock);
+    while (chain != NULL) {
+        void *next = *(void **)chain;
+        if (cache->count[bucket] < CPU_CACHE_MAX) {
+#ifdef CMPCT_DEBUG
+            *cached_mark(chain) = (uintptr_t)chain ^ CACHED_MAGIC;
+#endif
+            *(void **)chain = cache->blocks[bucket];
+            cache->blocks[bucket] = chain;
+            cache->count[bucket]++;
+        } else {
+            *(void **)chain = excess;
+            excess = chain;
+        }
+        chain = next;
+    }
+    // Keep the most recently freed blocks and hand a batch of the oldest back.
+    if (excess != NULL) {
+        void **tail = &cache->blocks[bucket];
+        for (int i = 0; i < CPU_CACHE_MAX - CPU_CACHE_BATCH; i++) {
+            tail = (void **)*tail;
+        }
+        void *old = *tail;
+        *tail = NULL;
+        cache->count[bucket] = CPU_CACHE_MAX - CPU_CACHE_BATCH;
+        cache->drains++;
+        while (old != NULL) {
+            void *next = *(void **)old;
+            *(void **)old = excess;
+            excess = old;
+            old = next;
+        }
+    }
+    spin_unlock(&cache->lock);
+    arch_interrupt_restore(state);
+
+    return excess;
+}
+
+// Allocate from the free lists and top up the local cache for this bucket
+// with a batch of blocks of the same size, all under one acquisition of the
+// lock.
+static void *cpu_cache_refill(size_t size, int bucket, size_t rounded_up) {
+    void *chain = NULL;
+
+    lock();
+    void *result = alloc_locked(size, bucket, rounded_up, true);
+    for (int i = 1; result != NULL && i < CPU_CACHE_BATCH; i++) {
+        // Only use what is already free, don't grow the heap for the cache.
+        void *extra = alloc_locked(size, bucket, rounded_up, false);
+        if (extra == NULL) {
+            break;
+        }
+        *(void **)extra = chain;
+        chain = extra;
+    }
+    unlock();
+
+    if (chain != NULL) {
+        void *excess = cpu_cache_push(bucket, chain);
+        if (excess != NULL) {
+            lock();
+            free_chain_locked(excess);
+            unlock();
+        }
+    }
+    return result;
+}
+
+void cmpct_cpu_cache_flush(void) {
+    void *chain = NULL;
+
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        struct cpu_cache *cache = &theheap.cpu_cache[cpu];
+
+        arch_interrupt_saved_state_t state = spin_lock_irqsave(&cache->lock);
+        for (int bucket = 0; bucket < CPU_CACHE_BUCKETS; bucket++) {
+            void *payload = cache->blocks[bucket];
+            while (payload != NULL) {
+                void *next = *(void **)payload;
+                *(void **)payload = chain;
+                chain = payload;
+                payload = next;
+            }
+            cache->blocks[bucket] = NULL;
+            cache->count[bucket] = 0;
+        }
+        spin_unlock_irqrestore(&cache->lock, state);
+    }
+
+    if (chain != NULL) {
+        lock();
+        free_chain_locked(chain);
+        unlock();
+    }
+}
+
+void *cmpct_alloc(size_t size) {
+    if (size == 0u) {
+        return NULL;
+    }
+
+    if (size + sizeof(header_t) > (1u << HEAP_ALLOC_VIRTUAL_BITS)) {
+        return large_alloc(size);
+    }
+
+    size_t rounded_up;
+    int start_bucket = size_to_index_allocating(size, &rounded_up);
+
+    rounded_up += sizeof(header_t);
+
+    void *result;
+    if (start_bucket < CPU_CACHE_BUCKETS && theheap.cpu_cache_enabled) {
+        result = cpu_cache_alloc(start_bucket);
+        if (result == NULL) {
+            result = cpu_cache_refill(size, start_bucket, rounded_up);
+            if (result == NULL) {
+                return NULL;
+            }
+        }
+#ifdef CMPCT_DEBUG
+        // Cached blocks may be bigger than this bucket, so only the requested
+        // bytes are filled.
+        memset(result, ALLOC_FILL, size);
+#endif
+        return result;
+    }
+
+    lock();
+    result = alloc_locked(size, start_bucket, rounded_up, true);
+    unlock();
+    if (result == NULL) {
+        return NULL;
+    }
 #ifdef CMPCT_DEBUG
     memset(result, ALLOC_FILL, size);
     memset(((char *)result) + size, PADDING_FILL, rounded_up - size - sizeof(header_t));
 #endif
-    unlock();
     return result;
 }
 
@@ -438,8 +670,9 @@ void *cmpct_memalign(size_t size, size_t alignment) {
         header_t *right = right_header(unaligned_header);
         unaligned_header->size = left_over;
         FixLeftPointer(right, header);
+        // Straight back to the free lists, so the leading fragment can coalesce.
+        free_locked(unaligned_header);
         unlock();
-        cmpct_free(unaligned);
     } else {
         unlock();
     }
@@ -453,36 +686,24 @@ void cmpct_free(void *payload) {
     }
     header_t *header = (header_t *)payload - 1;
     DEBUG_ASSERT(!is_tagged_as_free(header)); // Double free!
-    size_t size = header->size;
-    lock();
-    header_t *left = header->left;
-    if (left != NULL && is_tagged_as_free(left)) {
-        // Coalesce with left free object.
-        unlink_free_unknown_bucket((free_t *)left);
-        header_t *right = right_header(header);
-        if (is_tagged_as_free(right)) {
-            // Coalesce both sides.
-            unlink_free_unknown_bucket((free_t *)right);
-            header_t *right_right = right_header(right);
-            FixLeftPointer(right_right, left);
-            free_memory(left, left->left, left->size + size + right->size);
-        } else {
-            // Coalesce only left.
-            FixLeftPointer(right, left);
-            free_memory(left, left->left, left->size + size);
-        }
-    } else {
-        header_t *right = right_header(header);
-        if (is_tagged_as_free(right)) {
-            // Coalesce only right.
-            header_t *right_right = right_header(right);
-            unlink_free_unknown_bucket((free_t *)right);
-            FixLeftPointer(right_right, header);
-            free_memory(header, left, size + right->size);
-        } else {
-            free_memory(header, left, size);
+    size_t size = header->size - sizeof(header_t);
+    if (size <= CPU_CACHE_BUCKETS * HEAP_ALIGN && theheap.cpu_cache_enabled) {
+#ifdef CMPCT_DEBUG
+        DEBUG_ASSERT(!is_marked_as_cached(payload)); // Double free!
+        memset(payload, FREE_FILL, size);
+#endif
+        *(void **)payload = NULL;
+        void *excess = cpu_cache_push(size_to_index_freeing(size), payload);
+        if (excess == NULL) {
+            return;
         }
+        lock();
+        free_chain_locked(excess);
+        unlock();
+        return;
     }
+    lock();
+    free_locked(header);
     unlock();
 }
 
@@ -547,4 +768,13 @@ void cmpct_init(void) {
     theheap.remaining = 0;
 
     heap_grow(initial_alloc, NULL);
+
+    for (int i = 0; i < SMP_MAX_CPUS; i++) {
+        spin_lock_init(&theheap.cpu_cache[i].lock);
+        for (int j = 0; j < CPU_CACHE_BUCKETS; j++) {
+            theheap.cpu_cache[i].blocks[j] = NULL;
+            theheap.cpu_cache[i].count[j] = 0;
+        }
+    }
+    theheap.cpu_cache_enabled = true;
 }
@@ -8,7 +8,9 @@
  */
 #pragma once
 
+#include <arch/ops.h>
 #include <kernel/mutex.h>
+#include <kernel/spinlock.h>
 #include <lib/cmpctmalloc.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -41,10 +43,32 @@ typedef struct free_struct {
     struct free_struct *prev;
 } free_t;
 
+// Per cpu caches of recently freed small blocks, one LIFO per bucket for the
+// HEAP_ALIGN-spaced buckets (allocations of up to 16 * HEAP_ALIGN bytes).
+// Cached blocks are still allocated as far as the free lists are concerned.
+#define CPU_CACHE_BUCKETS 16
+#ifndef CPU_CACHE_BATCH
+#define CPU_CACHE_BATCH 8
+#endif
+#define CPU_CACHE_MAX (CPU_CACHE_BATCH * 2)
+
+struct cpu_cache {
+    spin_lock_t lock;
+    void *blocks[CPU_CACHE_BUCKETS]; // linked through the first word of the payload
+    uint8_t count[CPU_CACHE_BUCKETS];
+
+    // stats
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long drains;
+} __CPU_ALIGN;
+
 struct heap {
     size_t size;
     size_t remaining;
     mutex_t lock;
+    bool cpu_cache_enabled;
+    struct cpu_cache cpu_cache[SMP_MAX_CPUS];
     free_t *free_lists[NUMBER_OF_BUCKETS];
     // We have some 32 bit words that tell us whether there is an entry in the
     // freelist.
@@ -56,3 +80,6 @@ extern struct heap theheap;
 
 int size_to_index_allocating(size_t size, size_t *rounded_up_out);
 int size_to_index_freeing(size_t size);
+
+// Return every block held in the per cpu caches to the free lists.
+void cmpct_cpu_cache_flush(void);
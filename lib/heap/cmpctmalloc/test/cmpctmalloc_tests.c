@@ -13,6 +13,17 @@
 #include <stdlib.h>
 #include <string.h>
 
+// The tests below look at exactly where blocks land and how much of the heap
+// is free, so they run with the per cpu caches emptied and turned off.
+static void DisableCpuCache(void) {
+    theheap.cpu_cache_enabled = false;
+    cmpct_cpu_cache_flush();
+}
+
+static void EnableCpuCache(void) {
+    theheap.cpu_cache_enabled = true;
+}
+
 static void WasteFreeMemory(void) {
     while (theheap.remaining != 0) {
         cmpct_alloc(1);
@@ -50,6 +61,7 @@ static void TestTrimFreeHelper(char *block) {
 static bool test_cmpct_trim(void) {
     BEGIN_TEST;
 
+    DisableCpuCache();
     WasteFreeMemory();
 
     static size_t test_sizes[200];
@@ -153,6 +165,7 @@ static bool test_cmpct_trim(void) {
         }
     }
 
+    EnableCpuCache();
     END_TEST;
 }
 
@@ -259,6 +272,7 @@ static bool test_cmpct_get_back_newly_freed(void) {
 static bool test_cmpct_return_to_os(void) {
     BEGIN_TEST;
 
+    DisableCpuCache();
     cmpct_trim();
     size_t remaining = theheap.remaining;
     // This goes in a new OS allocation since the trim above removed any free
@@ -273,11 +287,13 @@ static bool test_cmpct_return_to_os(void) {
     // the middle of an OS allocation, and our test won't work as expected, so
     // bail out.
     if (((uintptr_t)a & (PAGE_SIZE - 1)) != sizeof(header_t) * 2) {
+        EnableCpuCache();
         return true;
     }
     // No trim needed when the entire OS allocation is free.
     ASSERT_EQ(remaining, theheap.remaining, "reclaiming OS allocation should return memory");
 
+    EnableCpuCache();
     END_TEST;
 }
 
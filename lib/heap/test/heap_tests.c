@@ -9,10 +9,12 @@
 #include <lib/unittest.h>
 
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 
 #if MEMSIZE >= (128 * 1024)
 #define HEAP_TEST_LARGE_ALLOCATIONS     1
+#define HEAP_TEST_BENCH_ROUNDS          4096
 #define HEAP_TEST_MEMALIGN_MAX_ALIGN    4096
 #define HEAP_TEST_MEMALIGN_SIZE         64
 #define HEAP_TEST_STRESS_SLOTS          16
@@ -21,6 +23,7 @@
 #define HEAP_TEST_STRESS_ITERS_PER_SLOT 128
 #else
 #define HEAP_TEST_LARGE_ALLOCATIONS     0
+#define HEAP_TEST_BENCH_ROUNDS          256
 #define HEAP_TEST_MEMALIGN_MAX_ALIGN    256
 #define HEAP_TEST_MEMALIGN_SIZE         32
 #define HEAP_TEST_STRESS_SLOTS          8
@@ -480,6 +483,62 @@ static bool test_realloc_multiple_steps(void) {
     END_TEST;
 }
 
+/*
+ * Small allocation throughput with one thread per cpu on 1..N cpus. Each
+ * thread keeps a handful of blocks of mixed small sizes live and frees them in
+ * a different order than it allocated them. Reports allocs/sec; only fails if
+ * the heap runs out or hands out overlapping blocks.
+ */
+#define HEAP_BENCH_LIVE 16
+
+static int heap_bench_thread(void *arg, uint index, const volatile bool *stop) {
+    static const size_t sizes[] = { 16, 24, 32, 48, 64, 96, 128, 200 };
+    unsigned char *ptrs[HEAP_BENCH_LIVE];
+    unsigned char tag = (unsigned char)(index + 1);
+
+    for (int r = 0; r < HEAP_TEST_BENCH_ROUNDS; r++) {
+        for (int i = 0; i < HEAP_BENCH_LIVE; i++) {
+            ptrs[i] = malloc(sizes[(r + i) % countof(sizes)]);
+            if (!ptrs[i]) {
+                while (i-- > 0) {
+                    free(ptrs[i]);
+                }
+                return -1;
+            }
+            ptrs[i][0] = tag;
+        }
+        for (int i = 0; i < HEAP_BENCH_LIVE; i++) {
+            unsigned char *p = ptrs[(i * 7) % HEAP_BENCH_LIVE];
+            if (p[0] != tag) {
+                return -2;
+            }
+            free(p);
+        }
+    }
+
+    return 0;
+}
+
+static bool test_malloc_thread_scaling(void) {
+    BEGIN_TEST;
+
+    uint cpu_count = unittest_active_cpu_count();
+
+    for (uint cpus = 1; cpus <= cpu_count; cpus++) {
+        lk_bigtime_t elapsed;
+
+        int err = unittest_run_threads("heap bench", cpus, cpus, 0, &heap_bench_thread, NULL, &elapsed);
+        ASSERT_EQ(0, err, "heap bench thread failed");
+
+        uint64_t allocs = (uint64_t)cpus * HEAP_TEST_BENCH_ROUNDS * HEAP_BENCH_LIVE;
+        unittest_printf("\n\t%u threads: %llu allocs in %llu usecs, %llu allocs/sec",
+                        cpus, allocs, elapsed, elapsed ? allocs * 1000000ULL / elapsed : 0);
+    }
+    unittest_printf("\n");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(heap_tests)
 RUN_TEST(test_malloc_basic)
 RUN_TEST(test_malloc_zero)
@@ -499,4 +558,5 @@ RUN_TEST(test_simultaneous_allocs)
 RUN_TEST(test_no_overlap)
 RUN_TEST(test_memalign_stress)
 RUN_TEST(test_heap_worst_case)
+RUN_TEST(test_malloc_thread_scaling)
 END_TEST_CASE(heap_tests)
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <arch/x86/feature.h>
+
+/*
+ * memcpy and memmove on top of the rep string instructions. The kernel does
+ * not save vector state around its own code, so SSE/AVX loops are out; on
+ * anything recent rep movsb is as fast as they would be anyway. With ERMS the
+ * microcode handles alignment and picks the copy width itself, so the whole
+ * copy is one rep movsb. Without it, move what we can a word at a time and
+ * only the tail a byte at a time.
+ */
+
+#if ARCH_X86_64
+#define REP_MOVSW "rep movsq"
+#else
+#define REP_MOVSW "rep movsl"
+#endif
+
+static inline void rep_movsb(void *dest, const void *src, size_t count) {
+    __asm__ volatile("rep movsb" : "+D"(dest), "+S"(src), "+c"(count) :: "memory");
+}
+
+void *memcpy(void *dest, const void *src, size_t count) {
+    if (__x86_string_erms || __x86_string_fsrm) {
+        rep_movsb(dest, src, count);
+        return dest;
+    }
+
+    void *d = dest;
+    size_t words = count / sizeof(size_t);
+    __asm__ volatile(REP_MOVSW : "+D"(d), "+S"(src), "+c"(words) :: "memory");
+    rep_movsb(d, src, count % sizeof(size_t));
+
+    return dest;
+}
+
+void *memmove(void *dest, const void *src, size_t count) {
+    /* a forward copy is safe unless dest starts inside the source. The rep
+     * forms keep byte at a time semantics for overlapping buffers, fast
+     * strings or not. */
+    if ((uintptr_t)dest - (uintptr_t)src >= count)
+        return memcpy(dest, src, count);
+
+    /* copy backwards: the whole words at the top first, then the odd bytes
+     * at the bottom. Interrupt entry clears the direction flag, so leaving it
+     * set for the duration is fine. */
+    size_t words = count / sizeof(size_t);
+    size_t bytes = count % sizeof(size_t);
+    const char *s = (const char *)src + count - sizeof(size_t);
+    char *d = (char *)dest + count - sizeof(size_t);
+    __asm__ volatile("std\n" REP_MOVSW "\ncld" : "+D"(d), "+S"(s), "+c"(words) :: "memory");
+
+    s = (const char *)src + bytes - 1;
+    d = (char *)dest + bytes - 1;
+    __asm__ volatile("std\nrep movsb\ncld" : "+D"(d), "+S"(s), "+c"(bytes) :: "memory");
+
+    return dest;
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#include <string.h>
+#include <sys/types.h>
+
+#include <arch/x86/feature.h>
+
+/* memset on top of rep stos, see memcpy.c for the reasoning */
+
+#if ARCH_X86_64
+#define REP_STOSW "rep stosq"
+#else
+#define REP_STOSW "rep stosl"
+#endif
+
+void *memset(void *s, int c, size_t count) {
+    void *d = s;
+
+    if (__x86_string_erms) {
+        __asm__ volatile("rep stosb" : "+D"(d), "+c"(count) : "a"(c) : "memory");
+        return s;
+    }
+
+    size_t pattern = (unsigned char)c * ((size_t)-1 / 0xff);
+    size_t words = count / sizeof(size_t);
+    count %= sizeof(size_t);
+    __asm__ volatile(REP_STOSW : "+D"(d), "+c"(words) : "a"(pattern) : "memory");
+    __asm__ volatile("rep stosb" : "+D"(d), "+c"(count) : "a"(pattern) : "memory");
+
+    return s;
+}
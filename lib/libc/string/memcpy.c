@@ -23,7 +23,7 @@ typedef long word;
 void *memcpy(void *dest, const void *src, size_t count) {
     char *d = (char *)dest;
     const char *s = (const char *)src;
-    int len;
+    size_t len;
 
     if (count == 0 || dest == src)
         return dest;
@@ -39,7 +39,20 @@ void *memcpy(void *dest, const void *src, size_t count) {
         for (; len > 0; len--)
             *d++ = *s++;
     }
-    for (len = count / lsize; len > 0; len--) {
+    // four words per iteration so in order cores can overlap the loads
+    for (len = count / (4 * lsize); len > 0; len--) {
+        word w0 = ((const word *)s)[0];
+        word w1 = ((const word *)s)[1];
+        word w2 = ((const word *)s)[2];
+        word w3 = ((const word *)s)[3];
+        ((word *)d)[0] = w0;
+        ((word *)d)[1] = w1;
+        ((word *)d)[2] = w2;
+        ((word *)d)[3] = w3;
+        d += 4 * lsize;
+        s += 4 * lsize;
+    }
+    for (len = (count / lsize) & 3; len > 0; len--) {
         *(word *)d = *(word *)s;
         d += lsize;
         s += lsize;
@@ -9,17 +9,39 @@
  * license that can be found in the LICENSE file or at
  * https://opensource.org/licenses/MIT
  */
+#include <stdint.h>
 #include <string.h>
 #include <sys/types.h>
 
+typedef unsigned long word;
+
+#define lsize sizeof(word)
+#define lmask (lsize - 1)
+
+#define ONES ((word)-1 / 0xff)
+#define HIGHS (ONES << 7)
+
+// nonzero if any byte in x is zero
+#define HAS_ZERO(x) (((x) - ONES) & ~(x) & HIGHS)
+
 size_t
 strlen(char const *s) {
-    size_t i;
+    const char *p = s;
 
-    i= 0;
-    while (s[i]) {
-        i+= 1;
+    // byte at a time up to a word boundary, then look for the terminator a
+    // word at a time. An aligned word never crosses a page, so reading past
+    // the end of the string this way cannot fault.
+    for (; (uintptr_t)p & lmask; p++) {
+        if (!*p)
+            return p - s;
     }
 
-    return i;
+    const word *w = (const word *)p;
+    while (!HAS_ZERO(*w))
+        w++;
+
+    for (p = (const char *)w; *p; p++)
+        ;
+
+    return p - s;
 }
@@ -3,6 +3,7 @@ LOCAL_DIR := $(GET_LOCAL_DIR)
 MODULE := $(LOCAL_DIR)
 
 MODULE_SRCS += $(LOCAL_DIR)/printf_tests.cpp
+MODULE_SRCS += $(LOCAL_DIR)/string_tests.cpp
 MODULE_FLOAT_SRCS += $(LOCAL_DIR)/printf_tests_float.cpp
 
 MODULE_DEPS += lib/libc
@@ -0,0 +1,275 @@
+// Copyright (c) 2026 Travis Geiselbrecht
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <arch/defines.h>
+#include <inttypes.h>
+#include <lib/unittest.h>
+#include <lk/console_cmd.h>
+#include <lk/err.h>
+#include <platform.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+// The string routines are arch specific and pick their strategy by size and
+// alignment, so walk every source/destination alignment within a word pair
+// over sizes that cross all of their small/medium/large thresholds, and check
+// the bytes on either side of the destination were left alone.
+constexpr size_t kMaxAlign = 16;
+constexpr size_t kMaxLen = 300;
+constexpr size_t kBufLen = kMaxLen + 2 * kMaxAlign + 64;
+
+uint8_t src_buf[kBufLen];
+uint8_t dst_buf[kBufLen];
+uint8_t ref_buf[kBufLen];
+
+// byte at a time references, through volatile so the compiler cannot turn
+// them back into calls to the routines under test
+void ref_copy(uint8_t* dst, const uint8_t* src, size_t len) {
+  volatile uint8_t* d = dst;
+  for (size_t i = 0; i < len; i++) {
+    d[i] = src[i];
+  }
+}
+
+void fill_pattern(uint8_t* buf, size_t len, uint32_t seed) {
+  for (size_t i = 0; i < len; i++) {
+    seed = seed * 1103515245 + 12345;
+    buf[i] = static_cast<uint8_t>(seed >> 16);
+  }
+}
+
+bool buffers_match(const uint8_t* a, const uint8_t* b, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (a[i] != b[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool memcpy_test() {
+  BEGIN_TEST;
+
+  fill_pattern(src_buf, kBufLen, 1);
+  for (size_t so = 0; so < kMaxAlign; so++) {
+    for (size_t dof = 0; dof < kMaxAlign; dof++) {
+      for (size_t len = 0; len <= kMaxLen; len++) {
+        fill_pattern(dst_buf, kBufLen, static_cast<uint32_t>(len));
+        ref_copy(ref_buf, dst_buf, kBufLen);
+        ref_copy(ref_buf + dof, src_buf + so, len);
+
+        void* ret = memcpy(dst_buf + dof, src_buf + so, len);
+        ASSERT_EQ(static_cast<void*>(dst_buf + dof), ret, "memcpy return value");
+        if (!buffers_match(dst_buf, ref_buf, kBufLen)) {
+          printf("memcpy mismatch: src offset %zu dst offset %zu len %zu\n", so, dof, len);
+          ASSERT_TRUE(false, "memcpy result");
+        }
+      }
+    }
+  }
+
+  END_TEST;
+}
+
+bool memmove_test() {
+  BEGIN_TEST;
+
+  // move within one buffer in both directions, overlapping or not
+  constexpr size_t kBase = kMaxAlign;
+  for (size_t so = 0; so < kMaxAlign; so++) {
+    for (size_t dof = 0; dof < kMaxAlign; dof++) {
+      for (size_t len = 0; len <= kMaxLen; len++) {
+        fill_pattern(dst_buf, kBufLen, static_cast<uint32_t>(len + so));
+        ref_copy(ref_buf, dst_buf, kBufLen);
+        uint8_t tmp[kMaxLen];
+        ref_copy(tmp, dst_buf + kBase + so, len);
+        ref_copy(ref_buf + kBase + dof, tmp, len);
+
+        void* ret = memmove(dst_buf + kBase + dof, dst_buf + kBase + so, len);
+        ASSERT_EQ(static_cast<void*>(dst_buf + kBase + dof), ret, "memmove return value");
+        if (!buffers_match(dst_buf, ref_buf, kBufLen)) {
+          printf("memmove mismatch: src offset %zu dst offset %zu len %zu\n", so, dof, len);
+          ASSERT_TRUE(false, "memmove result");
+        }
+      }
+    }
+  }
+
+  END_TEST;
+}
+
+bool memset_test() {
+  BEGIN_TEST;
+
+  for (size_t dof = 0; dof < kMaxAlign; dof++) {
+    for (size_t len = 0; len <= kMaxLen; len++) {
+      // only the low byte of the value counts
+      int c = static_cast<int>(0x100 | (len * 7));
+      fill_pattern(dst_buf, kBufLen, static_cast<uint32_t>(len));
+      ref_copy(ref_buf, dst_buf, kBufLen);
+      for (size_t i = 0; i < len; i++) {
+        ref_buf[dof + i] = static_cast<uint8_t>(c);
+      }
+
+      void* ret = memset(dst_buf + dof, c, len);
+      ASSERT_EQ(static_cast<void*>(dst_buf + dof), ret, "memset return value");
+      if (!buffers_match(dst_buf, ref_buf, kBufLen)) {
+        printf("memset mismatch: offset %zu len %zu\n", dof, len);
+        ASSERT_TRUE(false, "memset result");
+      }
+    }
+  }
+
+  END_TEST;
+}
+
+bool memcmp_test() {
+  BEGIN_TEST;
+
+  fill_pattern(src_buf, kBufLen, 2);
+  for (size_t so = 0; so < kMaxAlign; so++) {
+    for (size_t dof = 0; dof < kMaxAlign; dof++) {
+      for (size_t len = 0; len <= kMaxLen; len++) {
+        ref_copy(dst_buf + dof, src_buf + so, len);
+        ASSERT_EQ(0, memcmp(src_buf + so, dst_buf + dof, len), "equal buffers");
+        if (len == 0) {
+          continue;
+        }
+
+        // a difference anywhere, including in the high bit, must order
+        // the buffers as unsigned bytes
+        size_t pos = (so * 31 + dof * 7 + len / 2) % len;
+        uint8_t saved = dst_buf[dof + pos];
+        dst_buf[dof + pos] = static_cast<uint8_t>(src_buf[so + pos] ^ 0x80);
+        int expected = src_buf[so + pos] < dst_buf[dof + pos] ? -1 : 1;
+        int ret = memcmp(src_buf + so, dst_buf + dof, len);
+        if ((ret < 0 ? -1 : (ret > 0 ? 1 : 0)) != expected) {
+          printf("memcmp mismatch: src offset %zu dst offset %zu len %zu pos %zu\n", so, dof, len,
+                 pos);
+          ASSERT_TRUE(false, "memcmp ordering");
+        }
+        dst_buf[dof + pos] = saved;
+      }
+    }
+  }
+
+  END_TEST;
+}
+
+bool strlen_test() {
+  BEGIN_TEST;
+
+  for (size_t so = 0; so < kMaxAlign; so++) {
+    for (size_t len = 0; len <= kMaxLen; len++) {
+      // no zero bytes, but plenty with the high bit set
+      for (size_t i = 0; i < kBufLen; i++) {
+        src_buf[i] = static_cast<uint8_t>(0x80 | ((i * 13) & 0x7f)) | 1;
+      }
+      src_buf[so + len] = 0;
+      ASSERT_EQ(len, strlen(reinterpret_cast<const char*>(src_buf + so)), "strlen result");
+    }
+  }
+
+  END_TEST;
+}
+
+BEGIN_TEST_CASE(string_tests)
+RUN_TEST(memcpy_test)
+RUN_TEST(memmove_test)
+RUN_TEST(memset_test)
+RUN_TEST(memcmp_test)
+RUN_TEST(strlen_test)
+END_TEST_CASE(string_tests)
+
+#if WITH_LIB_CONSOLE
+
+// Throughput of the string routines per size bucket. Every bucket moves the
+// same total number of bytes so the small sizes measure call and setup
+// overhead and the large ones the memory system.
+constexpr size_t kBenchBufLen = 1024 * 1024;
+constexpr uint64_t kBenchTotalBytes = 64 * 1024 * 1024;
+constexpr size_t kBenchSizes[] = {16, 64, 256, 1024, 4096, 16384, 65536, 262144, 1048576};
+
+enum class BenchOp { kMemcpy, kMemset, kMemcmp, kStrlen };
+
+void print_rate(size_t size, uint64_t bytes, lk_bigtime_t usecs) {
+  if (usecs == 0) {
+    usecs = 1;
+  }
+  // bytes per usec is MB/s, so hundredths of a GB/s is bytes / usecs / 10
+  uint64_t centi_gbs = bytes / usecs / 10;
+  printf("\t%8zu bytes: %4" PRIu64 ".%02" PRIu64 " GB/s\n", size, centi_gbs / 100, centi_gbs % 100);
+}
+
+void bench_op(const char* name, BenchOp op, uint8_t* a, uint8_t* b) {
+  printf("%s:\n", name);
+  for (size_t size : kBenchSizes) {
+    uint64_t iters = kBenchTotalBytes / size;
+
+    if (op == BenchOp::kStrlen) {
+      memset(a, 'a', size);
+      a[size - 1] = 0;
+    } else if (op == BenchOp::kMemcmp) {
+      memset(a, 'a', size);
+      memset(b, 'a', size);
+    }
+
+    volatile size_t sink = 0;
+    lk_bigtime_t start = current_time_hires();
+    for (uint64_t i = 0; i < iters; i++) {
+      switch (op) {
+        case BenchOp::kMemcpy:
+          memcpy(b, a, size);
+          break;
+        case BenchOp::kMemset:
+          memset(b, static_cast<int>(i), size);
+          break;
+        case BenchOp::kMemcmp:
+          sink = sink + memcmp(a, b, size);
+          break;
+        case BenchOp::kStrlen:
+          sink = sink + strlen(reinterpret_cast<const char*>(a));
+          break;
+      }
+    }
+    print_rate(size, iters * size, current_time_hires() - start);
+  }
+}
+
+int cmd_string_bench(int argc, const console_cmd_args* argv) {
+  auto* a = static_cast<uint8_t*>(memalign(CACHE_LINE, kBenchBufLen));
+  auto* b = static_cast<uint8_t*>(memalign(CACHE_LINE, kBenchBufLen));
+  if (!a || !b) {
+    printf("failed to allocate buffers\n");
+    free(a);
+    free(b);
+    return ERR_NO_MEMORY;
+  }
+  memset(a, 0x55, kBenchBufLen);
+
+  bench_op("memcpy", BenchOp::kMemcpy, a, b);
+  bench_op("memset", BenchOp::kMemset, a, b);
+  bench_op("memcmp", BenchOp::kMemcmp, a, b);
+  bench_op("strlen", BenchOp::kStrlen, a, b);
+
+  free(a);
+  free(b);
+  return 0;
+}
+
+#endif  // WITH_LIB_CONSOLE
+
+}  // namespace
+
+#if WITH_LIB_CONSOLE
+STATIC_COMMAND_START
+STATIC_COMMAND("string_bench", "libc string routine throughput", &cmd_string_bench)
+STATIC_COMMAND_END(string_bench);
+#endif
@@ -8,23 +8,101 @@
 
 #include "minip-internal.h"
 
-uint16_t ones_sum16(uint32_t sum, const void *_buf, int len) {
-    const uint16_t *buf = _buf;
+/*
+ * The ones complement sum does not care about word size or byte order: since
+ * 2^16 == 1 modulo 0xffff, adding native 32 bit words into a 64 bit
+ * accumulator and folding at the end gives the same result as adding native
+ * 16 bit words with an end around carry after each one. That lets the inner
+ * loops go four bytes at a time with no carry handling at all; the 64 bit
+ * accumulator cannot overflow for any buffer that fits in an int.
+ *
+ * Loads and stores go through __builtin_memcpy so that buffers at any
+ * alignment work on cpus that fault on unaligned accesses, while the ones that
+ * do not still get plain word loads.
+ */
+
+static inline uint32_t load32(const uint8_t *p) {
+    uint32_t v;
+    __builtin_memcpy(&v, p, sizeof(v));
+    return v;
+}
 
-    while (len >= 2) {
-        sum += *buf++;
-        if (sum & 0x80000000)
-            sum = (sum & 0xffff) + (sum >> 16);
+static inline uint16_t fold64(uint64_t sum) {
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return sum;
+}
+
+/* the last len (< 4) bytes, summed the way a 16 bit loop would */
+static inline uint64_t sum_tail(uint64_t sum, const uint8_t *buf, int len) {
+    if (len >= 2) {
+        uint16_t v;
+        __builtin_memcpy(&v, buf, sizeof(v));
+        sum += v;
+        buf += 2;
         len -= 2;
     }
-
     if (len) {
-        uint16_t temp = htons((*(uint8_t *)buf) << 8);
-        sum += temp;
+        /* the odd byte is the first half of a zero padded word */
+        uint16_t v = 0;
+        __builtin_memcpy(&v, buf, 1);
+        sum += v;
+    }
+    return sum;
+}
+
+uint16_t ones_sum16(uint32_t sum, const void *_buf, int len) {
+    const uint8_t *buf = _buf;
+    uint64_t sum0 = sum, sum1 = 0;
+
+    /* two accumulators so consecutive adds do not wait on each other */
+    while (len >= 16) {
+        sum0 += load32(buf);
+        sum1 += load32(buf + 4);
+        sum0 += load32(buf + 8);
+        sum1 += load32(buf + 12);
+        buf += 16;
+        len -= 16;
+    }
+    while (len >= 4) {
+        sum0 += load32(buf);
+        buf += 4;
+        len -= 4;
+    }
+
+    return fold64(sum_tail(sum0 + sum1, buf, len));
+}
+
+uint16_t ones_sum16_copy(uint32_t sum, void *_dst, const void *_src, int len) {
+    uint8_t *dst = _dst;
+    const uint8_t *src = _src;
+    uint64_t sum0 = sum, sum1 = 0;
+
+    while (len >= 8) {
+        uint32_t a = load32(src);
+        uint32_t b = load32(src + 4);
+        __builtin_memcpy(dst, &a, sizeof(a));
+        __builtin_memcpy(dst + 4, &b, sizeof(b));
+        sum0 += a;
+        sum1 += b;
+        src += 8;
+        dst += 8;
+        len -= 8;
+    }
+    if (len >= 4) {
+        uint32_t a = load32(src);
+        __builtin_memcpy(dst, &a, sizeof(a));
+        sum0 += a;
+        src += 4;
+        dst += 4;
+        len -= 4;
     }
 
-    while (sum >> 16)
-        sum = (sum & 0xffff) + (sum >> 16);
+    for (int i = 0; i < len; i++)
+        dst[i] = src[i];
 
-    return sum;
+    return fold64(sum_tail(sum0 + sum1, src, len));
 }
@@ -67,11 +67,37 @@ typedef struct tcp_socket tcp_socket_t;
 
 status_t tcp_connect(tcp_socket_t **handle, uint32_t addr, uint16_t port);
 status_t tcp_open_listen(tcp_socket_t **handle, uint16_t port);
+
+/* Variants that size the socket's receive and transmit buffers, or those of
+ * the sockets a listening socket accepts. 0 picks the default; other sizes
+ * are rounded up to a power of 2. The receive buffer is the largest window
+ * the socket will advertise, using window scaling past 64KB. */
+status_t tcp_connect_etc(tcp_socket_t **handle, uint32_t addr, uint16_t port,
+                         size_t rx_buffer_size, size_t tx_buffer_size);
+status_t tcp_open_listen_etc(tcp_socket_t **handle, uint16_t port,
+                             size_t rx_buffer_size, size_t tx_buffer_size);
 status_t tcp_accept_timeout(tcp_socket_t *listen_socket, tcp_socket_t **accept_socket, lk_time_t timeout);
 status_t tcp_close(tcp_socket_t *socket);
 ssize_t tcp_read(tcp_socket_t *socket, void *buf, size_t len);
 ssize_t tcp_write(tcp_socket_t *socket, const void *buf, size_t len);
 
+/* Zero copy receive. Waits for data and hands all of it over as a chain of
+ * pktbufs, which the caller frees with pktbuf_free(). Returns the number of
+ * bytes in the chain. From the first call on, the socket keeps the packets it
+ * receives rather than copying them into its receive buffer, holding on to at
+ * most a few dozen pool buffers between reads. tcp_read() still works. */
+ssize_t tcp_read_pktbuf(tcp_socket_t *socket, pktbuf_t **p);
+
+/* Zero copy send. Queues the memory described by iov to be sent as is, after
+ * anything already written. The memory must stay untouched until cb is called
+ * with NO_ERROR once the other end has acked all of it and no packet points
+ * into it any more, or with an error if the connection went away first. cb is
+ * called from a dpc thread and may be NULL. Plain tcp_write() calls wait for
+ * queued zero copy writes to finish. */
+typedef void (*tcp_write_callback_t)(void *arg, status_t status);
+status_t tcp_write_zerocopy(tcp_socket_t *socket, const iovec_t *iov, uint iov_count,
+                            tcp_write_callback_t cb, void *arg);
+
 static inline status_t tcp_accept(tcp_socket_t *listen_socket, tcp_socket_t **accept_socket) {
     return tcp_accept_timeout(listen_socket, accept_socket, INFINITE_TIME);
 }
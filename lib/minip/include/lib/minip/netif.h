@@ -8,6 +8,8 @@
 #pragma once
 
 #include <lk/compiler.h>
+#include <lk/list.h>
+#include <kernel/event.h>
 #include <lib/minip.h>
 
 __BEGIN_CDECLS
@@ -33,6 +35,14 @@ struct netif {
     tx_func_t tx_func;
     void *tx_func_arg;
 
+    // transmit offloads the driver handles, NETIF_OFFLOAD_*
+    uint32_t offloads;
+    // largest tcp payload the driver accepts in one segmentation offload packet
+    uint32_t gso_max_size;
+
+    // receive pollers the driver started, see netif_poll_start
+    struct list_node pollers;
+
     // name
     char name[32];
 };
@@ -44,14 +54,70 @@ typedef struct netif netif_t;
 #define NETIF_FLAG_REGISTERED      (1U << 2) // added to the main list
 #define NETIF_FLAG_IPV4_CONFIGURED (1U << 3) // ipv4 address is set
 
+#define NETIF_OFFLOAD_TX_CSUM      (1U << 0) // fills in PKTBUF_FLAG_CSUM_PARTIAL checksums
+#define NETIF_OFFLOAD_TSO4         (1U << 1) // segments PKTBUF_FLAG_GSO_TCPV4 packets, needs TX_CSUM
+#define NETIF_OFFLOAD_SG           (1U << 2) // sends packets chained from buffers anywhere in memory
+
 // Initialize a netif struct.
 // Allocates a new one if passed in pointer is null.
 netif_t *netif_create(netif_t *n, const char *name);
 
 status_t netif_set_eth(netif_t *n, tx_func_t tx_handler, void *tx_arg, const uint8_t *macaddr);
+status_t netif_set_offloads(netif_t *n, uint32_t offloads, uint32_t gso_max_size);
 status_t netif_set_ipv4_addr(netif_t *n, ipv4_addr_t addr, uint8_t subnet_width);
 status_t netif_register(netif_t *n);
 
+// Interrupt/poll hybrid receive.
+//
+// Rather than taking an interrupt per packet, a driver's rx interrupt masks
+// itself and calls netif_poll_schedule(). The poller's thread then calls the
+// driver's poll routine, which hands up to budget packets to the stack and
+// returns how many it did. A pass that uses up the budget is followed by
+// another once other threads have had a turn. A pass that comes in under
+// budget means the ring is empty, so the thread calls the driver's done
+// routine to unmask the interrupt again. Done returns true if packets showed
+// up that the interrupt won't report, and polling carries on.
+//
+// A driver with several receive queues starts a poller per queue.
+typedef int (*netif_poll_func_t)(void *arg, int budget);
+typedef bool (*netif_poll_done_func_t)(void *arg);
+
+#ifndef NETIF_POLL_BUDGET
+#define NETIF_POLL_BUDGET 64
+#endif
+
+typedef struct netif_poll {
+    struct list_node node;
+    netif_t *netif;
+
+    netif_poll_func_t poll;
+    netif_poll_done_func_t done;
+    void *arg;
+    int budget;
+
+    // cpu the thread runs on, or -1 to let it float
+    int cpu;
+
+    event_t event;
+    char name[32];
+
+    // counters
+    uint64_t irqs;       // netif_poll_schedule calls
+    uint64_t polls;      // passes through the poll routine
+    uint64_t packets;    // packets the poll routine handled
+    uint64_t full_polls; // passes that used up the budget
+} netif_poll_t;
+
+// Start a poller for an interface created with netif_create. A budget of 0
+// picks NETIF_POLL_BUDGET.
+status_t netif_poll_start(netif_poll_t *np, netif_t *n, const char *name,
+                          netif_poll_func_t poll, netif_poll_done_func_t done, void *arg,
+                          int budget, int cpu);
+
+// Wake the poller. Safe to call from interrupt context, which should return
+// INT_RESCHEDULE.
+void netif_poll_schedule(netif_poll_t *np);
+
 // construct netmask and broadcast addresses dynamically
 
 static inline ipv4_addr_t netif_get_netmask_ipv4(netif_t *n) {
@@ -46,6 +46,14 @@ typedef struct pktbuf {
     pktbuf_free_callback cb;
     void *cb_args;
     u8 *buffer;
+
+    /* next buffer of a multi part packet, the last one has PKTBUF_FLAG_EOF set */
+    struct pktbuf *next;
+
+    /* transmit offload requests, valid on the first pktbuf of a packet */
+    u16 csum_start;     // offset from buffer of where the nic starts summing
+    u16 csum_offset;    // where it stores the sum, relative to csum_start
+    u16 gso_size;       // payload bytes per segment for PKTBUF_FLAG_GSO_TCPV4
 } pktbuf_t;
 
 typedef struct pktbuf_pool_object {
@@ -60,6 +68,8 @@ typedef struct pktbuf_pool_object {
 #define PKTBUF_FLAG_CKSUM_UDP_GOOD (1<<2)
 #define PKTBUF_FLAG_EOF            (1<<3)
 #define PKTBUF_FLAG_CACHED         (1<<4)
+#define PKTBUF_FLAG_CSUM_PARTIAL   (1<<5) // nic fills in the checksum, see csum_start
+#define PKTBUF_FLAG_GSO_TCPV4      (1<<6) // nic splits the packet into gso_size tcp segments
 
 /* Return the physical address offset of data in the packet */
 static inline paddr_t pktbuf_data_phys(pktbuf_t *p) {
@@ -76,6 +86,15 @@ static inline u32 pktbuf_avail_tail(pktbuf_t *p) {
     return p->blen - (p->data - p->buffer) - p->dlen;
 }
 
+// total number of data bytes in a packet and the buffers chained to it
+static inline u32 pktbuf_chain_len(const pktbuf_t *p) {
+    u32 len = 0;
+    for (; p; p = p->next) {
+        len += p->dlen;
+    }
+    return len;
+}
+
 // allocate packet buffer from buffer pool
 pktbuf_t *pktbuf_alloc(void);
 pktbuf_t *pktbuf_alloc_empty(void);
@@ -84,10 +103,23 @@ pktbuf_t *pktbuf_alloc_empty(void);
 void pktbuf_add_buffer(pktbuf_t *p, u8 *buf, u32 len, uint32_t header_sz,
                        uint32_t flags, pktbuf_free_callback cb, void *cb_args);
 
-// return packet buffer to buffer pool
+// add frag to the end of the chain of buffers that make up packet p
+void pktbuf_chain(pktbuf_t *p, pktbuf_t *frag);
+
+// shorten a multi part packet to len bytes of data
+void pktbuf_chain_trim(pktbuf_t *p, size_t len);
+
+// return packet buffer and any buffers chained to it to buffer pool
 // returns number of threads woken up
 int pktbuf_free(pktbuf_t *p, bool reschedule);
 
+// Take the data of packet p, and any buffers chained to it, for keeping past
+// the rx callback. p is left with empty buffers of the same size and header
+// room so the driver that owns it can recycle it as usual. Pool buffers change
+// hands without a copy, other buffers are copied. Returns NULL rather than
+// waiting if the pool is exhausted.
+pktbuf_t *pktbuf_detach(pktbuf_t *p);
+
 // extend buffer by sz bytes, copied from data
 void pktbuf_append_data(pktbuf_t *p, const void *data, size_t sz);
 
@@ -104,7 +104,39 @@ const uint8_t *arp_get_dest_mac(uint32_t host);
 int handle_arp_pkt(netif_t *netif, pktbuf_t *p);
 
 // checksums
+//
+// ones_sum16() returns the folded, uncomplemented ones complement sum of buf
+// added to sum. ones_sum16_copy() does the same while copying src to dst, for
+// paths that touch the payload anyway.
 uint16_t ones_sum16(uint32_t sum, const void *_buf, int len);
+uint16_t ones_sum16_copy(uint32_t sum, void *dst, const void *src, int len);
+
+// Fold the sum of a piece of a larger buffer into the running sum of the
+// whole. A piece that starts at an odd offset had its bytes summed in the
+// other halves of each word, which a byte swap of its sum undoes.
+static inline uint16_t ones_sum16_add(uint16_t sum, uint16_t piece_sum, size_t piece_offset) {
+    uint32_t piece = piece_sum;
+    if (piece_offset & 1)
+        piece = ((piece & 0xff) << 8) | (piece >> 8);
+    uint32_t total = (uint32_t)sum + piece;
+    return (total & 0xffff) + (total >> 16);
+}
+
+// Incrementally update a stored (complemented) checksum after one 16 bit word
+// it covers changed from old_word to new_word, per RFC 1624 equation 3:
+// HC' = ~(~HC + ~m + m'). Both words are as they sit in the packet.
+static inline uint16_t cksum_update16(uint16_t cksum, uint16_t old_word, uint16_t new_word) {
+    uint32_t sum = (uint16_t)~cksum + (uint16_t)~old_word + new_word;
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return ~sum;
+}
+
+// same for a 32 bit field, such as an address in the pseudo header
+static inline uint16_t cksum_update32(uint16_t cksum, uint32_t old_word, uint32_t new_word) {
+    cksum = cksum_update16(cksum, old_word >> 16, new_word >> 16);
+    return cksum_update16(cksum, old_word & 0xffff, new_word & 0xffff);
+}
 
 typedef struct ipv4_pseudo_header {
     ipv4_addr_t source_addr;
@@ -144,6 +176,7 @@ void minip_build_mac_hdr(netif_t *netif, struct eth_hdr *pkt, const uint8_t *dst
 status_t minip_ipv4_send(pktbuf_t *p, ipv4_addr_t dest_addr, uint8_t proto);
 status_t minip_ipv4_send_raw(pktbuf_t *p, ipv4_addr_t dest_addr, uint8_t proto, const uint8_t *dest_mac, netif_t *netif);
 
+void tcp_init(void);
 void tcp_input(netif_t *netif, pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip);
 void udp_input(netif_t *netif, pktbuf_t *p, uint32_t src_ip);
 
@@ -278,7 +278,7 @@ status_t minip_ipv4_send_raw(pktbuf_t *p, ipv4_addr_t dest_addr, uint8_t proto,
     DEBUG_ASSERT(p);
     DEBUG_ASSERT(netif);
 
-    size_t data_len = p->dlen;
+    size_t data_len = pktbuf_chain_len(p);
 
     struct ipv4_hdr *ip = pktbuf_prepend(p, sizeof(struct ipv4_hdr));
     struct eth_hdr *eth = pktbuf_prepend(p, sizeof(struct eth_hdr));
@@ -305,8 +305,14 @@ status_t minip_ipv4_send(pktbuf_t *p, ipv4_addr_t dest_addr, uint8_t proto) {
     DEBUG_ASSERT(route->interface);
     netif_t *netif = route->interface;
 
-    // are we sending a broadcast packet?
+    // loopback packets never leave the machine, so there is nothing to arp for
     const uint8_t *dest_mac;
+    if (netif_is_loopback(netif)) {
+        dest_mac = netif->mac_address;
+        goto ready;
+    }
+
+    // are we sending a broadcast packet?
     if (dest_addr == IPV4_BCAST || dest_addr == netif_get_broadcast_ipv4(netif)) {
         dest_mac = bcast_mac;
         goto ready;
@@ -360,7 +366,14 @@ static void send_ping_reply(netif_t *netif, uint32_t ipaddr, struct icmp_pkt *re
     icmp = pktbuf_prepend(p, sizeof(struct icmp_pkt));
     ip = pktbuf_prepend(p, sizeof(struct ipv4_hdr));
     eth = pktbuf_prepend(p, sizeof(struct eth_hdr));
-    pktbuf_append_data(p, req->data, reqdatalen);
+
+    /* validate the request while copying its payload; it must sum to all ones */
+    uint16_t sum = ones_sum16_copy(0, pktbuf_append(p, reqdatalen), req->data, reqdatalen);
+    if (ones_sum16(sum, req, sizeof(struct icmp_pkt)) != 0xffff) {
+        LTRACEF("REJECT: bad icmp checksum\n");
+        pktbuf_free(p, true);
+        return;
+    }
 
     len = sizeof(struct icmp_pkt) + reqdatalen;
 
@@ -370,8 +383,13 @@ static void send_ping_reply(netif_t *netif, uint32_t ipaddr, struct icmp_pkt *re
     icmp->type = ICMP_ECHO_REPLY;
     icmp->code = 0;
     memcpy(icmp->hdr_data, req->hdr_data, sizeof(icmp->hdr_data));
-    icmp->chksum = 0;
-    icmp->chksum = ~ones_sum16(0, (uint8_t *) icmp, len);
+
+    /* the reply only differs from the request in the type and code, so
+     * patch the request's checksum rather than summing it all again */
+    uint16_t old_word, new_word;
+    memcpy(&old_word, &req->type, sizeof(old_word));
+    memcpy(&new_word, &icmp->type, sizeof(new_word));
+    icmp->chksum = cksum_update16(req->chksum, old_word, new_word);
 
     netif->tx_func(netif->tx_func_arg, p);
 }
@@ -421,14 +439,21 @@ __NO_INLINE static void handle_ipv4_packet(netif_t *netif, pktbuf_t *p, const ui
     }
 
     /* is the pkt_buf large enough to hold the length the header says the packet is? */
-    if (htons(ip->len) > p->dlen) {
-        LTRACEF("REJECT: packet exceeds size of buffer (header %d, dlen %d)\n", htons(ip->len), p->dlen);
+    size_t len = pktbuf_chain_len(p);
+    if (htons(ip->len) > len) {
+        LTRACEF("REJECT: packet exceeds size of buffer (header %d, len %zu)\n", htons(ip->len), len);
         return;
     }
 
     /* trim any excess bytes at the end of the packet */
-    if (p->dlen > htons(ip->len)) {
-        pktbuf_consume_tail(p, p->dlen - htons(ip->len));
+    if (len > htons(ip->len)) {
+        pktbuf_chain_trim(p, htons(ip->len));
+    }
+
+    /* only large receive offload packets from the nic span several buffers */
+    if (p->next && ip->proto != IP_PROTO_TCP) {
+        LTRACEF("REJECT: multi part non tcp packet\n");
+        return;
     }
 
     /* remove the header from the front of the packet_buf  */
@@ -558,6 +583,7 @@ static void minip_init(uint level) {
     arp_cache_init();
     net_timer_init();
     netif_init();
+    tcp_init();
 }
 
 LK_INIT_HOOK(minip, minip_init, LK_INIT_LEVEL_THREADING);
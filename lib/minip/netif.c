@@ -15,7 +15,12 @@
 #include <lib/minip.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <inttypes.h>
+#include <kernel/event.h>
+#include <kernel/mp.h>
 #include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
 
 #include "minip-internal.h"
 
@@ -25,8 +30,40 @@ static struct list_node netif_list = LIST_INITIAL_VALUE(netif_list);
 static mutex_t lock = MUTEX_INITIAL_VALUE(lock);
 static netif_t loopback;
 
+/* Packets sent to the loopback interface are queued and handed back to the
+ * stack from a thread of their own, since the sender usually still holds the
+ * socket lock the receive path is about to want. */
+static struct list_node loopback_queue = LIST_INITIAL_VALUE(loopback_queue);
+static spin_lock_t loopback_queue_lock = SPIN_LOCK_INITIAL_VALUE;
+static event_t loopback_event = EVENT_INITIAL_VALUE(loopback_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+
 static int loopback_tx_func(void *arg, pktbuf_t *p) {
     LTRACEF("arg %p, pkt %p\n", arg, p);
+
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&loopback_queue_lock);
+    list_add_tail(&loopback_queue, &p->list);
+    spin_unlock_irqrestore(&loopback_queue_lock, state);
+
+    event_signal(&loopback_event, true);
+    return 0;
+}
+
+static int loopback_rx_thread(void *arg) {
+    for (;;) {
+        event_wait(&loopback_event);
+
+        for (;;) {
+            arch_interrupt_saved_state_t state = spin_lock_irqsave(&loopback_queue_lock);
+            pktbuf_t *p = list_remove_head_type(&loopback_queue, pktbuf_t, list);
+            spin_unlock_irqrestore(&loopback_queue_lock, state);
+            if (!p)
+                break;
+
+            minip_rx_driver_callback(&loopback, p);
+            pktbuf_free(p, true);
+        }
+    }
+
     return 0;
 }
 
@@ -39,6 +76,9 @@ void netif_init(void) {
     netif_set_eth(&loopback, loopback_tx_func, NULL, bcast_mac);
     netif_set_ipv4_addr(&loopback, IPV4(127, 0, 0, 1), 8);
     netif_register(&loopback);
+
+    thread_detach_and_resume(thread_create("loopback rx", &loopback_rx_thread, NULL,
+                                           DEFAULT_PRIORITY, DEFAULT_STACK_SIZE));
 }
 
 netif_t *netif_create(netif_t *n, const char *name) {
@@ -54,11 +94,82 @@ netif_t *netif_create(netif_t *n, const char *name) {
     memset(n, 0, sizeof(*n));
 
     n->magic = NETIF_MAGIC;
+    list_initialize(&n->pollers);
     strlcpy(n->name, name, sizeof(n->name));
 
     return n;
 }
 
+static int netif_poll_thread(void *arg) {
+    netif_poll_t *np = arg;
+
+    for (;;) {
+        // secondary cpus may come up after the driver does, so move to the
+        // poller's cpu once it's running. It takes effect the next time this
+        // thread blocks.
+        if (np->cpu >= 0 && thread_pinned_cpu(get_current_thread()) < 0 &&
+                mp_is_cpu_active(np->cpu)) {
+            thread_set_pinned_cpu(get_current_thread(), np->cpu);
+        }
+
+        event_wait(&np->event);
+
+        for (;;) {
+            int count = np->poll(np->arg, np->budget);
+            np->polls++;
+            np->packets += count;
+
+            if (count >= np->budget) {
+                // more are likely waiting, let other threads run first
+                np->full_polls++;
+                thread_yield();
+                continue;
+            }
+
+            if (!np->done(np->arg))
+                break;
+        }
+    }
+
+    return 0;
+}
+
+status_t netif_poll_start(netif_poll_t *np, netif_t *n, const char *name,
+                          netif_poll_func_t poll, netif_poll_done_func_t done, void *arg,
+                          int budget, int cpu) {
+    LTRACEF("np %p, n %p, name '%s'\n", np, n, name);
+
+    DEBUG_ASSERT(n->magic == NETIF_MAGIC);
+    DEBUG_ASSERT(poll && done);
+
+    memset(np, 0, sizeof(*np));
+    np->netif = n;
+    np->poll = poll;
+    np->done = done;
+    np->arg = arg;
+    np->budget = (budget > 0) ? budget : NETIF_POLL_BUDGET;
+    np->cpu = cpu;
+    event_init(&np->event, false, EVENT_FLAG_AUTOUNSIGNAL);
+    strlcpy(np->name, name, sizeof(np->name));
+
+    thread_t *t = thread_create(np->name, &netif_poll_thread, np, HIGH_PRIORITY, DEFAULT_STACK_SIZE);
+    if (!t)
+        return ERR_NO_MEMORY;
+
+    mutex_acquire(&lock);
+    list_add_tail(&n->pollers, &np->node);
+    mutex_release(&lock);
+
+    thread_detach_and_resume(t);
+
+    return NO_ERROR;
+}
+
+void netif_poll_schedule(netif_poll_t *np) {
+    np->irqs++;
+    event_signal(&np->event, false);
+}
+
 // generic logic to decide what to do when a netif comes up
 // TODO: make this overridable
 void netif_registration_callback(netif_t *n) {
@@ -110,6 +221,23 @@ status_t netif_set_eth(netif_t *n, tx_func_t tx_handler, void *tx_arg, const uin
     return NO_ERROR;
 }
 
+status_t netif_set_offloads(netif_t *n, uint32_t offloads, uint32_t gso_max_size) {
+    DEBUG_ASSERT(n->magic == NETIF_MAGIC);
+
+    // segmentation offload implies the nic sums each segment
+    if ((offloads & NETIF_OFFLOAD_TSO4) && !(offloads & NETIF_OFFLOAD_TX_CSUM))
+        return ERR_INVALID_ARGS;
+
+    mutex_acquire(&lock);
+
+    n->offloads = offloads;
+    n->gso_max_size = (offloads & NETIF_OFFLOAD_TSO4) ? gso_max_size : 0;
+
+    mutex_release(&lock);
+
+    return NO_ERROR;
+}
+
 status_t netif_set_ipv4_addr(netif_t *n, ipv4_addr_t addr, uint8_t subnet_width) {
     DEBUG_ASSERT(n->magic == NETIF_MAGIC);
 
@@ -141,7 +269,23 @@ void netif_dump(void) {
         print_ipv4_address(netif_get_netmask_ipv4(n));
         printf(" bcast ");
         print_ipv4_address(netif_get_broadcast_ipv4(n));
+        if (n->offloads & NETIF_OFFLOAD_TX_CSUM)
+            printf(" tx-csum");
+        if (n->offloads & NETIF_OFFLOAD_TSO4)
+            printf(" tso4 (max %u)", n->gso_max_size);
+        if (n->offloads & NETIF_OFFLOAD_SG)
+            printf(" sg");
         printf("\n");
+
+        netif_poll_t *np;
+        list_for_every_entry(&n->pollers, np, netif_poll_t, node) {
+            // hundredths of a packet per poll
+            uint64_t per_poll = np->polls ? np->packets * 100 / np->polls : 0;
+            printf("\tpoller '%s': irqs %" PRIu64 " polls %" PRIu64 " packets %" PRIu64
+                   " (%" PRIu64 ".%02" PRIu64 " per poll, budget %d) full %" PRIu64 "\n",
+                   np->name, np->irqs, np->polls, np->packets, per_poll / 100, per_poll % 100,
+                   np->budget, np->full_polls);
+        }
     }
 
     mutex_release(&lock);
@@ -9,6 +9,7 @@
 
 #include <assert.h>
 #include <lk/debug.h>
+#include <lk/err.h>
 #include <lk/trace.h>
 #include <malloc.h>
 #include <printf.h>
@@ -67,6 +68,18 @@ static void *get_pool_object(void) {
     return (pktbuf_pool_object_t *)entry;
 }
 
+/* Like get_pool_object(), but fails rather than waiting if the pool is empty. */
+static void *try_get_pool_object(void) {
+    if (sem_trywait(&pktbuf_sem) != NO_ERROR) {
+        return NULL;
+    }
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&lock);
+    pool_t *entry = pool_alloc(&pktbuf_pool);
+    spin_unlock_irqrestore(&lock, state);
+
+    return (pktbuf_pool_object_t *)entry;
+}
+
 /* Return an object to thje pktbuf object pool. */
 static void free_pool_object(pktbuf_pool_object_t *entry, bool reschedule) {
     DEBUG_ASSERT(entry);
@@ -149,19 +162,126 @@ void pktbuf_reset(pktbuf_t *p, uint32_t header_sz) {
 pktbuf_t *pktbuf_alloc_empty(void) {
     pktbuf_t *p = (pktbuf_t *)get_pool_object();
 
+    memset(p, 0, sizeof(pktbuf_t));
     p->flags = PKTBUF_FLAG_EOF;
     return p;
 }
 
+void pktbuf_chain(pktbuf_t *p, pktbuf_t *frag) {
+    DEBUG_ASSERT(p);
+    DEBUG_ASSERT(frag);
+    DEBUG_ASSERT(frag->next == NULL);
+
+    while (p->next) {
+        p = p->next;
+    }
+
+    p->flags &= ~PKTBUF_FLAG_EOF;
+    p->next = frag;
+    frag->flags |= PKTBUF_FLAG_EOF;
+}
+
+void pktbuf_chain_trim(pktbuf_t *p, size_t len) {
+    DEBUG_ASSERT(p);
+
+    for (; p; p = p->next) {
+        if (p->dlen >= len) {
+            p->dlen = len;
+            len = 0;
+        } else {
+            len -= p->dlen;
+        }
+    }
+}
+
 int pktbuf_free(pktbuf_t *p, bool reschedule) {
     DEBUG_ASSERT(p);
 
-    if (p->cb) {
-        p->cb(p->buffer, p->cb_args);
+    int count = 0;
+    while (p) {
+        pktbuf_t *next = p->next;
+
+        if (p->cb) {
+            p->cb(p->buffer, p->cb_args);
+        }
+        free_pool_object((pktbuf_pool_object_t *)p, reschedule);
+        count++;
+
+        p = next;
+    }
+
+    return count;
+}
+
+/* Move the data of one buffer of a packet into a new pktbuf. */
+static pktbuf_t *pktbuf_detach_one(pktbuf_t *p) {
+    pktbuf_t *q = try_get_pool_object();
+    if (!q) {
+        return NULL;
+    }
+    u8 *buf = try_get_pool_object();
+    if (!buf) {
+        free_pool_object((pktbuf_pool_object_t *)q, false);
+        return NULL;
+    }
+
+    memset(q, 0, sizeof(pktbuf_t));
+    u32 flags = p->flags & (PKTBUF_FLAG_CKSUM_IP_GOOD | PKTBUF_FLAG_CKSUM_TCP_GOOD |
+                            PKTBUF_FLAG_CKSUM_UDP_GOOD);
+
+    if (p->cb == free_pktbuf_buf_cb && p->blen == PKTBUF_SIZE) {
+        /* a pool buffer: give it to q and slip a fresh one of the same size
+         * and layout in behind the driver's back */
+        q->buffer = p->buffer;
+        q->blen = p->blen;
+        q->data = p->data;
+        q->dlen = p->dlen;
+        q->phys_base = p->phys_base;
+        q->flags = PKTBUF_FLAG_EOF | flags;
+        q->cb = free_pktbuf_buf_cb;
+
+        u32 header_sz = p->data - p->buffer;
+        u32 p_flags = p->flags;
+        pktbuf_t *next = p->next;
+        pktbuf_add_buffer(p, buf, PKTBUF_SIZE, header_sz, 0, free_pktbuf_buf_cb, NULL);
+        p->flags = p_flags;
+        p->next = next;
+    } else {
+        /* someone else's memory, it has to be copied */
+        if (p->dlen > PKTBUF_SIZE) {
+            free_pool_object((pktbuf_pool_object_t *)buf, false);
+            free_pool_object((pktbuf_pool_object_t *)q, false);
+            return NULL;
+        }
+        pktbuf_add_buffer(q, buf, PKTBUF_SIZE, 0, flags, free_pktbuf_buf_cb, NULL);
+        memcpy(q->data, p->data, p->dlen);
+        q->dlen = p->dlen;
+    }
+
+    return q;
+}
+
+pktbuf_t *pktbuf_detach(pktbuf_t *p) {
+    DEBUG_ASSERT(p);
+
+    pktbuf_t *head = NULL;
+    for (; p; p = p->next) {
+        pktbuf_t *q = pktbuf_detach_one(p);
+        if (!q) {
+            if (head) {
+                pktbuf_free(head, false);
+            }
+            return NULL;
+        }
+
+        if (head) {
+            pktbuf_chain(head, q);
+        } else {
+            head = q;
+        }
     }
-    free_pool_object((pktbuf_pool_object_t *)p, reschedule);
 
-    return 1;
+    return head;
 }
 
 void pktbuf_append_data(pktbuf_t *p, const void *data, size_t sz) {
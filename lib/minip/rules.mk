@@ -4,6 +4,7 @@ MODULE := $(LOCAL_DIR)
 
 MODULE_DEPS := \
 	lib/cbuf \
+	lib/dpc \
 	lib/iovec \
 	lib/libcpp \
 	lib/pool
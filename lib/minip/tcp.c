@@ -19,9 +19,13 @@
 #include <lib/cbuf.h>
 #include <kernel/mutex.h>
 #include <kernel/semaphore.h>
+#include <kernel/spinlock.h>
 #include <arch/ops.h>
 #include <platform.h>
 #include <arch/atomic.h>
+#include <lk/pow2.h>
+#include <lib/dpc.h>
+#include <arch/defines.h>
 
 #define LOCAL_TRACE 0
 
@@ -42,6 +46,51 @@ typedef struct tcp_mss_option {
     uint16_t mss;
 } __PACKED tcp_mss_option_t;
 
+#define TCP_OPTION_END 0
+#define TCP_OPTION_NOP 1
+#define TCP_OPTION_MSS 2
+#define TCP_OPTION_WSCALE 3
+#define TCP_OPTION_SACK_PERMITTED 4
+#define TCP_OPTION_SACK 5
+
+/* the options we put on a SYN: mss, sack permitted and window scale, each
+ * padded out to a word */
+#define TCP_SYN_OPTIONS_MAX 12
+
+/* largest window scale shift RFC 7323 allows */
+#define TCP_MAX_WSCALE 14
+
+/* 4 blocks is all that fits in the option space without timestamps */
+#define TCP_MAX_SACK_BLOCKS 4
+
+typedef struct tcp_sack_option {
+    uint8_t nop[2];
+    uint8_t kind; /* 0x5 */
+    uint8_t len;  /* 2 + 8 * number of blocks */
+    struct {
+        uint32_t left;  /* first sequence of the block */
+        uint32_t right; /* sequence just past the block */
+    } __PACKED blocks[TCP_MAX_SACK_BLOCKS];
+} __PACKED tcp_sack_option_t;
+
+/* what we care about in a received SYN's options */
+typedef struct tcp_options {
+    uint16_t mss;
+    bool sack_permitted;
+    bool wscale_ok;
+    uint8_t wscale;
+} tcp_options_t;
+
+typedef struct tcp_counters {
+    ulong ooo_segments;  // segments queued out of order
+    ulong ooo_bytes;
+    ulong ooo_drops;     // out of order segments that could not be queued
+    ulong dup_acks_sent;
+    ulong dup_acks_rcvd;
+    ulong fast_retransmits;
+    ulong timeouts;
+} tcp_counters_t;
+
 typedef enum tcp_state {
     STATE_CLOSED,
     STATE_LISTEN,
@@ -68,6 +117,10 @@ typedef enum tcp_flags {
 typedef struct tcp_socket {
     struct list_node node;
 
+    /* receive demux, see tcp_hash_bucket_t */
+    struct list_node hash_node;
+    struct tcp_hash_bucket *hash_bucket;
+
     mutex_t lock;
     volatile int ref;
 
@@ -83,21 +136,55 @@ typedef struct tcp_socket {
     /* rx */
     uint32_t rx_win_size;
     uint32_t rx_win_low;
-    uint32_t rx_win_high;
+    uint32_t rx_win_high;   // right edge we have advertised, one past the last byte we take
     uint8_t  *rx_buffer_raw;
     cbuf_t   rx_buffer;
     event_t  rx_event;
     int      rx_full_mss_count; // number of packets we have received in a row with a full mss
     net_timer_t ack_delay_timer;
 
+    /* rx segments past a hole, sorted by sequence and not overlapping */
+    struct list_node rx_ooo_list;
+    uint32_t rx_ooo_count;
+    uint32_t rx_ooo_last_seq; // start of the most recently queued segment
+    bool     sack_permitted;  // they take sack options from us
+    uint8_t  rx_wscale;       // shift of the windows we advertise
+
+    /* in order data kept as the packets it came in, see tcp_read_pktbuf().
+     * It always follows whatever is in rx_buffer. */
+    bool     rx_zero_copy;
+    struct list_node rx_pkt_list;
+    uint32_t rx_pkt_bytes;
+    uint32_t rx_pkt_count;    // pool buffers held, counting every buffer of a chain
+
     /* tx */
     uint32_t tx_win_low;  // low side of the acked window
     uint32_t tx_win_high; // tx_win_low + their advertised window size
-    uint32_t tx_highest_seq; // highest sequence we have txed them
+    uint32_t tx_highest_seq; // highest sequence we have txed them, pulled back to resend after a timeout
+    uint32_t tx_max_seq;  // highest sequence we have ever txed them
+    uint32_t tx_buffer_size;
     uint8_t  *tx_buffer_raw; // our outgoing buffer backing memory
     cbuf_t   tx_buffer;   // our outgoing circular buffer
+    struct list_node tx_req_list; // zero copy writes, sent after tx_buffer's data
+    uint32_t tx_req_bytes; // not yet acked in tx_req_list
     event_t  tx_event;
     net_timer_t retransmit_timer;
+    uint8_t  tx_wscale;   // shift of the windows they advertise
+
+    /* congestion control, NewReno per RFC 5681 and RFC 6582 */
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint32_t recover;     // tx_max_seq when the last fast recovery started
+    uint32_t dup_acks;    // in a row
+    bool     in_recovery;
+
+    /* retransmit timeout estimation per RFC 6298, one segment timed at a time */
+    lk_time_t rto;
+    uint32_t srtt;        // smoothed rtt in msecs, scaled by 8
+    uint32_t rttvar;      // rtt variation in msecs, scaled by 4
+    bool     rtt_timing;
+    uint32_t rtt_seq;     // ack that ends the timed segment
+    lk_time_t rtt_start;
 
     /* listen accept */
     semaphore_t accept_sem;
@@ -107,42 +194,128 @@ typedef struct tcp_socket {
 
     /* connect waiting */
     event_t connect_event;
+
+    tcp_counters_t counters;
 } tcp_socket_t;
 
+/* a received segment waiting for the hole in front of it to be filled */
+typedef struct tcp_ooo_segment {
+    struct list_node node;
+    uint32_t sequence;
+    uint32_t len;
+    uint32_t offset; // of the first byte still wanted in p
+    pktbuf_t *p;
+} tcp_ooo_segment_t;
+
+/* A zero copy write. The caller's memory is sent straight out of, so the
+ * write holds a ref for as long as it is queued on the socket plus one for
+ * every pktbuf pointing into it, and completes when the last one goes. */
+typedef struct tcp_tx_req {
+    struct list_node node;
+    volatile int ref;
+    status_t status;
+    size_t len;
+    size_t acked;
+    tcp_write_callback_t cb;
+    void *cb_arg;
+    dpc_t dpc;
+    uint iov_count;
+    iovec_t iov[];
+} tcp_tx_req_t;
+
 #define DEFAULT_MSS (1460)
+#ifndef DEFAULT_RX_WINDOW_SIZE
 #define DEFAULT_RX_WINDOW_SIZE (8192)
+#endif
+#ifndef DEFAULT_TX_BUFFER_SIZE
 #define DEFAULT_TX_BUFFER_SIZE (8192)
+#endif
+#define MAX_BUFFER_SIZE (4 * 1024 * 1024)
+
+/* pool buffers a zero copy receiver may pin between reads */
+#define MAX_RX_PKTBUFS (32)
+
+/* pieces of the transmit stream that go into one segment */
+#define TCP_TX_MAX_IOV (16)
 
-#define RETRANSMIT_TIMEOUT (250)
+#define INITIAL_RTO (1000)
+#define MIN_RTO (200)
+#define MAX_RTO (60000)
 #define DELAYED_ACK_TIMEOUT (50)
 #define TIME_WAIT_TIMEOUT (60000) // 1 minute
 
 #define FORCE_TCP_CHECKSUM (false)
 
+/* out of order segments pin pktbufs from the shared pool, so cap them */
+#define MAX_OOO_SEGMENTS (8)
+
 #define SEQUENCE_GTE(a, b) ((int32_t)((a) - (b)) >= 0)
 #define SEQUENCE_LTE(a, b) ((int32_t)((a) - (b)) <= 0)
 #define SEQUENCE_GT(a, b) ((int32_t)((a) - (b)) > 0)
 #define SEQUENCE_LT(a, b) ((int32_t)((a) - (b)) < 0)
 
+/* every socket, for the debug commands */
 static mutex_t tcp_socket_list_lock = MUTEX_INITIAL_VALUE(tcp_socket_list_lock);
 static struct list_node tcp_socket_list = LIST_INITIAL_VALUE(tcp_socket_list);
 
+/*
+ * Incoming segments find their socket through two hash tables, connected
+ * sockets by address and port 4-tuple and listening sockets by local port.
+ * Each bucket has its own spinlock, held just long enough to walk its chain
+ * and take a ref on the match, so receive paths only contend when they hit
+ * the same bucket.
+ */
+#ifndef TCP_CONN_HASH_BUCKETS
+#define TCP_CONN_HASH_BUCKETS (256) // power of 2
+#endif
+#define TCP_LISTEN_HASH_BUCKETS (16) // power of 2
+
+typedef struct tcp_hash_bucket {
+    spin_lock_t lock;
+    struct list_node list;
+} tcp_hash_bucket_t;
+
+typedef struct tcp_hash_table {
+    uint32_t mask;
+    tcp_hash_bucket_t *buckets;
+} tcp_hash_table_t;
+
+static tcp_hash_bucket_t tcp_conn_buckets[TCP_CONN_HASH_BUCKETS];
+static tcp_hash_bucket_t tcp_listen_buckets[TCP_LISTEN_HASH_BUCKETS];
+
+static tcp_hash_table_t tcp_conn_hash = { TCP_CONN_HASH_BUCKETS - 1, tcp_conn_buckets };
+static tcp_hash_table_t tcp_listen_hash = { TCP_LISTEN_HASH_BUCKETS - 1, tcp_listen_buckets };
+
 static bool tcp_debug = false;
 
+/* totals across all sockets */
+static tcp_counters_t tcp_counters;
+
+#define TCP_COUNT(s, counter, n) \
+    do { \
+        (s)->counters.counter += (n); \
+        __atomic_fetch_add(&tcp_counters.counter, (n), __ATOMIC_RELAXED); \
+    } while (0)
+
 /* local routines */
 static tcp_socket_t *lookup_socket(ipv4_addr_t remote_ip, ipv4_addr_t local_ip, uint16_t remote_port, uint16_t local_port);
-static void add_socket_to_list(tcp_socket_t *s);
+static status_t add_socket_to_list(tcp_socket_t *s);
 static void remove_socket_from_list(tcp_socket_t *s);
-static tcp_socket_t *create_tcp_socket(bool alloc_buffers);
+static tcp_socket_t *create_tcp_socket(bool alloc_buffers, size_t rx_buffer_size, size_t tx_buffer_size);
 static status_t tcp_send(ipv4_addr_t dest_ip, uint16_t dest_port, ipv4_addr_t src_ip, uint16_t src_port,
-                         const iovec_t *iov, size_t iov_cnt,
+                         const iovec_t *iov, tcp_tx_req_t * const *iov_reqs, size_t iov_cnt,
                          tcp_flags_t flags, const void *options, size_t options_length,
-                         uint32_t ack, uint32_t sequence, uint16_t window_size);
-static status_t tcp_socket_send(tcp_socket_t *s, const iovec_t *iov, size_t iov_cnt,
+                         uint32_t ack, uint32_t sequence, uint16_t window_size,
+                         uint32_t offloads, uint32_t mss);
+static status_t tcp_socket_send(tcp_socket_t *s, const iovec_t *iov, tcp_tx_req_t * const *iov_reqs, size_t iov_cnt,
                                 tcp_flags_t flags, const void *options, size_t options_length, uint32_t sequence);
-static void handle_data(tcp_socket_t *s, const void *data, size_t len, uint32_t sequence);
+static void handle_data(tcp_socket_t *s, pktbuf_t *p, uint32_t sequence);
+static void tcp_ooo_flush(tcp_socket_t *s);
 static void send_ack(tcp_socket_t *s);
-static void handle_ack(tcp_socket_t *s, uint32_t sequence, uint32_t win_size);
+static void tcp_rx_flush_pkts(tcp_socket_t *s);
+static void tcp_tx_req_flush(tcp_socket_t *s, status_t status);
+static void handle_ack(tcp_socket_t *s, uint32_t sequence, uint32_t win_size, size_t data_len);
+static ssize_t tcp_retransmit(tcp_socket_t *s);
 static ssize_t tcp_write_pending_data(tcp_socket_t *s);
 static void handle_retransmit_timeout(void *_s);
 static void handle_time_wait_timeout(void *_s);
@@ -192,6 +365,12 @@ static const char *tcp_state_to_string(tcp_state_t state) {
     }
 }
 
+static void dump_counters(const tcp_counters_t *c) {
+    printf("\tooo segments %lu bytes %lu drops %lu, dup acks sent %lu rcvd %lu\n",
+           c->ooo_segments, c->ooo_bytes, c->ooo_drops, c->dup_acks_sent, c->dup_acks_rcvd);
+    printf("\tfast retransmits %lu, timeouts %lu\n", c->fast_retransmits, c->timeouts);
+}
+
 static void dump_socket(tcp_socket_t *s) {
     printf("socket %p: state %d (%s), local 0x%x:%hu, remote 0x%x:%hu, ref %d\n",
            s, s->state, tcp_state_to_string(s->state),
@@ -204,70 +383,160 @@ static void dump_socket(tcp_socket_t *s) {
                s->tx_win_low, s->tx_win_high, s->tx_win_high - s->tx_win_low,
                s->tx_highest_seq, s->tx_highest_seq - s->tx_win_low,
                cbuf_size(&s->tx_buffer), (uint32_t)cbuf_space_used(&s->tx_buffer));
+        printf("\tzero copy rx %s, %u bytes in %u pktbufs, tx %u bytes queued\n",
+               s->rx_zero_copy ? "on" : "off", s->rx_pkt_bytes, s->rx_pkt_count, s->tx_req_bytes);
+        printf("\tsack %s, ooo queued %u, wscale rx %u tx %u\n", s->sack_permitted ? "on" : "off",
+               s->rx_ooo_count, s->rx_wscale, s->tx_wscale);
+        printf("\tcwnd %u ssthresh %u%s, srtt %u rttvar %u rto %u msecs\n", s->cwnd, s->ssthresh,
+               s->in_recovery ? " (recovering)" : "", s->srtt >> 3, s->rttvar >> 2, (uint)s->rto);
     }
+    dump_counters(&s->counters);
 }
 
 
 
-static tcp_socket_t *lookup_socket(ipv4_addr_t remote_ip, ipv4_addr_t local_ip, uint16_t remote_port, uint16_t local_port) {
-    LTRACEF_LEVEL(2, "remote ip 0x%x local ip 0x%x remote port %u local port %u\n", remote_ip, local_ip, remote_port, local_port);
+static void tcp_hash_init(tcp_hash_table_t *t) {
+    for (uint32_t i = 0; i <= t->mask; i++) {
+        spin_lock_init(&t->buckets[i].lock);
+        list_initialize(&t->buckets[i].list);
+    }
+}
 
-    mutex_acquire(&tcp_socket_list_lock);
+static uint32_t tcp_hash_conn(ipv4_addr_t remote_ip, ipv4_addr_t local_ip, uint16_t remote_port, uint16_t local_port) {
+    uint32_t h = remote_ip * 0x9e3779b1u;
+    h = (h ^ local_ip) * 0x85ebca6bu;
+    h = (h ^ (((uint32_t)remote_port << 16) | local_port)) * 0xc2b2ae35u;
+    return h ^ (h >> 16);
+}
 
-    /* XXX replace with something faster, like a hash table */
-    tcp_socket_t *s = NULL;
-    list_for_every_entry(&tcp_socket_list, s, tcp_socket_t, node) {
-        if (s->state == STATE_CLOSED || s->state == STATE_LISTEN) {
-            continue;
-        } else {
-            /* full check */
-            if (s->remote_ip == remote_ip &&
-                    s->local_ip == local_ip &&
-                    s->remote_port == remote_port &&
-                    s->local_port == local_port) {
-                goto out;
-            }
+static uint32_t tcp_hash_port(uint16_t local_port) {
+    return (local_port * 0x9e3779b1u) >> 16;
+}
+
+/* a socket's bucket in whichever table its state puts it in */
+static tcp_hash_bucket_t *tcp_hash_bucket(tcp_hash_table_t *conn, tcp_hash_table_t *listen, const tcp_socket_t *s) {
+    if (s->state == STATE_LISTEN)
+        return &listen->buckets[tcp_hash_port(s->local_port) & listen->mask];
+
+    return &conn->buckets[tcp_hash_conn(s->remote_ip, s->local_ip, s->remote_port, s->local_port) & conn->mask];
+}
+
+/* called with the bucket lock held */
+static tcp_socket_t *tcp_hash_find_conn(tcp_hash_bucket_t *b, ipv4_addr_t remote_ip, ipv4_addr_t local_ip,
+                                        uint16_t remote_port, uint16_t local_port) {
+    tcp_socket_t *s;
+    list_for_every_entry(&b->list, s, tcp_socket_t, hash_node) {
+        if (s->remote_ip == remote_ip &&
+                s->local_ip == local_ip &&
+                s->remote_port == remote_port &&
+                s->local_port == local_port &&
+                s->state != STATE_CLOSED) {
+            return s;
         }
     }
+    return NULL;
+}
 
-    /* walk the list again, looking only for listen matches */
-    list_for_every_entry(&tcp_socket_list, s, tcp_socket_t, node) {
-        if (s->state == STATE_LISTEN) {
-            /* sockets in listen state only care about local port */
-            if (s->local_port == local_port) {
-                goto out;
-            }
-        }
+/* called with the bucket lock held */
+static tcp_socket_t *tcp_hash_find_listen(tcp_hash_bucket_t *b, uint16_t local_port) {
+    tcp_socket_t *s;
+    list_for_every_entry(&b->list, s, tcp_socket_t, hash_node) {
+        /* sockets in listen state only care about local port */
+        if (s->local_port == local_port && s->state == STATE_LISTEN)
+            return s;
     }
+    return NULL;
+}
 
-    /* fall through case returns null */
-    s = NULL;
+static tcp_socket_t *tcp_hash_lookup(tcp_hash_table_t *conn, tcp_hash_table_t *listen, ipv4_addr_t remote_ip,
+                                     ipv4_addr_t local_ip, uint16_t remote_port, uint16_t local_port, bool take_ref) {
+    tcp_hash_bucket_t *b = &conn->buckets[tcp_hash_conn(remote_ip, local_ip, remote_port, local_port) & conn->mask];
 
-out:
-    /* bump the ref before returning it */
-    if (s)
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&b->lock);
+    tcp_socket_t *s = tcp_hash_find_conn(b, remote_ip, local_ip, remote_port, local_port);
+    if (s && take_ref)
         inc_socket_ref(s);
+    spin_unlock_irqrestore(&b->lock, state);
+    if (s)
+        return s;
 
-    mutex_release(&tcp_socket_list_lock);
+    /* no connection, see if anything is listening on the port */
+    b = &listen->buckets[tcp_hash_port(local_port) & listen->mask];
+
+    state = spin_lock_irqsave(&b->lock);
+    s = tcp_hash_find_listen(b, local_port);
+    if (s && take_ref)
+        inc_socket_ref(s);
+    spin_unlock_irqrestore(&b->lock, state);
 
     return s;
 }
 
-static void add_socket_to_list(tcp_socket_t *s) {
+/* fails if another socket already has the same 4-tuple, or the same port for listening sockets */
+static status_t tcp_hash_insert(tcp_hash_table_t *conn, tcp_hash_table_t *listen, tcp_socket_t *s) {
+    tcp_hash_bucket_t *b = tcp_hash_bucket(conn, listen, s);
+    status_t err = NO_ERROR;
+
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&b->lock);
+    tcp_socket_t *existing = (s->state == STATE_LISTEN) ?
+                             tcp_hash_find_listen(b, s->local_port) :
+                             tcp_hash_find_conn(b, s->remote_ip, s->local_ip, s->remote_port, s->local_port);
+    if (existing) {
+        err = ERR_ALREADY_EXISTS;
+    } else {
+        list_add_head(&b->list, &s->hash_node);
+        s->hash_bucket = b;
+    }
+    spin_unlock_irqrestore(&b->lock, state);
+
+    return err;
+}
+
+static void tcp_hash_remove(tcp_socket_t *s) {
+    tcp_hash_bucket_t *b = s->hash_bucket;
+
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&b->lock);
+    DEBUG_ASSERT(list_in_list(&s->hash_node));
+    list_delete(&s->hash_node);
+    s->hash_bucket = NULL;
+    spin_unlock_irqrestore(&b->lock, state);
+}
+
+void tcp_init(void) {
+    tcp_hash_init(&tcp_conn_hash);
+    tcp_hash_init(&tcp_listen_hash);
+}
+
+static tcp_socket_t *lookup_socket(ipv4_addr_t remote_ip, ipv4_addr_t local_ip, uint16_t remote_port, uint16_t local_port) {
+    LTRACEF_LEVEL(2, "remote ip 0x%x local ip 0x%x remote port %u local port %u\n", remote_ip, local_ip, remote_port, local_port);
+
+    /* bumps the ref before returning it */
+    return tcp_hash_lookup(&tcp_conn_hash, &tcp_listen_hash, remote_ip, local_ip, remote_port, local_port, true);
+}
+
+static status_t add_socket_to_list(tcp_socket_t *s) {
     DEBUG_ASSERT(s);
     DEBUG_ASSERT(s->ref > 0); // we should have implicitly bumped the ref when creating the socket
 
+    status_t err = tcp_hash_insert(&tcp_conn_hash, &tcp_listen_hash, s);
+    if (err < 0)
+        return err;
+
     mutex_acquire(&tcp_socket_list_lock);
 
     list_add_head(&tcp_socket_list, &s->node);
 
     mutex_release(&tcp_socket_list_lock);
+
+    return NO_ERROR;
 }
 
 static void remove_socket_from_list(tcp_socket_t *s) {
     DEBUG_ASSERT(s);
     DEBUG_ASSERT(s->ref > 0);
 
+    tcp_hash_remove(s);
+
     mutex_acquire(&tcp_socket_list_lock);
 
     DEBUG_ASSERT(list_in_list(&s->node));
@@ -300,6 +569,10 @@ static bool dec_socket_ref(tcp_socket_t *s) {
         event_destroy(&s->rx_event);
         event_destroy(&s->connect_event);
 
+        tcp_ooo_flush(s);
+        tcp_rx_flush_pkts(s);
+        tcp_tx_req_flush(s, ERR_CHANNEL_CLOSED);
+
         free(s->rx_buffer_raw);
         free(s->tx_buffer_raw);
 
@@ -325,6 +598,96 @@ static void tcp_timer_cancel(tcp_socket_t *s, net_timer_t *timer) {
         dec_socket_ref(s);
 }
 
+static void tcp_parse_options(const uint8_t *opt, size_t len, tcp_options_t *options) {
+    memset(options, 0, sizeof(*options));
+
+    while (len > 0) {
+        uint8_t kind = opt[0];
+        if (kind == TCP_OPTION_END)
+            break;
+        if (kind == TCP_OPTION_NOP) {
+            opt++;
+            len--;
+            continue;
+        }
+
+        /* everything else is kind, length, data */
+        if (len < 2 || opt[1] < 2 || opt[1] > len)
+            break;
+        uint8_t opt_len = opt[1];
+
+        switch (kind) {
+            case TCP_OPTION_MSS:
+                if (opt_len == 4)
+                    options->mss = (opt[2] << 8) | opt[3];
+                break;
+            case TCP_OPTION_WSCALE:
+                if (opt_len == 3) {
+                    options->wscale_ok = true;
+                    options->wscale = opt[2];
+                }
+                break;
+            case TCP_OPTION_SACK_PERMITTED:
+                if (opt_len == 2)
+                    options->sack_permitted = true;
+                break;
+        }
+
+        opt += opt_len;
+        len -= opt_len;
+    }
+}
+
+/* fill in the options for a SYN we send, returning their length */
+static size_t tcp_build_syn_options(uint8_t *opt, uint32_t mss, bool sack_permitted,
+                                    bool wscale_ok, uint8_t wscale) {
+    size_t len = 0;
+
+    opt[len++] = TCP_OPTION_MSS;
+    opt[len++] = 4;
+    opt[len++] = mss >> 8;
+    opt[len++] = mss;
+    if (sack_permitted) {
+        opt[len++] = TCP_OPTION_NOP;
+        opt[len++] = TCP_OPTION_NOP;
+        opt[len++] = TCP_OPTION_SACK_PERMITTED;
+        opt[len++] = 2;
+    }
+    if (wscale_ok) {
+        opt[len++] = TCP_OPTION_NOP;
+        opt[len++] = TCP_OPTION_WSCALE;
+        opt[len++] = 3;
+        opt[len++] = wscale;
+    }
+    DEBUG_ASSERT(len <= TCP_SYN_OPTIONS_MAX);
+
+    return len;
+}
+
+/* take on what the other side said in its SYN, once the mss is settled */
+static void tcp_apply_syn_options(tcp_socket_t *s, const tcp_options_t *options) {
+    if (options->mss)
+        s->mss = MIN(s->mss, options->mss);
+    s->sack_permitted = options->sack_permitted;
+
+    /* windows are only scaled if both sides asked for it */
+    if (options->wscale_ok) {
+        s->tx_wscale = MIN(options->wscale, TCP_MAX_WSCALE);
+    } else {
+        s->rx_wscale = 0;
+        s->tx_wscale = 0;
+    }
+
+    /* initial window per RFC 5681 */
+    if (s->mss > 2190)
+        s->cwnd = 2 * s->mss;
+    else if (s->mss > 1095)
+        s->cwnd = 3 * s->mss;
+    else
+        s->cwnd = 4 * s->mss;
+    s->ssthresh = UINT32_MAX;
+}
+
 void tcp_input(netif_t *netif, pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip) {
     if (unlikely(tcp_debug))
         TRACEF("p %p (len %u), src_ip 0x%x, dst_ip 0x%x\n", p, p->dlen, src_ip, dst_ip);
@@ -345,11 +708,21 @@ void tcp_input(netif_t *netif, pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip) {
         TRACEF("REJECT: packet too large for buffer\n");
         return;
     }
+    if (header_len < sizeof(tcp_header_t)) {
+        TRACEF("REJECT: header length too short\n");
+        return;
+    }
 
     /* checksum */
     if (FORCE_TCP_CHECKSUM || (p->flags & PKTBUF_FLAG_CKSUM_TCP_GOOD) == 0) {
         ipv4_pseudo_header_t pheader;
 
+        /* multi part packets only come from nics that have already checked them */
+        if (p->next) {
+            TRACEF("REJECT: unchecked multi part packet\n");
+            return;
+        }
+
         // set up the pseudo header for checksum purposes
         pheader.source_addr = src_ip;
         pheader.dest_addr = dst_ip;
@@ -375,9 +748,14 @@ void tcp_input(netif_t *netif, pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip) {
 
     /* get some data from the packet */
     uint8_t packet_flags = header->length_flags & 0x3f;
-    size_t data_len = p->dlen - header_len;
+    size_t data_len = pktbuf_chain_len(p) - header_len;
     uint32_t highest_sequence = header->seq_num + ((data_len > 0) ? (data_len - 1) : 0);
 
+    /* only the options on a SYN matter to us */
+    tcp_options_t options = {};
+    if (packet_flags & PKT_SYN)
+        tcp_parse_options((const uint8_t *)(header + 1), header_len - sizeof(tcp_header_t), &options);
+
     /* see if it matches a socket we have */
     tcp_socket_t *s = lookup_socket(src_ip, dst_ip, header->source_port, header->dest_port);
     if (!s) {
@@ -393,6 +771,11 @@ void tcp_input(netif_t *netif, pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip) {
 
     mutex_acquire(&s->lock);
 
+    /* the window on anything but a SYN is scaled */
+    uint32_t peer_win = header->win_size;
+    if (!(packet_flags & PKT_SYN))
+        peer_win <<= s->tx_wscale;
+
     /* check to see if they're resetting us */
     if (packet_flags & PKT_RST) {
         if (s->state != STATE_CLOSED && s->state != STATE_LISTEN) {
@@ -419,7 +802,7 @@ void tcp_input(netif_t *netif, pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip) {
                 goto done;
 
             /* make a new accept socket */
-            tcp_socket_t *accept_socket = create_tcp_socket(true);
+            tcp_socket_t *accept_socket = create_tcp_socket(true, s->rx_win_size, s->tx_buffer_size);
             if (!accept_socket)
                 goto done;
 
@@ -429,19 +812,27 @@ void tcp_input(netif_t *netif, pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip) {
             accept_socket->remote_ip = src_ip;
             accept_socket->remote_port = header->source_port;
             accept_socket->state = STATE_SYN_RCVD;
+            tcp_apply_syn_options(accept_socket, &options);
 
             /* look up and cache the route for the accepted socket */
             ipv4_route_t *route = ipv4_search_route(src_ip);
             if (!route) {
+                dec_socket_ref(accept_socket);
                 goto done;
             }
             accept_socket->route = route;
 
             mutex_acquire(&accept_socket->lock);
 
-            add_socket_to_list(accept_socket);
+            if (add_socket_to_list(accept_socket) < 0) {
+                /* not in the hash, so nothing else can have found it */
+                mutex_release(&accept_socket->lock);
+                dec_socket_ref(accept_socket);
+                goto send_reset;
+            }
 
-            /* remember their sequence */
+            /* remember their sequence. The window is kept a byte short of
+             * the buffer, as tcp_socket_send() does when it moves rx_win_high. */
             accept_socket->rx_win_low = header->seq_num + 1;
             accept_socket->rx_win_high = accept_socket->rx_win_low + accept_socket->rx_win_size - 1;
 
@@ -449,14 +840,15 @@ void tcp_input(netif_t *netif, pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip) {
             s->accepted = accept_socket;
             sem_post(&s->accept_sem, true);
 
-            /* set up a mss option for sending back */
-            tcp_mss_option_t mss_option;
-            mss_option.kind = 0x2;
-            mss_option.len = 0x4;
-            mss_option.mss = ntohs(s->mss); // XXX make sure we fit in their mss
+            /* set up our options for sending back, only offering sack and
+             * window scaling if they did */
+            uint8_t syn_options[TCP_SYN_OPTIONS_MAX];
+            size_t syn_options_len = tcp_build_syn_options(syn_options, s->mss,
+                                                           accept_socket->sack_permitted,
+                                                           options.wscale_ok, accept_socket->rx_wscale);
 
             /* send a response */
-            tcp_socket_send(accept_socket, NULL, 0, PKT_ACK|PKT_SYN, &mss_option, sizeof(mss_option),
+            tcp_socket_send(accept_socket, NULL, NULL, 0, PKT_ACK|PKT_SYN, syn_options, syn_options_len,
                             accept_socket->tx_win_low);
 
             /* SYN consumed a sequence */
@@ -478,8 +870,10 @@ void tcp_input(netif_t *netif, pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip) {
                     goto send_reset;
                 }
 
-                s->tx_win_high = s->tx_win_low + header->win_size;
+                s->tx_win_high = s->tx_win_low + peer_win;
                 s->tx_highest_seq = s->tx_win_low;
+                s->tx_max_seq = s->tx_win_low;
+                s->recover = s->tx_win_low;
 
                 s->state = STATE_ESTABLISHED;
             } else {
@@ -508,13 +902,17 @@ void tcp_input(netif_t *netif, pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip) {
                 goto send_reset;
             }
 
-            // remember their sequence
+            // remember their sequence, window a byte short of the buffer as above
             s->rx_win_low = header->seq_num + 1;
             s->rx_win_high = s->rx_win_low + s->rx_win_size - 1;
 
+            tcp_apply_syn_options(s, &options);
+
             s->tx_win_low++;
-            s->tx_win_high = s->tx_win_low + header->win_size;
+            s->tx_win_high = s->tx_win_low + peer_win;
             s->tx_highest_seq = s->tx_win_low;
+            s->tx_max_seq = s->tx_win_low;
+            s->recover = s->tx_win_low;
 
             s->state = STATE_ESTABLISHED;
 
@@ -529,12 +927,12 @@ void tcp_input(netif_t *netif, pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip) {
         case STATE_ESTABLISHED:
             if (packet_flags & PKT_ACK) {
                 /* they're acking us */
-                handle_ack(s, header->ack_num, header->win_size);
+                handle_ack(s, header->ack_num, peer_win, data_len);
             }
 
             if (data_len > 0) {
                 LTRACEF("new data, len %zu\n", data_len);
-                handle_data(s, p->data, p->dlen, header->seq_num);
+                handle_data(s, p, header->seq_num);
             }
 
             if ((packet_flags & PKT_FIN) && SEQUENCE_GTE(s->rx_win_low, highest_sequence)) {
@@ -555,7 +953,7 @@ void tcp_input(netif_t *netif, pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip) {
         case STATE_CLOSE_WAIT:
             if (packet_flags & PKT_ACK) {
                 /* they're acking us */
-                handle_ack(s, header->ack_num, header->win_size);
+                handle_ack(s, header->ack_num, peer_win, data_len);
             }
             if (packet_flags & PKT_FIN) {
                 /* they must have missed our ack, ack them again */
@@ -625,17 +1023,352 @@ send_reset:
     LTRACEF("SEND RST\n");
     if (!(packet_flags & PKT_RST)) {
         tcp_send(src_ip, header->source_port, dst_ip, header->dest_port,
-                 NULL, 0, PKT_RST, NULL, 0, 0, header->ack_num, 0);
+                 NULL, NULL, 0, PKT_RST, NULL, 0, 0, header->ack_num, 0, 0, 0);
+    }
+}
+
+/* copy len bytes starting offset bytes into packet p to the receive buffer,
+ * or to dst if there is one */
+static void tcp_rx_copy(tcp_socket_t *s, pktbuf_t *p, size_t offset, size_t len, uint8_t *dst) {
+    /* a large receive offload packet may span several buffers */
+    for (size_t left = len; left > 0; p = p->next) {
+        DEBUG_ASSERT(p);
+        if (offset >= p->dlen) {
+            offset -= p->dlen;
+            continue;
+        }
+
+        size_t chunk = MIN(p->dlen - offset, left);
+        if (dst) {
+            memcpy(dst, p->data + offset, chunk);
+            dst += chunk;
+        } else {
+            cbuf_write(&s->rx_buffer, p->data + offset, chunk, false);
+        }
+        left -= chunk;
+        offset = 0;
     }
 }
 
-static void handle_data(tcp_socket_t *s, const void *data, size_t len, uint32_t sequence) {
+/* received data waiting for the reader, copied or not */
+static uint32_t tcp_rx_queued(tcp_socket_t *s) {
+    return cbuf_space_used(&s->rx_buffer) + s->rx_pkt_bytes;
+}
+
+/* Bytes we will take starting at sequence, up to the right edge of the window
+ * we have advertised. rx_win_high is exclusive: the window is
+ * [rx_win_low, rx_win_high). */
+static uint32_t tcp_rx_win_room(tcp_socket_t *s, uint32_t sequence) {
+    if (SEQUENCE_GTE(sequence, s->rx_win_high))
+        return 0;
+    return s->rx_win_high - sequence;
+}
+
+/* Pool buffers a zero copy reader would hold for the data starting offset
+ * bytes into packet p: everything from the buffer that offset lands in to the
+ * end of the chain. */
+static uint32_t tcp_rx_pkt_bufs(const pktbuf_t *p, size_t offset) {
+    while (p->next && p->dlen <= offset) {
+        offset -= p->dlen;
+        p = p->next;
+    }
+
+    uint32_t count = 0;
+    for (; p; p = p->next)
+        count++;
+    return count;
+}
+
+/* Whether the buffers holding the data starting offset bytes into packet p
+ * fit in what is left of the socket's zero copy budget. */
+static bool tcp_rx_pkt_fits(tcp_socket_t *s, const pktbuf_t *p, size_t offset) {
+    return s->rx_pkt_count + tcp_rx_pkt_bufs(p, offset) <= MAX_RX_PKTBUFS;
+}
+
+/* Queue len bytes starting offset bytes into packet p, which the socket now
+ * owns, for a zero copy reader. */
+static void tcp_rx_queue_pkt(tcp_socket_t *s, pktbuf_t *p, size_t offset, size_t len) {
+    /* drop the buffers in front of the new data */
+    while (p->dlen <= offset) {
+        pktbuf_t *next = p->next;
+        DEBUG_ASSERT(next);
+        offset -= p->dlen;
+        p->next = NULL;
+        pktbuf_free(p, false);
+        p = next;
+    }
+    pktbuf_consume(p, offset);
+    pktbuf_chain_trim(p, len);
+
+    list_add_tail(&s->rx_pkt_list, &p->list);
+    s->rx_pkt_bytes += len;
+    for (; p; p = p->next)
+        s->rx_pkt_count++;
+}
+
+/* Free the first buffer of the first queued packet, once it has been read. */
+static void tcp_rx_pop_buf(tcp_socket_t *s, pktbuf_t *p) {
+    DEBUG_ASSERT(p == list_peek_head_type(&s->rx_pkt_list, pktbuf_t, list));
+
+    pktbuf_t *next = p->next;
+    if (next)
+        list_add_after(&p->list, &next->list);
+    list_delete(&p->list);
+    p->next = NULL;
+    pktbuf_free(p, false);
+    s->rx_pkt_count--;
+}
+
+static void tcp_rx_flush_pkts(tcp_socket_t *s) {
+    pktbuf_t *p;
+    while ((p = list_remove_head_type(&s->rx_pkt_list, pktbuf_t, list)))
+        pktbuf_free(p, false);
+    s->rx_pkt_bytes = 0;
+    s->rx_pkt_count = 0;
+}
+
+/* Hand len bytes starting offset bytes into packet p to the reader. Zero copy
+ * sockets take the packet's buffers over, anything else copies the data into
+ * the receive buffer. Returns false if there was nowhere to put it. */
+static bool tcp_rx_deliver(tcp_socket_t *s, pktbuf_t *p, size_t offset, size_t len) {
+    if (len == 0)
+        return true;
+
+    if (s->rx_zero_copy) {
+        /* small segments are cheaper to copy onto the last queued buffer
+         * than to pin a pool buffer each */
+        pktbuf_t *tail = list_peek_tail_type(&s->rx_pkt_list, pktbuf_t, list);
+        if (tail && !tail->next && pktbuf_avail_tail(tail) >= len) {
+            tcp_rx_copy(s, p, offset, len, pktbuf_append(tail, len));
+            s->rx_pkt_bytes += len;
+            return true;
+        }
+
+        if (tcp_rx_pkt_fits(s, p, offset)) {
+            pktbuf_t *q = pktbuf_detach(p);
+            if (q) {
+                tcp_rx_queue_pkt(s, q, offset, len);
+                return true;
+            }
+        }
+
+        /* copied data has to stay in front of the queued packets */
+        if (!list_is_empty(&s->rx_pkt_list))
+            return false;
+    }
+
+    tcp_rx_copy(s, p, offset, len, NULL);
+    return true;
+}
+
+/* Copy up to len bytes of received data out to buf, oldest first. */
+static size_t tcp_rx_read(tcp_socket_t *s, uint8_t *buf, size_t len) {
+    size_t copied = cbuf_read(&s->rx_buffer, buf, len, false);
+
+    pktbuf_t *p;
+    while (copied < len && (p = list_peek_head_type(&s->rx_pkt_list, pktbuf_t, list))) {
+        size_t chunk = MIN(p->dlen, len - copied);
+        memcpy(buf + copied, p->data, chunk);
+        pktbuf_consume(p, chunk);
+        s->rx_pkt_bytes -= chunk;
+        copied += chunk;
+
+        if (p->dlen == 0)
+            tcp_rx_pop_buf(s, p);
+    }
+
+    return copied;
+}
+
+/* The reader took some data: unsignal it if there is nothing left, and let
+ * the other end know if the window opened back up. */
+static void tcp_rx_consumed(tcp_socket_t *s) {
+    size_t remaining_bytes = tcp_rx_queued(s);
+    if (s->state == STATE_ESTABLISHED && remaining_bytes == 0) {
+        event_unsignal(&s->rx_event);
+    }
+
+    uint32_t new_rx_win_size = s->rx_win_size - remaining_bytes;
+
+    /* if we've opened it enough, send an ack */
+    if (new_rx_win_size >= s->mss && s->rx_win_high - s->rx_win_low < s->mss)
+        send_ack(s);
+}
+
+static void tcp_ooo_free(tcp_socket_t *s, tcp_ooo_segment_t *seg) {
+    list_delete(&seg->node);
+    s->rx_ooo_count--;
+    if (seg->p)
+        pktbuf_free(seg->p, false);
+    free(seg);
+}
+
+static void tcp_ooo_flush(tcp_socket_t *s) {
+    tcp_ooo_segment_t *seg;
+    while ((seg = list_peek_head_type(&s->rx_ooo_list, tcp_ooo_segment_t, node)))
+        tcp_ooo_free(s, seg);
+}
+
+/* Hold on to a segment that landed past a hole in the window. The packet's
+ * buffers are taken over rather than copied, and only the part that does not
+ * overlap what is already queued is kept. */
+static void tcp_ooo_queue(tcp_socket_t *s, pktbuf_t *p, uint32_t sequence, size_t len) {
+    DEBUG_ASSERT(SEQUENCE_GT(sequence, s->rx_win_low));
+
+    /* trim to the window we have advertised */
+    uint32_t room = tcp_rx_win_room(s, sequence);
+    if (room == 0)
+        goto drop;
+    uint32_t start = sequence;
+    uint32_t end = sequence + MIN(len, room);
+    uint32_t offset = 0;
+
+    /* find where it goes, trimming anything already queued off the front
+     * and stopping at the next queued segment */
+    tcp_ooo_segment_t *seg;
+    tcp_ooo_segment_t *prev = NULL;
+    list_for_every_entry(&s->rx_ooo_list, seg, tcp_ooo_segment_t, node) {
+        uint32_t seg_end = seg->sequence + seg->len;
+        if (SEQUENCE_LTE(seg_end, start)) {
+            prev = seg;
+            continue;
+        }
+        if (SEQUENCE_GTE(seg->sequence, end))
+            break;
+
+        if (SEQUENCE_LTE(seg->sequence, start)) {
+            if (SEQUENCE_GTE(seg_end, end)) {
+                /* nothing new */
+                return;
+            }
+            offset += seg_end - start;
+            start = seg_end;
+            prev = seg;
+        } else {
+            end = seg->sequence;
+            break;
+        }
+    }
+
+    if (s->rx_ooo_count >= MAX_OOO_SEGMENTS)
+        goto drop;
+
+    seg = malloc(sizeof(*seg));
+    if (!seg)
+        goto drop;
+
+    seg->p = pktbuf_detach(p);
+    if (!seg->p) {
+        free(seg);
+        goto drop;
+    }
+    seg->sequence = start;
+    seg->len = end - start;
+    seg->offset = offset;
+
+    if (prev)
+        list_add_after(&prev->node, &seg->node);
+    else
+        list_add_head(&s->rx_ooo_list, &seg->node);
+    s->rx_ooo_count++;
+    s->rx_ooo_last_seq = start;
+
+    TCP_COUNT(s, ooo_segments, 1);
+    TCP_COUNT(s, ooo_bytes, seg->len);
+    return;
+
+drop:
+    TCP_COUNT(s, ooo_drops, 1);
+}
+
+/* move any queued segments the bottom of the window has reached into the
+ * receive buffer, returning whether any new data came out */
+static bool tcp_ooo_drain(tcp_socket_t *s) {
+    bool drained = false;
+
+    tcp_ooo_segment_t *seg;
+    while ((seg = list_peek_head_type(&s->rx_ooo_list, tcp_ooo_segment_t, node))) {
+        if (SEQUENCE_GT(seg->sequence, s->rx_win_low))
+            break;
+
+        uint32_t seg_end = seg->sequence + seg->len;
+        if (SEQUENCE_GT(seg_end, s->rx_win_low)) {
+            uint32_t skip = s->rx_win_low - seg->sequence;
+            size_t copy_len = MIN(seg_end - s->rx_win_low, tcp_rx_win_room(s, s->rx_win_low));
+
+            LTRACEF("pulling %zu bytes from ooo segment at %u\n", copy_len, seg->sequence);
+
+            /* a zero copy reader can have the buffers we already hold */
+            if (s->rx_zero_copy && copy_len > 0 &&
+                tcp_rx_pkt_fits(s, seg->p, seg->offset + skip)) {
+                tcp_rx_queue_pkt(s, seg->p, seg->offset + skip, copy_len);
+                seg->p = NULL;
+            } else if (!tcp_rx_deliver(s, seg->p, seg->offset + skip, copy_len)) {
+                break;
+            }
+            s->rx_win_low += copy_len;
+            drained = true;
+        }
+
+        tcp_ooo_free(s, seg);
+    }
+
+    return drained;
+}
+
+/* Describe the queued out of order data as sack blocks, leading with the
+ * block holding the most recently received segment as RFC 2018 asks. Returns
+ * the length of the option, or 0 if there is nothing to send. */
+static size_t tcp_build_sack_option(tcp_socket_t *s, tcp_sack_option_t *sack) {
+    if (!s->sack_permitted || list_is_empty(&s->rx_ooo_list))
+        return 0;
+
+    /* merge adjacent segments into blocks */
+    uint32_t left[MAX_OOO_SEGMENTS] = {};
+    uint32_t right[MAX_OOO_SEGMENTS] = {};
+    uint count = 0;
+    uint first = 0;
+    tcp_ooo_segment_t *seg;
+    list_for_every_entry(&s->rx_ooo_list, seg, tcp_ooo_segment_t, node) {
+        if (count > 0 && right[count - 1] == seg->sequence) {
+            right[count - 1] += seg->len;
+        } else {
+            DEBUG_ASSERT(count < MAX_OOO_SEGMENTS);
+            left[count] = seg->sequence;
+            right[count] = seg->sequence + seg->len;
+            count++;
+        }
+        if (seg->sequence == s->rx_ooo_last_seq)
+            first = count - 1;
+    }
+
+    uint blocks = 0;
+    sack->blocks[blocks].left = htonl(left[first]);
+    sack->blocks[blocks].right = htonl(right[first]);
+    blocks++;
+    for (uint i = 0; i < count && blocks < TCP_MAX_SACK_BLOCKS; i++) {
+        if (i == first)
+            continue;
+        sack->blocks[blocks].left = htonl(left[i]);
+        sack->blocks[blocks].right = htonl(right[i]);
+        blocks++;
+    }
+
+    sack->nop[0] = TCP_OPTION_NOP;
+    sack->nop[1] = TCP_OPTION_NOP;
+    sack->kind = TCP_OPTION_SACK;
+    sack->len = 2 + 8 * blocks;
+    return 4 + 8 * blocks;
+}
+
+static void handle_data(tcp_socket_t *s, pktbuf_t *p, uint32_t sequence) {
+    size_t len = pktbuf_chain_len(p);
+
     if (unlikely(tcp_debug))
-        TRACEF("data %p, len %zu, sequence %u\n", data, len, sequence);
+        TRACEF("p %p, len %zu, sequence %u\n", p, len, sequence);
 
     DEBUG_ASSERT(s);
     DEBUG_ASSERT(is_mutex_held(&s->lock));
-    DEBUG_ASSERT(data);
     DEBUG_ASSERT(len > 0);
 
     /* see if it matches our current window */
@@ -645,26 +1378,34 @@ static void handle_data(tcp_socket_t *s, const void *data, size_t len, uint32_t
 
         /* copy the data we need to our cbuf */
         size_t offset = s->rx_win_low - sequence;
-        size_t copy_len = MIN(s->rx_win_high - s->rx_win_low, len - offset);
+        size_t copy_len = MIN(tcp_rx_win_room(s, s->rx_win_low), len - offset);
 
         DEBUG_ASSERT(offset < len);
 
         LTRACEF("copying from offset %zu, len %zu\n", offset, copy_len);
 
+        if (!tcp_rx_deliver(s, p, offset, copy_len)) {
+            /* nowhere to keep it until the reader catches up, it will be resent */
+            return;
+        }
         s->rx_win_low += copy_len;
 
-        cbuf_write(&s->rx_buffer, (uint8_t *)data + offset, copy_len, false);
+        /* it may have filled a hole in front of data we already have */
+        bool filled_hole = tcp_ooo_drain(s);
+
         event_signal(&s->rx_event, true);
 
-        /* keep a counter if they've been sending a full mss */
+        /* keep a counter if they've been sending a full mss, counting each
+         * mss worth of a large receive as its own packet */
         if (copy_len >= s->mss) {
-            s->rx_full_mss_count++;
+            s->rx_full_mss_count += copy_len / s->mss;
         } else {
             s->rx_full_mss_count = 0;
         }
 
-        /* immediately ack if we're more than halfway into our buffer or they've sent 2 or more full packets */
-        if (s->rx_full_mss_count >= 2 ||
+        /* immediately ack if we're more than halfway into our buffer, they've sent 2 or more
+         * full packets, or they're recovering from a loss */
+        if (filled_hole || s->rx_full_mss_count >= 2 ||
                 (int)(s->rx_win_low + s->rx_win_size - s->rx_win_high) > (int)s->rx_win_size / 2) {
             send_ack(s);
             s->rx_full_mss_count = 0;
@@ -672,13 +1413,122 @@ static void handle_data(tcp_socket_t *s, const void *data, size_t len, uint32_t
             tcp_timer_set(s, &s->ack_delay_timer, &handle_delayed_ack_timeout, DELAYED_ACK_TIMEOUT);
         }
     } else {
-        // either out of order or completely out of our window, drop
-        // duplicately ack the last thing we really got
+        /* past a hole, keep it for when the hole is filled */
+        if (SEQUENCE_GT(sequence, s->rx_win_low))
+            tcp_ooo_queue(s, p, sequence, len);
+
+        // duplicately ack the last thing we really got, with sack blocks
+        // for what we're holding on to
+        TCP_COUNT(s, dup_acks_sent, 1);
         send_ack(s);
     }
 }
 
-static status_t tcp_socket_send(tcp_socket_t *s, const iovec_t *iov, size_t iov_cnt,
+static void tcp_tx_req_complete(void *_req) {
+    tcp_tx_req_t *req = _req;
+
+    if (req->cb)
+        req->cb(req->cb_arg, req->status);
+    free(req);
+}
+
+static void tcp_tx_req_put(tcp_tx_req_t *req) {
+    /* the last pktbuf may be freed from the nic's interrupt handler, so
+     * complete the write from a dpc */
+    if (atomic_add(&req->ref, -1) == 1)
+        dpc_enqueue(&req->dpc, DPC_CPU_LOCAL, DPC_FLAG_NORESCHED);
+}
+
+/* pktbuf free callback for buffers pointing into a zero copy write */
+static void tcp_tx_req_buf_free(void *buf, void *arg) {
+    tcp_tx_req_put(arg);
+}
+
+/* len more bytes of the zero copy writes have been acked */
+static void tcp_tx_req_ack(tcp_socket_t *s, uint32_t len) {
+    tcp_tx_req_t *req;
+    while (len > 0 && (req = list_peek_head_type(&s->tx_req_list, tcp_tx_req_t, node))) {
+        size_t acked = MIN(len, req->len - req->acked);
+        req->acked += acked;
+        s->tx_req_bytes -= acked;
+        len -= acked;
+
+        if (req->acked == req->len) {
+            list_delete(&req->node);
+            tcp_tx_req_put(req);
+        }
+    }
+}
+
+/* the socket is done sending, fail whatever zero copy writes are left */
+static void tcp_tx_req_flush(tcp_socket_t *s, status_t status) {
+    tcp_tx_req_t *req;
+    while ((req = list_remove_head_type(&s->tx_req_list, tcp_tx_req_t, node))) {
+        req->status = status;
+        tcp_tx_req_put(req);
+    }
+    s->tx_req_bytes = 0;
+}
+
+/* Describe up to len bytes of the transmit stream starting offset bytes past
+ * tx_win_low, which is the data in tx_buffer followed by the zero copy writes.
+ * Fills in at most TCP_TX_MAX_IOV pieces, with the write each one belongs
+ * to, and returns how many bytes they cover. */
+static uint32_t tcp_tx_gather(tcp_socket_t *s, uint32_t offset, uint32_t len, iovec_t *iov,
+                              tcp_tx_req_t **reqs, size_t *iov_cnt) {
+    size_t n = 0;
+    uint32_t gathered = 0;
+
+    uint32_t buffered = cbuf_space_used(&s->tx_buffer);
+    if (offset < buffered) {
+        iovec_t regions[2];
+        gathered = cbuf_peek_at(&s->tx_buffer, offset, MIN(len, buffered - offset), regions);
+        for (uint i = 0; i < 2; i++) {
+            if (regions[i].iov_len > 0) {
+                iov[n] = regions[i];
+                reqs[n] = NULL;
+                n++;
+            }
+        }
+        offset = 0;
+    } else {
+        offset -= buffered;
+    }
+
+    tcp_tx_req_t *req;
+    list_for_every_entry(&s->tx_req_list, req, tcp_tx_req_t, node) {
+        if (gathered == len || n == TCP_TX_MAX_IOV)
+            break;
+
+        /* the acked part of the first write is behind tx_win_low */
+        size_t avail = req->len - req->acked;
+        if (offset >= avail) {
+            offset -= avail;
+            continue;
+        }
+        size_t pos = req->acked + offset;
+        offset = 0;
+
+        for (uint i = 0; i < req->iov_count && gathered < len && n < TCP_TX_MAX_IOV; i++) {
+            if (pos >= req->iov[i].iov_len) {
+                pos -= req->iov[i].iov_len;
+                continue;
+            }
+            size_t chunk = MIN(req->iov[i].iov_len - pos, len - gathered);
+            iov[n].iov_base = (uint8_t *)req->iov[i].iov_base + pos;
+            iov[n].iov_len = chunk;
+            reqs[n] = req;
+            n++;
+            gathered += chunk;
+            pos = 0;
+        }
+    }
+
+    *iov_cnt = n;
+    return gathered;
+}
+
+static status_t tcp_socket_send(tcp_socket_t *s, const iovec_t *iov, tcp_tx_req_t * const *iov_reqs, size_t iov_cnt,
                                 tcp_flags_t flags, const void *options, size_t options_length, uint32_t sequence) {
     DEBUG_ASSERT(s);
     DEBUG_ASSERT(is_mutex_held(&s->lock));
@@ -686,13 +1536,22 @@ static status_t tcp_socket_send(tcp_socket_t *s, const iovec_t *iov, size_t iov_
     DEBUG_ASSERT(options_length == 0 || options);
     DEBUG_ASSERT((options_length % 4) == 0);
 
-    // calculate the new right edge of the rx window
-    uint32_t rx_win_high = s->rx_win_low + s->rx_win_size - cbuf_space_used(&s->rx_buffer) - 1;
+    // calculate the new right edge of the rx window, as far as the window
+    // field can express it. The window on a SYN is never scaled.
+    uint32_t win = s->rx_win_size - tcp_rx_queued(s) - 1;
+    if (s->rx_zero_copy) {
+        /* don't invite more segments than we have buffers left to hold */
+        uint32_t bufs_left = s->rx_pkt_count < MAX_RX_PKTBUFS ? MAX_RX_PKTBUFS - s->rx_pkt_count : 0;
+        win = MIN(win, bufs_left * s->mss);
+    }
+    uint8_t wscale = (flags & PKT_SYN) ? 0 : s->rx_wscale;
+    win = MIN(win, 0xffffu << wscale) & ~((1u << wscale) - 1);
+    uint32_t rx_win_high = s->rx_win_low + win;
 
     LTRACEF("rx_win_low %u rx_win_size %u read_buf_len %zu, new win high %u\n",
-            s->rx_win_low, s->rx_win_size, cbuf_space_used(&s->rx_buffer), rx_win_high);
+            s->rx_win_low, s->rx_win_size, (size_t)tcp_rx_queued(s), rx_win_high);
 
-    uint16_t win_size;
+    uint32_t win_size;
     if (SEQUENCE_GTE(rx_win_high, s->rx_win_high)) {
         s->rx_win_high = rx_win_high;
         win_size = rx_win_high - s->rx_win_low;
@@ -701,14 +1560,18 @@ static status_t tcp_socket_send(tcp_socket_t *s, const iovec_t *iov, size_t iov_
         // right edge of the window backwards
         win_size = s->rx_win_high - s->rx_win_low;
     }
+    win_size = MIN(win_size >> wscale, 0xffffu);
 
     // we are piggybacking a pending ACK, so clear the delayed ACK timer
     if (flags & PKT_ACK) {
         tcp_timer_cancel(s, &s->ack_delay_timer);
     }
 
-    status_t err = tcp_send(s->remote_ip, s->remote_port, s->local_ip, s->local_port, iov, iov_cnt, flags,
-                            options, options_length, (flags & PKT_ACK) ? s->rx_win_low : 0, sequence, win_size);
+    uint32_t offloads = s->route ? s->route->interface->offloads : 0;
+
+    status_t err = tcp_send(s->remote_ip, s->remote_port, s->local_ip, s->local_port, iov, iov_reqs, iov_cnt, flags,
+                            options, options_length, (flags & PKT_ACK) ? s->rx_win_low : 0, sequence, win_size,
+                            offloads, s->mss);
 
     return err;
 }
@@ -720,12 +1583,16 @@ static void send_ack(tcp_socket_t *s) {
     if (s->state != STATE_ESTABLISHED && s->state != STATE_CLOSE_WAIT && s->state != STATE_FIN_WAIT_2)
         return;
 
-    tcp_socket_send(s, NULL, 0, PKT_ACK, NULL, 0, s->tx_win_low);
+    tcp_sack_option_t sack;
+    size_t sack_len = tcp_build_sack_option(s, &sack);
+
+    tcp_socket_send(s, NULL, NULL, 0, PKT_ACK, sack_len ? &sack : NULL, sack_len, s->tx_win_low);
 }
 
 static status_t tcp_send(ipv4_addr_t dest_ip, uint16_t dest_port, ipv4_addr_t src_ip, uint16_t src_port,
-                         const iovec_t *iov, size_t iov_cnt,
-                         tcp_flags_t flags, const void *options, size_t options_length, uint32_t ack, uint32_t sequence, uint16_t window_size) {
+                         const iovec_t *iov, tcp_tx_req_t * const *iov_reqs, size_t iov_cnt,
+                         tcp_flags_t flags, const void *options, size_t options_length, uint32_t ack, uint32_t sequence, uint16_t window_size,
+                         uint32_t offloads, uint32_t mss) {
     DEBUG_ASSERT(iov_cnt == 0 || iov);
     DEBUG_ASSERT(options_length == 0 || options);
     DEBUG_ASSERT((options_length % 4) == 0);
@@ -749,27 +1616,92 @@ static status_t tcp_send(ipv4_addr_t dest_ip, uint16_t dest_port, ipv4_addr_t sr
     if (options)
         memcpy(header + 1, options, options_length);
 
-    /* append the data */
-    if (iov) {
-        for (size_t i = 0; i < iov_cnt; i++) {
-            if (iov[i].iov_len > 0) {
-                DEBUG_ASSERT(iov[i].iov_base);
-                pktbuf_append_data(p, iov[i].iov_base, iov[i].iov_len);
+    /* append the data, spilling into chained buffers if this is more than
+     * one segment for the nic to split up. If the nic will not checksum it,
+     * sum the data on the way in rather than reading it all back afterwards. */
+    bool sw_csum = FORCE_TCP_CHECKSUM || !(offloads & NETIF_OFFLOAD_TX_CSUM);
+    uint16_t data_sum = 0;
+    pktbuf_t *tail = p;
+    size_t data_len = 0;
+    for (size_t i = 0; iov && i < iov_cnt; i++) {
+        const uint8_t *buf = iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+
+        /* zero copy writes go out of the caller's memory if the nic can
+         * gather the packet from several buffers */
+        tcp_tx_req_t *req = (iov_reqs && (offloads & NETIF_OFFLOAD_SG)) ? iov_reqs[i] : NULL;
+
+        DEBUG_ASSERT(len == 0 || buf);
+        while (len > 0 && req) {
+            /* a page at a time, so each buffer is physically contiguous */
+            size_t chunk = MIN(len, PAGE_SIZE - ((uintptr_t)buf & (PAGE_SIZE - 1)));
+
+            pktbuf_t *frag = pktbuf_alloc_empty();
+            if (!frag) {
+                pktbuf_free(p, true);
+                return ERR_NO_MEMORY;
             }
+            atomic_add(&req->ref, 1);
+            pktbuf_add_buffer(frag, (u8 *)buf, chunk, 0, 0, &tcp_tx_req_buf_free, req);
+            pktbuf_append(frag, chunk);
+            pktbuf_chain(p, frag);
+            tail = frag;
+
+            if (sw_csum)
+                data_sum = ones_sum16_add(data_sum, ones_sum16(0, buf, chunk), data_len);
+            buf += chunk;
+            len -= chunk;
+            data_len += chunk;
         }
-    }
+        while (len > 0) {
+            if (pktbuf_avail_tail(tail) == 0) {
+                pktbuf_t *frag = pktbuf_alloc();
+                if (!frag) {
+                    pktbuf_free(p, true);
+                    return ERR_NO_MEMORY;
+                }
+                pktbuf_reset(frag, 0);
+                pktbuf_chain(p, frag);
+                tail = frag;
+            }
 
-    /* compute the checksum */
-    /* XXX get the tx ckecksum capability from the nic */
-    if (FORCE_TCP_CHECKSUM || true) {
-        ipv4_pseudo_header_t pheader;
-        pheader.source_addr = src_ip;
-        pheader.dest_addr = dest_ip;
-        pheader.zero = 0;
-        pheader.protocol = IP_PROTO_TCP;
-        pheader.tcp_length = htons(p->dlen);
+            size_t chunk = MIN(len, pktbuf_avail_tail(tail));
+            if (sw_csum) {
+                void *dst = pktbuf_append(tail, chunk);
+                data_sum = ones_sum16_add(data_sum, ones_sum16_copy(0, dst, buf, chunk), data_len);
+            } else {
+                pktbuf_append_data(tail, buf, chunk);
+            }
+            buf += chunk;
+            len -= chunk;
+            data_len += chunk;
+        }
+    }
 
-        header->checksum = cksum_pheader(&pheader, p->data, p->dlen);
+    /* compute the checksum, or leave it to the nic */
+    ipv4_pseudo_header_t pheader;
+    pheader.source_addr = src_ip;
+    pheader.dest_addr = dest_ip;
+    pheader.zero = 0;
+    pheader.protocol = IP_PROTO_TCP;
+    pheader.tcp_length = htons(pktbuf_chain_len(p));
+
+    if (!sw_csum) {
+        /* the nic sums from the tcp header to the end of the packet on top
+         * of the pseudo header sum left in the checksum field */
+        header->checksum = ones_sum16(0, &pheader, sizeof(pheader));
+        p->flags |= PKTBUF_FLAG_CSUM_PARTIAL;
+        p->csum_start = (uint8_t *)header - p->buffer;
+        p->csum_offset = offsetof(tcp_header_t, checksum);
+
+        if ((offloads & NETIF_OFFLOAD_TSO4) && data_len > mss) {
+            p->flags |= PKTBUF_FLAG_GSO_TCPV4;
+            p->gso_size = mss;
+        }
+    } else {
+        /* the header is a multiple of 4 bytes, so the data sum lines up */
+        uint16_t sum = ones_sum16(data_sum, &pheader, sizeof(pheader));
+        header->checksum = ~ones_sum16(sum, header, sizeof(tcp_header_t) + options_length);
     }
 
     if (LOCAL_TRACE) {
@@ -782,7 +1714,86 @@ static status_t tcp_send(ipv4_addr_t dest_ip, uint16_t dest_port, ipv4_addr_t sr
     return err;
 }
 
-static void handle_ack(tcp_socket_t *s, uint32_t sequence, uint32_t win_size) {
+/* fold a round trip time sample into the retransmit timeout, RFC 6298 */
+static void tcp_rtt_sample(tcp_socket_t *s, uint32_t ack) {
+    if (!s->rtt_timing || SEQUENCE_LT(ack, s->rtt_seq))
+        return;
+    s->rtt_timing = false;
+
+    uint32_t rtt = current_time() - s->rtt_start;
+    if (s->srtt == 0) {
+        s->srtt = rtt << 3;
+        s->rttvar = rtt << 1;
+    } else {
+        int32_t delta = rtt - (s->srtt >> 3);
+        s->srtt += delta;
+        if (delta < 0)
+            delta = -delta;
+        s->rttvar += delta - (s->rttvar >> 2);
+    }
+
+    s->rto = (s->srtt >> 3) + s->rttvar;
+    s->rto = MAX(s->rto, MIN_RTO);
+    s->rto = MIN(s->rto, MAX_RTO);
+}
+
+static uint32_t tcp_flight_size(tcp_socket_t *s) {
+    return s->tx_highest_seq - s->tx_win_low;
+}
+
+/* on the third duplicate ack, resend the segment they're missing and go into
+ * fast recovery; past that each one means another segment left the network */
+static void tcp_cc_dup_ack(tcp_socket_t *s) {
+    if (s->in_recovery) {
+        s->cwnd += s->mss;
+        tcp_write_pending_data(s);
+        return;
+    }
+
+    if (++s->dup_acks < 3)
+        return;
+
+    /* only one recovery per window of data, RFC 6582 */
+    if (!SEQUENCE_GT(s->tx_win_low, s->recover))
+        return;
+
+    TCP_COUNT(s, fast_retransmits, 1);
+
+    s->ssthresh = MAX(tcp_flight_size(s) / 2, 2 * s->mss);
+    s->recover = s->tx_max_seq;
+    s->in_recovery = true;
+    tcp_retransmit(s);
+    s->cwnd = s->ssthresh + 3 * s->mss;
+}
+
+static void tcp_cc_new_ack(tcp_socket_t *s, uint32_t acked_len) {
+    s->dup_acks = 0;
+
+    if (s->in_recovery) {
+        if (SEQUENCE_GTE(s->tx_win_low, s->recover)) {
+            /* everything outstanding when the loss was found is in */
+            s->in_recovery = false;
+            s->cwnd = MIN(s->ssthresh, MAX(tcp_flight_size(s), s->mss) + s->mss);
+        } else {
+            /* a partial ack means the next segment was lost too */
+            tcp_retransmit(s);
+            s->cwnd -= MIN(acked_len, s->cwnd);
+            s->cwnd += s->mss;
+        }
+        return;
+    }
+
+    if (s->cwnd < s->ssthresh) {
+        /* slow start */
+        s->cwnd += MIN(acked_len, s->mss);
+    } else {
+        /* congestion avoidance, about a segment per round trip */
+        s->cwnd += MAX(s->mss * s->mss / s->cwnd, 1u);
+    }
+    s->cwnd = MIN(s->cwnd, (uint32_t)MAX_BUFFER_SIZE * 2);
+}
+
+static void handle_ack(tcp_socket_t *s, uint32_t sequence, uint32_t win_size, size_t data_len) {
     LTRACEF("socket %p ack sequence %u, win_size %u\n", s, sequence, win_size);
 
     DEBUG_ASSERT(s);
@@ -792,8 +1803,20 @@ static void handle_ack(tcp_socket_t *s, uint32_t sequence, uint32_t win_size) {
             s, s->tx_win_low, s->tx_win_high, s->tx_highest_seq, cbuf_size(&s->tx_buffer), cbuf_space_used(&s->tx_buffer));
     if (SEQUENCE_LTE(sequence, s->tx_win_low)) {
         /* they're acking stuff we've already received an ack for */
+        if (sequence != s->tx_win_low)
+            return;
+
+        if (s->tx_max_seq != s->tx_win_low && data_len == 0 && s->tx_win_low + win_size == s->tx_win_high) {
+            /* a duplicate ack, something after this was lost or reordered */
+            TCP_COUNT(s, dup_acks_rcvd, 1);
+            tcp_cc_dup_ack(s);
+        } else if (SEQUENCE_GT(s->tx_win_low + win_size, s->tx_win_high)) {
+            /* a window update */
+            s->tx_win_high = s->tx_win_low + win_size;
+            tcp_write_pending_data(s);
+        }
         return;
-    } else if (SEQUENCE_GT(sequence, s->tx_highest_seq)) {
+    } else if (SEQUENCE_GT(sequence, s->tx_max_seq)) {
         /* they're acking stuff we haven't sent */
         return;
     } else {
@@ -804,20 +1827,29 @@ static void handle_ack(tcp_socket_t *s, uint32_t sequence, uint32_t win_size) {
 
         LTRACEF("acked len %u\n", acked_len);
 
-        DEBUG_ASSERT(acked_len <= cbuf_size(&s->tx_buffer));
-        DEBUG_ASSERT(acked_len <= cbuf_space_used(&s->tx_buffer));
+        DEBUG_ASSERT(acked_len <= cbuf_space_used(&s->tx_buffer) + s->tx_req_bytes);
 
+        /* the oldest data is in the tx buffer, then the zero copy writes */
         size_t consumed = cbuf_read(&s->tx_buffer, NULL, acked_len, false);
-        DEBUG_ASSERT(consumed == acked_len);
+        if (consumed < acked_len)
+            tcp_tx_req_ack(s, acked_len - consumed);
 
         s->tx_win_low += acked_len;
         s->tx_win_high = s->tx_win_low + win_size;
 
+        /* after a timeout we go back and resend, but they may have had more
+         * of the old data than the ack we timed out on said */
+        if (SEQUENCE_GT(s->tx_win_low, s->tx_highest_seq))
+            s->tx_highest_seq = s->tx_win_low;
+
+        tcp_rtt_sample(s, sequence);
+        tcp_cc_new_ack(s, acked_len);
+
         /* cancel or reset our retransmit timer */
         if (s->tx_win_low == s->tx_highest_seq) {
             tcp_timer_cancel(s, &s->retransmit_timer);
         } else {
-            tcp_timer_set(s, &s->retransmit_timer, &handle_retransmit_timeout, RETRANSMIT_TIMEOUT);
+            tcp_timer_set(s, &s->retransmit_timer, &handle_retransmit_timeout, s->rto);
         }
 
         /* we have opened the transmit buffer */
@@ -828,6 +1860,18 @@ static void handle_ack(tcp_socket_t *s, uint32_t sequence, uint32_t win_size) {
     }
 }
 
+/* largest run of data to hand to tcp_send in one packet */
+static uint32_t tcp_max_tx_segment(tcp_socket_t *s) {
+    if (!s->route)
+        return s->mss;
+
+    const netif_t *netif = s->route->interface;
+    if ((netif->offloads & NETIF_OFFLOAD_TSO4) == 0 || netif->gso_max_size < s->mss * 2)
+        return s->mss;
+
+    return netif->gso_max_size / s->mss * s->mss;
+}
+
 static ssize_t tcp_write_pending_data(tcp_socket_t *s) {
     LTRACEF("s %p, tx_win_low %u tx_win_high %u tx_highest_seq %u bufsize %zu space_used %zu\n",
             s, s->tx_win_low, s->tx_win_high, s->tx_highest_seq, cbuf_size(&s->tx_buffer), cbuf_space_used(&s->tx_buffer));
@@ -838,32 +1882,48 @@ static ssize_t tcp_write_pending_data(tcp_socket_t *s) {
 
     /* do we have any new data to send? */
     uint32_t outstanding = (s->tx_highest_seq - s->tx_win_low);
-    uint32_t pending = cbuf_space_used(&s->tx_buffer) - outstanding;
+    uint32_t pending = cbuf_space_used(&s->tx_buffer) + s->tx_req_bytes - outstanding;
     LTRACEF("outstanding %u, pending %u\n", outstanding, pending);
 
-    /* check the remote window limit */
-    int32_t allowed = (int32_t)(s->tx_win_high - s->tx_highest_seq);
+    /* check the remote window and congestion window limits */
+    uint32_t win_high = s->tx_win_high;
+    if (SEQUENCE_LT(s->tx_win_low + s->cwnd, win_high))
+        win_high = s->tx_win_low + s->cwnd;
+    int32_t allowed = (int32_t)(win_high - s->tx_highest_seq);
     if (allowed < 0) {
         allowed = 0;
     }
     uint32_t to_send = MIN(pending, (uint32_t)allowed);
 
-    /* send packets that cover the pending area of the window */
+    /* send packets that cover the pending area of the window, several
+     * segments at a time if the nic will split them up */
+    uint32_t max_segment = tcp_max_tx_segment(s);
     uint32_t offset = 0;
     while (offset < to_send) {
-        uint32_t tosend = MIN(s->mss, to_send - offset);
-
-        iovec_t iov[2];
-        cbuf_peek_at(&s->tx_buffer, outstanding + offset, tosend, iov);
+        iovec_t iov[TCP_TX_MAX_IOV];
+        tcp_tx_req_t *reqs[TCP_TX_MAX_IOV];
+        size_t iov_cnt;
+        uint32_t tosend = tcp_tx_gather(s, outstanding + offset, MIN(max_segment, to_send - offset),
+                                        iov, reqs, &iov_cnt);
+
+        tcp_socket_send(s, iov, reqs, iov_cnt, PKT_ACK|PKT_PSH, NULL, 0, s->tx_highest_seq);
+
+        /* time a segment of new data if we aren't already, never a resend */
+        if (!s->rtt_timing && SEQUENCE_GTE(s->tx_highest_seq, s->tx_max_seq)) {
+            s->rtt_timing = true;
+            s->rtt_seq = s->tx_highest_seq + tosend;
+            s->rtt_start = current_time();
+        }
 
-        tcp_socket_send(s, iov, 2, PKT_ACK|PKT_PSH, NULL, 0, s->tx_highest_seq);
         s->tx_highest_seq += tosend;
+        if (SEQUENCE_GT(s->tx_highest_seq, s->tx_max_seq))
+            s->tx_max_seq = s->tx_highest_seq;
         offset += tosend;
     }
 
     /* reset the retransmit timer if we sent anything */
     if (offset > 0) {
-        tcp_timer_set(s, &s->retransmit_timer, &handle_retransmit_timeout, RETRANSMIT_TIMEOUT);
+        tcp_timer_set(s, &s->retransmit_timer, &handle_retransmit_timeout, s->rto);
     }
 
     return offset;
@@ -885,10 +1945,15 @@ static ssize_t tcp_retransmit(tcp_socket_t *s) {
 
     LTRACEF("s %p, tosend %u seq %u\n", s, tosend, s->tx_win_low);
 
-    iovec_t iov[2];
-    cbuf_peek_at(&s->tx_buffer, 0, tosend, iov);
+    /* an ack for a resent segment can't be timed, RFC 6298 */
+    s->rtt_timing = false;
 
-    tcp_socket_send(s, iov, 2, PKT_ACK|PKT_PSH, NULL, 0, s->tx_win_low);
+    iovec_t iov[TCP_TX_MAX_IOV];
+    tcp_tx_req_t *reqs[TCP_TX_MAX_IOV];
+    size_t iov_cnt;
+    tosend = tcp_tx_gather(s, 0, tosend, iov, reqs, &iov_cnt);
+
+    tcp_socket_send(s, iov, reqs, iov_cnt, PKT_ACK|PKT_PSH, NULL, 0, s->tx_win_low);
 
     return tosend;
 }
@@ -902,10 +1967,25 @@ static void handle_retransmit_timeout(void *_s) {
 
     mutex_acquire(&s->lock);
 
-    if (tcp_retransmit(s) == 0)
+    if (s->state != STATE_ESTABLISHED && s->state != STATE_CLOSE_WAIT)
         goto done;
+    if (tcp_flight_size(s) == 0)
+        goto done;
+
+    TCP_COUNT(s, timeouts, 1);
 
-    tcp_timer_set(s, &s->retransmit_timer, &handle_retransmit_timeout, RETRANSMIT_TIMEOUT);
+    /* the whole window is presumed lost: back off the timer, start over
+     * from one segment and resend everything after the last ack */
+    s->ssthresh = MAX(tcp_flight_size(s) / 2, 2 * s->mss);
+    s->cwnd = s->mss;
+    s->dup_acks = 0;
+    s->in_recovery = false;
+    s->recover = s->tx_max_seq;
+    s->rtt_timing = false;
+    s->rto = MIN(s->rto * 2, MAX_RTO);
+
+    s->tx_highest_seq = s->tx_win_low;
+    tcp_write_pending_data(s);
 
 done:
     mutex_release(&s->lock);
@@ -969,38 +2049,70 @@ static void tcp_remote_close(tcp_socket_t *s) {
     tcp_timer_cancel(s, &s->retransmit_timer);
     tcp_timer_cancel(s, &s->ack_delay_timer);
 
+    tcp_ooo_flush(s);
+    tcp_tx_req_flush(s, ERR_CHANNEL_CLOSED);
+
     tcp_wakeup_waiters(s);
 }
 
-static tcp_socket_t *create_tcp_socket(bool alloc_buffers) {
+/* buffers are power of 2 sized circular buffers, 0 picks the default */
+static size_t tcp_buffer_size(size_t size, size_t default_size) {
+    if (size == 0)
+        return default_size;
+
+    size = MAX(size, (size_t)DEFAULT_MSS);
+    size = MIN(size, (size_t)MAX_BUFFER_SIZE);
+    return round_up_pow2_u32(size);
+}
+
+static tcp_socket_t *create_tcp_socket(bool alloc_buffers, size_t rx_buffer_size, size_t tx_buffer_size) {
     tcp_socket_t *s;
 
     s = calloc(1, sizeof(tcp_socket_t));
     if (!s)
         return NULL;
 
+    s->rx_win_size = tcp_buffer_size(rx_buffer_size, DEFAULT_RX_WINDOW_SIZE);
+    s->tx_buffer_size = tcp_buffer_size(tx_buffer_size, DEFAULT_TX_BUFFER_SIZE);
+
+    if (alloc_buffers) {
+        s->rx_buffer_raw = malloc(s->rx_win_size);
+        s->tx_buffer_raw = malloc(s->tx_buffer_size);
+        if (!s->rx_buffer_raw || !s->tx_buffer_raw) {
+            free(s->rx_buffer_raw);
+            free(s->tx_buffer_raw);
+            free(s);
+            return NULL;
+        }
+        cbuf_initialize_etc(&s->rx_buffer, s->rx_win_size, s->rx_buffer_raw);
+        cbuf_initialize_etc(&s->tx_buffer, s->tx_buffer_size, s->tx_buffer_raw);
+    }
+
     mutex_init(&s->lock);
     s->ref = 1; // start with the ref already bumped
 
     s->state = STATE_CLOSED;
-    s->rx_win_size = DEFAULT_RX_WINDOW_SIZE;
     event_init(&s->rx_event, false, 0);
+    list_initialize(&s->rx_ooo_list);
+    list_initialize(&s->rx_pkt_list);
+    list_initialize(&s->tx_req_list);
+
+    /* smallest window scale that lets us advertise the whole buffer */
+    while (s->rx_wscale < TCP_MAX_WSCALE && (s->rx_win_size >> s->rx_wscale) > 0xffff)
+        s->rx_wscale++;
 
     s->mss = DEFAULT_MSS;
 
     s->tx_win_low = rand();
     s->tx_win_high = s->tx_win_low;
     s->tx_highest_seq = s->tx_win_low;
+    s->tx_max_seq = s->tx_win_low;
     event_init(&s->tx_event, true, 0);
 
-    if (alloc_buffers) {
-        // XXX check for error
-        s->rx_buffer_raw = malloc(s->rx_win_size);
-        cbuf_initialize_etc(&s->rx_buffer, s->rx_win_size, s->rx_buffer_raw);
-
-        s->tx_buffer_raw = malloc(DEFAULT_TX_BUFFER_SIZE);
-        cbuf_initialize_etc(&s->tx_buffer, DEFAULT_TX_BUFFER_SIZE, s->tx_buffer_raw);
-    }
+    s->cwnd = s->mss;
+    s->ssthresh = UINT32_MAX;
+    s->recover = s->tx_win_low;
+    s->rto = INITIAL_RTO;
 
     sem_init(&s->accept_sem, 0);
     event_init(&s->connect_event, false, 0);
@@ -1009,13 +2121,14 @@ static tcp_socket_t *create_tcp_socket(bool alloc_buffers) {
 }
 
 /* user api */
-status_t tcp_connect(tcp_socket_t **handle, uint32_t addr, uint16_t port) {
+status_t tcp_connect_etc(tcp_socket_t **handle, uint32_t addr, uint16_t port,
+                         size_t rx_buffer_size, size_t tx_buffer_size) {
     tcp_socket_t *s;
 
     if (!handle)
         return ERR_INVALID_ARGS;
 
-    s = create_tcp_socket(true);
+    s = create_tcp_socket(true, rx_buffer_size, tx_buffer_size);
     if (!s)
         return ERR_NO_MEMORY;
 
@@ -1033,8 +2146,6 @@ status_t tcp_connect(tcp_socket_t **handle, uint32_t addr, uint16_t port) {
 
     // set up the socket for outgoing connections
     s->local_ip = netif->ipv4_addr;
-    s->local_port = (rand() + 1024) & 0xffff; // TODO: allocate sanely
-    DEBUG_ASSERT(s->local_port <= 0xffff);
     s->remote_ip = addr;
     s->remote_port = port;
 
@@ -1046,15 +2157,27 @@ status_t tcp_connect(tcp_socket_t **handle, uint32_t addr, uint16_t port) {
     mutex_acquire(&s->lock);
 
     s->state = STATE_SYN_SENT;
-    add_socket_to_list(s);
 
-    /* set up a mss option for sending back */
-    tcp_mss_option_t mss_option;
-    mss_option.kind = 0x2;
-    mss_option.len = 0x4;
-    mss_option.mss = ntohs(s->mss);
+    /* pick a random ephemeral port, trying again if the 4-tuple is taken */
+    status_t err;
+    for (int tries = 0; tries < 16; tries++) {
+        s->local_port = 49152 + (rand() % 16384);
+        err = add_socket_to_list(s);
+        if (err != ERR_ALREADY_EXISTS)
+            break;
+    }
+    if (err < 0) {
+        mutex_release(&s->lock);
+        dec_socket_ref(s);
+        return err;
+    }
 
-    tcp_send(s->remote_ip, s->remote_port, s->local_ip, s->local_port, NULL, 0, PKT_SYN, &mss_option, 0x4, 0, s->tx_win_low, s->rx_win_size);
+    /* offer our mss, to take sack options and to scale windows */
+    uint8_t syn_options[TCP_SYN_OPTIONS_MAX];
+    size_t syn_options_len = tcp_build_syn_options(syn_options, s->mss, true, true, s->rx_wscale);
+
+    tcp_send(s->remote_ip, s->remote_port, s->local_ip, s->local_port, NULL, NULL, 0, PKT_SYN,
+             syn_options, syn_options_len, 0, s->tx_win_low, MIN(s->rx_win_size - 1, 0xffffu), 0, 0);
 
     // TODO: handle retransmit
 
@@ -1066,7 +2189,7 @@ status_t tcp_connect(tcp_socket_t **handle, uint32_t addr, uint16_t port) {
         return ERR_TIMED_OUT;
     }
 
-    status_t err = NO_ERROR;
+    err = NO_ERROR;
     mutex_acquire(&s->lock);
     if (s->state != STATE_ESTABLISHED) {
         err = ERR_CHANNEL_CLOSED;
@@ -1078,30 +2201,43 @@ status_t tcp_connect(tcp_socket_t **handle, uint32_t addr, uint16_t port) {
     return err;
 }
 
-status_t tcp_open_listen(tcp_socket_t **handle, uint16_t port) {
+status_t tcp_connect(tcp_socket_t **handle, uint32_t addr, uint16_t port) {
+    return tcp_connect_etc(handle, addr, port, 0, 0);
+}
+
+status_t tcp_open_listen_etc(tcp_socket_t **handle, uint16_t port,
+                             size_t rx_buffer_size, size_t tx_buffer_size) {
     tcp_socket_t *s;
 
     if (!handle)
         return ERR_INVALID_ARGS;
 
-    s = create_tcp_socket(false);
+    /* just remember the buffer sizes for the sockets it accepts */
+    s = create_tcp_socket(false, rx_buffer_size, tx_buffer_size);
     if (!s)
         return ERR_NO_MEMORY;
 
-    // XXX see if there's another listen socket already on this port
-
     s->local_port = port;
 
     /* go to listen state */
     s->state = STATE_LISTEN;
 
-    add_socket_to_list(s);
+    /* only one socket can listen on a port */
+    status_t err = add_socket_to_list(s);
+    if (err < 0) {
+        dec_socket_ref(s);
+        return err;
+    }
 
     *handle = s;
 
     return NO_ERROR;
 }
 
+status_t tcp_open_listen(tcp_socket_t **handle, uint16_t port) {
+    return tcp_open_listen_etc(handle, port, 0, 0);
+}
+
 status_t tcp_accept_timeout(tcp_socket_t *listen_socket, tcp_socket_t **accept_socket, lk_time_t timeout) {
     if (!listen_socket || !accept_socket)
         return ERR_INVALID_ARGS;
@@ -1148,7 +2284,7 @@ retry:
     mutex_acquire(&s->lock);
 
     /* try to read some data from the receive buffer, even if we're closed */
-    ret = cbuf_read(&s->rx_buffer, buf, len, false);
+    ret = tcp_rx_read(s, buf, len);
     if (ret == 0) {
         /* check to see if we've closed */
         if (s->state != STATE_ESTABLISHED) {
@@ -1162,21 +2298,87 @@ retry:
         goto retry;
     }
 
-    /* if we've used up the last byte in the read buffer, unsignal the read event */
-    size_t remaining_bytes = cbuf_space_used(&s->rx_buffer);
-    if (s->state == STATE_ESTABLISHED && remaining_bytes == 0) {
+    /* we've read something, make sure the other end knows that our window is opening */
+    tcp_rx_consumed(s);
+
+out:
+    mutex_release(&s->lock);
+    dec_socket_ref(s);
+
+    return ret;
+}
+
+ssize_t tcp_read_pktbuf(tcp_socket_t *socket, pktbuf_t **p) {
+    LTRACEF("socket %p\n", socket);
+    if (!socket || !p)
+        return ERR_INVALID_ARGS;
+
+    tcp_socket_t *s = socket;
+    inc_socket_ref(s);
+
+    pktbuf_t *copy = NULL;
+    ssize_t ret;
+    for (;;) {
+        /* block on available data */
+        event_wait(&s->rx_event);
+
+        mutex_acquire(&s->lock);
+
+        /* keep the packets from here on rather than copying them */
+        s->rx_zero_copy = true;
+
+        size_t buffered = cbuf_space_used(&s->rx_buffer);
+        if (buffered > 0 && copy) {
+            /* data that came in before, or that could not be kept, is copied out */
+            ret = cbuf_read(&s->rx_buffer, copy->data, pktbuf_avail_tail(copy), false);
+            pktbuf_append(copy, ret);
+            *p = copy;
+            copy = NULL;
+            break;
+        } else if (buffered > 0) {
+            /* get a buffer to copy it into without holding up the socket */
+            mutex_release(&s->lock);
+            copy = pktbuf_alloc();
+            if (!copy) {
+                dec_socket_ref(s);
+                return ERR_NO_MEMORY;
+            }
+            continue;
+        } else if (!list_is_empty(&s->rx_pkt_list)) {
+            /* hand over everything queued as one chain */
+            pktbuf_t *head = list_remove_head_type(&s->rx_pkt_list, pktbuf_t, list);
+            pktbuf_t *tail = head;
+            pktbuf_t *next;
+            while ((next = list_remove_head_type(&s->rx_pkt_list, pktbuf_t, list))) {
+                while (tail->next)
+                    tail = tail->next;
+                tail->flags &= ~PKTBUF_FLAG_EOF;
+                tail->next = next;
+            }
+
+            ret = s->rx_pkt_bytes;
+            s->rx_pkt_bytes = 0;
+            s->rx_pkt_count = 0;
+            *p = head;
+            break;
+        } else if (s->state != STATE_ESTABLISHED) {
+            ret = ERR_CHANNEL_CLOSED;
+            mutex_release(&s->lock);
+            goto out;
+        }
+
+        /* we must have raced with another thread */
         event_unsignal(&s->rx_event);
+        mutex_release(&s->lock);
     }
 
     /* we've read something, make sure the other end knows that our window is opening */
-    uint32_t new_rx_win_size = s->rx_win_size - remaining_bytes;
-
-    /* if we've opened it enough, send an ack */
-    if (new_rx_win_size >= s->mss && s->rx_win_high - s->rx_win_low < s->mss)
-        send_ack(s);
+    tcp_rx_consumed(s);
+    mutex_release(&s->lock);
 
 out:
-    mutex_release(&s->lock);
+    if (copy)
+        pktbuf_free(copy, true);
     dec_socket_ref(s);
 
     return ret;
@@ -1213,8 +2415,9 @@ ssize_t tcp_write(tcp_socket_t *socket, const void *buf, size_t len) {
 
         DEBUG_ASSERT(cbuf_size(&s->tx_buffer) > 0);
 
-        /* figure out how much data to copy in */
-        size_t avail = cbuf_space_avail(&s->tx_buffer);
+        /* figure out how much data to copy in, after any zero copy writes
+         * have gone since the buffer's data is sent first */
+        size_t avail = list_is_empty(&s->tx_req_list) ? cbuf_space_avail(&s->tx_buffer) : 0;
         if (avail == 0) {
             event_unsignal(&s->tx_event);
             mutex_release(&s->lock);
@@ -1242,6 +2445,59 @@ ssize_t tcp_write(tcp_socket_t *socket, const void *buf, size_t len) {
     return len;
 }
 
+status_t tcp_write_zerocopy(tcp_socket_t *socket, const iovec_t *iov, uint iov_count,
+                            tcp_write_callback_t cb, void *arg) {
+    LTRACEF("socket %p, iov %p, iov_count %u\n", socket, iov, iov_count);
+    if (!socket || (iov_count > 0 && !iov))
+        return ERR_INVALID_ARGS;
+
+    size_t len = 0;
+    for (uint i = 0; i < iov_count; i++) {
+        if (iov[i].iov_len > 0 && !iov[i].iov_base)
+            return ERR_INVALID_ARGS;
+        len += iov[i].iov_len;
+    }
+    if (len == 0 || len > MAX_BUFFER_SIZE)
+        return ERR_INVALID_ARGS;
+
+    tcp_tx_req_t *req = malloc(sizeof(*req) + iov_count * sizeof(iovec_t));
+    if (!req)
+        return ERR_NO_MEMORY;
+
+    req->ref = 1;
+    req->status = NO_ERROR;
+    req->len = len;
+    req->acked = 0;
+    req->cb = cb;
+    req->cb_arg = arg;
+    dpc_initialize(&req->dpc, &tcp_tx_req_complete, req);
+    req->iov_count = iov_count;
+    memcpy(req->iov, iov, iov_count * sizeof(iovec_t));
+
+    tcp_socket_t *s = socket;
+    inc_socket_ref(s);
+    mutex_acquire(&s->lock);
+
+    status_t err = NO_ERROR;
+    if (s->state != STATE_ESTABLISHED && s->state != STATE_CLOSE_WAIT) {
+        free(req);
+        err = ERR_CHANNEL_CLOSED;
+        goto out;
+    }
+
+    list_add_tail(&s->tx_req_list, &req->node);
+    s->tx_req_bytes += len;
+
+    /* send as much data as we can */
+    tcp_write_pending_data(s);
+
+out:
+    mutex_release(&s->lock);
+    dec_socket_ref(s);
+
+    return err;
+}
+
 status_t tcp_close(tcp_socket_t *socket) {
     if (!socket)
         return ERR_INVALID_ARGS;
@@ -1272,14 +2528,14 @@ status_t tcp_close(tcp_socket_t *socket) {
         case STATE_SYN_RCVD:
         case STATE_ESTABLISHED:
             s->state = STATE_FIN_WAIT_1;
-            tcp_socket_send(s, NULL, 0, PKT_ACK|PKT_FIN, NULL, 0, s->tx_win_low);
+            tcp_socket_send(s, NULL, NULL, 0, PKT_ACK|PKT_FIN, NULL, 0, s->tx_win_low);
             s->tx_win_low++;
 
             /* stick around and wait for them to FIN us */
             break;
         case STATE_CLOSE_WAIT:
             s->state = STATE_LAST_ACK;
-            tcp_socket_send(s, NULL, 0, PKT_ACK|PKT_FIN, NULL, 0, s->tx_win_low);
+            tcp_socket_send(s, NULL, NULL, 0, PKT_ACK|PKT_FIN, NULL, 0, s->tx_win_low);
             s->tx_win_low++;
 
             // XXX set up fin retransmit timer here
@@ -1312,14 +2568,229 @@ out:
 }
 
 /* debug stuff */
+
+/* Bulk transfer over the loopback interface, which puts the whole stack,
+ * windowing and congestion control included, in the path without a nic. */
+#define TCP_BENCH_PORT 5001
+#define TCP_BENCH_CHUNK 4096
+#define TCP_BENCH_ZC_CHUNK (16 * 1024)
+#define TCP_BENCH_ZC_WRITES 8 // zero copy writes in flight
+
+struct tcp_bench_args {
+    tcp_socket_t *listen_socket;
+    bool zerocopy;
+    size_t bytes;
+    ssize_t received;
+    event_t done;
+};
+
+static int tcp_bench_rx_thread(void *_args) {
+    struct tcp_bench_args *args = _args;
+    uint8_t *buf = malloc(TCP_BENCH_CHUNK);
+    tcp_socket_t *accepted;
+
+    args->received = ERR_NO_MEMORY;
+    if (!buf)
+        goto out;
+
+    args->received = tcp_accept_timeout(args->listen_socket, &accepted, 5000);
+    if (args->received < 0)
+        goto out;
+
+    args->received = 0;
+    while ((size_t)args->received < args->bytes) {
+        ssize_t len;
+        if (args->zerocopy) {
+            pktbuf_t *p;
+            len = tcp_read_pktbuf(accepted, &p);
+            if (len > 0)
+                pktbuf_free(p, true);
+        } else {
+            len = tcp_read(accepted, buf, TCP_BENCH_CHUNK);
+        }
+        if (len <= 0)
+            break;
+        args->received += len;
+    }
+
+    /* close from this side once everything is in so the sender sees it */
+    tcp_close(accepted);
+
+out:
+    free(buf);
+    event_signal(&args->done, true);
+    return 0;
+}
+
+static void tcp_bench_write_done(void *arg, status_t status) {
+    sem_post(arg, false);
+}
+
+static int tcp_bench(size_t bytes, size_t buffer_size, bool zerocopy) {
+    struct tcp_bench_args args = { .bytes = bytes, .zerocopy = zerocopy };
+    tcp_socket_t *s = NULL;
+    uint8_t *buf = NULL;
+    ssize_t sent = 0;
+    lk_bigtime_t t = current_time_hires();
+    semaphore_t writes;
+
+    event_init(&args.done, false, 0);
+    sem_init(&writes, TCP_BENCH_ZC_WRITES);
+
+    status_t err = tcp_open_listen_etc(&args.listen_socket, TCP_BENCH_PORT, buffer_size, buffer_size);
+    if (err < 0) {
+        printf("tcp_open_listen_etc returns %d\n", err);
+        return err;
+    }
+
+    thread_detach_and_resume(thread_create("tcp bench rx", &tcp_bench_rx_thread, &args,
+                                           DEFAULT_PRIORITY, DEFAULT_STACK_SIZE));
+
+    buf = calloc(1, TCP_BENCH_ZC_CHUNK);
+    if (!buf) {
+        err = ERR_NO_MEMORY;
+        goto done;
+    }
+
+    t = current_time_hires();
+    err = tcp_connect_etc(&s, IPV4(127, 0, 0, 1), TCP_BENCH_PORT, buffer_size, buffer_size);
+    if (err < 0) {
+        printf("tcp_connect_etc returns %d\n", err);
+        goto done;
+    }
+
+    while ((size_t)sent < bytes && !zerocopy) {
+        ssize_t len = tcp_write(s, buf, MIN(bytes - sent, TCP_BENCH_CHUNK));
+        if (len < 0) {
+            printf("tcp_write returns %ld\n", len);
+            break;
+        }
+        sent += len;
+    }
+
+    /* the same unchanging buffer is fine to have in several writes at once */
+    while ((size_t)sent < bytes && zerocopy) {
+        iovec_t iov = { buf, MIN(bytes - sent, TCP_BENCH_ZC_CHUNK) };
+
+        sem_wait(&writes);
+        status_t werr = tcp_write_zerocopy(s, &iov, 1, &tcp_bench_write_done, &writes);
+        if (werr < 0) {
+            printf("tcp_write_zerocopy returns %d\n", werr);
+            sem_post(&writes, false);
+            break;
+        }
+        sent += iov.iov_len;
+    }
+
+done:
+    event_wait(&args.done);
+    t = current_time_hires() - t;
+
+    if (s) {
+        /* wait for the receiver to hang up, then finish the close */
+        while (tcp_read(s, buf, TCP_BENCH_CHUNK) > 0)
+            ;
+        tcp_close(s);
+    }
+    tcp_close(args.listen_socket);
+    event_destroy(&args.done);
+
+    /* the buffer can't go until every zero copy write is done with it */
+    for (int i = 0; i < TCP_BENCH_ZC_WRITES; i++)
+        sem_wait(&writes);
+    sem_destroy(&writes);
+    free(buf);
+
+    if (err < 0)
+        return err;
+
+    printf("sent %ld received %ld bytes in %llu usecs", sent, args.received, t);
+    if (t > 0)
+        printf(", %llu KB/s", (unsigned long long)args.received * 1000000 / 1024 / t);
+    printf("\n");
+
+    return NO_ERROR;
+}
+
+/* Receive demux cost against the number of connections, from a private table
+ * of idle established sockets, next to the list walk the table replaced. */
+#define TCP_DEMUX_BENCH_LOOKUPS 100000
+
+static int tcp_demux_bench(uint count) {
+    tcp_hash_bucket_t *conn_buckets = malloc(sizeof(tcp_hash_bucket_t) * TCP_CONN_HASH_BUCKETS);
+    tcp_hash_bucket_t listen_buckets[TCP_LISTEN_HASH_BUCKETS];
+    tcp_socket_t *sockets = calloc(count, sizeof(tcp_socket_t));
+    if (!conn_buckets || !sockets) {
+        free(conn_buckets);
+        free(sockets);
+        return ERR_NO_MEMORY;
+    }
+
+    tcp_hash_table_t conn = { TCP_CONN_HASH_BUCKETS - 1, conn_buckets };
+    tcp_hash_table_t listen = { TCP_LISTEN_HASH_BUCKETS - 1, listen_buckets };
+    tcp_hash_init(&conn);
+    tcp_hash_init(&listen);
+
+    /* many clients talking to one server port */
+    struct list_node list = LIST_INITIAL_VALUE(list);
+    for (uint i = 0; i < count; i++) {
+        tcp_socket_t *s = &sockets[i];
+        s->state = STATE_ESTABLISHED;
+        s->local_ip = IPV4(10, 0, 0, 1);
+        s->local_port = 80;
+        s->remote_ip = IPV4(10, 1, (i >> 8) & 0xff, i & 0xff);
+        s->remote_port = 1024 + (i >> 16);
+        tcp_hash_insert(&conn, &listen, s);
+        list_add_tail(&list, &s->node);
+    }
+
+    uint hits = 0;
+    lk_bigtime_t t = current_time_hires();
+    for (uint n = 0; n < TCP_DEMUX_BENCH_LOOKUPS; n++) {
+        const tcp_socket_t *want = &sockets[(n * 7919u) % count];
+        tcp_socket_t *s = tcp_hash_lookup(&conn, &listen, want->remote_ip, want->local_ip,
+                                          want->remote_port, want->local_port, false);
+        hits += (s == want);
+    }
+    lk_bigtime_t hash_time = current_time_hires() - t;
+
+    t = current_time_hires();
+    for (uint n = 0; n < TCP_DEMUX_BENCH_LOOKUPS; n++) {
+        const tcp_socket_t *want = &sockets[(n * 7919u) % count];
+        tcp_socket_t *s;
+        list_for_every_entry(&list, s, tcp_socket_t, node) {
+            if (s->remote_ip == want->remote_ip &&
+                    s->local_ip == want->local_ip &&
+                    s->remote_port == want->remote_port &&
+                    s->local_port == want->local_port) {
+                break;
+            }
+        }
+        hits += (s == want);
+    }
+    lk_bigtime_t list_time = current_time_hires() - t;
+
+    printf("%u sockets, %u lookups: hash %llu ns, list walk %llu ns per lookup%s\n",
+           count, TCP_DEMUX_BENCH_LOOKUPS,
+           hash_time * 1000 / TCP_DEMUX_BENCH_LOOKUPS, list_time * 1000 / TCP_DEMUX_BENCH_LOOKUPS,
+           (hits == 2 * TCP_DEMUX_BENCH_LOOKUPS) ? "" : " (MISSED LOOKUPS)");
+
+    free(sockets);
+    free(conn_buckets);
+    return NO_ERROR;
+}
+
 int cmd_tcp(int argc, const console_cmd_args *argv) {
     if (argc < 2) {
 notenoughargs:
         printf("ERROR not enough arguments\n");
 usage:
         printf("usage: %s sockets\n", argv[0].str);
+        printf("usage: %s stats\n", argv[0].str);
         printf("usage: %s listenclose <port>\n", argv[0].str);
         printf("usage: %s listen <port>\n", argv[0].str);
+        printf("usage: %s bench [kbytes] [buffer size] [zerocopy]\n", argv[0].str);
+        printf("usage: %s demuxbench [sockets]\n", argv[0].str);
         printf("usage: %s debug\n", argv[0].str);
         return ERR_INVALID_ARGS;
     }
@@ -1332,6 +2803,9 @@ usage:
             dump_socket(s);
         }
         mutex_release(&tcp_socket_list_lock);
+    } else if (!strcmp(argv[1].str, "stats")) {
+        printf("tcp totals:\n");
+        dump_counters(&tcp_counters);
     } else if (!strcmp(argv[1].str, "listenclose")) {
         /* listen for a connection, accept it, then immediately close it */
         if (argc < 3) goto notenoughargs;
@@ -1384,6 +2858,18 @@ usage:
 
         err = tcp_close(handle);
         printf("tcp_close returns %d\n", err);
+    } else if (!strcmp(argv[1].str, "bench")) {
+        size_t kbytes = (argc >= 3) ? argv[2].u : 16 * 1024;
+        size_t buffer_size = (argc >= 4) ? argv[3].u : 0;
+        bool zerocopy = (argc >= 5) && !strcmp(argv[4].str, "zerocopy");
+
+        return tcp_bench(kbytes * 1024, buffer_size, zerocopy);
+    } else if (!strcmp(argv[1].str, "demuxbench")) {
+        if (argc >= 3)
+            return tcp_demux_bench(MAX(argv[2].u, 1u));
+
+        for (uint count = 1; count <= 4096; count *= 4)
+            tcp_demux_bench(count);
     } else if (!strcmp(argv[1].str, "debug")) {
         tcp_debug = !tcp_debug;
         printf("tcp debug now %u\n", tcp_debug);
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+
+#include "../minip-internal.h"
+
+#include <arch/defines.h>
+#include <inttypes.h>
+#include <lib/unittest.h>
+#include <lk/console_cmd.h>
+#include <lk/err.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_ALIGN 8
+#define MAX_LEN 1600
+#define BUF_LEN (MAX_LEN + 2 * MAX_ALIGN)
+
+static uint8_t src_buf[BUF_LEN];
+static uint8_t dst_buf[BUF_LEN];
+
+/* the straightforward 16 bit at a time sum the optimized one replaced */
+static uint16_t ref_sum16(uint32_t sum, const uint8_t *buf, int len) {
+    while (len >= 2) {
+        uint16_t v;
+        memcpy(&v, buf, sizeof(v));
+        sum += v;
+        if (sum & 0xffff0000)
+            sum = (sum & 0xffff) + 1;
+        buf += 2;
+        len -= 2;
+    }
+    if (len) {
+        sum += htons(buf[0] << 8);
+        if (sum & 0xffff0000)
+            sum = (sum & 0xffff) + 1;
+    }
+    return sum;
+}
+
+static void fill_pattern(uint8_t *buf, size_t len, uint32_t seed) {
+    for (size_t i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = seed >> 16;
+    }
+}
+
+static bool sum_matches_reference(void) {
+    BEGIN_TEST;
+
+    fill_pattern(src_buf, BUF_LEN, 1);
+    for (int align = 0; align < MAX_ALIGN; align++) {
+        for (int len = 0; len <= MAX_LEN; len++) {
+            uint32_t seed = (len * 0x9e37) & 0xffff;
+            uint16_t ref = ref_sum16(seed, src_buf + align, len);
+            uint16_t sum = ones_sum16(seed, src_buf + align, len);
+            if (ref != sum) {
+                printf("sum mismatch: align %d len %d ref %#x sum %#x\n", align, len, ref, sum);
+                ASSERT_TRUE(false, "ones_sum16 result");
+            }
+        }
+    }
+
+    /* all ones data is where carries pile up the most */
+    memset(src_buf, 0xff, BUF_LEN);
+    EXPECT_EQ(ref_sum16(0xffff, src_buf, MAX_LEN), ones_sum16(0xffff, src_buf, MAX_LEN), "all ones");
+
+    END_TEST;
+}
+
+static bool copy_sum_matches(void) {
+    BEGIN_TEST;
+
+    fill_pattern(src_buf, BUF_LEN, 2);
+    for (int so = 0; so < MAX_ALIGN; so++) {
+        for (int dof = 0; dof < MAX_ALIGN; dof++) {
+            for (int len = 0; len <= MAX_LEN; len += (len < 64) ? 1 : 37) {
+                memset(dst_buf, 0xa5, BUF_LEN);
+                uint16_t sum = ones_sum16_copy(0x1234, dst_buf + dof, src_buf + so, len);
+                if (sum != ref_sum16(0x1234, src_buf + so, len) ||
+                        memcmp(dst_buf + dof, src_buf + so, len) != 0) {
+                    printf("copy mismatch: src offset %d dst offset %d len %d\n", so, dof, len);
+                    ASSERT_TRUE(false, "ones_sum16_copy result");
+                }
+                /* nothing past the end was touched */
+                EXPECT_EQ(0xa5, dst_buf[dof + len], "copy overran");
+            }
+        }
+    }
+
+    END_TEST;
+}
+
+static bool piecewise_sum(void) {
+    BEGIN_TEST;
+
+    /* summing a buffer in pieces of any length, odd ones included, adds up
+     * to the sum of the whole */
+    fill_pattern(src_buf, BUF_LEN, 3);
+    for (int piece = 1; piece < 40; piece++) {
+        uint16_t sum = 0;
+        for (int off = 0; off < MAX_LEN; off += piece) {
+            int len = MIN(piece, MAX_LEN - off);
+            sum = ones_sum16_add(sum, ones_sum16(0, src_buf + off, len), off);
+        }
+        EXPECT_EQ(ones_sum16(0, src_buf, MAX_LEN) % 0xffff, sum % 0xffff, "piecewise sum");
+    }
+
+    END_TEST;
+}
+
+static bool incremental_update(void) {
+    BEGIN_TEST;
+
+    /* patch a word in a checksummed buffer and compare against summing it
+     * all again, including the words that take the sum to its edges */
+    static const uint16_t words[] = { 0x0000, 0x0001, 0x00ff, 0x7fff, 0x8000, 0xfffe, 0xffff, 0x1234 };
+
+    fill_pattern(src_buf, 64, 4);
+    for (size_t i = 0; i < countof(words); i++) {
+        for (size_t j = 0; j < countof(words); j++) {
+            uint16_t *field = (uint16_t *)src_buf + 5;
+            *field = words[i];
+            uint16_t cksum = ~ones_sum16(0, src_buf, 64);
+
+            *field = words[j];
+            uint16_t updated = cksum_update16(cksum, words[i], words[j]);
+            uint16_t full = ~ones_sum16(0, src_buf, 64);
+
+            /* 0 and 0xffff are the same value in ones complement */
+            EXPECT_EQ(full % 0xffff, updated % 0xffff, "cksum_update16");
+        }
+    }
+
+    uint32_t *addr = (uint32_t *)src_buf + 3;
+    *addr = 0x0a000001;
+    uint16_t cksum = ~ones_sum16(0, src_buf, 64);
+    *addr = 0xc0a80164;
+    EXPECT_EQ((uint16_t)~ones_sum16(0, src_buf, 64) % 0xffff,
+              cksum_update32(cksum, 0x0a000001, 0xc0a80164) % 0xffff, "cksum_update32");
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(chksum_tests)
+RUN_TEST(sum_matches_reference)
+RUN_TEST(copy_sum_matches)
+RUN_TEST(piecewise_sum)
+RUN_TEST(incremental_update)
+END_TEST_CASE(chksum_tests)
+
+#if WITH_LIB_CONSOLE
+
+/* Checksum throughput over typical packet sizes. Every size sums the same
+ * total number of bytes, so the small sizes show the per call overhead. */
+#define BENCH_TOTAL_BYTES (64 * 1024 * 1024)
+
+static const int bench_sizes[] = { 64, 128, 256, 576, 1024, 1500, 9000 };
+
+static void print_rate(const char *name, int size, uint64_t bytes, lk_bigtime_t usecs) {
+    if (usecs == 0)
+        usecs = 1;
+    /* bytes per usec is MB/s */
+    printf("\t%-12s %5d bytes: %6" PRIu64 " MB/s\n", name, size, bytes / usecs);
+}
+
+static int cmd_chksum_bench(int argc, const console_cmd_args *argv) {
+    uint8_t *src = memalign(CACHE_LINE, 9000);
+    uint8_t *dst = memalign(CACHE_LINE, 9000);
+    if (!src || !dst) {
+        printf("failed to allocate buffers\n");
+        free(src);
+        free(dst);
+        return ERR_NO_MEMORY;
+    }
+    fill_pattern(src, 9000, 5);
+
+    volatile uint16_t sink = 0;
+    for (size_t i = 0; i < countof(bench_sizes); i++) {
+        int size = bench_sizes[i];
+        uint64_t iters = BENCH_TOTAL_BYTES / size;
+        lk_bigtime_t t;
+
+        printf("%d byte buffers:\n", size);
+
+        t = current_time_hires();
+        for (uint64_t n = 0; n < iters; n++)
+            sink = ref_sum16(sink, src, size);
+        print_rate("16 bit loop", size, iters * size, current_time_hires() - t);
+
+        t = current_time_hires();
+        for (uint64_t n = 0; n < iters; n++)
+            sink = ones_sum16(sink, src, size);
+        print_rate("ones_sum16", size, iters * size, current_time_hires() - t);
+
+        t = current_time_hires();
+        for (uint64_t n = 0; n < iters; n++) {
+            memcpy(dst, src, size);
+            sink = ones_sum16(sink, dst, size);
+        }
+        print_rate("copy, sum", size, iters * size, current_time_hires() - t);
+
+        t = current_time_hires();
+        for (uint64_t n = 0; n < iters; n++)
+            sink = ones_sum16_copy(sink, dst, src, size);
+        print_rate("copy+sum", size, iters * size, current_time_hires() - t);
+    }
+
+    free(src);
+    free(dst);
+    return NO_ERROR;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("chksum_bench", "minip checksum throughput", &cmd_chksum_bench)
+STATIC_COMMAND_END(chksum_bench);
+
+#endif
@@ -114,6 +114,90 @@ static bool reset_test(void) {
     END_TEST;
 }
 
+static bool chain_test(void) {
+    BEGIN_TEST;
+
+    pktbuf_t *p = pktbuf_alloc();
+    ASSERT_NONNULL(p, "");
+    pktbuf_append_data(p, "head", 4);
+    EXPECT_EQ(NULL, p->next, "New packet should not be chained");
+    EXPECT_EQ(4UL, pktbuf_chain_len(p), "");
+
+    pktbuf_t *frag1 = pktbuf_alloc_empty();
+    ASSERT_NONNULL(frag1, "");
+    bool cb_called = false;
+    uint8_t buf[64];
+    pktbuf_add_buffer(frag1, buf, sizeof(buf), 0, 0, my_free_cb, &cb_called);
+    pktbuf_append_data(frag1, "middle", 6);
+    pktbuf_chain(p, frag1);
+
+    pktbuf_t *frag2 = pktbuf_alloc();
+    ASSERT_NONNULL(frag2, "");
+    pktbuf_append_data(frag2, "tail", 4);
+    pktbuf_chain(p, frag2);
+
+    EXPECT_EQ(frag1, p->next, "");
+    EXPECT_EQ(frag2, frag1->next, "");
+    EXPECT_EQ(0U, p->flags & PKTBUF_FLAG_EOF, "Only the last buffer should be EOF");
+    EXPECT_EQ(0U, frag1->flags & PKTBUF_FLAG_EOF, "Only the last buffer should be EOF");
+    EXPECT_EQ((uint32_t)PKTBUF_FLAG_EOF, frag2->flags & PKTBUF_FLAG_EOF, "Last buffer should be EOF");
+    EXPECT_EQ(14UL, pktbuf_chain_len(p), "");
+
+    // trimming into the middle buffer empties the one after it
+    pktbuf_chain_trim(p, 7);
+    EXPECT_EQ(7UL, pktbuf_chain_len(p), "");
+    EXPECT_EQ(4UL, p->dlen, "");
+    EXPECT_EQ(3UL, frag1->dlen, "");
+    EXPECT_EQ(0UL, frag2->dlen, "");
+
+    // freeing the packet frees every buffer in it
+    EXPECT_EQ(3, pktbuf_free(p, false), "Whole chain should be freed");
+    EXPECT_TRUE(cb_called, "Chained buffer callback should have been called");
+
+    END_TEST;
+}
+
+static bool detach_test(void) {
+    BEGIN_TEST;
+
+    // a pool buffer followed by someone else's memory
+    pktbuf_t *p = pktbuf_alloc();
+    ASSERT_NONNULL(p, "");
+    pktbuf_append_data(p, "pool", 4);
+    uint8_t *pool_buf = p->buffer;
+    u32 header_room = pktbuf_avail_head(p);
+
+    pktbuf_t *frag = pktbuf_alloc_empty();
+    ASSERT_NONNULL(frag, "");
+    bool cb_called = false;
+    uint8_t buf[64];
+    pktbuf_add_buffer(frag, buf, sizeof(buf), 0, 0, my_free_cb, &cb_called);
+    pktbuf_append_data(frag, "custom", 6);
+    pktbuf_chain(p, frag);
+
+    pktbuf_t *d = pktbuf_detach(p);
+    ASSERT_NONNULL(d, "");
+    EXPECT_EQ(10UL, pktbuf_chain_len(d), "Detached length mismatch");
+    EXPECT_BYTES_EQ((const uint8_t *)"pool", d->data, 4, "Detached data mismatch");
+    ASSERT_NONNULL(d->next, "Detached packet should be chained");
+    EXPECT_BYTES_EQ((const uint8_t *)"custom", d->next->data, 6, "Detached chain data mismatch");
+
+    // the pool buffer moved over, the custom one was copied
+    EXPECT_EQ(pool_buf, d->buffer, "Pool buffer should move without a copy");
+    EXPECT_NE(pool_buf, p->buffer, "Original should get a fresh buffer");
+    EXPECT_EQ(header_room, pktbuf_avail_head(p), "Original header room mismatch");
+    EXPECT_EQ(0UL, p->dlen, "Original should be left empty");
+    EXPECT_NE(&buf[0], d->next->buffer, "Custom buffer should be copied");
+    EXPECT_EQ(frag, p->next, "Original chain should be left alone");
+
+    EXPECT_EQ(2, pktbuf_free(d, false), "Detached chain should be freed");
+    EXPECT_FALSE(cb_called, "Custom buffer still belongs to the original");
+    EXPECT_EQ(2, pktbuf_free(p, false), "Original chain should be freed");
+    EXPECT_TRUE(cb_called, "Custom buffer callback should have been called");
+
+    END_TEST;
+}
+
 static bool recommended_rx_depth_test(void) {
     BEGIN_TEST;
 
@@ -132,5 +216,7 @@ RUN_TEST(basic_alloc_free)
 RUN_TEST(append_prepend_consume)
 RUN_TEST(custom_buffer)
 RUN_TEST(reset_test)
+RUN_TEST(chain_test)
+RUN_TEST(detach_test)
 RUN_TEST(recommended_rx_depth_test)
 END_TEST_CASE(pktbuf_tests)
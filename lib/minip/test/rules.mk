@@ -2,6 +2,7 @@ LOCAL_DIR := $(GET_LOCAL_DIR)
 
 MODULE := $(LOCAL_DIR)
 
+MODULE_SRCS += $(LOCAL_DIR)/chksum_tests.c
 MODULE_SRCS += $(LOCAL_DIR)/pktbuf_tests.c
 
 MODULE_DEPS += lib/minip
@@ -165,7 +165,18 @@ status_t udp_send_iovec(const iovec_t *iov, uint iov_count, udp_socket_t *handle
 
     buf = pktbuf_append(p, len);
 
+#if MINIP_USE_UDP_CHECKSUM
+    /* sum the payload as it is copied in */
+    uint16_t data_sum = 0;
+    size_t offset = 0;
+    for (uint i = 0; i < iov_count; i++) {
+        uint16_t sum = ones_sum16_copy(0, (uint8_t *)buf + offset, iov[i].iov_base, iov[i].iov_len);
+        data_sum = ones_sum16_add(data_sum, sum, offset);
+        offset += iov[i].iov_len;
+    }
+#else
     iovec_to_membuf(buf, len, iov, iov_count, 0);
+#endif
 
     udp = pktbuf_prepend(p, sizeof(udp_hdr_t));
     udp->src_port   = htons(handle->sport);
@@ -182,7 +193,8 @@ status_t udp_send_iovec(const iovec_t *iov, uint iov_count, udp_socket_t *handle
         pheader.protocol = IP_PROTO_UDP;
         pheader.tcp_length = htons(p->dlen);
 
-        udp->chksum = cksum_pheader(&pheader, p->data, p->dlen);
+        uint16_t sum = ones_sum16(data_sum, &pheader, sizeof(pheader));
+        udp->chksum = ~ones_sum16(sum, udp, sizeof(udp_hdr_t));
     }
 #endif
 
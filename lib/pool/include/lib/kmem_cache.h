@@ -0,0 +1,67 @@
+//
+// Copyright (c) 2026 Travis Geiselbrecht
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+#pragma once
+
+#include <lk/compiler.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// A slab style object cache for fixed size kernel objects.
+//
+// Objects are carved out of page backed slabs, each slab managing its objects
+// with a pool_t. Slabs are added as the cache grows and empty ones can be
+// handed back with kmem_cache_reap(). Each cpu keeps a small magazine of
+// recently freed objects in front of the slabs so the common alloc/free pair
+// does not touch shared state.
+//
+// The optional constructor runs once per object when its slab is created, not
+// on every allocation. Objects must be returned to the cache in their
+// constructed state.
+//
+// Typical usage:
+//
+// static kmem_cache_t *foo_cache;
+//
+// foo_cache = kmem_cache_create("foo", sizeof(struct foo), alignof(struct foo), NULL);
+//
+// struct foo *f = kmem_cache_alloc(foo_cache);
+// ...
+// kmem_cache_free(foo_cache, f);
+//
+// kmem_cache_alloc() may block to grow the cache. kmem_cache_free() never
+// blocks and may be called with interrupts disabled.
+__BEGIN_CDECLS
+
+typedef struct kmem_cache kmem_cache_t;
+
+typedef void (*kmem_cache_ctor)(void *object);
+
+// Create a cache for objects of the given size and alignment. An alignment of
+// 0 gives pointer alignment. Returns NULL if out of memory.
+kmem_cache_t *kmem_cache_create(const char *name, size_t object_size, size_t object_align,
+                                kmem_cache_ctor ctor);
+
+// Destroy a cache. Every object must have been freed back to it.
+void kmem_cache_destroy(kmem_cache_t *cache);
+
+// Allocate an object from the cache. Returns NULL if out of memory.
+void *kmem_cache_alloc(kmem_cache_t *cache);
+
+// Free an object previously allocated from the same cache.
+void kmem_cache_free(kmem_cache_t *cache, void *object);
+
+// Flush the per cpu magazines and return empty slabs to the page allocator.
+// Returns the number of pages freed.
+size_t kmem_cache_reap(kmem_cache_t *cache);
+
+// Make the cache type stable: its slabs are never handed back by
+// kmem_cache_reap(), only by kmem_cache_destroy(). A pointer to a freed object
+// keeps pointing at an object of the same type, possibly reallocated, which
+// lets lockless readers peek at objects that may be freed under them.
+void kmem_cache_set_type_stable(kmem_cache_t *cache);
+
+__END_CDECLS
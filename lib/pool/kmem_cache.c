@@ -0,0 +1,440 @@
+//
+// Copyright (c) 2026 Travis Geiselbrecht
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+#include <lib/kmem_cache.h>
+
+#include <arch/ops.h>
+#include <assert.h>
+#include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <lib/page_alloc.h>
+#include <lib/pool.h>
+#include <lk/console_cmd.h>
+#include <lk/debug.h>
+#include <lk/err.h>
+#include <lk/list.h>
+#include <lk/pow2.h>
+#include <lk/trace.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+#define LOCAL_TRACE 0
+
+// Number of objects each cpu keeps in front of the slabs. A magazine is
+// refilled to half full from the slabs when empty, and half of it goes back
+// when full.
+#ifndef KMEM_MAGAZINE_SIZE
+#define KMEM_MAGAZINE_SIZE 16
+#endif
+
+// Slabs are sized to hold at least this many objects, up to KMEM_MAX_SLAB_PAGES.
+#define KMEM_MIN_OBJECTS_PER_SLAB 8
+#define KMEM_MAX_SLAB_PAGES 64
+
+struct kmem_magazine {
+    spin_lock_t lock;
+    uint count;
+    void *objects[KMEM_MAGAZINE_SIZE];
+
+    // stats
+    ulong hits;
+    ulong misses;
+} __CPU_ALIGN;
+
+// Header at the start of every slab, followed by the color offset and then the
+// object slots. Each slot holds a pointer back to its slab in front of the
+// object, which doubles as the pool's free list link while the slot is free,
+// so free objects stay in their constructed state.
+struct kmem_slab {
+    struct list_node node;
+    kmem_cache_t *cache;
+    pool_t pool;
+    uint inuse;
+};
+
+struct kmem_cache {
+    struct list_node node;
+    const char *name;
+
+    size_t object_size;
+    size_t align;
+    size_t prefix;      // bytes in front of each object for the slab pointer
+    size_t slot_size;   // prefix plus the padded object
+    uint slab_pages;
+    uint objects_per_slab;
+    size_t color_max;   // slack at the end of a slab, used to stagger objects
+    size_t color_next;
+    kmem_cache_ctor ctor;
+    bool type_stable;   // never reap slabs, see kmem_cache_set_type_stable()
+
+    spin_lock_t lock;
+    struct list_node partial_slabs;
+    struct list_node full_slabs;
+    struct list_node empty_slabs;
+    uint slab_count;
+
+    // stats
+    ulong grows;
+    ulong reaped_slabs;
+
+    struct kmem_magazine magazines[SMP_MAX_CPUS];
+};
+
+static struct list_node cache_list = LIST_INITIAL_VALUE(cache_list);
+static mutex_t cache_list_lock = MUTEX_INITIAL_VALUE(cache_list_lock);
+
+static inline size_t slab_header_size(const kmem_cache_t *cache) {
+    return ROUNDUP(sizeof(struct kmem_slab), cache->align);
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t object_size, size_t object_align,
+                                kmem_cache_ctor ctor) {
+    LTRACEF("name '%s' size %zu align %zu\n", name, object_size, object_align);
+
+    DEBUG_ASSERT(object_size > 0);
+    DEBUG_ASSERT(object_align == 0 || ispow2(object_align));
+
+    kmem_cache_t *cache = memalign(CACHE_LINE, sizeof(kmem_cache_t));
+    if (!cache) {
+        return NULL;
+    }
+    memset(cache, 0, sizeof(*cache));
+
+    cache->name = name;
+    cache->object_size = object_size;
+    cache->align = pool_storage_align(object_size, object_align);
+    cache->prefix = ROUNDUP(sizeof(struct kmem_slab *), cache->align);
+    cache->slot_size = pool_padded_object_size(cache->prefix + object_size, cache->align);
+    cache->ctor = ctor;
+
+    // pick the smallest power of two number of pages that holds enough objects
+    size_t header = slab_header_size(cache);
+    size_t pages = 1;
+    for (;;) {
+        size_t bytes = pages * PAGE_SIZE;
+        size_t count = (bytes > header) ? (bytes - header) / cache->slot_size : 0;
+        if (count >= KMEM_MIN_OBJECTS_PER_SLAB || (count > 0 && pages == KMEM_MAX_SLAB_PAGES)) {
+            cache->slab_pages = pages;
+            cache->objects_per_slab = count;
+            cache->color_max = bytes - header - count * cache->slot_size;
+            break;
+        }
+        if (pages == KMEM_MAX_SLAB_PAGES) {
+            TRACEF("object size %zu too large for a slab\n", object_size);
+            free(cache);
+            return NULL;
+        }
+        pages *= 2;
+    }
+
+    spin_lock_init(&cache->lock);
+    list_initialize(&cache->partial_slabs);
+    list_initialize(&cache->full_slabs);
+    list_initialize(&cache->empty_slabs);
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        spin_lock_init(&cache->magazines[i].lock);
+    }
+
+    mutex_acquire(&cache_list_lock);
+    list_add_tail(&cache_list, &cache->node);
+    mutex_release(&cache_list_lock);
+
+    LTRACEF("cache %p: slot %zu, %u pages per slab, %u objects per slab\n", cache,
+            cache->slot_size, cache->slab_pages, cache->objects_per_slab);
+
+    return cache;
+}
+
+// Allocate and set up a new slab. Called without any locks held, may block.
+static struct kmem_slab *slab_create(kmem_cache_t *cache) {
+    void *base = page_alloc(cache->slab_pages, PAGE_ALLOC_ANY_ARENA);
+    if (!base) {
+        return NULL;
+    }
+
+    // stagger where the objects start in successive slabs so that the same
+    // object in each slab does not land on the same cache lines
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&cache->lock);
+    size_t color = cache->color_next;
+    size_t step = MAX(cache->align, (size_t)CACHE_LINE);
+    cache->color_next += step;
+    if (cache->color_next > cache->color_max) {
+        cache->color_next = 0;
+    }
+    spin_unlock_irqrestore(&cache->lock, state);
+
+    struct kmem_slab *slab = (struct kmem_slab *)base;
+    list_clear_node(&slab->node);
+    slab->cache = cache;
+    slab->inuse = 0;
+
+    uint8_t *storage = (uint8_t *)base + slab_header_size(cache) + color;
+    pool_init(&slab->pool, cache->slot_size, cache->align, cache->objects_per_slab, storage);
+
+    if (cache->ctor) {
+        for (uint i = 0; i < cache->objects_per_slab; i++) {
+            cache->ctor(storage + i * cache->slot_size + cache->prefix);
+        }
+    }
+
+    return slab;
+}
+
+// Take an object out of a slab, cache lock held.
+static void *slab_alloc_locked(kmem_cache_t *cache) {
+    struct kmem_slab *slab = list_peek_head_type(&cache->partial_slabs, struct kmem_slab, node);
+    if (!slab) {
+        slab = list_remove_head_type(&cache->empty_slabs, struct kmem_slab, node);
+        if (!slab) {
+            return NULL;
+        }
+        list_add_head(&cache->partial_slabs, &slab->node);
+    }
+
+    uint8_t *slot = pool_alloc(&slab->pool);
+    DEBUG_ASSERT(slot);
+    *(struct kmem_slab **)slot = slab;
+
+    if (++slab->inuse == cache->objects_per_slab) {
+        list_delete(&slab->node);
+        list_add_head(&cache->full_slabs, &slab->node);
+    }
+
+    return slot + cache->prefix;
+}
+
+// Return an object to its slab, cache lock held.
+static void slab_free_locked(kmem_cache_t *cache, void *object) {
+    uint8_t *slot = (uint8_t *)object - cache->prefix;
+    struct kmem_slab *slab = *(struct kmem_slab **)slot;
+
+    DEBUG_ASSERT(slab->cache == cache);
+    DEBUG_ASSERT(slab->inuse > 0);
+
+    bool was_full = (slab->inuse == cache->objects_per_slab);
+    pool_free(&slab->pool, slot);
+    slab->inuse--;
+
+    if (slab->inuse == 0) {
+        list_delete(&slab->node);
+        list_add_head(&cache->empty_slabs, &slab->node);
+    } else if (was_full) {
+        list_delete(&slab->node);
+        list_add_head(&cache->partial_slabs, &slab->node);
+    }
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    DEBUG_ASSERT(cache);
+
+    void *object = NULL;
+
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
+    struct kmem_magazine *mag = &cache->magazines[arch_curr_cpu_num()];
+
+    spin_lock(&mag->lock);
+    if (mag->count > 0) {
+        mag->hits++;
+    } else {
+        // refill half a magazine from the slabs
+        mag->misses++;
+        spin_lock(&cache->lock);
+        while (mag->count < KMEM_MAGAZINE_SIZE / 2) {
+            void *o = slab_alloc_locked(cache);
+            if (!o) {
+                break;
+            }
+            mag->objects[mag->count++] = o;
+        }
+        spin_unlock(&cache->lock);
+    }
+    if (mag->count > 0) {
+        object = mag->objects[--mag->count];
+    }
+    spin_unlock(&mag->lock);
+    arch_interrupt_restore(state);
+
+    if (object) {
+        return object;
+    }
+
+    // the slabs are exhausted, grow the cache
+    struct kmem_slab *slab = slab_create(cache);
+    if (!slab) {
+        return NULL;
+    }
+
+    state = spin_lock_irqsave(&cache->lock);
+    list_add_head(&cache->empty_slabs, &slab->node);
+    cache->slab_count++;
+    cache->grows++;
+    object = slab_alloc_locked(cache);
+    spin_unlock_irqrestore(&cache->lock, state);
+
+    return object;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *object) {
+    DEBUG_ASSERT(cache);
+    DEBUG_ASSERT(object);
+
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
+    struct kmem_magazine *mag = &cache->magazines[arch_curr_cpu_num()];
+
+    spin_lock(&mag->lock);
+    if (mag->count == KMEM_MAGAZINE_SIZE) {
+        // hand the older half back to the slabs
+        const uint half = KMEM_MAGAZINE_SIZE / 2;
+        spin_lock(&cache->lock);
+        for (uint i = 0; i < half; i++) {
+            slab_free_locked(cache, mag->objects[i]);
+        }
+        spin_unlock(&cache->lock);
+        memmove(&mag->objects[0], &mag->objects[half], (mag->count - half) * sizeof(void *));
+        mag->count -= half;
+    }
+    mag->objects[mag->count++] = object;
+    spin_unlock(&mag->lock);
+    arch_interrupt_restore(state);
+}
+
+void kmem_cache_set_type_stable(kmem_cache_t *cache) {
+    DEBUG_ASSERT(cache);
+
+    cache->type_stable = true;
+}
+
+static size_t kmem_cache_reap_etc(kmem_cache_t *cache, bool free_slabs) {
+    DEBUG_ASSERT(cache);
+
+    // empty every magazine back into the slabs
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        struct kmem_magazine *mag = &cache->magazines[i];
+
+        arch_interrupt_saved_state_t state = spin_lock_irqsave(&mag->lock);
+        spin_lock(&cache->lock);
+        while (mag->count > 0) {
+            slab_free_locked(cache, mag->objects[--mag->count]);
+        }
+        spin_unlock(&cache->lock);
+        spin_unlock_irqrestore(&mag->lock, state);
+    }
+
+    if (!free_slabs) {
+        return 0;
+    }
+
+    // pull the empty slabs off and free them outside the lock
+    struct list_node empty = LIST_INITIAL_VALUE(empty);
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&cache->lock);
+    struct kmem_slab *slab;
+    while ((slab = list_remove_head_type(&cache->empty_slabs, struct kmem_slab, node))) {
+        list_add_tail(&empty, &slab->node);
+        cache->slab_count--;
+        cache->reaped_slabs++;
+    }
+    spin_unlock_irqrestore(&cache->lock, state);
+
+    size_t pages = 0;
+    while ((slab = list_remove_head_type(&empty, struct kmem_slab, node))) {
+        page_free(slab, cache->slab_pages);
+        pages += cache->slab_pages;
+    }
+
+    LTRACEF("cache '%s' freed %zu pages\n", cache->name, pages);
+    return pages;
+}
+
+size_t kmem_cache_reap(kmem_cache_t *cache) {
+    return kmem_cache_reap_etc(cache, !cache->type_stable);
+}
+
+void kmem_cache_destroy(kmem_cache_t *cache) {
+    if (!cache) {
+        return;
+    }
+
+    kmem_cache_reap_etc(cache, true);
+
+    // anything left is still allocated
+    if (cache->slab_count > 0) {
+        panic("kmem_cache_destroy: cache '%s' still has %u slabs in use\n", cache->name,
+              cache->slab_count);
+    }
+
+    mutex_acquire(&cache_list_lock);
+    list_delete(&cache->node);
+    mutex_release(&cache_list_lock);
+
+    free(cache);
+}
+
+#if LK_DEBUGLEVEL > 0
+
+static void dump_cache(kmem_cache_t *cache) {
+    uint objects = 0;
+    uint cached = 0;
+    ulong hits = 0;
+    ulong misses = 0;
+
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&cache->lock);
+    struct kmem_slab *slab;
+    list_for_every_entry(&cache->partial_slabs, slab, struct kmem_slab, node) {
+        objects += slab->inuse;
+    }
+    list_for_every_entry(&cache->full_slabs, slab, struct kmem_slab, node) {
+        objects += slab->inuse;
+    }
+    uint slabs = cache->slab_count;
+    spin_unlock_irqrestore(&cache->lock, state);
+
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        cached += cache->magazines[i].count;
+        hits += cache->magazines[i].hits;
+        misses += cache->magazines[i].misses;
+    }
+
+    printf("%-16s %6zu %6zu %5u %5u %6u %6u %6u %8lu %8lu %6lu\n", cache->name,
+           cache->object_size, cache->slot_size, cache->slab_pages, cache->objects_per_slab, slabs,
+           objects - cached, cached, hits, misses, cache->grows);
+}
+
+static int cmd_kmem(int argc, const console_cmd_args *argv) {
+    if (argc >= 2 && !strcmp(argv[1].str, "reap")) {
+        size_t pages = 0;
+        kmem_cache_t *cache;
+        mutex_acquire(&cache_list_lock);
+        list_for_every_entry(&cache_list, cache, kmem_cache_t, node) {
+            pages += kmem_cache_reap(cache);
+        }
+        mutex_release(&cache_list_lock);
+        printf("freed %zu pages\n", pages);
+        return NO_ERROR;
+    } else if (argc >= 2) {
+        printf("usage:\n");
+        printf("%s\n", argv[0].str);
+        printf("%s reap\n", argv[0].str);
+        return ERR_INVALID_ARGS;
+    }
+
+    printf("%-16s %6s %6s %5s %5s %6s %6s %6s %8s %8s %6s\n", "name", "size", "slot", "pages",
+           "objs", "slabs", "inuse", "cached", "hits", "misses", "grows");
+    kmem_cache_t *cache;
+    mutex_acquire(&cache_list_lock);
+    list_for_every_entry(&cache_list, cache, kmem_cache_t, node) {
+        dump_cache(cache);
+    }
+    mutex_release(&cache_list_lock);
+
+    return NO_ERROR;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("kmem", "kernel object cache stats", &cmd_kmem)
+STATIC_COMMAND_END(kmem);
+
+#endif
@@ -3,6 +3,9 @@ LOCAL_DIR := $(GET_LOCAL_DIR)
 MODULE := $(LOCAL_DIR)
 MODULE_OPTIONS := test extra_warnings
 
+MODULE_SRCS += $(LOCAL_DIR)/kmem_cache.c
 MODULE_SRCS += $(LOCAL_DIR)/pool.cpp
 
+MODULE_DEPS += lib/heap
+
 include make/module.mk
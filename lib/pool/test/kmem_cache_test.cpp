@@ -0,0 +1,184 @@
+// Copyright (c) 2026 Travis Geiselbrecht
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+#include <arch/defines.h>
+#include <lib/kmem_cache.h>
+#include <lib/unittest.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace {
+
+struct test_object {
+    uint32_t magic;
+    uint8_t payload[52];
+};
+
+constexpr uint32_t kConstructedMagic = 0x6b6d656d; // 'kmem'
+
+size_t ctor_calls;
+
+void test_object_ctor(void *object) {
+    auto *o = static_cast<test_object *>(object);
+    o->magic = kConstructedMagic;
+    ctor_calls++;
+}
+
+bool test_kmem_cache_basic() {
+    BEGIN_TEST;
+
+    kmem_cache_t *cache = kmem_cache_create("test basic", 24, 0, nullptr);
+    ASSERT_NONNULL(cache, "cache creation should succeed");
+
+    void *a = kmem_cache_alloc(cache);
+    void *b = kmem_cache_alloc(cache);
+    EXPECT_NONNULL(a, "first allocation should not be null");
+    EXPECT_NONNULL(b, "second allocation should not be null");
+    EXPECT_NE(a, b, "allocations should be different");
+    EXPECT_EQ((uintptr_t)0, (uintptr_t)a % sizeof(void *), "pointer alignment check");
+    EXPECT_EQ((uintptr_t)0, (uintptr_t)b % sizeof(void *), "pointer alignment check");
+
+    // objects must not overlap
+    memset(a, 0xaa, 24);
+    memset(b, 0x55, 24);
+    EXPECT_EQ(0xaa, *(uint8_t *)a, "first object should be intact");
+    EXPECT_EQ(0x55, *((uint8_t *)b + 23), "second object should be intact");
+
+    kmem_cache_free(cache, a);
+    kmem_cache_free(cache, b);
+    kmem_cache_destroy(cache);
+
+    END_TEST;
+}
+
+bool test_kmem_cache_align() {
+    BEGIN_TEST;
+
+    kmem_cache_t *cache = kmem_cache_create("test align", 40, 64, nullptr);
+    ASSERT_NONNULL(cache, "cache creation should succeed");
+
+    constexpr size_t count = 64;
+    void *objects[count];
+    for (size_t i = 0; i < count; i++) {
+        objects[i] = kmem_cache_alloc(cache);
+        ASSERT_NONNULL(objects[i], "allocation should succeed");
+        EXPECT_EQ((uintptr_t)0, (uintptr_t)objects[i] % 64, "64 byte alignment check");
+    }
+    for (size_t i = 0; i < count; i++) {
+        kmem_cache_free(cache, objects[i]);
+    }
+    kmem_cache_destroy(cache);
+
+    END_TEST;
+}
+
+bool test_kmem_cache_ctor() {
+    BEGIN_TEST;
+
+    ctor_calls = 0;
+    kmem_cache_t *cache = kmem_cache_create("test ctor", sizeof(test_object),
+                                            alignof(test_object), &test_object_ctor);
+    ASSERT_NONNULL(cache, "cache creation should succeed");
+
+    auto *o = static_cast<test_object *>(kmem_cache_alloc(cache));
+    ASSERT_NONNULL(o, "allocation should succeed");
+    EXPECT_EQ(kConstructedMagic, o->magic, "object should come back constructed");
+
+    // the constructor runs when a slab is set up, not per allocation
+    const size_t calls = ctor_calls;
+    EXPECT_GT(calls, (size_t)0, "constructor should have run");
+    kmem_cache_free(cache, o);
+    for (int i = 0; i < 100; i++) {
+        o = static_cast<test_object *>(kmem_cache_alloc(cache));
+        ASSERT_NONNULL(o, "allocation should succeed");
+        EXPECT_EQ(kConstructedMagic, o->magic, "object should come back constructed");
+        kmem_cache_free(cache, o);
+    }
+    EXPECT_EQ(calls, ctor_calls, "alloc/free of a free object should not run the constructor");
+
+    kmem_cache_destroy(cache);
+
+    END_TEST;
+}
+
+bool test_kmem_cache_grow_and_reap() {
+    BEGIN_TEST;
+
+    kmem_cache_t *cache = kmem_cache_create("test reap", 256, 0, nullptr);
+    ASSERT_NONNULL(cache, "cache creation should succeed");
+
+    // enough objects to need several slabs
+    constexpr size_t count = 256;
+    void **objects = new void *[count];
+    ASSERT_NONNULL(objects, "allocating the test array should succeed");
+    for (size_t i = 0; i < count; i++) {
+        objects[i] = kmem_cache_alloc(cache);
+        ASSERT_NONNULL(objects[i], "allocation should succeed");
+        memset(objects[i], (int)i, 256);
+    }
+    for (size_t i = 0; i < count; i++) {
+        EXPECT_EQ((uint8_t)i, *((uint8_t *)objects[i] + 255), "object contents should be intact");
+    }
+
+    // nothing can be reaped while everything is allocated
+    EXPECT_EQ((size_t)0, kmem_cache_reap(cache), "no slabs should be empty");
+
+    for (size_t i = 0; i < count; i++) {
+        kmem_cache_free(cache, objects[i]);
+    }
+    delete[] objects;
+
+    // everything is free, so every page should come back
+    EXPECT_GE(kmem_cache_reap(cache), (size_t)((count * 256) / PAGE_SIZE),
+              "all slab pages should be reaped");
+    EXPECT_EQ((size_t)0, kmem_cache_reap(cache), "second reap should find nothing");
+
+    // the cache still works after a reap
+    void *o = kmem_cache_alloc(cache);
+    EXPECT_NONNULL(o, "allocation after reap should succeed");
+    kmem_cache_free(cache, o);
+
+    kmem_cache_destroy(cache);
+
+    END_TEST;
+}
+
+bool test_kmem_cache_type_stable() {
+    BEGIN_TEST;
+
+    kmem_cache_t *cache = kmem_cache_create("test stable", 256, 0, nullptr);
+    ASSERT_NONNULL(cache, "cache creation should succeed");
+    kmem_cache_set_type_stable(cache);
+
+    constexpr size_t count = 64;
+    void *objects[count];
+    for (size_t i = 0; i < count; i++) {
+        objects[i] = kmem_cache_alloc(cache);
+        ASSERT_NONNULL(objects[i], "allocation should succeed");
+    }
+    for (size_t i = 0; i < count; i++) {
+        kmem_cache_free(cache, objects[i]);
+    }
+
+    // the slabs stay put until the cache is destroyed
+    EXPECT_EQ((size_t)0, kmem_cache_reap(cache), "type stable cache should not give pages back");
+    void *o = kmem_cache_alloc(cache);
+    EXPECT_NONNULL(o, "allocation after reap should succeed");
+    kmem_cache_free(cache, o);
+
+    kmem_cache_destroy(cache);
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(kmem_cache_tests);
+RUN_TEST(test_kmem_cache_basic);
+RUN_TEST(test_kmem_cache_align);
+RUN_TEST(test_kmem_cache_ctor);
+RUN_TEST(test_kmem_cache_grow_and_reap);
+RUN_TEST(test_kmem_cache_type_stable);
+END_TEST_CASE(kmem_cache_tests);
+
+} // namespace
@@ -62,6 +62,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdarg.h>
+#include <sys/types.h>
 
 __BEGIN_CDECLS
 
@@ -412,4 +413,24 @@ bool run_all_tests(void);
 bool expect_bytes_eq(const uint8_t *expected, const uint8_t *actual, size_t len,
                      const char *msg);
 
+/*
+ * Multi-threaded benchmark scaffold.
+ *
+ * unittest_run_threads() creates |count| threads running |body|, lets them
+ * settle, then releases them all at once and reports how long it took until the
+ * last one returned in |elapsed|. |index| is 0..count-1 so a body can keep a
+ * per thread tally in an array owned by the caller. With |cpus| nonzero, thread
+ * i is pinned to the (i % cpus)'th active cpu; with 0 the scheduler places
+ * them. With |window| nonzero, *stop is set that many msecs after the start and
+ * the bodies are expected to poll it; otherwise they run a fixed amount of work
+ * and *stop is never set.
+ *
+ * Returns the first negative value a body returned, else NO_ERROR.
+ */
+typedef int (*unittest_thread_body_t)(void *arg, uint index, const volatile bool *stop);
+
+uint unittest_active_cpu_count(void);
+int unittest_run_threads(const char *name, uint count, uint cpus, lk_time_t window,
+                         unittest_thread_body_t body, void *arg, lk_bigtime_t *elapsed);
+
 __END_CDECLS
@@ -5,5 +5,6 @@ MODULE := $(LOCAL_DIR)
 MODULE_SRCS := \
 	$(LOCAL_DIR)/unittest.c \
 	$(LOCAL_DIR)/all_tests.c \
+	$(LOCAL_DIR)/threads.c \
 
 include make/module.mk
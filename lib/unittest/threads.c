@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+/*
+ * Shared scaffold for the multi-threaded benchmarks. See unittest_run_threads()
+ * in lib/unittest.h.
+ */
+#include <lib/unittest.h>
+
+#include <kernel/event.h>
+#include <kernel/mp.h>
+#include <kernel/thread.h>
+#include <lk/err.h>
+#include <platform.h>
+#include <stdlib.h>
+
+struct run_threads {
+    unittest_thread_body_t body;
+    void *arg;
+    event_t start;
+    volatile bool stop;
+    volatile bool abort;
+};
+
+struct run_thread {
+    struct run_threads *run;
+    thread_t *thread;
+    uint index;
+};
+
+static int run_threads_entry(void *arg) {
+    struct run_thread *t = arg;
+    struct run_threads *run = t->run;
+
+    event_wait(&run->start);
+    if (run->abort) {
+        return ERR_CANCELLED;
+    }
+
+    return run->body(run->arg, t->index, &run->stop);
+}
+
+uint unittest_active_cpu_count(void) {
+    uint count = 0;
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        if (mp_is_cpu_active(i))
+            count++;
+    }
+    return count;
+}
+
+// the n'th active cpu
+static int active_cpu(uint n) {
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        if (mp_is_cpu_active(i) && n-- == 0)
+            return (int)i;
+    }
+    return -1;
+}
+
+int unittest_run_threads(const char *name, uint count, uint cpus, lk_time_t window,
+                         unittest_thread_body_t body, void *arg, lk_bigtime_t *elapsed) {
+    if (count == 0 || cpus > unittest_active_cpu_count())
+        return ERR_INVALID_ARGS;
+
+    struct run_thread *threads = calloc(count, sizeof(*threads));
+    if (!threads)
+        return ERR_NO_MEMORY;
+
+    struct run_threads run = {
+        .body = body,
+        .arg = arg,
+    };
+    event_init(&run.start, false, 0);
+
+    // create them all parked on the start event, so thread creation and the
+    // first trip through the scheduler are not part of the measurement
+    uint created = 0;
+    for (; created < count; created++) {
+        struct run_thread *t = &threads[created];
+        t->run = &run;
+        t->index = created;
+        t->thread = thread_create(name, &run_threads_entry, t, DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        if (!t->thread)
+            break;
+        if (cpus > 0)
+            thread_set_pinned_cpu(t->thread, active_cpu(created % cpus));
+        thread_resume(t->thread);
+    }
+    if (created < count)
+        run.abort = true;
+    else
+        thread_sleep(50);
+
+    lk_bigtime_t start = current_time_hires();
+    event_signal(&run.start, true);
+    if (window > 0 && !run.abort) {
+        thread_sleep(window);
+        run.stop = true;
+    }
+
+    int err = run.abort ? ERR_NO_MEMORY : NO_ERROR;
+    for (uint i = 0; i < created; i++) {
+        int ret;
+        thread_join(threads[i].thread, &ret, INFINITE_TIME);
+        if (ret < 0 && err == NO_ERROR)
+            err = ret;
+    }
+    if (elapsed)
+        *elapsed = current_time_hires() - start;
+
+    event_destroy(&run.start);
+    free(threads);
+
+    return err;
+}